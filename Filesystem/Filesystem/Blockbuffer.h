@@ -12,44 +12,43 @@ vim: shiftwidth=4
 #include <Filesystem_Config.h>
 
 #include <Filesystem/Blockdevice.h>
+#include <Filesystem/Blockcache.h>
 #include <Filesystem/Error.h>
 
 namespace Filesystem {
 
-/** One block buffer of objects on the disk. */
+/** One block of objects on the disk, held pinned in the block cache. */
 template <class Object>
 class Blockbuffer {
 public:
-	typedef void (*FixObjectEndian)(Object& obj);
-
 	enum {
 		OBJECTS_SIZE = Blockdevice::BLOCK_SIZE / sizeof(Object)
 	};
 
 	//*******************************************************************
 	Blockbuffer(
-		Blockdevice&	Device,
-		FixObjectEndian	FixEndian
+		Blockcache&					Cache,
+		Blockcache::FixBlockEndian	FixEndian
 	)
-	:	Device_(Device)
-		,FixObjectEndian_(FixEndian)
+	:	Buffer_(0)
+		,Cache_(Cache)
+		,FixBlockEndian_(FixEndian)
 		,SecondCopyOffset_(-1)
 		,RangeStart_(0)
 		,RangeEnd_(-1)
 		,BlockNr_(-1)
+		,Slot_(0)
 		,Valid_(false)
-		,Dirty_(false)
 	{
 	}
 
 	//*******************************************************************
+	/** Release the block, it stays in the cache until evicted or flushed. */
 	~Blockbuffer(
 	)
 	{
-		try {
-			Flush();
-		} catch (const std::exception& e) {
-			filesystem_dprintf(("Blockbuffer: error flushing, '%s'\n", e.what()));
+		if (Valid_) {
+			Cache_.Unpin(Slot_);
 		}
 	}
 
@@ -63,6 +62,10 @@ public:
 		const int			SecondCopyOffset = -1
 	)
 	{
+		if (Valid_) {
+			Valid_ = false;
+			Cache_.Unpin(Slot_);
+		}
 		RangeStart_ = RangeStart;
 		RangeEnd_ = RangeEnd;
 		SecondCopyOffset_ = SecondCopyOffset;
@@ -79,37 +82,28 @@ public:
 			throw Error("Blockbuffer: block %d is out of range [0 .. %d)", BlockNr, (RangeEnd_-RangeStart_));
 		}
 
-		if (BlockNr_ != BlockNr) {
-			Flush();
-		}
-
 		if (!Valid_ || BlockNr_ != BlockNr) {
-			Valid_ = false;
+			if (Valid_) {
+				Valid_ = false;
+				Cache_.Unpin(Slot_);
+			}
 
-			Device_.Read(BlockNr+RangeStart_, Buffer_);
-			FixBufferEndian_();
+			Slot_ = Cache_.Fetch(BlockNr+RangeStart_, FixBlockEndian_, SecondCopyOffset_);
+			Buffer_ = reinterpret_cast<Object*>(Cache_.Data(Slot_));
 
 			BlockNr_ = BlockNr;
 			Valid_ = true;
-			Dirty_ = false;
 		}
 
 		return Buffer_;
 	}
 
 	//*******************************************************************
+	/** Write all modified blocks in the range to the disk. */
 	void
 	Flush()
 	{
-		if (Dirty_) {
-			FixBufferEndian_();
-			Device_.Write(BlockNr_+RangeStart_, Buffer_);
-			if (SecondCopyOffset_>0) {
-				Device_.Write(BlockNr_+RangeStart_ + SecondCopyOffset_, Buffer_);
-			}
-			FixBufferEndian_();
-			Dirty_ = false;
-		}
+		Cache_.Flush(RangeStart_, RangeEnd_-RangeStart_);
 	}
 
 	//*******************************************************************
@@ -123,7 +117,7 @@ public:
 	inline Object&
 	operator[](const unsigned int i)
 	{
-		Dirty_ = true;
+		Cache_.SetDirty(Slot_);
 		return Buffer_[i];
 	}
 
@@ -135,37 +129,26 @@ public:
 	}
 
 private:
-	//*******************************************************************
-	void
-	FixBufferEndian_()
-	{
-		if (FixObjectEndian_ != 0) {
-			for (unsigned int i=0; i<OBJECTS_SIZE; ++i) {
-				FixObjectEndian_(Buffer_[i]);
-			}
-		}
-	}
-
-	/** Buffered object page. */
-	Object			Buffer_[OBJECTS_SIZE];
+	/** Buffered object page, in the cache. */
+	Object*						Buffer_;
 
-	/** Block device. */
-	Blockdevice&	Device_;
-	/** Function to fix/reverse fix object endianness. */
-	FixObjectEndian	FixObjectEndian_;
+	/** Block cache. */
+	Blockcache&					Cache_;
+	/** Function to fix/reverse fix block endianness. */
+	Blockcache::FixBlockEndian	FixBlockEndian_;
 	/** Offset to the second copy. -1 if not in use. */
-	int				SecondCopyOffset_;
+	int							SecondCopyOffset_;
 	/** Start range. */
-	unsigned int	RangeStart_;
+	unsigned int				RangeStart_;
 	/** End range. */
-	unsigned int	RangeEnd_;
+	unsigned int				RangeEnd_;
 
 	/** Current block number. */
-	unsigned int	BlockNr_;
+	unsigned int				BlockNr_;
+	/** Cache slot of the current block. */
+	unsigned int				Slot_;
 	/** Is object block valid? */
-	bool			Valid_;
-	/** Is object block not yet written to disk? */
-	bool			Dirty_;
+	bool						Valid_;
 }; // class Blockbuffer
 
 } // namespace Filesystem
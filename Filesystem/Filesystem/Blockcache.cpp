@@ -0,0 +1,291 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include <Filesystem/Blockcache.h>
+#include <Filesystem/Error.h>
+
+#include <Filesystem_Config.h>
+
+#include <string.h>		// memcpy
+#include <exception>
+
+namespace Filesystem {
+
+//*******************************************************************
+Blockcache::Blockcache(
+	Blockdevice&		Device,
+	void*				Memory,
+	const unsigned int	MemorySize
+)
+:	Device_(Device)
+	,Entries_(reinterpret_cast<Entry*>(Memory))
+	,Blocks_(0)
+	,Size_(MemorySize / SLOT_SIZE)
+	,Clock_(0)
+	,Hits_(0)
+	,Misses_(0)
+{
+	if (Size_ < 2) {
+		throw Error("Blockcache: %d bytes is not enough for two blocks.", MemorySize);
+	}
+	Blocks_ = reinterpret_cast<char*>(Entries_ + Size_);
+	for (unsigned int i=0; i<Size_; ++i) {
+		Entry&	e = Entries_[i];
+		e.BlockNr = 0;
+		e.LastUse = 0;
+		e.MirrorOffset = -1;
+		e.FixEndian = 0;
+		e.Pins = 0;
+		e.Valid = false;
+		e.Dirty = false;
+	}
+}
+
+//*******************************************************************
+Blockcache::~Blockcache()
+{
+	try {
+		Flush();
+	} catch (const std::exception& e) {
+		filesystem_dprintf(("Blockcache: error flushing, '%s'\n", e.what()));
+	}
+	filesystem_dprintf(("Blockcache: statistics: %d hits, %d misses\n", Hits_, Misses_));
+}
+
+//*******************************************************************
+unsigned int
+Blockcache::Fetch(
+	const unsigned int	BlockNr,
+	FixBlockEndian		FixEndian,
+	const int			MirrorOffset
+)
+{
+	unsigned int	slot = Lookup(BlockNr);
+	if (slot == NOT_FOUND) {
+		slot = Allocate(BlockNr);
+		Device_.Read(BlockNr, Data(slot));
+		if (FixEndian != 0) {
+			FixEndian(Data(slot));
+		}
+		Entries_[slot].FixEndian = FixEndian;
+		Entries_[slot].Valid = true;
+		++Misses_;
+	} else {
+		Entry&	e = Entries_[slot];
+		// Block cached through Read/Write is in device byte order.
+		if (e.FixEndian != FixEndian) {
+			if (e.FixEndian != 0) {
+				e.FixEndian(Data(slot));
+			}
+			if (FixEndian != 0) {
+				FixEndian(Data(slot));
+			}
+			e.FixEndian = FixEndian;
+		}
+		++Hits_;
+	}
+
+	Entry&	e = Entries_[slot];
+	e.MirrorOffset = MirrorOffset;
+	++e.Pins;
+	Touch(slot);
+	return slot;
+}
+
+//*******************************************************************
+void
+Blockcache::Unpin(
+	const unsigned int	Slot
+)
+{
+	if (Entries_[Slot].Pins > 0) {
+		--Entries_[Slot].Pins;
+	}
+}
+
+//*******************************************************************
+void
+Blockcache::Read(
+	const unsigned int	BlockNr,
+	void*				Block
+)
+{
+	unsigned int	slot = Lookup(BlockNr);
+	if (slot == NOT_FOUND) {
+		slot = Allocate(BlockNr);
+		Device_.Read(BlockNr, Data(slot));
+		Entries_[slot].FixEndian = 0;
+		Entries_[slot].MirrorOffset = -1;
+		Entries_[slot].Valid = true;
+		++Misses_;
+	} else {
+		++Hits_;
+	}
+	Touch(slot);
+
+	memcpy(Block, Data(slot), BLOCK_SIZE);
+	const FixBlockEndian	fix = Entries_[slot].FixEndian;
+	if (fix != 0) {
+		fix(Block);
+	}
+}
+
+//*******************************************************************
+void
+Blockcache::Write(
+	const unsigned int	BlockNr,
+	const void*			Block
+)
+{
+	unsigned int	slot = Lookup(BlockNr);
+	if (slot == NOT_FOUND) {
+		slot = Allocate(BlockNr);
+		Entries_[slot].MirrorOffset = -1;
+		Entries_[slot].Valid = true;
+	}
+	Entry&	e = Entries_[slot];
+	memcpy(Data(slot), Block, BLOCK_SIZE);
+	e.FixEndian = 0;
+	e.Dirty = true;
+	Touch(slot);
+}
+
+//*******************************************************************
+void
+Blockcache::Flush(
+	const unsigned int	First,
+	const unsigned int	Count
+)
+{
+	const unsigned int	last = Count > 0xFFFFFFFF - First ? 0xFFFFFFFF : First + Count;
+	// Lowest dirty block in range first, so that the device sees sequential writes.
+	for (;;) {
+		unsigned int	slot = NOT_FOUND;
+		for (unsigned int i=0; i<Size_; ++i) {
+			const Entry&	e = Entries_[i];
+			if (e.Valid && e.Dirty && e.BlockNr>=First && e.BlockNr<last
+				&& (slot == NOT_FOUND || e.BlockNr < Entries_[slot].BlockNr)) {
+				slot = i;
+			}
+		}
+		if (slot == NOT_FOUND) {
+			break;
+		}
+		FlushSlot(slot);
+	}
+}
+
+//*******************************************************************
+void
+Blockcache::Flush()
+{
+	Flush(0, 0xFFFFFFFF);
+}
+
+//*******************************************************************
+void
+Blockcache::Discard(
+	const unsigned int	First,
+	const unsigned int	Count
+)
+{
+	for (unsigned int i=0; i<Size_; ++i) {
+		Entry&	e = Entries_[i];
+		if (e.Valid && e.Pins == 0 && e.BlockNr>=First && e.BlockNr-First<Count) {
+			e.Valid = false;
+			e.Dirty = false;
+		}
+	}
+}
+
+//*******************************************************************
+unsigned int
+Blockcache::Size() const
+{
+	return Size_;
+}
+
+//*******************************************************************
+unsigned int
+Blockcache::Hits() const
+{
+	return Hits_;
+}
+
+//*******************************************************************
+unsigned int
+Blockcache::Misses() const
+{
+	return Misses_;
+}
+
+//*******************************************************************
+unsigned int
+Blockcache::Lookup(
+	const unsigned int	BlockNr
+) const
+{
+	for (unsigned int i=0; i<Size_; ++i) {
+		if (Entries_[i].Valid && Entries_[i].BlockNr == BlockNr) {
+			return i;
+		}
+	}
+	return NOT_FOUND;
+}
+
+//*******************************************************************
+unsigned int
+Blockcache::Allocate(
+	const unsigned int	BlockNr
+)
+{
+	unsigned int	victim = NOT_FOUND;
+	for (unsigned int i=0; i<Size_; ++i) {
+		const Entry&	e = Entries_[i];
+		if (!e.Valid) {
+			victim = i;
+			break;
+		}
+		if (e.Pins == 0 && (victim == NOT_FOUND || e.LastUse < Entries_[victim].LastUse)) {
+			victim = i;
+		}
+	}
+	if (victim == NOT_FOUND) {
+		throw Error("Blockcache: all %d blocks are pinned.", Size_);
+	}
+
+	Entry&	e = Entries_[victim];
+	if (e.Valid && e.Dirty) {
+		FlushSlot(victim);
+	}
+	e.Valid = false;
+	e.Dirty = false;
+	e.Pins = 0;
+	e.BlockNr = BlockNr;
+	return victim;
+}
+
+//*******************************************************************
+void
+Blockcache::FlushSlot(
+	const unsigned int	Slot
+)
+{
+	Entry&	e = Entries_[Slot];
+	void*	data = Data(Slot);
+	if (e.FixEndian != 0) {
+		e.FixEndian(data);
+	}
+	// Device programs the block while we go on, the next access waits for it.
+	Device_.BeginWrite(e.BlockNr, data);
+	if (e.MirrorOffset>0) {
+		Device_.BeginWrite(e.BlockNr + e.MirrorOffset, data);
+	}
+	if (e.FixEndian != 0) {
+		e.FixEndian(data);
+	}
+	e.Dirty = false;
+}
+
+} // namespace Filesystem
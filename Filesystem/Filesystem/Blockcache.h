@@ -0,0 +1,192 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef Filesystem_Blockcache_h_
+#define Filesystem_Blockcache_h_
+
+#include <stdbool.h>
+
+#include <Filesystem/Blockdevice.h>
+
+namespace Filesystem {
+
+/** Write-back cache of device blocks with LRU replacement.
+
+Memory is supplied by the caller, so that it can be placed into external RAM.
+Blocks fetched by Blockbuffer are pinned and never evicted while pinned.
+*/
+class Blockcache {
+public:
+	/** Function to fix/reverse fix the endianness of the block contents. */
+	typedef void (*FixBlockEndian)(void* block);
+private:
+	/** Cache entry, one per cached block. */
+	typedef struct {
+		/** Device block number. */
+		unsigned int	BlockNr;
+		/** Value of the use clock at the last access. */
+		unsigned int	LastUse;
+		/** Offset to the second copy of the block. -1 if not in use. */
+		int				MirrorOffset;
+		/** Function to fix the block contents endianness, NULL if not in use. */
+		FixBlockEndian	FixEndian;
+		/** Number of pins. */
+		unsigned short	Pins;
+		/** Is entry valid? */
+		bool			Valid;
+		/** Is block not yet written to disk? */
+		bool			Dirty;
+	} Entry;
+public:
+	enum {
+		BLOCK_SIZE	= Blockdevice::BLOCK_SIZE,
+		/** Memory needed per cached block, bytes. */
+		SLOT_SIZE	= BLOCK_SIZE + sizeof(Entry)
+	};
+
+	/** Construct the cache in the given memory, which holds memory_size / SLOT_SIZE blocks.
+	At least two blocks are required.
+	*/
+	Blockcache(
+		Blockdevice&		Device,
+		void*				Memory,
+		const unsigned int	MemorySize
+	);
+
+	/** Write dirty blocks to the device. */
+	~Blockcache();
+
+	/** Bring the block into the cache and pin it.
+	\param[in]	BlockNr			Device block number.
+	\param[in]	FixEndian		Function to convert the block to host byte order, or NULL.
+	\param[in]	MirrorOffset	When positive, block is also written at BlockNr + MirrorOffset.
+	\return Slot number of the block, to be used with Data(), SetDirty() and Unpin().
+	*/
+	unsigned int
+	Fetch(
+		const unsigned int	BlockNr,
+		FixBlockEndian		FixEndian,
+		const int			MirrorOffset = -1
+	);
+
+	/** Release the block pinned by Fetch(). */
+	void
+	Unpin(
+		const unsigned int	Slot
+	);
+
+	/** Contents of the block in the given slot. */
+	inline void*
+	Data(
+		const unsigned int	Slot
+	)
+	{
+		return Blocks_ + Slot*BLOCK_SIZE;
+	}
+
+	/** Mark the block in the given slot as modified. */
+	inline void
+	SetDirty(
+		const unsigned int	Slot
+	)
+	{
+		Entries_[Slot].Dirty = true;
+	}
+
+	/** Read one block through the cache, in the device byte order. */
+	void
+	Read(
+		const unsigned int	BlockNr,
+		void*				Block
+	);
+
+	/** Write one block into the cache. It reaches the device when evicted or flushed. */
+	void
+	Write(
+		const unsigned int	BlockNr,
+		const void*			Block
+	);
+
+	/** Write dirty blocks in the range [First, First+Count) to the device, in ascending order. */
+	void
+	Flush(
+		const unsigned int	First,
+		const unsigned int	Count
+	);
+
+	/** Write all dirty blocks to the device. */
+	void
+	Flush();
+
+	/** Drop unpinned blocks in the range [First, First+Count) without writing them,
+	because device contents are about to be overwritten.
+	*/
+	void
+	Discard(
+		const unsigned int	First,
+		const unsigned int	Count
+	);
+
+	/** Number of cached blocks. */
+	unsigned int
+	Size() const;
+
+	/** Number of lookups served from the cache. */
+	unsigned int
+	Hits() const;
+
+	/** Number of lookups that had to go to the device. */
+	unsigned int
+	Misses() const;
+private:
+	enum {
+		NOT_FOUND	= 0xFFFFFFFF
+	};
+
+	/** Slot of the block, NOT_FOUND when not cached. */
+	unsigned int
+	Lookup(
+		const unsigned int	BlockNr
+	) const;
+
+	/** Evict the least recently used unpinned block and assign the slot to BlockNr. */
+	unsigned int
+	Allocate(
+		const unsigned int	BlockNr
+	);
+
+	/** Write the block in the given slot to the device. */
+	void
+	FlushSlot(
+		const unsigned int	Slot
+	);
+
+	/** Mark slot as most recently used. */
+	inline void
+	Touch(
+		const unsigned int	Slot
+	)
+	{
+		Entries_[Slot].LastUse = ++Clock_;
+	}
+
+	/** Block device. */
+	Blockdevice&	Device_;
+	/** Cache entries. */
+	Entry*			Entries_;
+	/** Cached blocks. */
+	char*			Blocks_;
+	/** Number of cached blocks. */
+	unsigned int	Size_;
+	/** Use clock, incremented on each access. */
+	unsigned int	Clock_;
+	/** Number of hits. */
+	unsigned int	Hits_;
+	/** Number of misses. */
+	unsigned int	Misses_;
+}; // class Blockcache
+
+} // namespace Filesystem
+
+#endif /* Filesystem_Blockcache_h_ */
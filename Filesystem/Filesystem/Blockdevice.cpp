@@ -11,4 +11,88 @@ Blockdevice::~Blockdevice()
 {
 }
 
+//*******************************************************************
+bool
+Blockdevice::ReadBlocks(
+	const unsigned int	first,
+	const unsigned int	count,
+	void*				buffer
+)
+{
+	char*	ptr = reinterpret_cast<char*>(buffer);
+	for (unsigned int i=0; i<count; ++i) {
+		if (!Read(first + i, ptr)) {
+			return false;
+		}
+		ptr += BLOCK_SIZE;
+	}
+	return true;
+}
+
+//*******************************************************************
+bool
+Blockdevice::WriteBlocks(
+	const unsigned int	first,
+	const unsigned int	count,
+	const void*			buffer
+)
+{
+	const char*	ptr = reinterpret_cast<const char*>(buffer);
+	for (unsigned int i=0; i<count; ++i) {
+		if (!Write(first + i, ptr)) {
+			return false;
+		}
+		ptr += BLOCK_SIZE;
+	}
+	return true;
+}
+
+//*******************************************************************
+bool
+Blockdevice::BeginWrite(
+	const unsigned int	nr,
+	const void*			block
+)
+{
+	return Write(nr, block);
+}
+
+//*******************************************************************
+bool
+Blockdevice::IsBusy()
+{
+	return false;
+}
+
+//*******************************************************************
+bool
+Blockdevice::Poll()
+{
+	return false;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice::EraseUnitSize()
+{
+	return 1;
+}
+
+//*******************************************************************
+bool
+Blockdevice::Erase(
+	const unsigned int	first,
+	const unsigned int	count
+)
+{
+	return false;
+}
+
+//*******************************************************************
+bool
+Blockdevice::Flush()
+{
+	return true;
+}
+
 } // namespace Filesystem
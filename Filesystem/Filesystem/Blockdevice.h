@@ -30,6 +30,75 @@ public:
 		const unsigned int	nr,
 		const void*			block
 	) = 0;
+
+	/** Read \c count consecutive blocks starting at block \c first.
+	Default implementation calls Read() for each block; devices capable
+	of streaming transfers should override it.
+	*/
+	virtual bool
+	ReadBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		void*				buffer
+	);
+
+	/** Write \c count consecutive blocks starting at block \c first.
+	Default implementation calls Write() for each block; devices capable
+	of streaming transfers should override it.
+	*/
+	virtual bool
+	WriteBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		const void*			buffer
+	);
+
+	/** Start writing block \c nr and return as soon as the device has taken the data,
+	without waiting for the device to program it. \c block may be reused when the call returns.
+	Default implementation calls Write().
+	*/
+	virtual bool
+	BeginWrite(
+		const unsigned int	nr,
+		const void*			block
+	);
+
+	/** Is the device still busy with the block started by BeginWrite()?
+	Answers from the state seen by the last Poll(), without accessing the device.
+	*/
+	virtual bool
+	IsBusy();
+
+	/** Check the device once for the end of the write started by BeginWrite(),
+	without waiting.
+	\return true while the device is busy.
+	*/
+	virtual bool
+	Poll();
+
+	/** Erase unit of the device, blocks. Flash cards write fastest in whole
+	units starting at a multiple of the unit. Default is one block.
+	*/
+	virtual unsigned int
+	EraseUnitSize();
+
+	/** Erase blocks [first, first+count) ahead of writing them, so that the
+	device need not erase them during the writes. Contents become all zeros
+	or all ones. Default implementation does nothing.
+	\return true if the blocks were erased.
+	*/
+	virtual bool
+	Erase(
+		const unsigned int	first,
+		const unsigned int	count
+	);
+
+	/** Write the blocks the device holds back, e.g. in a write window.
+	Writes made before reach the device before any made after.
+	Default implementation does nothing.
+	*/
+	virtual bool
+	Flush();
 }; // class Blockdevice
 
 } // namespace Filesystem
@@ -0,0 +1,197 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include <Filesystem/Blockdevice_Coalescing.h>
+#include <Filesystem/Error.h>
+
+#include <Filesystem_Config.h>
+
+#include <string.h>	// memcpy
+#include <exception>
+
+
+namespace Filesystem {
+
+//*******************************************************************
+Blockdevice_Coalescing::Blockdevice_Coalescing(
+	Blockdevice&		device,
+	void*				buffer,
+	const unsigned int	buffer_blocks
+)
+:	device_(device)
+	,buffer_(reinterpret_cast<char*>(buffer))
+	,buffer_blocks_(buffer_blocks)
+	,first_(0)
+	,count_(0)
+{
+	if (buffer_blocks_ < 2) {
+		throw Error("Blockdevice_Coalescing: window of %d blocks is too small.", buffer_blocks);
+	}
+}
+
+//*******************************************************************
+Blockdevice_Coalescing::~Blockdevice_Coalescing()
+{
+	try {
+		Flush();
+	} catch (const std::exception& e) {
+		filesystem_dprintf(("Blockdevice_Coalescing: error flushing, '%s'\n", e.what()));
+	}
+}
+
+//*******************************************************************
+bool
+Blockdevice_Coalescing::Read(
+	const unsigned int	nr,
+	void*				block
+)
+{
+	return ReadBlocks(nr, 1, block);
+}
+
+//*******************************************************************
+bool
+Blockdevice_Coalescing::Write(
+	const unsigned int	nr,
+	const void*			block
+)
+{
+	// 1. Block in the run: replace it.
+	if (count_ > 0 && nr - first_ < count_) {
+		memcpy(buffer_ + (nr - first_) * BLOCK_SIZE, block, BLOCK_SIZE);
+		return true;
+	}
+
+	// 2. Not the next block: the run goes to the device first.
+	if (count_ > 0 && nr != first_ + count_) {
+		if (!Flush()) {
+			return false;
+		}
+	}
+	if (count_ == 0) {
+		first_ = nr;
+	}
+	memcpy(buffer_ + count_ * BLOCK_SIZE, block, BLOCK_SIZE);
+	++count_;
+
+	// 3. Full window.
+	if (count_ == buffer_blocks_) {
+		return Flush();
+	}
+	return true;
+}
+
+//*******************************************************************
+bool
+Blockdevice_Coalescing::ReadBlocks(
+	const unsigned int	first,
+	const unsigned int	count,
+	void*				buffer
+)
+{
+	char*	ptr = reinterpret_cast<char*>(buffer);
+
+	// 1. All in the window.
+	if (count_ > 0 && first - first_ < count_ && count <= first_ + count_ - first) {
+		memcpy(ptr, buffer_ + (first - first_) * BLOCK_SIZE, count * BLOCK_SIZE);
+		return true;
+	}
+
+	// 2. From the device, with the pending blocks over it.
+	if (!device_.ReadBlocks(first, count, buffer)) {
+		return false;
+	}
+	const unsigned int	begin = first > first_ ? first : first_;
+	const unsigned int	end = first + count < first_ + count_ ? first + count : first_ + count_;
+	if (count_ > 0 && begin < end) {
+		memcpy(ptr + (begin - first) * BLOCK_SIZE, buffer_ + (begin - first_) * BLOCK_SIZE, (end - begin) * BLOCK_SIZE);
+	}
+	return true;
+}
+
+//*******************************************************************
+bool
+Blockdevice_Coalescing::WriteBlocks(
+	const unsigned int	first,
+	const unsigned int	count,
+	const void*			buffer
+)
+{
+	const char*	ptr = reinterpret_cast<const char*>(buffer);
+
+	if (count >= buffer_blocks_) {
+		// No gain from copying, but the run goes first to keep the order.
+		if (!Flush()) {
+			return false;
+		}
+		return device_.WriteBlocks(first, count, buffer);
+	}
+	for (unsigned int i=0; i<count; ++i) {
+		if (!Write(first + i, ptr)) {
+			return false;
+		}
+		ptr += BLOCK_SIZE;
+	}
+	return true;
+}
+
+//*******************************************************************
+bool
+Blockdevice_Coalescing::IsBusy()
+{
+	return device_.IsBusy();
+}
+
+//*******************************************************************
+bool
+Blockdevice_Coalescing::Poll()
+{
+	return device_.Poll();
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_Coalescing::EraseUnitSize()
+{
+	return device_.EraseUnitSize();
+}
+
+//*******************************************************************
+bool
+Blockdevice_Coalescing::Erase(
+	const unsigned int	first,
+	const unsigned int	count
+)
+{
+	if (!Flush()) {
+		return false;
+	}
+	return device_.Erase(first, count);
+}
+
+//*******************************************************************
+bool
+Blockdevice_Coalescing::Flush()
+{
+	const unsigned int	count = count_;
+
+	if (count == 0) {
+		return true;
+	}
+	count_ = 0;
+	// A single block leaves the card programming while we go on.
+	if (count == 1) {
+		return device_.BeginWrite(first_, buffer_);
+	}
+	return device_.WriteBlocks(first_, count, buffer_);
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_Coalescing::PendingCount() const
+{
+	return count_;
+}
+
+} // namespace Filesystem
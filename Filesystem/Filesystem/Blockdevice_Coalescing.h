@@ -0,0 +1,93 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef Filesystem_Blockdevice_Coalescing_h_
+#define Filesystem_Blockdevice_Coalescing_h_
+
+
+/** \file Block device decorator merging sequential writes. */
+
+#include <Filesystem/Blockdevice.h>
+
+namespace Filesystem {
+
+/** Holds written blocks back in a window and passes them to another block
+device as one multiple block write, so that callers writing one block at a
+time (the block cache, the file buffer, the write-behind queue) stream to the
+card like WriteBlocks() does.
+
+The window is one run of consecutive blocks. A write of a block in the run
+replaces it there, a write of the block just after the run extends it. Any
+other write, Flush() and a full window write the run to the device first, so
+the device sees the writes in the order they were made, only later and in
+fewer commands. Reads of blocks in the run are answered from the window.
+
+Multiple block writes of at least the window size are passed on at once.
+Memory is supplied by the caller, so that it can be placed into external RAM.
+*/
+class Blockdevice_Coalescing : public Blockdevice {
+public:
+	/** Collect writes to \c device in \c buffer_blocks blocks of \c buffer. */
+	Blockdevice_Coalescing(
+		Blockdevice&		device,
+		void*				buffer,
+		const unsigned int	buffer_blocks
+	);
+
+	/** Write the pending blocks. */
+	virtual ~Blockdevice_Coalescing();
+
+	virtual bool Read(
+		const unsigned int	nr,
+		void*				block
+	);
+
+	virtual bool Write(
+		const unsigned int	nr,
+		const void*			block
+	);
+
+	virtual bool ReadBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		void*				buffer
+	);
+
+	virtual bool WriteBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		const void*			buffer
+	);
+
+	virtual bool IsBusy();
+
+	virtual bool Poll();
+
+	virtual unsigned int EraseUnitSize();
+
+	/** Pending blocks are written before the erase. */
+	virtual bool Erase(
+		const unsigned int	first,
+		const unsigned int	count
+	);
+
+	/** Write the pending blocks to the device. */
+	virtual bool Flush();
+
+	/** Number of blocks waiting in the window. */
+	unsigned int
+	PendingCount() const;
+private:
+	Blockdevice&	device_;
+	char*			buffer_;
+	unsigned int	buffer_blocks_;
+	/** First block of the run in the window. */
+	unsigned int	first_;
+	/** Blocks in the window. */
+	unsigned int	count_;
+}; // class Blockdevice_Coalescing
+
+} // namespace Filesystem
+
+#endif /* Filesystem_Blockdevice_Coalescing_h_ */
@@ -4,6 +4,9 @@ vim: shiftwidth=4
 */
 #if defined(_MSC_VER)
 #define _CRT_SECURE_NO_WARNINGS
+#else
+// off_t of 64 bits on 32-bit hosts, too.
+#define _FILE_OFFSET_BITS	64
 #endif
 
 #include <Filesystem/Blockdevice_File.h>
@@ -11,22 +14,61 @@ vim: shiftwidth=4
 
 #include <Filesystem_Config.h>
 
+#include <stdint.h>
+#if !defined(_MSC_VER)
+#include <sys/types.h>	// off_t
+#endif
+
 
 namespace Filesystem {
 
+//*******************************************************************
+/** fseek() to a byte offset beyond 4 GB, images of large cards. */
+static int
+seek64(
+	FILE*			f,
+	const uint64_t	offset,
+	const int		whence
+)
+{
+#if defined(_MSC_VER)
+	return _fseeki64(f, static_cast<__int64>(offset), whence);
+#else
+	return fseeko(f, static_cast<off_t>(offset), whence);
+#endif
+}
+
+//*******************************************************************
+/** ftell() of files beyond 4 GB. */
+static uint64_t
+tell64(
+	FILE*	f
+)
+{
+#if defined(_MSC_VER)
+	return static_cast<uint64_t>(_ftelli64(f));
+#else
+	return static_cast<uint64_t>(ftello(f));
+#endif
+}
+
 //*******************************************************************
 Blockdevice_File::Blockdevice_File(
-	const std::string&	filename
+	const std::string&	filename,
+	const bool			readonly
 )
-:	read_count_(0)
+:	readonly_(readonly)
+	,read_count_(0)
 	,write_count_(0)
+	,read_command_count_(0)
+	,write_command_count_(0)
 {
-	f_ = fopen(filename.c_str(), "rb+");
+	f_ = fopen(filename.c_str(), readonly ? "rb" : "rb+");
 	if (f_ == 0) {
-		throw Error("Failed to open file '%s' for read-write", filename.c_str());
+		throw Error("Failed to open file '%s' for %s", filename.c_str(), readonly ? "reading" : "read-write");
 	}
-	fseek(f_, 0, SEEK_END);
-	max_block_nr = ftell(f_) / BLOCK_SIZE;
+	seek64(f_, 0, SEEK_END);
+	max_block_nr = static_cast<unsigned int>(tell64(f_) / BLOCK_SIZE);
 }
 
 //*******************************************************************
@@ -45,16 +87,38 @@ Blockdevice_File::Read(
 	void*				block
 )
 {
-	filesystem_dprintf(("Blockdevice_File::Read: 0x%04X\n", nr));
+	return ReadBlocks(nr, 1, block);
+}
+
+//*******************************************************************
+bool
+Blockdevice_File::Write(
+	const unsigned int	nr,
+	const void*			block
+)
+{
+	return WriteBlocks(nr, 1, block);
+}
 
-	if (nr > max_block_nr) {
-		throw Error("Blockdevice_File::Read: block %d is out of range [0 ... %d).", nr, max_block_nr);
+//*******************************************************************
+bool
+Blockdevice_File::ReadBlocks(
+	const unsigned int	first,
+	const unsigned int	count,
+	void*				buffer
+)
+{
+	filesystem_dprintf(("Blockdevice_File::ReadBlocks: 0x%04X, %d blocks\n", first, count));
+
+	if (first > max_block_nr || count > max_block_nr - first) {
+		throw Error("Blockdevice_File::Read: blocks %d+%d are out of range [0 ... %d).", first, count, max_block_nr);
 	}
-	const int	r1 = fseek(f_, nr*BLOCK_SIZE, SEEK_SET);
+	const int	r1 = seek64(f_, static_cast<uint64_t>(first) * BLOCK_SIZE, SEEK_SET);
 	if (r1 == 0) {
-		const size_t	r2 = fread(block, BLOCK_SIZE, 1, f_);
-		if (r2 == 1) {
-			++read_count_;
+		const size_t	r2 = fread(buffer, BLOCK_SIZE, count, f_);
+		if (r2 == count) {
+			read_count_ += count;
+			++read_command_count_;
 			return true;
 		} else {
 			filesystem_dprintf(("Blockdevice_File: fread failed, return value %d", r2)); 
@@ -67,21 +131,27 @@ Blockdevice_File::Read(
 
 //*******************************************************************
 bool
-Blockdevice_File::Write(
-	const unsigned int	nr,
-	const void*			block
+Blockdevice_File::WriteBlocks(
+	const unsigned int	first,
+	const unsigned int	count,
+	const void*			buffer
 )
 {
-	filesystem_dprintf(("Blockdevice_File::Write: 0x%04X\n", nr));
+	filesystem_dprintf(("Blockdevice_File::WriteBlocks: 0x%04X, %d blocks\n", first, count));
 
-	if (nr > max_block_nr) {
-		throw Error("Blockdevice_File::Write: block %d is out of range [0 ... %d).", nr, max_block_nr);
+	if (first > max_block_nr || count > max_block_nr - first) {
+		throw Error("Blockdevice_File::Write: blocks %d+%d are out of range [0 ... %d).", first, count, max_block_nr);
+	}
+	if (readonly_) {
+		filesystem_dprintf(("Blockdevice_File: write to a read-only file\n"));
+		return false;
 	}
-	const int	r1 = fseek(f_, nr*BLOCK_SIZE, SEEK_SET);
+	const int	r1 = seek64(f_, static_cast<uint64_t>(first) * BLOCK_SIZE, SEEK_SET);
 	if (r1 == 0) {
-		const size_t	r2 = fwrite(block, BLOCK_SIZE, 1, f_);
-		if (r2 == 1) {
-			++write_count_;
+		const size_t	r2 = fwrite(buffer, BLOCK_SIZE, count, f_);
+		if (r2 == count) {
+			write_count_ += count;
+			++write_command_count_;
 			return true;
 		} else {
 			filesystem_dprintf(("Blockdevice_File: fwrite failed, return value %d", r2)); 
@@ -93,4 +163,39 @@ Blockdevice_File::Write(
 	return false;
 }
 
+//*******************************************************************
+unsigned int
+Blockdevice_File::BlockCount() const
+{
+	return max_block_nr;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_File::ReadCount() const
+{
+	return read_count_;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_File::WriteCount() const
+{
+	return write_count_;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_File::ReadCommandCount() const
+{
+	return read_command_count_;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_File::WriteCommandCount() const
+{
+	return write_command_count_;
+}
+
 } // namespace Filesystem
@@ -17,8 +17,14 @@ namespace Filesystem {
 
 class Blockdevice_File : public Blockdevice {
 public:
+	/** Open the image file, throws exception when it cannot be opened.
+	\param[in]	filename	Image file.
+	\param[in]	readonly	Open the file for reading only; writes then fail and the file is never changed.
+	*/
+	explicit
 	Blockdevice_File(
-		const std::string&	filename
+		const std::string&	filename,
+		const bool			readonly = false
 	);
 	virtual ~Blockdevice_File();
 
@@ -31,11 +37,48 @@ public:
 		const unsigned int	nr,
 		const void*			block
 	);
+
+	/** Read consecutive blocks with one seek and one fread. */
+	virtual bool ReadBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		void*				buffer
+	);
+
+	/** Write consecutive blocks with one seek and one fwrite. */
+	virtual bool WriteBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		const void*			buffer
+	);
+
+	/** Number of blocks in the image file. */
+	unsigned int
+	BlockCount() const;
+
+	/** Number of blocks read so far. */
+	unsigned int
+	ReadCount() const;
+
+	/** Number of blocks written so far. */
+	unsigned int
+	WriteCount() const;
+
+	/** Number of read commands so far, multi-block read counts as one. */
+	unsigned int
+	ReadCommandCount() const;
+
+	/** Number of write commands so far, multi-block write counts as one. */
+	unsigned int
+	WriteCommandCount() const;
 private:
 	FILE*			f_;
+	bool			readonly_;
 	unsigned int	max_block_nr;
 	unsigned int	read_count_;
 	unsigned int	write_count_;
+	unsigned int	read_command_count_;
+	unsigned int	write_command_count_;
 }; // class Blockdevice_File
 
 } // namespace Filesystem
@@ -0,0 +1,117 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include <Filesystem/Blockdevice_RAM.h>
+#include <Filesystem/Error.h>
+
+#include <Filesystem_Config.h>
+
+#include <string.h>	// memcpy
+
+
+namespace Filesystem {
+
+//*******************************************************************
+Blockdevice_RAM::Blockdevice_RAM(
+	void*				memory,
+	const unsigned int	nblocks
+)
+:	memory_(reinterpret_cast<char*>(memory))
+	,nblocks_(nblocks)
+	,read_count_(0)
+	,write_count_(0)
+	,read_command_count_(0)
+	,write_command_count_(0)
+{
+}
+
+//*******************************************************************
+Blockdevice_RAM::~Blockdevice_RAM()
+{
+	filesystem_dprintf(("Blockdevice_RAM: statistics: %d reads, %d writes\n", read_count_, write_count_));
+}
+
+//*******************************************************************
+bool
+Blockdevice_RAM::Read(
+	const unsigned int	nr,
+	void*				block
+)
+{
+	return ReadBlocks(nr, 1, block);
+}
+
+//*******************************************************************
+bool
+Blockdevice_RAM::Write(
+	const unsigned int	nr,
+	const void*			block
+)
+{
+	return WriteBlocks(nr, 1, block);
+}
+
+//*******************************************************************
+bool
+Blockdevice_RAM::ReadBlocks(
+	const unsigned int	first,
+	const unsigned int	count,
+	void*				buffer
+)
+{
+	if (first > nblocks_ || count > nblocks_ - first) {
+		throw Error("Blockdevice_RAM::Read: blocks %d+%d are out of range [0 ... %d).", first, count, nblocks_);
+	}
+	memcpy(buffer, memory_ + static_cast<size_t>(first)*BLOCK_SIZE, static_cast<size_t>(count)*BLOCK_SIZE);
+	read_count_ += count;
+	++read_command_count_;
+	return true;
+}
+
+//*******************************************************************
+bool
+Blockdevice_RAM::WriteBlocks(
+	const unsigned int	first,
+	const unsigned int	count,
+	const void*			buffer
+)
+{
+	if (first > nblocks_ || count > nblocks_ - first) {
+		throw Error("Blockdevice_RAM::Write: blocks %d+%d are out of range [0 ... %d).", first, count, nblocks_);
+	}
+	memcpy(memory_ + static_cast<size_t>(first)*BLOCK_SIZE, buffer, static_cast<size_t>(count)*BLOCK_SIZE);
+	write_count_ += count;
+	++write_command_count_;
+	return true;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_RAM::ReadCount() const
+{
+	return read_count_;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_RAM::WriteCount() const
+{
+	return write_count_;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_RAM::ReadCommandCount() const
+{
+	return read_command_count_;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_RAM::WriteCommandCount() const
+{
+	return write_command_count_;
+}
+
+} // namespace Filesystem
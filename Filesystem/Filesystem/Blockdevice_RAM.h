@@ -0,0 +1,75 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef Filesystem_Blockdevice_RAM_h_
+#define Filesystem_Blockdevice_RAM_h_
+
+
+/** \file Memory-based block device. */
+
+#include <Filesystem/Blockdevice.h>
+
+namespace Filesystem {
+
+/** Block device in caller-supplied memory, so that benchmarks measure
+the filesystem code and not the disk of the host.
+*/
+class Blockdevice_RAM : public Blockdevice {
+public:
+	/** Use \c nblocks blocks of \c memory as the device contents. */
+	Blockdevice_RAM(
+		void*				memory,
+		const unsigned int	nblocks
+	);
+	virtual ~Blockdevice_RAM();
+
+	virtual bool Read(
+		const unsigned int	nr,
+		void*				block
+	);
+
+	virtual bool Write(
+		const unsigned int	nr,
+		const void*			block
+	);
+
+	virtual bool ReadBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		void*				buffer
+	);
+
+	virtual bool WriteBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		const void*			buffer
+	);
+
+	/** Number of blocks read so far. */
+	unsigned int
+	ReadCount() const;
+
+	/** Number of blocks written so far. */
+	unsigned int
+	WriteCount() const;
+
+	/** Number of read commands so far, multi-block read counts as one. */
+	unsigned int
+	ReadCommandCount() const;
+
+	/** Number of write commands so far, multi-block write counts as one. */
+	unsigned int
+	WriteCommandCount() const;
+private:
+	char*			memory_;
+	unsigned int	nblocks_;
+	unsigned int	read_count_;
+	unsigned int	write_count_;
+	unsigned int	read_command_count_;
+	unsigned int	write_command_count_;
+}; // class Blockdevice_RAM
+
+} // namespace Filesystem
+
+#endif /* Filesystem_Blockdevice_RAM_h_ */
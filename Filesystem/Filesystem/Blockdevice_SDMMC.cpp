@@ -9,35 +9,8 @@ vim: shiftwidth=4
 #include <Filesystem/Error.h>
 
 
-#if defined(_MSC_VER)
-//*******************************************************************
-static void
-FILESYSTEM_SDMMC_SPI_SELECT()
-{
-}
-
-//*******************************************************************
-static void
-FILESYSTEM_SDMMC_SPI_UNSELECT()
-{
-}
-
-//*******************************************************************
-static void
-FILESYSTEM_SDMMC_SPI_READ(
-	uint16_t*	data
-)
-{
-}
-
-//*******************************************************************
-static void
-FILESYSTEM_SDMMC_SPI_WRITE(
-	const uint16_t	data
-)
-{
-}
-
+#if defined(FILESYSTEM_SDMMC_MOCK)
+// SPI is routed to the SD/MMC card mock by Filesystem_Config.h.
 #define	delay_ms(x)	do { } while (0)
 #else
 // this is slightly a hack. don't worry :)
@@ -51,13 +24,17 @@ FILESYSTEM_SDMMC_SPI_WRITE(
 // MMC commands (taken from sandisk MMC reference)
 #define MMC_GO_IDLE_STATE                 0    ///< initialize card to SPI-type access
 #define MMC_SEND_OP_COND                  1    ///< set card operational mode
+#define SD_SEND_IF_COND                   8    ///< check voltage range, SD 2.0 cards only
 #define MMC_CMD2                          2               ///< illegal in SPI mode !
 #define MMC_SEND_CSD                      9    ///< get card's CSD
 #define MMC_SEND_CID                      10    ///< get card's CID
 #define MMC_SEND_STATUS                   13
 #define MMC_SET_BLOCKLEN                  16    ///< Set number of bytes to transfer per block
+#define MMC_STOP_TRANSMISSION             12    ///< stop multiple block read
 #define MMC_READ_SINGLE_BLOCK             17    ///< read a block
+#define MMC_READ_MULTIPLE_BLOCK           18    ///< read blocks until stopped
 #define MMC_WRITE_BLOCK                   24    ///< write a block
+#define MMC_WRITE_MULTIPLE_BLOCK          25    ///< write blocks until stop token
 #define MMC_PROGRAM_CSD                   27
 #define MMC_SET_WRITE_PROT                28
 #define MMC_CLR_WRITE_PROT                29
@@ -72,8 +49,11 @@ FILESYSTEM_SDMMC_SPI_WRITE(
 #define MMC_UNTAG_ERASE_GROUP             37    ///< Untag (unset) erase group (mass erase)
 #define MMC_ERASE                         38    ///< Perform block/mass erase
 #define SD_SEND_OP_COND_ACMD              41              ///< Same as MMC_SEND_OP_COND but specific to SD (must be preceeded by CMD55)
+#define SD_SD_STATUS_ACMD                 13              ///< read the 64 byte SD status (must be preceeded by CMD55)
+#define SD_SET_WR_BLK_ERASE_COUNT_ACMD    23              ///< pre-erase blocks of the following multiple block write (must be preceeded by CMD55)
 #define MMC_LOCK_UNLOCK                   42              ///< To start a lock/unlock/pwd operation
 #define SD_APP_CMD55                      55              ///< Use before any specific command (type ACMD)
+#define MMC_READ_OCR                      58    ///< read the OCR register
 #define MMC_CRC_ON_OFF                    59    ///< Turns CRC check on/off
 // R1 Response bit-defines
 #define MMC_R1_BUSY                       0x80  ///< R1 response: bit indicates card is busy
@@ -84,6 +64,13 @@ FILESYSTEM_SDMMC_SPI_WRITE(
 #define MMC_R1_ILLEGAL_COM                0x04
 #define MMC_R1_ERASE_RESET                0x02
 #define MMC_R1_IDLE_STATE                 0x01
+// SD 2.0 initialization
+#define SD_IF_COND_ARG                    0x1AA ///< 2.7-3.6 V, check pattern 0xAA
+#define SD_IF_COND_CRC                    0x87  ///< CRC of CMD8 with SD_IF_COND_ARG, checked in SPI mode too
+#define SD_ACMD41_HCS                     0x40000000    ///< host supports block addressed (high capacity) cards
+#define SD_OCR_CCS                        0x40  ///< first OCR byte: card capacity status, card is block addressed
+#define SD_STATUS_SIZE                    64    ///< bytes in the SD status
+#define SD_STATUS_AU_SIZE_BYTE            10    ///< AU_SIZE is the high nibble of this byte
 // Data Start tokens
 #define MMC_STARTBLOCK_READ               0xFE  ///< when received from card, indicates that a block of data will follow
 #define MMC_STARTBLOCK_WRITE              0xFE  ///< when sent to card, indicates that a block of data will follow
@@ -191,12 +178,13 @@ send_and_read(
 //!
 //! @param  command   command to send (see sd_mmc.h for command list)
 //!         arg       argument of the command
+//!         crc       CRC of the command, checked only for CMD0 and CMD8
 //!
 //! @return U8
 //!         R1 response (R1 == 0xFF time out error)
 //!/
 static uint8_t
-sd_mmc_command(const uint8_t command, const uint32_t arg)
+sd_mmc_command(const uint8_t command, const uint32_t arg, const uint8_t crc = 0x95)
 {
 	uint8_t	retry;
 	uint8_t	r1;
@@ -207,8 +195,8 @@ sd_mmc_command(const uint8_t command, const uint32_t arg)
 	FILESYSTEM_SDMMC_SPI_WRITE(arg>>16);
 	FILESYSTEM_SDMMC_SPI_WRITE(arg>>8 );
 	FILESYSTEM_SDMMC_SPI_WRITE(arg    );
-	FILESYSTEM_SDMMC_SPI_WRITE(0x95);            // correct CRC for first command in SPI (CMD0)
-								  // after, the CRC is ignored
+	FILESYSTEM_SDMMC_SPI_WRITE(crc);             // correct CRC for first command in SPI (CMD0)
+								  // after, the CRC is ignored except for CMD8
 	// end command
 	// wait for response
 	// if more than 8 retries, card has timed-out and return the received 0xFF
@@ -347,11 +335,13 @@ print_csd_field(
 //*******************************************************************
 //! @brief Reads the CSD (Card Specific Data) of the memory card
 //!
-//! @param  buffer to fill
+//! @param  erase_blocks	set to the erase sector size, blocks
 //!
 //!/
 void
-sd_mmc_get_csd()
+sd_mmc_get_csd(
+	unsigned int&	erase_blocks
+)
 {
 	uint8_t			buffer[16];
 	uint8_t			r1;
@@ -410,6 +400,61 @@ sd_mmc_get_csd()
 	print_csd_field("r2w_factor    ", buffer, 26, 3);
 	print_csd_field("write_blkbits ", buffer, 22, 4);
 	print_csd_field("write_partial ", buffer, 21, 1);
+
+	// SECTOR_SIZE is the erase unit in write blocks, less one; 127 on SDHC.
+	const unsigned int	write_blkbits = UNSTUFF_BITS(buffer, 22, 4);
+	const unsigned int	sector_size = UNSTUFF_BITS(buffer, 39, 7) + 1;
+	erase_blocks = write_blkbits > 9 ? sector_size << (write_blkbits - 9) : sector_size;
+	filesystem_dprintf(("Erase sector: %d blocks\n", erase_blocks));
+}
+
+//*******************************************************************
+/** Allocation unit size of an SD card from the SD status (ACMD13), blocks.
+Returns 0 when the card does not tell.
+*/
+static unsigned int
+sd_get_au_size()
+{
+	// AU_SIZE 1..9 is 16 kB << (AU_SIZE-1), 10..15 are the larger SDXC units.
+	static const unsigned int	large_au_mb[6] = { 8, 12, 16, 24, 32, 64 };
+	uint8_t						status[SD_STATUS_SIZE];
+	unsigned int				retry = 0;
+	uint8_t						r1;
+
+	SpiAutoselect	sa;
+
+	if (!wait_not_busy()) {
+		return 0;
+	}
+	sd_mmc_command(SD_APP_CMD55, 0);
+	send_and_read(0xFF);            // write dummy byte
+	r1 = sd_mmc_command(SD_SD_STATUS_ACMD, 0);
+	send_and_read(0xFF);            // second byte of R2
+	if (r1 != 0x00) {
+		return 0;
+	}
+	while ((r1 = send_and_read(0xFF)) != MMC_STARTBLOCK_READ) {
+		if (retry > 1000) {
+			return 0;
+		}
+		retry++;
+	}
+	for (unsigned int i=0; i<sizeof(status); ++i) {
+		status[i] = send_and_read(0xFF);
+	}
+	send_and_read(0xFF);   // CRC (not used)
+	send_and_read(0xFF);
+	send_and_read(0xFF);   // give clock again to end transaction
+
+	const unsigned int	au_size = status[SD_STATUS_AU_SIZE_BYTE] >> 4;
+	filesystem_dprintf(("SD status: AU_SIZE %d\n", au_size));
+	if (au_size == 0) {
+		return 0;
+	} else if (au_size <= 9) {
+		return (16*1024 / Blockdevice::BLOCK_SIZE) << (au_size - 1);
+	} else {
+		return large_au_mb[au_size - 10] * (1024*1024 / Blockdevice::BLOCK_SIZE);
+	}
 }
 
 //*******************************************************************
@@ -419,7 +464,8 @@ sd_mmc_get_csd()
  **/
 void
 memCardInit(
-	uint8_t&		card_type
+	uint8_t&		card_type,
+	bool&			block_addressing
 )
 {
 	uint32_t		retry = 0;
@@ -430,11 +476,15 @@ memCardInit(
 	// 1. CS line of SD/MMC is NOT selected!
 	// 2. Atmel SPI interface requires at least one CS line to be selected in order to output any data.
 	// The LCD display loses. I am very sorry. Hopefully she is not angry at me.
+#if !defined(FILESYSTEM_SDMMC_MOCK)
 	spi_selectChip(DIP204_SPI, DIP204_SPI_CS);
+#endif
 	for (unsigned int i=0; i<10; ++i) {
 		r1 = send_and_read(0xFF);
 	}
+#if !defined(FILESYSTEM_SDMMC_MOCK)
 	spi_unselectChip(DIP204_SPI, DIP204_SPI_CS);
+#endif
 	filesystem_dprintf(("sdmmc: reset1 r=0x%02X\n", r1));
 
 	SpiAutoselect	sa;
@@ -457,48 +507,94 @@ memCardInit(
 		}
 	} while(r1 != 0x01);   // check memory enters idle_state
 
-	// IDENTIFICATION OF THE CARD TYPE (SD or MMC)
-	// Both cards will accept CMD55 command but only the SD card will respond to ACMD41
-	r1 = sd_mmc_command(SD_APP_CMD55,0);
+	// SD 2.0 CARDS ANSWER SEND_IF_COND, OLDER SD AND MMC CARDS TAKE IT AS ILLEGAL
+	bool	sd_v2 = false;
+	block_addressing = false;
+	r1 = sd_mmc_command(SD_SEND_IF_COND, SD_IF_COND_ARG, SD_IF_COND_CRC);
+	if ((r1 & MMC_R1_ILLEGAL_COM) == 0) {
+		uint8_t	r7[4];
+		for (unsigned int i=0; i<sizeof(r7); ++i) {
+			r7[i] = send_and_read(0xFF);
+		}
+		if ((r7[2] & 0x0F) != ((SD_IF_COND_ARG >> 8) & 0x0F) || r7[3] != (SD_IF_COND_ARG & 0xFF)) {
+			throw Error("MemCard voltage range not supported.");
+		}
+		sd_v2 = true;
+	}
 	send_and_read(0xFF);  // write dummy byte
 
-	r1 = sd_mmc_command(SD_SEND_OP_COND_ACMD, 0);
-	send_and_read(0xFF);  // write dummy byte
+	if (sd_v2) {
+		// Tell the card we can handle block addressing, repeat until it leaves idle state.
+		card_type = SD_CARD;
+		retry = 0;
+		do {
+			sd_mmc_command(SD_APP_CMD55, 0);
+			send_and_read(0xFF);            // write dummy byte
+			r1 = sd_mmc_command(SD_SEND_OP_COND_ACMD, SD_ACMD41_HCS);
+			send_and_read(0xFF);            // write dummy byte
+			// do retry counter
+			retry++;
+			if (retry == 150000) {
+				throw Error("MemCard init timeout.\n");
+			}
+		} while (r1);
 
-	if ((r1&0xFE) == 0) {   // ignore "in_idle_state" flag bit
-		card_type = SD_CARD;    // card has accepted the command, this is a SD card
-		filesystem_dprintf(("sd_mmc: detected SD card.\n"));
+		// Card capacity status tells whether the card is block addressed (SDHC).
+		uint8_t	ocr[4];
+		r1 = sd_mmc_command(MMC_READ_OCR, 0);
+		for (unsigned int i=0; i<sizeof(ocr); ++i) {
+			ocr[i] = send_and_read(0xFF);
+		}
+		send_and_read(0xFF);  // write dummy byte
+		if (r1 != 0x00) {
+			throw Error("MemCard OCR fail, r1=0x%02X.", r1);
+		}
+		block_addressing = (ocr[0] & SD_OCR_CCS) != 0;
+		filesystem_dprintf(("sd_mmc: detected SD 2.0 card, %s addressing.\n", block_addressing ? "block" : "byte"));
 	} else {
-		card_type = MMC_CARD;   // card has not responded, this is a MMC card
-		filesystem_dprintf(("sd_mmc: querying MMC card.\n"));
-		// reset card again
+		// IDENTIFICATION OF THE CARD TYPE (SD or MMC)
+		// Both cards will accept CMD55 command but only the SD card will respond to ACMD41
+		r1 = sd_mmc_command(SD_APP_CMD55,0);
+		send_and_read(0xFF);  // write dummy byte
+
+		r1 = sd_mmc_command(SD_SEND_OP_COND_ACMD, 0);
+		send_and_read(0xFF);  // write dummy byte
+
+		if ((r1&0xFE) == 0) {   // ignore "in_idle_state" flag bit
+			card_type = SD_CARD;    // card has accepted the command, this is a SD card
+			filesystem_dprintf(("sd_mmc: detected SD card.\n"));
+		} else {
+			card_type = MMC_CARD;   // card has not responded, this is a MMC card
+			filesystem_dprintf(("sd_mmc: querying MMC card.\n"));
+			// reset card again
+			retry = 0;
+			do {
+				// reset card again
+				r1 = sd_mmc_command(MMC_GO_IDLE_STATE, 0);
+				send_and_read(0xFF);            // write dummy byte
+				// do retry counter
+				retry++;
+				if (retry > 100) {
+					throw Error("MemCard reset timeout.\n");
+				}
+			} while(r1 != 0x01);   // check memory enters idle_state
+		}
+
+		// CONTINUE INTERNAL INITIALIZATION OF THE CARD
+		// Continue sending CMD1 while memory card is in idle state
 		retry = 0;
 		do {
-			// reset card again
-			r1 = sd_mmc_command(MMC_GO_IDLE_STATE, 0);
+			// initializing card for operation
+			r1 = sd_mmc_command(CMD1, 0);
 			send_and_read(0xFF);            // write dummy byte
 			// do retry counter
 			retry++;
-			if (retry > 100) {
-				throw Error("MemCard reset timeout.\n");
+			if (retry == 150000) {    // measured approx. 500 on several cards
+				throw Error("MemCard init timeout.\n");
 			}
-		} while(r1 != 0x01);   // check memory enters idle_state
+		} while (r1);
 	}
 
-	// CONTINUE INTERNAL INITIALIZATION OF THE CARD
-	// Continue sending CMD1 while memory card is in idle state
-	retry = 0;
-	do {
-		// initializing card for operation
-		r1 = sd_mmc_command(CMD1, 0);
-		send_and_read(0xFF);            // write dummy byte
-		// do retry counter
-		retry++;
-		if (retry == 150000) {    // measured approx. 500 on several cards
-			throw Error("MemCard init timeout.\n");
-		}
-	} while (r1);
-
 	// DISABLE CRC TO SIMPLIFY AND SPEED UP COMMUNICATIONS
 	r1 = sd_mmc_command(MMC_CRC_ON_OFF, 0);  // disable CRC (should be already initialized on SPI init)
 	send_and_read(0xFF);            // write dummy byte
@@ -539,12 +635,18 @@ setBlockLength512()
 }
 
 //*******************************************************************
-Blockdevice_SDMMC::Blockdevice_SDMMC()
+Blockdevice_SDMMC::Blockdevice_SDMMC(
+	const bool	initialize
+)
 :	card_type_(0)
+	,block_addressing_(false)
+	,busy_(false)
+	,initialized_(false)
+	,erase_unit_(1)
 {
-	memCardInit(card_type_);
-	setBlockLength512();
-	sd_mmc_get_csd();
+	if (initialize) {
+		Initialize();
+	}
 }
 
 //*******************************************************************
@@ -552,6 +654,106 @@ Blockdevice_SDMMC::~Blockdevice_SDMMC()
 {
 }
 
+//*******************************************************************
+void
+Blockdevice_SDMMC::Initialize()
+{
+	initialized_ = false;
+	busy_ = false;
+	memCardInit(card_type_, block_addressing_);
+	setBlockLength512();
+	sd_mmc_get_csd(erase_unit_);
+	if (card_type_ == SD_CARD) {
+		const unsigned int	au = sd_get_au_size();
+		if (au > erase_unit_) {
+			erase_unit_ = au;
+		}
+	}
+	initialized_ = true;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_SDMMC::EraseUnitSize()
+{
+	return erase_unit_;
+}
+
+//*******************************************************************
+bool
+Blockdevice_SDMMC::Erase(
+	const unsigned int	first,
+	const unsigned int	count
+)
+{
+	filesystem_dprintf(("Blockdevice_SDMMC::Erase 0x%04X, %d blocks\n", first, count));
+	if (!initialized_) {
+		throw Error("MemCard Missing.");
+	}
+	if (card_type_ != SD_CARD || count == 0) {
+		// MMC cards erase by groups with other commands, not worth it.
+		return false;
+	}
+
+	SpiAutoselect	sa;
+	wait_not_busy();
+	busy_ = false;
+
+	uint8_t	r1 = sd_mmc_command(SD_TAG_WR_ERASE_GROUP_START, Address(first));
+	send_and_read(0xFF);            // write dummy byte
+	if (r1 == 0x00) {
+		r1 = sd_mmc_command(SD_TAG_WR_ERASE_GROUP_END, Address(first + count - 1));
+		send_and_read(0xFF);            // write dummy byte
+	}
+	if (r1 == 0x00) {
+		r1 = sd_mmc_command(MMC_ERASE, 0);
+	}
+	if (r1 != 0x00) {
+		throw Error("MemCard Erase Fail, r1=0x%02X, block %04X.", r1, first);
+	}
+
+	// Erasing takes up to 250 ms per allocation unit; wait_not_busy() gives up much earlier.
+	for (unsigned int retry=0; !wait_not_busy(); ++retry) {
+		if (retry == 100) {
+			throw Error("MemCard Erase timeout, block %04X.", first);
+		}
+	}
+	send_and_read(0xFF);
+	return true;
+}
+
+//*******************************************************************
+bool
+Blockdevice_SDMMC::IsPresent()
+{
+	if (!initialized_) {
+		return false;
+	}
+
+	uint8_t	r1 = 0xFF;
+	uint8_t	r2 = 0xFF;
+	{
+		SpiAutoselect	sa;
+		if (wait_not_busy()) {
+			busy_ = false;
+			r1 = sd_mmc_command(MMC_SEND_STATUS, 0);
+			r2 = send_and_read(0xFF);
+			send_and_read(0xFF);  // write dummy byte
+		}
+	}
+
+	// A replaced card is not in SPI mode and does not answer; a power cycled one is idle.
+	if (r1 != 0x00) {
+		filesystem_dprintf(("sd_mmc: card lost, r1=0x%02X.\n", r1));
+		initialized_ = false;
+		return false;
+	}
+	if (r2 != 0x00) {
+		filesystem_dprintf(("sd_mmc: card status 0x%02X.\n", r2));
+	}
+	return true;
+}
+
 //*******************************************************************
 bool
 Blockdevice_SDMMC::Read(
@@ -559,15 +761,19 @@ Blockdevice_SDMMC::Read(
 	void*				block
 )
 {
-	unsigned int	block256 = nr * 2;
+	const uint32_t	address = Address(nr);
 	bool			ok = false;
 	
 	filesystem_dprintf(("Blockdevice_SDMMC::Read 0x%04lX\n", nr));
+	if (!initialized_) {
+		throw Error("MemCard Missing.");
+	}
 
 	SpiAutoselect	sa;
 	wait_not_busy();
+	busy_ = false;
 
-	sendCommand(CMD17,(block256>>16)&0xFF,(block256>>8)&0xFF,block256&0xFF,0,0xFF);
+	sendCommand(CMD17,(address>>24)&0xFF,(address>>16)&0xFF,(address>>8)&0xFF,address&0xFF,0xFF);
 	if (cardResponse(0x00))	{
 		unsigned char	real_response = 0xFF;
 		if (cardResponse(0xFE, real_response)) {
@@ -595,18 +801,76 @@ Blockdevice_SDMMC::Write(
 	const unsigned int	nr,
 	const void*			block
 )
+{
+	return WriteBlock(nr, block, true);
+}
+
+//*******************************************************************
+bool
+Blockdevice_SDMMC::BeginWrite(
+	const unsigned int	nr,
+	const void*			block
+)
+{
+	return WriteBlock(nr, block, false);
+}
+
+//*******************************************************************
+bool
+Blockdevice_SDMMC::IsBusy()
+{
+	return busy_;
+}
+
+//*******************************************************************
+bool
+Blockdevice_SDMMC::Poll()
+{
+	if (busy_) {
+		SpiAutoselect	sa;
+		if (send_and_read(0xFF) == 0xFF) {
+			busy_ = false;
+		}
+	}
+	return busy_;
+}
+
+//*******************************************************************
+bool
+Blockdevice_SDMMC::WaitReady()
+{
+	bool	ready = true;
+	if (busy_) {
+		SpiAutoselect	sa;
+		ready = wait_not_busy();
+		busy_ = false;
+	}
+	return ready;
+}
+
+//*******************************************************************
+bool
+Blockdevice_SDMMC::WriteBlock(
+	const unsigned int	nr,
+	const void*			block,
+	const bool			wait
+)
 {
 	filesystem_dprintf(("Blockdevice_SDMMC::Write  0x%04lX\n", nr));
+	if (!initialized_) {
+		throw Error("MemCard Missing.");
+	}
 
-	unsigned int	block256 = nr * 2;
+	const uint32_t	address = Address(nr);
 	SpiAutoselect	sa;
 
 #if (1)
 	const unsigned int	max_retries = 3;
 	for (unsigned int retry=0; retry<max_retries; ++retry) {
 		wait_not_busy();
+		busy_ = false;
 		// issue command
-		sendCommand(CMD24, (block256>>16)&0xFF, (block256>>8)&0xFF, block256&0xFF, 0, 0xFF);
+		sendCommand(CMD24, (address>>24)&0xFF, (address>>16)&0xFF, (address>>8)&0xFF, address&0xFF, 0xFF);
 		uint8_t r1 = 0xFF;
 		{
 			// end command
@@ -647,9 +911,16 @@ Blockdevice_SDMMC::Write(
 		send_and_read(0xFF);		// send dummy bytes
 		send_and_read(0xFF);
 		if ((r1&MMC_DR_MASK) == MMC_DR_ACCEPT) {
-			// Without wait_not_busy the memory card will listen to the traffic
-			// with other SPI devices and screw up our write.
-			wait_not_busy();
+			if (wait) {
+				// Without wait_not_busy the memory card will listen to the traffic
+				// with other SPI devices and screw up our write.
+				wait_not_busy();
+			} else {
+				// Card goes on programming with chip select released and still
+				// listens to the bus: the other SPI devices must wait for
+				// WaitReady() or Poll() before they are used.
+				busy_ = true;
+			}
 			return true;
 		} else {
 			delay_ms(1);
@@ -664,7 +935,7 @@ Blockdevice_SDMMC::Write(
 	const unsigned int	max_retries = 3;
 	for (unsigned int retry=0; retry<max_retries; ++retry) {
 		wait_not_busy();
-		sendCommand(CMD24,(block256>>16)&0xFF,(block256>>8)&0xFF,block256&0xFF,0,0xFF);
+		sendCommand(CMD24,(address>>24)&0xFF,(address>>16)&0xFF,(address>>8)&0xFF,address&0xFF,0xFF);
 		if (cardResponse(0x00)) {
 			const char*	buf = reinterpret_cast<const char*>(block);
 
@@ -707,4 +978,134 @@ Blockdevice_SDMMC::Write(
 	return false;
 }
 
+//*******************************************************************
+uint32_t
+Blockdevice_SDMMC::Address(
+	const unsigned int	nr
+) const
+{
+	return block_addressing_ ? nr : nr * BLOCK_SIZE;
+}
+
+//*******************************************************************
+bool
+Blockdevice_SDMMC::ReadBlocks(
+	const unsigned int	first,
+	const unsigned int	count,
+	void*				buffer
+)
+{
+	if (count == 1) {
+		return Read(first, buffer);
+	}
+
+	filesystem_dprintf(("Blockdevice_SDMMC::ReadBlocks 0x%04X, %d blocks\n", first, count));
+	if (!initialized_) {
+		throw Error("MemCard Missing.");
+	}
+
+	const uint32_t	address = Address(first);
+	char*			buf = reinterpret_cast<char*>(buffer);
+
+	SpiAutoselect	sa;
+	wait_not_busy();
+	busy_ = false;
+
+	const uint8_t	r1 = sd_mmc_command(MMC_READ_MULTIPLE_BLOCK, address);
+	if (r1 != 0x00) {
+		throw Error("MemCard Read Fail 2, r1=0x%02X, block %04X.", r1, first);
+	}
+
+	for (unsigned int nr=0; nr<count; ++nr) {
+		unsigned char	real_response = 0xFF;
+		if (!cardResponse(MMC_STARTBLOCK_READ, real_response)) {
+			sd_mmc_command(MMC_STOP_TRANSMISSION, 0);
+			wait_not_busy();
+			throw Error("MemCard Read Fail, 0x%02X, block %04X.", real_response, first + nr);
+		}
+		for (unsigned int i=0; i<BLOCK_SIZE; ++i) {
+			buf[i] = send_and_read(0xff);
+		}
+		send_and_read(0xff);		// CRC (not used).
+		send_and_read(0xff);
+		buf += BLOCK_SIZE;
+	}
+
+	// Stop the transmission. The response is preceded by a stuff byte and
+	// followed by busy; wait_not_busy() skips over all of them.
+	sd_mmc_command(MMC_STOP_TRANSMISSION, 0);
+	wait_not_busy();
+	send_and_read(0xff);
+
+	return true;
+}
+
+//*******************************************************************
+bool
+Blockdevice_SDMMC::WriteBlocks(
+	const unsigned int	first,
+	const unsigned int	count,
+	const void*			buffer
+)
+{
+	if (count == 1) {
+		return Write(first, buffer);
+	}
+
+	filesystem_dprintf(("Blockdevice_SDMMC::WriteBlocks 0x%04X, %d blocks\n", first, count));
+	if (!initialized_) {
+		throw Error("MemCard Missing.");
+	}
+
+	const uint32_t	address = Address(first);
+	const char*		buf = reinterpret_cast<const char*>(buffer);
+
+	SpiAutoselect	sa;
+	wait_not_busy();
+	busy_ = false;
+
+	if (card_type_ == SD_CARD) {
+		// Let the card erase all the blocks at once; the write may end before.
+		sd_mmc_command(SD_APP_CMD55, 0);
+		send_and_read(0xFF);            // write dummy byte
+		sd_mmc_command(SD_SET_WR_BLK_ERASE_COUNT_ACMD, count);
+		send_and_read(0xFF);            // write dummy byte
+	}
+
+	const uint8_t	r1 = sd_mmc_command(MMC_WRITE_MULTIPLE_BLOCK, address);
+	if (r1 != 0x00) {
+		throw Error("MemCard Not Responding, r1=0x%02X, block %04X.", r1, first);
+	}
+	send_and_read(0xFF);		// give clock again to end transaction
+
+	for (unsigned int nr=0; nr<count; ++nr) {
+		// send data start token
+		send_and_read(MMC_STARTBLOCK_MWRITE);
+		for (unsigned int i=0; i<BLOCK_SIZE; ++i) {
+			send_and_read(buf[i]);
+		}
+		send_and_read(0xFF);		// send CRC (field required but value ignored)
+		send_and_read(0xFF);
+
+		// read data response token
+		const uint8_t	dr = send_and_read(0xFF);
+		if ((dr&MMC_DR_MASK) != MMC_DR_ACCEPT) {
+			send_and_read(MMC_STOPTRAN_WRITE);
+			send_and_read(0xFF);
+			wait_not_busy();
+			throw Error("MemCard Invalid Response 0x%02X, block %04X.", dr, first + nr);
+		}
+		// Card programs the block; next token may be sent when it is ready.
+		wait_not_busy();
+		buf += BLOCK_SIZE;
+	}
+
+	// Stop token, then one byte before busy is signalled.
+	send_and_read(MMC_STOPTRAN_WRITE);
+	send_and_read(0xFF);
+	wait_not_busy();
+
+	return true;
+}
+
 } // namespace Filesystem
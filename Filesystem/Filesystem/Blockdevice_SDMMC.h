@@ -14,18 +14,50 @@ functions/macros:
 - FILESYSTEM_SDMMC_SPI_UNSELECT()
 - FILESYSTEM_SDMMC_SPI_READ(uint16_t*)
 - FILESYSTEM_SDMMC_SPI_WRITE(uint16_t)
+
+After BeginWrite() the card programs the block with chip select released, but it
+still listens to the SPI bus and takes the traffic for other devices as commands,
+which screws up the write. Other devices on the bus must not be used before
+WaitReady(), or Poll(), reports that the card is done. Any other operation of the
+card waits until it is ready.
+
+SDHC cards are initialized with CMD8 and ACMD41 with the HCS bit, and addressed
+by block number instead of byte address.
+
+The erase unit is the allocation unit from the SD status, or the erase sector
+from the CSD when the card does not report one. Multiple block writes tell SD
+cards the number of blocks with ACMD23, so that they can erase them at once.
 */
 
 class Blockdevice_SDMMC : public Blockdevice {
 public:
-	/** Construct the block device and initialize SD/MMC card.
+	/** Construct the block device and initialize SD/MMC card, unless \c initialize is false.
 	SPI has to be initialized beforehand.
 
 	Throws errors on exceptions.
 	*/
-	Blockdevice_SDMMC();
+	explicit
+	Blockdevice_SDMMC(
+		const bool	initialize = true
+	);
 	virtual ~Blockdevice_SDMMC();
 
+	/** Reset and initialize the card, e.g. after it has been replaced.
+	Throws errors on exceptions.
+	*/
+	void
+	Initialize();
+
+	/** Ask the card for its status with CMD13 (SEND_STATUS).
+
+	Returns false when the card does not answer, i.e. it has been removed or
+	replaced by a card that is not initialized. Reads and writes then throw
+	until Initialize() succeeds, so that blocks meant for the old card never
+	reach a new one.
+	*/
+	bool
+	IsPresent();
+
 	virtual bool
 	Read(
 		const unsigned int	nr,
@@ -37,9 +69,80 @@ public:
 		const unsigned int	nr,
 		const void*			block
 	);
+
+	/** Read consecutive blocks with one CMD18 (READ_MULTIPLE_BLOCK). */
+	virtual bool
+	ReadBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		void*				buffer
+	);
+
+	/** Write consecutive blocks with one CMD25 (WRITE_MULTIPLE_BLOCK). */
+	virtual bool
+	WriteBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		const void*			buffer
+	);
+
+	/** Send the block with CMD24 (WRITE_BLOCK) and return once the card has accepted it,
+	while it is still busy programming.
+	*/
+	virtual bool
+	BeginWrite(
+		const unsigned int	nr,
+		const void*			block
+	);
+
+	virtual bool
+	IsBusy();
+
+	/** Read one byte from the card, which holds the data line low while it is busy. */
+	virtual bool
+	Poll();
+
+	/** Wait until the card has programmed the block of BeginWrite(), so that other
+	devices may use the SPI bus. Returns false when the card stays busy.
+	*/
+	bool
+	WaitReady();
+
+	/** Erase unit found at initialization, blocks. */
+	virtual unsigned int
+	EraseUnitSize();
+
+	/** Erase with CMD32, CMD33 and CMD38 (ERASE), waiting until done. SD cards only. */
+	virtual bool
+	Erase(
+		const unsigned int	first,
+		const unsigned int	count
+	);
 private:
+	/** Write one block with CMD24, waiting for the card to program it when \c wait is set. */
+	bool
+	WriteBlock(
+		const unsigned int	nr,
+		const void*			block,
+		const bool			wait
+	);
+
+	/** Command argument addressing block \c nr. */
+	uint32_t
+	Address(
+		const unsigned int	nr
+	) const;
+
 	// Is our card either SD_CARD or MMC_CARD?
 	uint8_t		card_type_;
+	// Is the card addressed by block number (SDHC) instead of byte address?
+	bool		block_addressing_;
+	// Is the card programming a block started with BeginWrite()?
+	bool		busy_;
+	// Has the card been initialized, and answered since?
+	bool		initialized_;
+	// Erase unit, blocks.
+	unsigned int	erase_unit_;
 }; // class Blockdevice_SDMMC
 
 } // namespace Filesystem
@@ -0,0 +1,315 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include <Filesystem/Blockdevice_SimSD.h>
+
+#include <Filesystem_Config.h>
+
+
+namespace Filesystem {
+
+//*******************************************************************
+Blockdevice_SimSD::Timing
+Blockdevice_SimSD::DefaultTiming()
+{
+	Timing	t;
+	t.SpiClock = 12000000;
+	t.CommandTime = 20;
+	t.ReadLatency = 250;
+	t.ProgramTimeMin = 500;
+	t.ProgramTimeMax = 2000;
+	t.StreamProgramTime = 250;
+	t.EraseBlockSize = 256;
+	t.EraseBlockPenalty = 2000;
+	t.GcInterval = 4096;
+	t.GcStall = 100000;
+	t.EraseTime = 1000;
+	return t;
+}
+
+//*******************************************************************
+Blockdevice_SimSD::Blockdevice_SimSD(
+	Blockdevice&	device,
+	const Timing&	timing
+)
+:	device_(device)
+	,timing_(timing)
+	,byte_time_(8 * 1e6 / timing.SpiClock)
+	,erase_block_(0xFFFFFFFF)
+	,seed_(1)
+	,erased_next_(0)
+{
+	for (unsigned int i=0; i<MAX_ERASED; ++i) {
+		erased_first_[i] = 0;
+		erased_end_[i] = 0;
+	}
+	ResetStatistics();
+}
+
+//*******************************************************************
+Blockdevice_SimSD::~Blockdevice_SimSD()
+{
+	filesystem_dprintf(("Blockdevice_SimSD: %.1f ms simulated, %.1f ms waiting, %d commands, %d stalls\n",
+		now_ / 1000, wait_time_ / 1000, command_count_, gc_count_));
+}
+
+//*******************************************************************
+bool
+Blockdevice_SimSD::Read(
+	const unsigned int	nr,
+	void*				block
+)
+{
+	StartCommand();
+	now_ += timing_.ReadLatency;
+	Transfer(1 + BLOCK_SIZE + 2);		// start token, data, CRC
+	return device_.Read(nr, block);
+}
+
+//*******************************************************************
+bool
+Blockdevice_SimSD::Write(
+	const unsigned int	nr,
+	const void*			block
+)
+{
+	const bool	ok = BeginWrite(nr, block);
+	WaitNotBusy();
+	return ok;
+}
+
+//*******************************************************************
+bool
+Blockdevice_SimSD::ReadBlocks(
+	const unsigned int	first,
+	const unsigned int	count,
+	void*				buffer
+)
+{
+	StartCommand();
+	for (unsigned int i=0; i<count; ++i) {
+		now_ += timing_.ReadLatency;
+		Transfer(1 + BLOCK_SIZE + 2);
+	}
+	Transfer(8);						// stop command
+	return device_.ReadBlocks(first, count, buffer);
+}
+
+//*******************************************************************
+bool
+Blockdevice_SimSD::WriteBlocks(
+	const unsigned int	first,
+	const unsigned int	count,
+	const void*			buffer
+)
+{
+	StartCommand();
+	for (unsigned int i=0; i<count; ++i) {
+		// Card is busy between blocks, the driver waits for it.
+		WaitNotBusy();
+		Transfer(1 + BLOCK_SIZE + 2 + 1);	// token, data, CRC, data response
+		busy_until_ = now_ + ProgramTime(first + i, true);
+	}
+	Transfer(2);						// stop token
+	WaitNotBusy();
+	return device_.WriteBlocks(first, count, buffer);
+}
+
+//*******************************************************************
+bool
+Blockdevice_SimSD::BeginWrite(
+	const unsigned int	nr,
+	const void*			block
+)
+{
+	StartCommand();
+	Transfer(1 + BLOCK_SIZE + 2 + 1);		// token, data, CRC, data response
+	busy_until_ = now_ + ProgramTime(nr, false);
+	return device_.Write(nr, block);
+}
+
+//*******************************************************************
+bool
+Blockdevice_SimSD::IsBusy()
+{
+	return now_ < busy_until_;
+}
+
+//*******************************************************************
+bool
+Blockdevice_SimSD::Poll()
+{
+	if (now_ < busy_until_) {
+		Transfer(1);
+	}
+	return now_ < busy_until_;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_SimSD::EraseUnitSize()
+{
+	return timing_.EraseBlockSize;
+}
+
+//*******************************************************************
+bool
+Blockdevice_SimSD::Erase(
+	const unsigned int	first,
+	const unsigned int	count
+)
+{
+	// Start, end and erase commands; the card is busy until done.
+	StartCommand();
+	StartCommand();
+	StartCommand();
+	const unsigned int	erase_blocks = (first + count + timing_.EraseBlockSize - 1) / timing_.EraseBlockSize
+										- first / timing_.EraseBlockSize;
+	busy_until_ = now_ + erase_blocks * static_cast<double>(timing_.EraseTime);
+	WaitNotBusy();
+
+	erased_first_[erased_next_] = first;
+	erased_end_[erased_next_] = first + count;
+	erased_next_ = (erased_next_ + 1) % MAX_ERASED;
+	return device_.Erase(first, count);
+}
+
+//*******************************************************************
+void
+Blockdevice_SimSD::Elapse(
+	const double	us
+)
+{
+	now_ += us;
+}
+
+//*******************************************************************
+double
+Blockdevice_SimSD::Now() const
+{
+	return now_;
+}
+
+//*******************************************************************
+double
+Blockdevice_SimSD::WaitTime() const
+{
+	return wait_time_;
+}
+
+//*******************************************************************
+double
+Blockdevice_SimSD::MaxWaitTime() const
+{
+	return max_wait_time_;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_SimSD::CommandCount() const
+{
+	return command_count_;
+}
+
+//*******************************************************************
+unsigned int
+Blockdevice_SimSD::GcCount() const
+{
+	return gc_count_;
+}
+
+//*******************************************************************
+void
+Blockdevice_SimSD::ResetStatistics()
+{
+	now_ = 0;
+	busy_until_ = 0;
+	wait_time_ = 0;
+	max_wait_time_ = 0;
+	command_count_ = 0;
+	gc_count_ = 0;
+}
+
+//*******************************************************************
+void
+Blockdevice_SimSD::StartCommand()
+{
+	WaitNotBusy();
+	++command_count_;
+	now_ += timing_.CommandTime;
+	Transfer(8);						// command and response
+}
+
+//*******************************************************************
+void
+Blockdevice_SimSD::WaitNotBusy()
+{
+	if (busy_until_ > now_) {
+		const double	wait = busy_until_ - now_;
+		wait_time_ += wait;
+		if (wait > max_wait_time_) {
+			max_wait_time_ = wait;
+		}
+		now_ = busy_until_;
+	}
+}
+
+//*******************************************************************
+void
+Blockdevice_SimSD::Transfer(
+	const unsigned int	bytes
+)
+{
+	now_ += bytes * byte_time_;
+}
+
+//*******************************************************************
+double
+Blockdevice_SimSD::ProgramTime(
+	const unsigned int	nr,
+	const bool			streaming
+)
+{
+	double	t = streaming
+		? timing_.StreamProgramTime
+		: timing_.ProgramTimeMin + Random() * (timing_.ProgramTimeMax - timing_.ProgramTimeMin);
+
+	// Card closes the open erase block before programming another one.
+	const unsigned int	erase_block = nr / timing_.EraseBlockSize;
+	const bool			erased = IsErased(nr);
+	if (erase_block != erase_block_ && !erased) {
+		t += timing_.EraseBlockPenalty;
+	}
+	erase_block_ = erase_block;
+
+	if (!erased && timing_.GcInterval > 0 && Random() * timing_.GcInterval < 1) {
+		t += timing_.GcStall;
+		++gc_count_;
+	}
+	return t;
+}
+
+//*******************************************************************
+bool
+Blockdevice_SimSD::IsErased(
+	const unsigned int	nr
+) const
+{
+	for (unsigned int i=0; i<MAX_ERASED; ++i) {
+		if (nr>=erased_first_[i] && nr<erased_end_[i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//*******************************************************************
+double
+Blockdevice_SimSD::Random()
+{
+	seed_ = seed_ * 1664525 + 1013904223;
+	return (seed_ >> 8) / 16777216.0;
+}
+
+} // namespace Filesystem
@@ -0,0 +1,203 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef Filesystem_Blockdevice_SimSD_h_
+#define Filesystem_Blockdevice_SimSD_h_
+
+
+/** \file Block device decorator simulating SD card timing. */
+
+#include <Filesystem/Blockdevice.h>
+
+namespace Filesystem {
+
+/** Passes blocks to another block device and keeps a simulated clock of how
+long an SD card in SPI mode would have taken.
+
+The model charges per-command overhead, SPI transfer time of every byte,
+random programming busy time after writes, a penalty when writes move to
+another erase block, and occasional long garbage collection stalls.
+Random numbers come from a fixed seed, so runs are repeatable.
+
+Blocks erased with Erase() are programmed without the erase block penalty
+and without garbage collection, like the card writes into an erased
+allocation unit. The last few erased ranges are remembered.
+
+Writes started with BeginWrite() leave the card busy while the caller goes on;
+Elapse() accounts for the time the caller spends meanwhile. Any other command
+waits for the card first, and the waiting time is counted by WaitTime().
+*/
+class Blockdevice_SimSD : public Blockdevice {
+public:
+	/** Card and bus timing, microseconds unless noted otherwise. */
+	typedef struct {
+		/** SPI clock, Hz. */
+		unsigned int	SpiClock;
+		/** Command, response and chip select overhead per command. */
+		unsigned int	CommandTime;
+		/** From read command to the data start token, per block. */
+		unsigned int	ReadLatency;
+		/** Busy time after a single block write, uniformly distributed. */
+		unsigned int	ProgramTimeMin;
+		unsigned int	ProgramTimeMax;
+		/** Busy time per block within a multiple block write. */
+		unsigned int	StreamProgramTime;
+		/** Erase block size, blocks. */
+		unsigned int	EraseBlockSize;
+		/** Extra busy time when a write goes to another erase block than the previous one. */
+		unsigned int	EraseBlockPenalty;
+		/** Mean number of written blocks between garbage collection stalls, 0 for none. */
+		unsigned int	GcInterval;
+		/** Garbage collection stall. */
+		unsigned int	GcStall;
+		/** Busy time of an erase command, per erase block. */
+		unsigned int	EraseTime;
+	} Timing;
+
+	/** Timing of a typical class 4 card at 12 MHz SPI clock. */
+	static Timing
+	DefaultTiming();
+
+	Blockdevice_SimSD(
+		Blockdevice&	device,
+		const Timing&	timing = DefaultTiming()
+	);
+	virtual ~Blockdevice_SimSD();
+
+	virtual bool
+	Read(
+		const unsigned int	nr,
+		void*				block
+	);
+
+	virtual bool
+	Write(
+		const unsigned int	nr,
+		const void*			block
+	);
+
+	virtual bool
+	ReadBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		void*				buffer
+	);
+
+	virtual bool
+	WriteBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		const void*			buffer
+	);
+
+	virtual bool
+	BeginWrite(
+		const unsigned int	nr,
+		const void*			block
+	);
+
+	virtual bool
+	IsBusy();
+
+	/** Costs one byte transfer. */
+	virtual bool
+	Poll();
+
+	/** Erase block size of the timing. */
+	virtual unsigned int
+	EraseUnitSize();
+
+	/** Charges the erase commands and the erase time, and remembers the range as erased. */
+	virtual bool
+	Erase(
+		const unsigned int	first,
+		const unsigned int	count
+	);
+
+	/** Advance the clock by time the caller spends on other work. */
+	void
+	Elapse(
+		const double	us
+	);
+
+	/** Simulated time since construction, microseconds. */
+	double
+	Now() const;
+
+	/** Time spent waiting for the busy card, microseconds. */
+	double
+	WaitTime() const;
+
+	/** Longest single wait for the busy card, microseconds. */
+	double
+	MaxWaitTime() const;
+
+	/** Number of commands so far, multi-block transfers count as one. */
+	unsigned int
+	CommandCount() const;
+
+	/** Number of garbage collection stalls so far. */
+	unsigned int
+	GcCount() const;
+
+	/** Reset clock and statistics, e.g. after setting up the benchmark. */
+	void
+	ResetStatistics();
+private:
+	/** Charge a command and wait for the card to be ready for it. */
+	void
+	StartCommand();
+
+	/** Advance the clock to the end of the busy time, counting it as waiting. */
+	void
+	WaitNotBusy();
+
+	/** Charge the SPI transfer of \c bytes bytes. */
+	void
+	Transfer(
+		const unsigned int	bytes
+	);
+
+	/** Busy time after writing block \c nr, with erase block and garbage collection penalties. */
+	double
+	ProgramTime(
+		const unsigned int	nr,
+		const bool			streaming
+	);
+
+	/** Is block \c nr in one of the erased ranges? */
+	bool
+	IsErased(
+		const unsigned int	nr
+	) const;
+
+	/** Pseudo random number in [0, 1). */
+	double
+	Random();
+
+	Blockdevice&	device_;
+	Timing			timing_;
+	double			byte_time_;
+	double			now_;
+	double			busy_until_;
+	double			wait_time_;
+	double			max_wait_time_;
+	unsigned int	command_count_;
+	unsigned int	gc_count_;
+	unsigned int	erase_block_;
+	unsigned int	seed_;
+
+	enum {
+		/** Number of erased ranges remembered. */
+		MAX_ERASED = 4
+	};
+	/** Erased ranges [first, end), the oldest is replaced. */
+	unsigned int	erased_first_[MAX_ERASED];
+	unsigned int	erased_end_[MAX_ERASED];
+	unsigned int	erased_next_;
+}; // class Blockdevice_SimSD
+
+} // namespace Filesystem
+
+#endif /* Filesystem_Blockdevice_SimSD_h_ */
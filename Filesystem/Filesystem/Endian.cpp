@@ -4,34 +4,45 @@ vim: shiftwidth=4
 */
 #include <Filesystem/Endian.h>
 
-#if !defined(_MSC_VER)
-
 namespace Filesystem {
 
+// The swapping kernels are built on every host, so that the benchmark can
+// measure them on little-endian machines too.
+
 //*******************************************************************
-/** Swap LSB/MSB if on the big-endian machine. */
-void FixEndian16(	uint16_t&	x)
+/** Two 16-bit words per 32-bit access when the words are 32-bit aligned. */
+void
+EndianTraits<false>::Fix16(
+	uint16_t*			words,
+	const unsigned int	count
+)
 {
-	uint8_t*	ptr = reinterpret_cast<uint8_t*>(&x);
-	const uint8_t	tmp = ptr[0];
-	ptr[0] = ptr[1];
-	ptr[1] = tmp;
+	unsigned int	i = 0;
+	if ((reinterpret_cast<uintptr_t>(words) & 3) == 0) {
+		// Chunks of fixed length, unrolled or vectorized by the compiler.
+		for (; i+16<=count; i+=16) {
+			uint32_t*	pairs = reinterpret_cast<uint32_t*>(words + i);
+			for (unsigned int j=0; j<8; ++j) {
+				const uint32_t	x = pairs[j];
+				pairs[j] = ((x >> 8) & 0x00ff00ff) | ((x << 8) & 0xff00ff00);
+			}
+		}
+	}
+	for (; i<count; ++i) {
+		Fix16(words[i]);
+	}
 }
 
 //*******************************************************************
-/** Swap LSB/MSB if on the big-endian machine. */
-void FixEndian32(	uint32_t&	x)
+void
+EndianTraits<false>::Fix32(
+	uint32_t*			words,
+	const unsigned int	count
+)
 {
-	uint8_t*	ptr = reinterpret_cast<uint8_t*>(&x);
-	const uint8_t	tmp0 = ptr[0];
-	const uint8_t	tmp1 = ptr[1];
-	ptr[0] = ptr[3];
-	ptr[1] = ptr[2];
-	ptr[2] = tmp1;
-	ptr[3] = tmp0;
+	for (unsigned int i=0; i<count; ++i) {
+		Fix32(words[i]);
+	}
 }
 
 } // namespace Filesystem
-
-#endif
-
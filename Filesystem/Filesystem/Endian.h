@@ -7,17 +7,118 @@ vim: shiftwidth=4
 
 #include <stdint.h>
 
+/** Defined when the host byte order is the little-endian byte order of FAT. */
+#if defined(_MSC_VER) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#	define	FILESYSTEM_LITTLE_ENDIAN
+#endif
+
 namespace Filesystem {
 
-#if defined(_MSC_VER)
-#	define	FixEndian16(x)	do { } while (0)
-#	define	FixEndian32(x)	do { } while (0)
+/** Conversion between the host byte order and the little-endian byte order
+of the disk. Each conversion is its own inverse.
+\param	LittleEndianHost	true when the host is little-endian, nothing to do then.
+*/
+template <bool LittleEndianHost>
+struct EndianTraits;
+
+/** Big-endian host, the bytes are swapped. */
+template <>
+struct EndianTraits<false> {
+	/** true when conversions change anything. */
+	enum { SWAP = 1 };
+
+	/** Swap the bytes of \c x. */
+	static inline void
+	Fix16(
+		uint16_t&	x
+	)
+	{
+		x = static_cast<uint16_t>((x >> 8) | (x << 8));
+	}
+
+	/** Swap the bytes of \c x. */
+	static inline void
+	Fix32(
+		uint32_t&	x
+	)
+	{
+		x = (x >> 24) | ((x >> 8) & 0x0000ff00) | ((x << 8) & 0x00ff0000) | (x << 24);
+	}
+
+	/** Swap the bytes of \c count 16-bit words, e.g. a block of FAT entries. */
+	static void
+	Fix16(
+		uint16_t*			words,
+		const unsigned int	count
+	);
+
+	/** Swap the bytes of \c count 32-bit words. */
+	static void
+	Fix32(
+		uint32_t*			words,
+		const unsigned int	count
+	);
+};
+
+/** Little-endian host, all conversions compile to nothing. */
+template <>
+struct EndianTraits<true> {
+	enum { SWAP = 0 };
+
+	static inline void
+	Fix16(
+		uint16_t&
+	)
+	{
+	}
+
+	static inline void
+	Fix32(
+		uint32_t&
+	)
+	{
+	}
+
+	static inline void
+	Fix16(
+		uint16_t*,
+		const unsigned int
+	)
+	{
+	}
+
+	static inline void
+	Fix32(
+		uint32_t*,
+		const unsigned int
+	)
+	{
+	}
+};
+
+#if defined(FILESYSTEM_LITTLE_ENDIAN)
+typedef EndianTraits<true>	HostEndian;
 #else
+typedef EndianTraits<false>	HostEndian;
+#endif
+
 /** Swap LSB/MSB if on the big-endian machine. */
-void FixEndian16(	uint16_t&	x);
+inline void
+FixEndian16(
+	uint16_t&	x
+)
+{
+	HostEndian::Fix16(x);
+}
+
 /** Swap LSB/MSB if on the big-endian machine. */
-void FixEndian32(	uint32_t&	x);
-#endif
+inline void
+FixEndian32(
+	uint32_t&	x
+)
+{
+	HostEndian::Fix32(x);
+}
 
 } // namespace Filesystem
 
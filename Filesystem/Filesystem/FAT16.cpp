@@ -2,8 +2,10 @@
 vim: ts=4
 vim: shiftwidth=4
 */
+#include <algorithm>				// std::min
 #include <string.h>				// memset, strncmp
 #include <ctype.h>				// toupper.
+#include <exception>
 #include <Filesystem/FAT16.h>
 #include <Filesystem/Error.h>
 #include <Filesystem/Endian.h>
@@ -29,9 +31,27 @@ typedef enum {
 	/** Last cluster in file. */
 	CLUSTER_LAST_MIN		= 0xFFF8,
 	/** Last cluster in file. */
-	CLUSTER_LAST_MAX		= 0xFFFF
+	CLUSTER_LAST_MAX		= 0xFFFF,
+	/** FAT32 entries are 28 bits, the top 4 bits are reserved. */
+	CLUSTER32_MASK			= 0x0FFFFFFF,
+	/** Bad, FAT32. */
+	CLUSTER32_BAD			= 0x0FFFFFF7,
+	/** Last cluster in file, FAT32. */
+	CLUSTER32_LAST_MAX		= 0x0FFFFFFF
 } CLUSTER;
 
+/** FSInfo block of FAT32. */
+enum {
+	FSINFO_LEAD_SIGNATURE		= 0x41615252,
+	FSINFO_STRUCT_SIGNATURE		= 0x61417272,
+	FSINFO_LEAD_OFFSET			= 0,
+	FSINFO_STRUCT_OFFSET		= 484,
+	FSINFO_FREE_COUNT_OFFSET	= 488,
+	FSINFO_NEXT_FREE_OFFSET		= 492,
+	/** Free count or next free cluster is not known. */
+	FSINFO_UNKNOWN				= 0xFFFFFFFF
+};
+
 /** File attributes, bit-or. */
 typedef enum {
 	ATTRIB_VOLUME		= 0x01,
@@ -77,23 +97,47 @@ uint32_of_byte4(
 	return r;
 }
 
+//*******************************************************************
+static inline void
+byte4_of_uint32(
+	unsigned char*	ptr,
+	const uint32_t	value
+)
+{
+	ptr[0] = value & 0xFF;
+	ptr[1] = (value >> 8) & 0xFF;
+	ptr[2] = (value >> 16) & 0xFF;
+	ptr[3] = (value >> 24) & 0xFF;
+}
+
 //*******************************************************************
 static bool
-IsFilesystemFat16(
+IsFilesystemFat32(
+	const unsigned char*	Buffer
+)
+{
+	return strncmp((const char*)(Buffer+82), "FAT32", 5)==0;
+}
+
+//*******************************************************************
+static bool
+IsFilesystemFat(
 	Blockdevice&		Device,
 	const unsigned int	PartitionStartBlock,
 	unsigned char*		Buffer
 )
 {
 	if (Device.Read(PartitionStartBlock, Buffer)) {
-		return strncmp((const char*)(Buffer+54), "FAT16", 5)==0;
+		return strncmp((const char*)(Buffer+54), "FAT16", 5)==0 || IsFilesystemFat32(Buffer);
 	}
 	return false;
 }
 
 //*******************************************************************
 FAT16::FAT16(
-	Blockdevice&	device
+	Blockdevice&	device,
+	uint8_t*		free_bitmap,
+	Blockcache*		cache
 )
 :	Device_(device)
 	,PartitionStartBlock_(0)
@@ -106,23 +150,36 @@ FAT16::FAT16(
 	,NrOfBlocksInRootDir_(-1)
 	,LastEmptyBlock_(-1)
 	,FreeClusterSearchStart_(CLUSTER_USED_MIN)
-	,DirectoryEntries_(device, FixFat16DirectoryEntryEndian)
-	,FatEntries_(device,
-#if defined(_MSC_VER)
-				NULL
-#else
-				FixEndian16
-#endif
-	)
+	,NrOfClusters_(0)
+	,Fat32_(false)
+	,EndOfChain_(CLUSTER_LAST_MAX)
+	,RootCluster_(0)
+	,RootDirCluster_(0)
+	,RootDirClusterIndex_(0)
+	,FsInfoBlock_(0)
+	,FreeCount_(FSINFO_UNKNOWN)
+	,FsInfoDirty_(false)
+	,FreeBitmap_(free_bitmap)
+	,GroupCommit_(false)
+	,PreErase_(false)
+	,EraseUnitClusters_(1)
+	,MirrorFirst_(-1)
+	,MirrorEnd_(0)
+	,OwnCache_(device, OwnCacheMemory_, sizeof(OwnCacheMemory_))
+	,Cache_(cache != 0 ? *cache : OwnCache_)
+	// No conversion at all on little-endian hosts, the cache skips NULL.
+	,DirectoryEntries_(Cache_, HostEndian::SWAP ? FixDirectoryBlockEndian : NULL)
+	,FatEntries_(Cache_, HostEndian::SWAP ? FixFatBlockEndian : NULL)
+	,Fat32Entries_(Cache_, HostEndian::SWAP ? FixFat32BlockEndian : NULL)
 {
 	unsigned char	first_block[Blockdevice::BLOCK_SIZE];
 
 	// 1. Find partition start block.
-	if (!IsFilesystemFat16(Device_, PartitionStartBlock_, first_block)) {
+	if (!IsFilesystemFat(Device_, PartitionStartBlock_, first_block)) {
 		const unsigned int	offset = uint32_of_byte4(&first_block[454]);
 		filesystem_dprintf(("FAT16: checking partition start at block %d\n", offset));
-		if (!IsFilesystemFat16(Device_, offset, first_block)) {
-			throw Error("No FAT16 detected on the given block device.");
+		if (!IsFilesystemFat(Device_, offset, first_block)) {
+			throw Error("No FAT16 or FAT32 detected on the given block device.");
 		}
 		PartitionStartBlock_ = offset;
 	}
@@ -131,27 +188,54 @@ FAT16::FAT16(
 	// 2. Load filesystem parameters.
 	const unsigned int	maxRootEntry = uint16_of_byte2(first_block+17);
 
+	Fat32_				= IsFilesystemFat32(first_block);
+	EndOfChain_			= Fat32_ ? CLUSTER32_LAST_MAX : CLUSTER_LAST_MAX;
 	BlocksPerCluster_	= first_block[13];
 	FatBlock_			= uint16_of_byte2(first_block+14);
 	NrOfFATs_			= first_block[16];
 	BlocksPerFat_		= uint16_of_byte2(first_block+22);
+	if (BlocksPerFat_ == 0) {
+		BlocksPerFat_	= uint32_of_byte4(first_block+36);
+	}
 	RootDirBlock_		= FatBlock_ + BlocksPerFat_ * NrOfFATs_;
 	NrOfBlocksInRootDir_= ( maxRootEntry / Blockdevice::BLOCK_SIZE ) * 32;
 	DataStartBlock_		= RootDirBlock_ + NrOfBlocksInRootDir_;
+	{
+		const unsigned int	total_blocks16 = uint16_of_byte2(first_block+19);
+		const unsigned int	total_blocks = total_blocks16!=0 ? total_blocks16 : uint32_of_byte4(first_block+32);
+		const unsigned int	max_clusters = BlocksPerFat_ * FatEntriesPerBlock() - CLUSTER_USED_MIN;
+		const unsigned int	max_cluster_nr = (Fat32_ ? CLUSTER32_BAD : CLUSTER_BAD) - CLUSTER_USED_MIN;
+		NrOfClusters_		= (total_blocks - DataStartBlock_) / BlocksPerCluster_;
+		if (NrOfClusters_ > max_clusters) {
+			NrOfClusters_ = max_clusters;
+		}
+		if (NrOfClusters_ > max_cluster_nr) {
+			NrOfClusters_ = max_cluster_nr;
+		}
+	}
 
-	DirectoryEntries_.SetOptions(
-		PartitionStartBlock_ + RootDirBlock_,
-		PartitionStartBlock_ + RootDirBlock_ + NrOfBlocksInRootDir_
-	);
-
-	FatEntries_.SetOptions(
-		PartitionStartBlock_ + FatBlock_,
-		PartitionStartBlock_ + FatBlock_ + BlocksPerFat_,
-		BlocksPerFat_
-	);
+	if (Fat32_) {
+		// Root directory is a cluster chain in the data area.
+		RootCluster_		= uint32_of_byte4(first_block+44);
+		RootDirCluster_		= RootCluster_;
+		FsInfoBlock_		= uint16_of_byte2(first_block+48);
+		if (!IsDataCluster(RootCluster_)) {
+			throw Error("FAT16: root directory cluster %d is out of range.", RootCluster_);
+		}
+		DirectoryEntries_.SetOptions(
+			PartitionStartBlock_ + DataStartBlock_,
+			PartitionStartBlock_ + DataStartBlock_ + NrOfClusters_ * BlocksPerCluster_
+		);
+	} else {
+		DirectoryEntries_.SetOptions(
+			PartitionStartBlock_ + RootDirBlock_,
+			PartitionStartBlock_ + RootDirBlock_ + NrOfBlocksInRootDir_
+		);
+	}
+	SetFatOptions(true);
 
-	filesystem_dprintf(("FAT16: BlocksPerCluster_=%d, maxRootEntry=%d, BlocksPerFat_=%ld\n",
-			BlocksPerCluster_, FatBlock_, maxRootEntry, BlocksPerFat_));
+	filesystem_dprintf(("FAT16: %s, BlocksPerCluster_=%d, maxRootEntry=%d, BlocksPerFat_=%ld\n",
+			Fat32_ ? "FAT32" : "FAT16", BlocksPerCluster_, maxRootEntry, BlocksPerFat_));
 	filesystem_dprintf(("FAT16: RootDirBLock_=0x%04X, FatBlock_=0x%04X, DataStartBlock_=0x%04X\n",
 			PartitionStartBlock_+RootDirBlock_,
 			PartitionStartBlock_+FatBlock_, 
@@ -161,6 +245,95 @@ FAT16::FAT16(
 	for (unsigned int i=0; i<ARRAYSIZE(Files_); ++i) {
 		memset(&Files_[i], 0, sizeof(Files_[i]));
 	}
+
+	// 4. Next free cluster hint.
+	if (Fat32_ && FsInfoBlock_ != 0) {
+		LoadFsInfo();
+	}
+
+	// 5. Free cluster bitmap, if any.
+	if (FreeBitmap_ != 0 && NrOfClusters_ + CLUSTER_USED_MIN > MAX_CLUSTERS) {
+		filesystem_dprintf(("FAT16: %d clusters do not fit in the free cluster bitmap\n", NrOfClusters_));
+		FreeBitmap_ = 0;
+	}
+	if (FreeBitmap_ != 0) {
+		LoadFreeBitmap();
+	}
+}
+
+//*******************************************************************
+unsigned int
+FAT16::BlocksPerCluster() const
+{
+	return BlocksPerCluster_;
+}
+
+//*******************************************************************
+bool
+FAT16::IsFat32() const
+{
+	return Fat32_;
+}
+
+//*******************************************************************
+const Blockcache&
+FAT16::Cache() const
+{
+	return Cache_;
+}
+
+//*******************************************************************
+Blockdevice&
+FAT16::Device()
+{
+	return Device_;
+}
+
+//*******************************************************************
+unsigned int
+FAT16::DataStartBlock() const
+{
+	return PartitionStartBlock_ + DataStartBlock_;
+}
+
+//*******************************************************************
+void
+FAT16::SetGroupCommit(
+	const bool	Enable
+)
+{
+	if (Enable != GroupCommit_) {
+		// Leave the old mode with everything on the disk.
+		for (unsigned int i=0; i<ARRAYSIZE(Files_); ++i) {
+			if (Files_[i].IsOpen && GroupCommit_) {
+				UpdateDirectoryEntry(Files_[i]);
+			}
+		}
+		FlushData();
+		FlushFat();
+		DirectoryEntries_.Flush();
+		SyncMirror();
+
+		GroupCommit_ = Enable;
+		SetFatOptions(!GroupCommit_);
+	}
+}
+
+//*******************************************************************
+void
+FAT16::SetPreErase(
+	const bool	Enable
+)
+{
+	const unsigned int	unit = Device_.EraseUnitSize();
+
+	PreErase_ = Enable;
+	EraseUnitClusters_ = 1;
+	if (Enable && unit > BlocksPerCluster_ && unit % BlocksPerCluster_ == 0) {
+		EraseUnitClusters_ = unit / BlocksPerCluster_;
+	}
+	filesystem_dprintf(("FAT16::SetPreErase: %d, erase unit %d blocks, %d clusters\n",
+		Enable, unit, EraseUnitClusters_));
 }
 
 //*******************************************************************
@@ -203,7 +376,11 @@ FAT16::Open(
 	filesystem_dprintf(("FAT16: filename is '%s', entry size %d\n", fatname, sizeof(Fat16DirectoryEntry)));
 
 	// 3. Scan the root directory.
-	for (unsigned int block_nr=0; block_nr<NrOfBlocksInRootDir_; ++block_nr) {
+	for (unsigned int index=0; ; ++index) {
+		const unsigned int			block_nr = RootDirectoryBlock(index);
+		if (block_nr == NO_BLOCK) {
+			break;
+		}
 		const Fat16DirectoryEntry*	fatpage = DirectoryEntries_.Fetch(block_nr);
 		bool						stop_scan = false;
 		for (unsigned int j=0; j<DirectoryEntries_.size(); ++j) {
@@ -216,17 +393,27 @@ FAT16::Open(
 				break;
 			}
 			if (strncmp(fatname, reinterpret_cast<const char*>(entry.Name), FILENAME_LENGTH)==0) {
+				for (unsigned int i=0; i<ARRAYSIZE(Files_); ++i) {
+					if (Files_[i].IsOpen && Files_[i].DirectoryBlock==block_nr && Files_[i].DirectoryBlockIndex==j) {
+						throw Error("FAT16: file '%s' is already open.", filename);
+					}
+				}
 				file.IsOpen					= true;
 				file.Flags					= flags;
-				file.FirstCluster			= entry.Cluster;
+				file.FirstCluster			= FirstClusterOf(entry);
 				file.Size					= entry.Size;
 				file.SizeBlocks				= (entry.Size + BLOCK_SIZE-1) / BLOCK_SIZE;
 				file.SizeClusters			= (file.SizeBlocks + BlocksPerCluster_ - 1) / BlocksPerCluster_;
 				file.DirectoryBlock			= block_nr;
 				file.DirectoryBlockIndex	= j;
-				file.CurrentCluster			= entry.Cluster;
+				file.CurrentCluster			= file.FirstCluster;
 				file.RelativeBlock			= 0;
 				file.RelativeCluster		= 0;
+				file.NrOfExtents			= 0;
+				file.HintRelativeCluster	= 0;
+				file.HintCluster			= 0;
+				file.ReservedCluster		= 0;
+				file.ReservedCount			= 0;
 				filesystem_dprintf(("FAT16: file '%s' found, cluster=%d, size=%d, dir.block=%d\n",
 					filename, file.FirstCluster, file.Size, file.DirectoryBlock));
 				return fd;
@@ -240,49 +427,90 @@ FAT16::Open(
 
 	if (flags == OPEN_CREATE) {
 		// create the file entry :)
-		for (unsigned int block_nr=0; block_nr<NrOfBlocksInRootDir_; ++block_nr) {
-			const Fat16DirectoryEntry*	fatpage = DirectoryEntries_.Fetch(block_nr);
-			for (unsigned int j=0; j<DirectoryEntries_.size(); ++j) {
+		unsigned int	block_nr = NO_BLOCK;
+		unsigned int	j = 0;
+		for (unsigned int index=0; block_nr==NO_BLOCK; ++index) {
+			const unsigned int			dir_block = RootDirectoryBlock(index);
+			if (dir_block == NO_BLOCK) {
+				break;
+			}
+			const Fat16DirectoryEntry*	fatpage = DirectoryEntries_.Fetch(dir_block);
+			for (j=0; j<DirectoryEntries_.size(); ++j) {
 				const Fat16DirectoryEntry&	entry = fatpage[j];
 				if (entry.Name[0] == DIRENTRY_LAST || entry.Name[0] == DIRENTRY_FREE) {
-					Fat16DirectoryEntry	new_entry;
-					memset(&new_entry, 0, sizeof(new_entry));
-					memcpy(new_entry.Name, fatname, FILENAME_LENGTH);
-
-					// Set the date and time to January 02, 2005 21:00:00 .
-					// If a real time clock is available, we could use it.
-					new_entry.CreatedTime_HourAndMinute =  ((04 >> 1) & 0x1F + (03 << 5))
-														 |(((03 >> 3) & 0x07) + (21 << 3)) << 8;
-					new_entry.Time = new_entry.CreatedTime_HourAndMinute;
-					new_entry.Date = (02 & 0x1F) | ((01 << 5) & 0xE0) |
-									 ((01 >> 3) & 0x01 | (((2005 - 1980) & 0xFF) << 1) & 0xFE) << 8;
-					new_entry.LastAccessedDate = new_entry.Date;
-
-					DirectoryEntries_[j] = new_entry;
-
-					file.IsOpen					= true;
-					file.Flags					= flags;
-					file.FirstCluster			= new_entry.Cluster;
-					file.Size					= new_entry.Size;
-					file.SizeBlocks				= 0;
-					file.SizeClusters			= 0;
-					file.DirectoryBlock			= block_nr;
-					file.DirectoryBlockIndex	= j;
-					file.CurrentCluster			= 0;
-					file.RelativeBlock			= 0;
-					file.RelativeCluster		= 0;
-					filesystem_dprintf(("FAT16: file '%s' created, dir.block=%d\n",
-						filename, file.DirectoryBlock));
-					return fd;
+					block_nr = dir_block;
+					break;
 				}
 			}
 		}
-		throw Error("FAT16: unable to create file '%s'.", filename);
+		if (block_nr == NO_BLOCK) {
+			if (!Fat32_) {
+				throw Error("FAT16: unable to create file '%s'.", filename);
+			}
+			// FAT32 root directory grows.
+			block_nr = ExtendRootDirectory();
+			j = 0;
+		}
+
+		Fat16DirectoryEntry	new_entry;
+		memset(&new_entry, 0, sizeof(new_entry));
+		memcpy(new_entry.Name, fatname, FILENAME_LENGTH);
+
+		// Set the date and time to January 02, 2005 21:00:00 .
+		// If a real time clock is available, we could use it.
+		new_entry.CreatedTime_HourAndMinute =  ((04 >> 1) & 0x1F + (03 << 5))
+											 |(((03 >> 3) & 0x07) + (21 << 3)) << 8;
+		new_entry.Time = new_entry.CreatedTime_HourAndMinute;
+		new_entry.Date = (02 & 0x1F) | ((01 << 5) & 0xE0) |
+						 ((01 >> 3) & 0x01 | (((2005 - 1980) & 0xFF) << 1) & 0xFE) << 8;
+		new_entry.LastAccessedDate = new_entry.Date;
+
+		DirectoryEntries_.Fetch(block_nr);
+		DirectoryEntries_[j] = new_entry;
+
+		file.IsOpen					= true;
+		file.Flags					= flags;
+		file.FirstCluster			= 0;
+		file.Size					= new_entry.Size;
+		file.SizeBlocks				= 0;
+		file.SizeClusters			= 0;
+		file.DirectoryBlock			= block_nr;
+		file.DirectoryBlockIndex	= j;
+		file.CurrentCluster			= 0;
+		file.RelativeBlock			= 0;
+		file.RelativeCluster		= 0;
+		file.NrOfExtents			= 0;
+		file.HintRelativeCluster	= 0;
+		file.HintCluster			= 0;
+		file.ReservedCluster		= 0;
+		file.ReservedCount			= 0;
+		filesystem_dprintf(("FAT16: file '%s' created, dir.block=%d\n",
+			filename, file.DirectoryBlock));
+		return fd;
 	} else {
 		throw Error("FAT16: file '%s' not found in the root directory.", filename);
 	}
 }
 
+//*******************************************************************
+FAT16::~FAT16()
+{
+	try {
+		for (unsigned int i=0; i<ARRAYSIZE(Files_); ++i) {
+			if (Files_[i].IsOpen && GroupCommit_) {
+				UpdateDirectoryEntry(Files_[i]);
+			}
+		}
+		FlushData();
+		FlushFat();
+		DirectoryEntries_.Flush();
+		SyncMirror();
+		WriteFsInfo();
+	} catch (const std::exception& e) {
+		filesystem_dprintf(("FAT16: error flushing, '%s'\n", e.what()));
+	}
+}
+
 //*******************************************************************
 void
 FAT16::Close(
@@ -291,11 +519,47 @@ FAT16::Close(
 {
 	filesystem_dprintf(("FAT16::Close\n"));
 
-	// FIXME: flush operation!!!
-	Files_[fd].IsOpen = false;
+	FatFile&	file = OpenFile(fd);
+
+	// The descriptor is released even when the device fails.
+	try {
+		Commit(fd);
+		SyncMirror();
+	} catch (...) {
+		ReleaseReserved(file);
+		file.IsOpen = false;
+		throw;
+	}
+
+	ReleaseReserved(file);
+	WriteFsInfo();
+	file.IsOpen = false;
+	FlushDevice();
+}
+
+//*******************************************************************
+void
+FAT16::Remove(
+	const char*	filename
+)
+{
+	filesystem_dprintf(("FAT16::Remove '%s'\n", filename));
+
+	const unsigned int	fd = Open(filename, OPEN_READONLY);
+	FatFile&			file = Files_[fd];
+	file.IsOpen = false;
 
+	// 1. Directory entry first, power loss leaves lost clusters at worst.
+	Fat16DirectoryEntry	direntry = DirectoryEntries_.Fetch(file.DirectoryBlock)[file.DirectoryBlockIndex];
+	direntry.Name[0] = DIRENTRY_FREE;
+	DirectoryEntries_[file.DirectoryBlockIndex] = direntry;
 	DirectoryEntries_.Flush();
-	FatEntries_.Flush();
+
+	// 2. Free the cluster chain.
+	FreeChain(file.FirstCluster);
+	FlushFat();
+	SyncMirror();
+	WriteFsInfo();
 }
 
 //*******************************************************************
@@ -304,7 +568,7 @@ FAT16::Size(
 	const unsigned int	fd
 )
 {
-	return Files_[fd].Size;
+	return OpenFile(fd).Size;
 }
 
 //*******************************************************************
@@ -315,7 +579,7 @@ FAT16::Read(
 )
 {
 	filesystem_dprintf(("FAT16::Read\n"));
-	FatFile&			file = Files_[fd];
+	FatFile&			file = OpenFile(fd);
 
 	if (file.RelativeBlock < file.SizeBlocks) {
 		// 1. Read the file.
@@ -337,108 +601,251 @@ FAT16::Write(
 {
 	filesystem_dprintf(("FAT16::Write\n"));
 
-	FatFile&	file = Files_[fd];
-	const bool	past_eof = file.RelativeBlock == file.SizeBlocks;
+	WriteRun(OpenFile(fd), block, 1, true);
+}
 
-	// Do we need to find a new cluster?
-	if (past_eof && (file.SizeBlocks % BlocksPerCluster_)==0) {
-		const unsigned int	fatentries_per_block = (BLOCK_SIZE / sizeof(FatEntry));
-		unsigned int		cluster = FreeClusterSearchStart_;
+//*******************************************************************
+void
+FAT16::ReadBlocks(
+	const unsigned int	fd,
+	void*				blocks,
+	const unsigned int	count
+)
+{
+	filesystem_dprintf(("FAT16::ReadBlocks %d\n", count));
+	FatFile&	file = OpenFile(fd);
+	char*		ptr = reinterpret_cast<char*>(blocks);
 
-		for (unsigned int scan_count=0; scan_count<BlocksPerFat_; ++scan_count) {
-			const unsigned int	block_nr = cluster / fatentries_per_block;
-			const unsigned int	start_index = cluster % fatentries_per_block;
-			bool				found = false;
-			unsigned int		found_i = -1;
-			FatEntry*			fatpage = FatEntries_.Fetch(block_nr);
+	if (file.RelativeBlock + count > file.SizeBlocks) {
+		throw Error("FAT16: end of file reached when reading.");
+	}
 
-			filesystem_dprintf(("FAT16::Write searches for free cluster in block %d, start index %d\n", block_nr, start_index));
-			for (unsigned int i=start_index; i<fatentries_per_block; ++i) {
-				if (fatpage[i] == CLUSTER_AVAILABLE) {
-					found = true;
-					found_i = i;
-					break;
-				}
-			}
+	for (unsigned int todo=count; todo>0; ) {
+		const unsigned int	block_nr =   DataStartBlock_ +
+										(file.CurrentCluster-2)*BlocksPerCluster_ +
+										file.RelativeBlock % BlocksPerCluster_;
+
+		// One read over the clusters following each other on the disk.
+		unsigned int	run = 0;
+		do {
+			const unsigned int	cluster_offset = file.RelativeBlock % BlocksPerCluster_;
+			const unsigned int	this_round =
+				cluster_offset + todo - run > BlocksPerCluster_
+					? BlocksPerCluster_ - cluster_offset
+					: todo - run;
+			SeekSetBlock(fd, file.RelativeBlock + this_round);
+			run += this_round;
+		} while (run < todo
+			&& DataStartBlock_ + (file.CurrentCluster-2)*BlocksPerCluster_ + file.RelativeBlock % BlocksPerCluster_ == block_nr + run);
+		ReadDevice(block_nr, run, ptr);
+
+		ptr += run * BLOCK_SIZE;
+		todo -= run;
+	}
+}
 
-			if (found) {
-				filesystem_dprintf(("FAT16::Write found free cluster %d\n", cluster));
-				cluster = block_nr * fatentries_per_block + found_i;
-				FreeClusterSearchStart_ = cluster + 1;
-
-				// 1. Write data to the block.
-				const unsigned int	data_block_nr = DataStartBlock_ + (cluster - 2)*BlocksPerCluster_;
-				WriteDevice(data_block_nr, block);
-
-				// 2. Set new cluster to be the last one.
-				FatEntries_[found_i] = CLUSTER_LAST_MAX;
-
-				// 4. Update file size and current cluster.
-				const unsigned int	previous_cluster = file.CurrentCluster;
-				file.SizeBlocks		= file.SizeBlocks + 1;
-				file.SizeClusters	= file.SizeClusters + 1;
-				file.Size			= file.SizeBlocks * BLOCK_SIZE;
-				file.CurrentCluster = cluster;
-				const unsigned int	new_size = file.SizeBlocks * BLOCK_SIZE;
-
-				// Was it first write into empty file?
-				if (file.SizeBlocks == 1) {
-					// 3. Update directory entries, including fat.
-					file.FirstCluster = cluster;
-
-					Fat16DirectoryEntry	direntry = DirectoryEntries_.Fetch(file.DirectoryBlock)[file.DirectoryBlockIndex];
-					direntry.Cluster = cluster;
-					direntry.Size = new_size;
-					DirectoryEntries_[file.DirectoryBlockIndex] = direntry;
-				} else {
-					// 3. Set the previous cluster to point to the new cluster.
-					FatEntries_.Fetch(previous_cluster / fatentries_per_block);
-					FatEntries_[previous_cluster % fatentries_per_block] = file.CurrentCluster;
-
-					// 4. Update directory entries for new size.
-					Fat16DirectoryEntry	direntry = DirectoryEntries_.Fetch(file.DirectoryBlock)[file.DirectoryBlockIndex];
-					direntry.Size = new_size;
-					DirectoryEntries_[file.DirectoryBlockIndex] = direntry;
-				}
+//*******************************************************************
+void
+FAT16::WriteBlocks(
+	const unsigned int	fd,
+	const void*			blocks,
+	const unsigned int	count
+)
+{
+	filesystem_dprintf(("FAT16::WriteBlocks %d\n", count));
+	FatFile&	file = OpenFile(fd);
+	const char*	ptr = reinterpret_cast<const char*>(blocks);
+
+	for (unsigned int todo=count; todo>0; ) {
+		const unsigned int	cluster_offset = file.RelativeBlock % BlocksPerCluster_;
+		unsigned int		this_round =
+			cluster_offset + todo > BlocksPerCluster_
+				? BlocksPerCluster_ - cluster_offset
+				: todo;
+		if (file.RelativeBlock==file.SizeBlocks && (file.SizeBlocks % BlocksPerCluster_)==0 && file.ReservedCount>0) {
+			// Appending to reserved clusters, which follow each other on the disk.
+			const unsigned int	max_round = file.ReservedCount * BlocksPerCluster_;
+			this_round = todo < max_round ? todo : max_round;
+		}
+		WriteRun(file, ptr, this_round, false);
 
-				// yes :)
-				return;
-			} else {
-				cluster = ((cluster/fatentries_per_block + 1) % BlocksPerFat_) * fatentries_per_block;
+		SeekSetBlock(fd, file.RelativeBlock + this_round);
+		ptr += this_round * BLOCK_SIZE;
+		todo -= this_round;
+	}
+}
+
+//*******************************************************************
+unsigned int
+FAT16::Reserve(
+	const unsigned int	fd,
+	const unsigned int	bytes
+)
+{
+	FatFile&			file = OpenFile(fd);
+	const unsigned int	cluster_size = BlocksPerCluster_ * BLOCK_SIZE;
+	const unsigned int	slack = file.SizeClusters * cluster_size - file.Size;
+
+	if (slack + file.ReservedCount * cluster_size >= bytes) {
+		return slack + file.ReservedCount * cluster_size;
+	}
+
+	// 1. Start over, the new run may include the old one.
+	ReleaseReserved(file);
+
+	// 2. Prefer the clusters right after the end of the file.
+	const unsigned int	count = (bytes - slack + cluster_size - 1) / cluster_size;
+	const unsigned int	start = file.SizeClusters>0
+								? ClusterOf(file, file.SizeClusters-1) + 1
+								: FreeClusterSearchStart_;
+	unsigned int		found = 0;
+	unsigned int		cluster = 0;
+	if (EraseUnitClusters_ > 1) {
+		// Fill up the erase unit of the file end, or take whole units.
+		const unsigned int	head = file.SizeClusters>0 ? ClustersToEraseUnitEnd(start) % EraseUnitClusters_ : 0;
+		const unsigned int	units = (count - std::min(count, head) + EraseUnitClusters_ - 1) / EraseUnitClusters_;
+		if (head > 0 && IsDataCluster(start) && IsClusterFree(start)) {
+			cluster = FindFreeRun(start, head + units*EraseUnitClusters_, found);
+			if (cluster != start) {
+				found = 0;
 			}
 		}
+		if (found == 0) {
+			const unsigned int	aligned_count = (count + EraseUnitClusters_ - 1) / EraseUnitClusters_ * EraseUnitClusters_;
+			cluster = FindFreeRun(start, aligned_count, found, true);
+		}
+	}
+	if (found == 0) {
+		cluster = FindFreeRun(start, count, found);
+	}
+	filesystem_dprintf(("FAT16::Reserve: %d clusters at %d, %d requested\n", found, cluster, count));
 
-		// Perhaps we failed.
-		throw Error("FAT16: Disk Full.");
+	if (FreeBitmap_ != 0) {
+		for (unsigned int i=cluster; i<cluster+found; ++i) {
+			FreeBitmap_[i >> 3] |= 1 << (i & 0x07);
+		}
+	}
+	file.ReservedCluster = cluster;
+	file.ReservedCount = found;
+	if (found > 0) {
+		FreeClusterSearchStart_ = cluster + found;
 	}
 
-	// Write :)
-	const unsigned int	data_block_nr = DataStartBlock_ +
-										(file.CurrentCluster - 2)*BlocksPerCluster_ +
-										(file.RelativeBlock % BlocksPerCluster_);
-	WriteDevice(data_block_nr, block);
+	// 3. Erase ahead; clusters of the old run are free, too.
+	if (PreErase_ && found > 0) {
+		Cache_.Discard(ClusterBlock(cluster), found * BlocksPerCluster_);
+		Device_.Erase(ClusterBlock(cluster), found * BlocksPerCluster_);
+	}
 
+	return slack + file.ReservedCount * cluster_size;
+}
 
-	// Is file size increased by one block?
-	if (past_eof) {
-		file.SizeBlocks += 1;
-		file.Size	= file.SizeBlocks * BLOCK_SIZE;
-		const unsigned int	new_size = file.SizeBlocks * BLOCK_SIZE;
-		Fat16DirectoryEntry	direntry = DirectoryEntries_.Fetch(file.DirectoryBlock)[file.DirectoryBlockIndex];
-		direntry.Size = new_size;
-		DirectoryEntries_[file.DirectoryBlockIndex] = direntry;
-	} else {
-		// shall we set new size because last block of the file was written to?
-		const unsigned int	full_size = file.SizeBlocks * BLOCK_SIZE;
-		if (file.RelativeBlock+1==file.SizeBlocks && full_size!=file.Size) {
-			Fat16DirectoryEntry	direntry = DirectoryEntries_.Fetch(file.DirectoryBlock)[file.DirectoryBlockIndex];
-			direntry.Size = full_size;
-			DirectoryEntries_[file.DirectoryBlockIndex] = direntry;
+//*******************************************************************
+void
+FAT16::Preallocate(
+	const unsigned int	fd,
+	const unsigned int	bytes
+)
+{
+	FatFile&			file = OpenFile(fd);
+	const unsigned int	cluster_size = BlocksPerCluster_ * BLOCK_SIZE;
+	const unsigned int	count = (bytes + cluster_size - 1) / cluster_size;
+
+	if (file.SizeClusters > 0) {
+		throw Error("FAT16::Preallocate: file is not empty.");
+	}
+	Reserve(fd, bytes);
+	if (file.ReservedCount < count) {
+		ReleaseReserved(file);
+		throw Error("FAT16::Preallocate: no run of %d free clusters.", count);
+	}
+
+	// Link the run, AppendCluster() takes the reserved clusters in order.
+	while (file.SizeClusters < count) {
+		AppendCluster(file);
+	}
+	file.Size = count * cluster_size;
+	file.SizeBlocks = count * BlocksPerCluster_;
+	file.CurrentCluster = file.FirstCluster;
+	ReleaseReserved(file);
+
+	UpdateDirectoryEntry(file);
+	FlushFat();
+	DirectoryEntries_.Flush();
+	WriteFsInfo();
+}
+
+//*******************************************************************
+unsigned int
+FAT16::ContiguousBlocks(
+	const unsigned int	fd,
+	unsigned int&		blocks
+)
+{
+	FatFile&			file = OpenFile(fd);
+
+	if (file.SizeClusters == 0) {
+		throw Error("FAT16::ContiguousBlocks: file is empty.");
+	}
+	for (unsigned int i=1; i<file.SizeClusters; ++i) {
+		if (ClusterOf(file, i) != file.FirstCluster + i) {
+			throw Error("FAT16::ContiguousBlocks: file is fragmented at cluster %d.", i);
+		}
+	}
+
+	const unsigned int	first = ClusterBlock(file.FirstCluster);
+	blocks = file.SizeClusters * BlocksPerCluster_;
+	FlushData();
+	Cache_.Discard(first, blocks);
+	return first;
+}
+
+//*******************************************************************
+unsigned int
+FAT16::NextRun(
+	const unsigned int	fd,
+	unsigned int&		count
+)
+{
+	FatFile&			file = OpenFile(fd);
+
+	if (file.RelativeBlock >= file.SizeBlocks) {
+		count = 0;
+		return 0;
+	}
+
+	// 1. Follow the chain while the clusters are consecutive.
+	const unsigned int	first = ClusterBlock(file.CurrentCluster) + file.RelativeBlock % BlocksPerCluster_;
+	unsigned int		cluster = file.CurrentCluster;
+	unsigned int		relative_cluster = file.RelativeCluster;
+	unsigned int		next = 0;
+	while (relative_cluster + 1 < file.SizeClusters) {
+		next = NextCluster(cluster);
+		if (!IsDataCluster(next)) {
+			throw Error("FAT16: next cluster %d invalid in FAT.", next);
+		}
+		MapCluster(file, relative_cluster + 1, next);
+		if (next != cluster + 1) {
+			break;
 		}
+		cluster = next;
+		++relative_cluster;
 	}
 
-	// printf("write not implemented.\n");
-	// FIXME: do what?
+	// 2. Leave the block pointer at the next run, or at the end of the file.
+	const unsigned int	end_block = (relative_cluster + 1) * BlocksPerCluster_;
+	if (end_block < file.SizeBlocks) {
+		count = end_block - file.RelativeBlock;
+		file.CurrentCluster = next;
+		file.RelativeCluster = relative_cluster + 1;
+		file.RelativeBlock = end_block;
+	} else {
+		count = file.SizeBlocks - file.RelativeBlock;
+		file.CurrentCluster = cluster;
+		file.RelativeCluster = file.SizeBlocks / BlocksPerCluster_;
+		file.RelativeBlock = file.SizeBlocks;
+	}
+	return first;
 }
 
 //*******************************************************************
@@ -448,44 +855,17 @@ FAT16::SeekSetBlock(
 	const unsigned int	BlockNr
 )
 {
-	FatFile&			file = Files_[fd];
+	FatFile&			file = OpenFile(fd);
 
 	if (BlockNr <= file.SizeBlocks) {
 		const unsigned int	current_relative_cluster	= file.RelativeBlock / BlocksPerCluster_;
 		const unsigned int	new_relative_cluster		= BlockNr / BlocksPerCluster_;
 
 		if (current_relative_cluster != new_relative_cluster) {
-			// Update file.CurrentCluster
-			unsigned int	cluster	= -1;
-			unsigned int	count	= -1;
-			if (new_relative_cluster < current_relative_cluster) {
-				cluster = file.FirstCluster;
-				count	= new_relative_cluster;
-			} else {
-				cluster	= file.CurrentCluster;
-				count	= new_relative_cluster - current_relative_cluster;
-			}
-
-			FatEntry*			fatpage = 0;
-			const unsigned int	fatentries_per_block = (BLOCK_SIZE / sizeof(FatEntry));
-			for (; count>0; --count) {
-				if (cluster>=CLUSTER_USED_MIN && cluster<=CLUSTER_USED_MAX) {
-					// yes, take on the next one.
-					const unsigned int	block_nr = cluster / fatentries_per_block;
-					const unsigned int	index = cluster % fatentries_per_block;
-					fatpage = FatEntries_.Fetch(block_nr);
-					if (count!=1 || BlockNr != file.SizeBlocks) {
-						// yeah, skip the damn thing :)
-						cluster = fatpage[index];
-					}
-				} else {
-					throw Error("FAT16: next cluster %d invalid in FAT.", cluster);
-				}
-			}
-
-			if (cluster<CLUSTER_USED_MIN || cluster >CLUSTER_USED_MAX) {
-				throw Error("FAT16::Seek: cluster %d is out of range [%d .. %d].", cluster, CLUSTER_USED_MIN, CLUSTER_USED_MAX);
-			}
+			// Update file.CurrentCluster. Past EOF at the cluster boundary
+			// it points to the last cluster of the file.
+			const bool			past_last_cluster = new_relative_cluster == file.SizeClusters;
+			const unsigned int	cluster = ClusterOf(file, past_last_cluster ? new_relative_cluster-1 : new_relative_cluster);
 
 			file.CurrentCluster = cluster;
 			file.RelativeCluster = new_relative_cluster;
@@ -510,7 +890,7 @@ FAT16::SetSize(
 	const unsigned int	NewSize
 )
 {
-	FatFile&			file = Files_[fd];
+	FatFile&			file = OpenFile(fd);
 
 	// 1. Check end cluster.
 	const unsigned int	new_size_clusters = (NewSize + BlocksPerCluster_*BLOCK_SIZE - 1) / (BlocksPerCluster_*BLOCK_SIZE);
@@ -528,11 +908,13 @@ FAT16::SetSize(
 	file.Size = NewSize;
 	file.SizeBlocks = (NewSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-	Fat16DirectoryEntry	direntry = DirectoryEntries_.Fetch(file.DirectoryBlock)[file.DirectoryBlockIndex];
-	// Shall we update?
-	if (direntry.Size != NewSize) {
-		direntry.Size = NewSize;
-		DirectoryEntries_[file.DirectoryBlockIndex] = direntry;
+	if (!GroupCommit_) {
+		Fat16DirectoryEntry	direntry = DirectoryEntries_.Fetch(file.DirectoryBlock)[file.DirectoryBlockIndex];
+		// Shall we update?
+		if (direntry.Size != NewSize) {
+			direntry.Size = NewSize;
+			DirectoryEntries_[file.DirectoryBlockIndex] = direntry;
+		}
 	}
 }
 
@@ -542,44 +924,927 @@ FAT16::Flush(
 	const unsigned int	fd
 )
 {
-	FatEntries_.Flush();
-	DirectoryEntries_.Flush();
+	// Data first, so that FAT and directory never point to unwritten blocks.
+	FlushData();
+	if (!GroupCommit_) {
+		FlushFat();
+		DirectoryEntries_.Flush();
+	}
 }
 
 //*******************************************************************
 void
-FAT16::ReadDevice(
-	const unsigned int	Nr,
-	void*				Block
+FAT16::Commit(
+	const unsigned int	fd
 )
 {
-	Device_.Read(Nr + PartitionStartBlock_, Block);
+	FatFile&	file = OpenFile(fd);
+
+	if (GroupCommit_) {
+		UpdateDirectoryEntry(file);
+	}
+	FlushData();
+	FlushFat();
+	DirectoryEntries_.Flush();
+	FlushDevice();
 }
 
 //*******************************************************************
 void
-FAT16::WriteDevice(
-	const unsigned int	Nr,
-	const void*			Block
-)
+FAT16::SyncMirror()
 {
-	Device_.Write(Nr + PartitionStartBlock_, Block);
+	if (MirrorFirst_ < MirrorEnd_) {
+		unsigned char	block[BLOCK_SIZE];
+
+		FlushFat();
+		for (unsigned int block_nr=MirrorFirst_; block_nr<MirrorEnd_; ++block_nr) {
+			const unsigned int	fat_block = PartitionStartBlock_ + FatBlock_ + block_nr;
+			Cache_.Read(fat_block, block);
+			Device_.BeginWrite(fat_block + BlocksPerFat_, block);
+		}
+		MirrorFirst_ = -1;
+		MirrorEnd_ = 0;
+	}
 }
 
 //*******************************************************************
-void
-FAT16::FixFat16DirectoryEntryEndian(
-	Fat16DirectoryEntry&	entry
+unsigned int
+FAT16::RecoverSize(
+	const unsigned int	fd
 )
 {
-	FixEndian16(entry.CreatedTime_HourAndMinute);
-	FixEndian16(entry.CreatedDate);
-	FixEndian16(entry.LastAccessedDate);
-	FixEndian16(entry.ExtendedAttribute);
-	FixEndian16(entry.Time);
-	FixEndian16(entry.Date);
-	FixEndian16(entry.Cluster);
-	FixEndian32(entry.Size);
+	FatFile&			file = OpenFile(fd);
+	if (!IsDataCluster(file.FirstCluster)) {
+		return 0;
+	}
+
+	// 1. Walk the chain past the last cluster of the file.
+	unsigned int		nclusters = file.SizeClusters>0 ? file.SizeClusters : 1;
+	unsigned int		cluster = ClusterOf(file, nclusters-1);
+	for (;;) {
+		const unsigned int	next = NextCluster(cluster);
+		if (!IsDataCluster(next)) {
+			break;
+		}
+		MapCluster(file, nclusters, next);
+		cluster = next;
+		++nclusters;
+	}
+	if (nclusters <= file.SizeClusters) {
+		return 0;
+	}
+
+	// 2. File ends at the last block written, trailing erased blocks were never written.
+	unsigned int		size_blocks = nclusters * BlocksPerCluster_;
+	while (size_blocks > file.SizeBlocks) {
+		const unsigned int	block = size_blocks - 1;
+		if (!IsBlockErased(ClusterBlock(ClusterOf(file, block / BlocksPerCluster_)) + block % BlocksPerCluster_)) {
+			break;
+		}
+		--size_blocks;
+	}
+	const unsigned int	size_clusters = (size_blocks + BlocksPerCluster_ - 1) / BlocksPerCluster_;
+	const unsigned int	keep_clusters = std::max(size_clusters, file.SizeClusters);
+	const unsigned int	old_size = file.Size;
+	if (size_blocks > file.SizeBlocks) {
+		file.SizeBlocks	= size_blocks;
+		file.Size		= size_blocks * BLOCK_SIZE;
+	}
+	file.SizeClusters	= keep_clusters;
+	filesystem_dprintf(("FAT16::RecoverSize: size %d -> %d, %d of %d clusters\n",
+		old_size, file.Size, keep_clusters, nclusters));
+
+	// 3. Directory entry first, then free the clusters past the end of the file.
+	const unsigned int	first_cluster = file.FirstCluster;
+	if (keep_clusters == 0) {
+		file.FirstCluster = 0;
+	}
+	UpdateDirectoryEntry(file);
+	DirectoryEntries_.Flush();
+	if (keep_clusters < nclusters) {
+		if (keep_clusters == 0) {
+			FreeChain(first_cluster);
+		} else {
+			const unsigned int	last = ClusterOf(file, keep_clusters-1);
+			const unsigned int	next = NextCluster(last);
+			SetFatEntry(last, EndOfChain_);
+			FreeChain(next);
+		}
+		file.NrOfExtents = 0;
+		file.HintCluster = 0;
+		file.CurrentCluster = file.FirstCluster;
+		file.RelativeBlock = 0;
+		file.RelativeCluster = 0;
+		FlushFat();
+		SyncMirror();
+		WriteFsInfo();
+	}
+
+	return file.Size - old_size;
+}
+
+//*******************************************************************
+bool
+FAT16::Poll()
+{
+	return Device_.Poll();
+}
+
+//*******************************************************************
+unsigned int
+FAT16::OpenFiles() const
+{
+	unsigned int	count = 0;
+	for (unsigned int i=0; i<ARRAYSIZE(Files_); ++i) {
+		if (Files_[i].IsOpen) {
+			++count;
+		}
+	}
+	return count;
+}
+
+//*******************************************************************
+void
+FAT16::FlushDevice()
+{
+	if (!Device_.Flush()) {
+		throw Error("FAT16: device failed to write the blocks held back.");
+	}
+}
+
+//*******************************************************************
+void
+FAT16::ReadDevice(
+	const unsigned int	Nr,
+	void*				Block
+)
+{
+	Cache_.Read(Nr + PartitionStartBlock_, Block);
+}
+
+//*******************************************************************
+void
+FAT16::ReadDevice(
+	const unsigned int	Nr,
+	const unsigned int	Count,
+	void*				Blocks
+)
+{
+	// Cached copies may be newer than the disk.
+	Cache_.Flush(Nr + PartitionStartBlock_, Count);
+	Device_.ReadBlocks(Nr + PartitionStartBlock_, Count, Blocks);
+}
+
+//*******************************************************************
+void
+FAT16::WriteDevice(
+	const unsigned int	Nr,
+	const void*			Block
+)
+{
+	Cache_.Write(Nr + PartitionStartBlock_, Block);
+}
+
+//*******************************************************************
+void
+FAT16::WriteDevice(
+	const unsigned int	Nr,
+	const unsigned int	Count,
+	const void*			Blocks
+)
+{
+	// Cached copies are superseded by the new contents.
+	Cache_.Discard(Nr + PartitionStartBlock_, Count);
+	if (Count == 1) {
+		// Split-phase, the card programs the block while the caller goes on.
+		Device_.BeginWrite(Nr + PartitionStartBlock_, Blocks);
+	} else {
+		Device_.WriteBlocks(Nr + PartitionStartBlock_, Count, Blocks);
+	}
+}
+
+//*******************************************************************
+void
+FAT16::FixFat16DirectoryEntryEndian(
+	Fat16DirectoryEntry&	entry
+)
+{
+	FixEndian16(entry.CreatedTime_HourAndMinute);
+	FixEndian16(entry.CreatedDate);
+	FixEndian16(entry.LastAccessedDate);
+	FixEndian16(entry.ClusterHigh);
+	FixEndian16(entry.Time);
+	FixEndian16(entry.Date);
+	FixEndian16(entry.Cluster);
+	FixEndian32(entry.Size);
+}
+
+//*******************************************************************
+void
+FAT16::FixDirectoryBlockEndian(
+	void*	block
+)
+{
+	Fat16DirectoryEntry*	entries = reinterpret_cast<Fat16DirectoryEntry*>(block);
+	for (unsigned int i=0; i<BLOCK_SIZE/sizeof(Fat16DirectoryEntry); ++i) {
+		FixFat16DirectoryEntryEndian(entries[i]);
+	}
+}
+
+//*******************************************************************
+void
+FAT16::FixFatBlockEndian(
+	void*	block
+)
+{
+	HostEndian::Fix16(reinterpret_cast<FatEntry*>(block), BLOCK_SIZE/sizeof(FatEntry));
+}
+
+//*******************************************************************
+void
+FAT16::FixFat32BlockEndian(
+	void*	block
+)
+{
+	HostEndian::Fix32(reinterpret_cast<Fat32Entry*>(block), BLOCK_SIZE/sizeof(Fat32Entry));
+}
+
+//*******************************************************************
+unsigned int
+FAT16::FirstClusterOf(
+	const Fat16DirectoryEntry&	entry
+) const
+{
+	return Fat32_ ? entry.Cluster | (static_cast<unsigned int>(entry.ClusterHigh) << 16) : entry.Cluster;
+}
+
+//*******************************************************************
+void
+FAT16::SetFirstCluster(
+	Fat16DirectoryEntry&	entry,
+	const unsigned int		Cluster
+)
+{
+	entry.Cluster = Cluster & 0xFFFF;
+	entry.ClusterHigh = Cluster >> 16;
+}
+
+//*******************************************************************
+bool
+FAT16::IsDataCluster(
+	const unsigned int	Cluster
+) const
+{
+	return Cluster>=CLUSTER_USED_MIN && Cluster<NrOfClusters_+CLUSTER_USED_MIN;
+}
+
+//*******************************************************************
+unsigned int
+FAT16::FatEntriesPerBlock() const
+{
+	return Fat32_ ? BLOCK_SIZE / sizeof(Fat32Entry) : BLOCK_SIZE / sizeof(FatEntry);
+}
+
+//*******************************************************************
+unsigned int
+FAT16::NextCluster(
+	const unsigned int	Cluster
+)
+{
+	if (Fat32_) {
+		const unsigned int	fatentries_per_block = (BLOCK_SIZE / sizeof(Fat32Entry));
+		const Fat32Entry*	fatpage = Fat32Entries_.Fetch(Cluster / fatentries_per_block);
+		return fatpage[Cluster % fatentries_per_block] & CLUSTER32_MASK;
+	} else {
+		const unsigned int	fatentries_per_block = (BLOCK_SIZE / sizeof(FatEntry));
+		const FatEntry*		fatpage = FatEntries_.Fetch(Cluster / fatentries_per_block);
+		return fatpage[Cluster % fatentries_per_block];
+	}
+}
+
+//*******************************************************************
+void
+FAT16::SetFatOptions(
+	const bool	Mirror
+)
+{
+	const unsigned int	start = PartitionStartBlock_ + FatBlock_;
+	const int			mirror = Mirror && NrOfFATs_>1 ? static_cast<int>(BlocksPerFat_) : -1;
+	if (Fat32_) {
+		Fat32Entries_.SetOptions(start, start + BlocksPerFat_, mirror);
+	} else {
+		FatEntries_.SetOptions(start, start + BlocksPerFat_, mirror);
+	}
+}
+
+//*******************************************************************
+void
+FAT16::FlushFat()
+{
+	Cache_.Flush(PartitionStartBlock_ + FatBlock_, BlocksPerFat_);
+}
+
+//*******************************************************************
+void
+FAT16::FlushData()
+{
+	const unsigned int	start = PartitionStartBlock_ + DataStartBlock_;
+	const unsigned int	end = start + NrOfClusters_ * BlocksPerCluster_;
+
+	if (!Fat32_) {
+		Cache_.Flush(start, end - start);
+		return;
+	}
+
+	// Flush around the directory blocks of the open files, lowest first.
+	for (unsigned int first=start; first<end; ) {
+		unsigned int	skip = end;
+		for (unsigned int i=0; i<ARRAYSIZE(Files_); ++i) {
+			const unsigned int	dir_block = start + Files_[i].DirectoryBlock;
+			if (Files_[i].IsOpen && dir_block>=first && dir_block<skip) {
+				skip = dir_block;
+			}
+		}
+		Cache_.Flush(first, skip - first);
+		first = skip + 1;
+	}
+}
+
+//*******************************************************************
+unsigned int
+FAT16::RootDirectoryBlock(
+	const unsigned int	Index
+)
+{
+	if (!Fat32_) {
+		return Index < NrOfBlocksInRootDir_ ? Index : NO_BLOCK;
+	}
+
+	// Walk the chain from the cluster found last, scans go forward.
+	const unsigned int	cluster_index = Index / BlocksPerCluster_;
+	if (cluster_index < RootDirClusterIndex_) {
+		RootDirCluster_ = RootCluster_;
+		RootDirClusterIndex_ = 0;
+	}
+	while (RootDirClusterIndex_ < cluster_index) {
+		const unsigned int	next = NextCluster(RootDirCluster_);
+		if (!IsDataCluster(next)) {
+			return NO_BLOCK;
+		}
+		RootDirCluster_ = next;
+		++RootDirClusterIndex_;
+	}
+	return (RootDirCluster_ - CLUSTER_USED_MIN) * BlocksPerCluster_ + Index % BlocksPerCluster_;
+}
+
+//*******************************************************************
+unsigned int
+FAT16::ExtendRootDirectory()
+{
+	// 1. Find the last cluster of the root directory.
+	for (unsigned int next=NextCluster(RootDirCluster_); IsDataCluster(next); next=NextCluster(RootDirCluster_)) {
+		RootDirCluster_ = next;
+		++RootDirClusterIndex_;
+	}
+
+	// 2. Allocate a cluster and clear it, the directory scan stops at the first empty entry.
+	const unsigned int	cluster = FindFreeCluster();
+	filesystem_dprintf(("FAT16::ExtendRootDirectory with cluster %d\n", cluster));
+	FreeClusterSearchStart_ = cluster + 1;
+	if (FreeBitmap_ != 0) {
+		FreeBitmap_[cluster >> 3] |= 1 << (cluster & 0x07);
+	}
+	if (FreeCount_ != FSINFO_UNKNOWN) {
+		--FreeCount_;
+	}
+	FsInfoDirty_ = true;
+
+	unsigned char		block[BLOCK_SIZE];
+	const unsigned int	block_nr = (cluster - CLUSTER_USED_MIN) * BlocksPerCluster_;
+	memset(block, 0, sizeof(block));
+	for (unsigned int i=0; i<BlocksPerCluster_; ++i) {
+		WriteDevice(DataStartBlock_ + block_nr + i, block);
+	}
+
+	// 3. Link it to the chain.
+	SetFatEntry(cluster, EndOfChain_);
+	SetFatEntry(RootDirCluster_, cluster);
+	RootDirCluster_ = cluster;
+	++RootDirClusterIndex_;
+
+	return block_nr;
+}
+
+//*******************************************************************
+void
+FAT16::LoadFsInfo()
+{
+	unsigned char	block[BLOCK_SIZE];
+
+	Cache_.Read(PartitionStartBlock_ + FsInfoBlock_, block);
+	if (uint32_of_byte4(block + FSINFO_LEAD_OFFSET) != FSINFO_LEAD_SIGNATURE
+		|| uint32_of_byte4(block + FSINFO_STRUCT_OFFSET) != FSINFO_STRUCT_SIGNATURE) {
+		filesystem_dprintf(("FAT16: no FSInfo at block %d\n", FsInfoBlock_));
+		FsInfoBlock_ = 0;
+		return;
+	}
+
+	const unsigned int	free_count = uint32_of_byte4(block + FSINFO_FREE_COUNT_OFFSET);
+	const unsigned int	next_free = uint32_of_byte4(block + FSINFO_NEXT_FREE_OFFSET);
+	FreeCount_ = free_count <= NrOfClusters_ ? free_count : FSINFO_UNKNOWN;
+	if (IsDataCluster(next_free)) {
+		FreeClusterSearchStart_ = next_free;
+	}
+	filesystem_dprintf(("FAT16: FSInfo free count %d, next free %d\n", free_count, next_free));
+}
+
+//*******************************************************************
+void
+FAT16::WriteFsInfo()
+{
+	if (FsInfoBlock_ == 0 || !FsInfoDirty_) {
+		return;
+	}
+
+	unsigned char		block[BLOCK_SIZE];
+	const unsigned int	block_nr = PartitionStartBlock_ + FsInfoBlock_;
+
+	Cache_.Read(block_nr, block);
+	byte4_of_uint32(block + FSINFO_FREE_COUNT_OFFSET, FreeCount_);
+	byte4_of_uint32(block + FSINFO_NEXT_FREE_OFFSET, FreeClusterSearchStart_);
+	Cache_.Write(block_nr, block);
+	Cache_.Flush(block_nr, 1);
+	FsInfoDirty_ = false;
+}
+
+//*******************************************************************
+void
+FAT16::MapCluster(
+	FatFile&			file,
+	const unsigned int	RelativeCluster,
+	const unsigned int	Cluster
+)
+{
+	if (file.NrOfExtents > 0) {
+		Extent&	last = file.Extents[file.NrOfExtents-1];
+		if (RelativeCluster < last.RelativeCluster + last.Count) {
+			// Mapped already, or in a gap of the map.
+			return;
+		}
+		if (last.RelativeCluster + last.Count == RelativeCluster && last.Cluster + last.Count == Cluster) {
+			++last.Count;
+			return;
+		}
+	}
+
+	if (file.NrOfExtents == MAX_EXTENTS) {
+		// Keep every second extent, the map goes on covering the whole chain.
+		for (unsigned int i=1; i<MAX_EXTENTS/2; ++i) {
+			file.Extents[i] = file.Extents[2*i];
+		}
+		file.NrOfExtents = MAX_EXTENTS/2;
+	}
+	Extent&	extent = file.Extents[file.NrOfExtents];
+	extent.RelativeCluster	= RelativeCluster;
+	extent.Cluster			= Cluster;
+	extent.Count			= 1;
+	++file.NrOfExtents;
+}
+
+//*******************************************************************
+unsigned int
+FAT16::ClusterOf(
+	FatFile&			file,
+	const unsigned int	RelativeCluster
+)
+{
+	// 1. Binary search for the last extent starting at or before the cluster.
+	unsigned int	lo = 0;
+	unsigned int	hi = file.NrOfExtents;
+	while (lo < hi) {
+		const unsigned int	mid = (lo + hi) / 2;
+		if (RelativeCluster < file.Extents[mid].RelativeCluster) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	// 2. Start walking from its end, or from the cluster found last if nearer.
+	unsigned int	relative_cluster = 0;
+	unsigned int	cluster = file.FirstCluster;
+	if (lo > 0) {
+		const Extent&	extent = file.Extents[lo-1];
+		if (RelativeCluster < extent.RelativeCluster + extent.Count) {
+			return extent.Cluster + (RelativeCluster - extent.RelativeCluster);
+		}
+		relative_cluster = extent.RelativeCluster + extent.Count - 1;
+		cluster = extent.Cluster + extent.Count - 1;
+	} else if (IsDataCluster(cluster)) {
+		MapCluster(file, 0, cluster);
+	}
+	if (file.HintCluster != 0 && file.HintRelativeCluster <= RelativeCluster && file.HintRelativeCluster > relative_cluster) {
+		relative_cluster = file.HintRelativeCluster;
+		cluster = file.HintCluster;
+	}
+
+	// 3. Walk the FAT.
+	for (; relative_cluster<RelativeCluster; ++relative_cluster) {
+		if (IsDataCluster(cluster)) {
+			// yes, take on the next one.
+			cluster = NextCluster(cluster);
+			if (IsDataCluster(cluster)) {
+				MapCluster(file, relative_cluster + 1, cluster);
+			}
+		} else {
+			throw Error("FAT16: next cluster %d invalid in FAT.", cluster);
+		}
+	}
+
+	if (!IsDataCluster(cluster)) {
+		throw Error("FAT16::Seek: cluster %d is out of range [%d .. %d].", cluster, CLUSTER_USED_MIN, NrOfClusters_ + CLUSTER_USED_MIN - 1);
+	}
+	file.HintRelativeCluster = RelativeCluster;
+	file.HintCluster = cluster;
+	return cluster;
+}
+
+//*******************************************************************
+void
+FAT16::FreeChain(
+	const unsigned int	Cluster
+)
+{
+	for (unsigned int cluster=Cluster; IsDataCluster(cluster); ) {
+		const unsigned int	next = NextCluster(cluster);
+		SetFatEntry(cluster, CLUSTER_AVAILABLE);
+		if (FreeBitmap_ != 0) {
+			FreeBitmap_[cluster >> 3] &= ~(1 << (cluster & 0x07));
+		}
+		if (FreeCount_ != FSINFO_UNKNOWN) {
+			++FreeCount_;
+		}
+		if (cluster < FreeClusterSearchStart_) {
+			FreeClusterSearchStart_ = cluster;
+		}
+		FsInfoDirty_ = true;
+		cluster = next;
+	}
+}
+
+//*******************************************************************
+bool
+FAT16::IsBlockErased(
+	const unsigned int	Nr
+)
+{
+	uint32_t	block[BLOCK_SIZE / sizeof(uint32_t)];
+
+	// Straight from the device, the blocks are not needed afterwards.
+	Cache_.Flush(Nr, 1);
+	if (!Device_.Read(Nr, block)) {
+		throw Error("FAT16: reading block %d failed.", Nr);
+	}
+	const uint32_t	first = block[0];
+	if (first != 0 && first != 0xFFFFFFFF) {
+		return false;
+	}
+	for (unsigned int i=1; i<ARRAYSIZE(block); ++i) {
+		if (block[i] != first) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//*******************************************************************
+void
+FAT16::LoadFreeBitmap()
+{
+	const unsigned int	end_cluster = NrOfClusters_ + CLUSTER_USED_MIN;
+
+	// Everything outside the data area is marked as used.
+	memset(FreeBitmap_, 0xFF, FREE_BITMAP_SIZE);
+	for (unsigned int cluster=CLUSTER_USED_MIN; cluster<end_cluster; ++cluster) {
+		if (NextCluster(cluster) == CLUSTER_AVAILABLE) {
+			FreeBitmap_[cluster >> 3] &= ~(1 << (cluster & 0x07));
+		}
+	}
+}
+
+//*******************************************************************
+unsigned int
+FAT16::FindFreeCluster()
+{
+	const unsigned int	end_cluster = NrOfClusters_ + CLUSTER_USED_MIN;
+	unsigned int		cluster = FreeClusterSearchStart_ < end_cluster ? FreeClusterSearchStart_ : CLUSTER_USED_MIN;
+
+	if (FreeBitmap_ != 0) {
+		for (unsigned int scan_count=0; scan_count<end_cluster; ) {
+			if ((cluster & 0x07)==0 && FreeBitmap_[cluster >> 3]==0xFF) {
+				// Skip fully used byte.
+				cluster += 8;
+				scan_count += 8;
+			} else {
+				if ((FreeBitmap_[cluster >> 3] & (1 << (cluster & 0x07))) == 0) {
+					return cluster;
+				}
+				++cluster;
+				++scan_count;
+			}
+			if (cluster >= end_cluster) {
+				cluster = CLUSTER_USED_MIN;
+			}
+		}
+	} else {
+		const unsigned int	fatentries_per_block = FatEntriesPerBlock();
+
+		for (unsigned int scan_count=0; scan_count<=BlocksPerFat_; ++scan_count) {
+			const unsigned int	block_nr = cluster / fatentries_per_block;
+			const unsigned int	start_index = cluster % fatentries_per_block;
+
+			filesystem_dprintf(("FAT16::FindFreeCluster searches for free cluster in block %d, start index %d\n", block_nr, start_index));
+			for (unsigned int i=start_index; i<fatentries_per_block; ++i) {
+				const unsigned int	found = block_nr * fatentries_per_block + i;
+				if (found>=CLUSTER_USED_MIN && found<end_cluster && IsClusterFree(found)) {
+					return found;
+				}
+			}
+			cluster = ((block_nr + 1) % BlocksPerFat_) * fatentries_per_block;
+		}
+	}
+
+	// Perhaps we failed.
+	throw Error("FAT16: Disk Full.");
+}
+
+//*******************************************************************
+bool
+FAT16::IsClusterFree(
+	const unsigned int	Cluster
+)
+{
+	if (FreeBitmap_ != 0) {
+		// Reserved clusters are marked in the bitmap.
+		return (FreeBitmap_[Cluster >> 3] & (1 << (Cluster & 0x07))) == 0;
+	}
+
+	if (NextCluster(Cluster) != CLUSTER_AVAILABLE) {
+		return false;
+	}
+	for (unsigned int i=0; i<ARRAYSIZE(Files_); ++i) {
+		const FatFile&	file = Files_[i];
+		if (file.IsOpen && Cluster>=file.ReservedCluster && Cluster<file.ReservedCluster+file.ReservedCount) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//*******************************************************************
+unsigned int
+FAT16::FindFreeRun(
+	const unsigned int	Start,
+	const unsigned int	Count,
+	unsigned int&		Found,
+	const bool			Aligned
+)
+{
+	const unsigned int	end_cluster = NrOfClusters_ + CLUSTER_USED_MIN;
+	unsigned int		cluster = Start>=CLUSTER_USED_MIN && Start<end_cluster ? Start : CLUSTER_USED_MIN;
+	unsigned int		run_start = 0;
+	unsigned int		run_count = 0;
+	unsigned int		best_start = 0;
+
+	Found = 0;
+	for (unsigned int scan_count=0; scan_count<NrOfClusters_; ++scan_count) {
+		if (run_count == 0 && Aligned && ClustersToEraseUnitEnd(cluster) != EraseUnitClusters_) {
+			// Not the start of an erase unit.
+		} else if (IsClusterFree(cluster)) {
+			if (run_count == 0) {
+				run_start = cluster;
+			}
+			++run_count;
+			if (run_count > Found) {
+				best_start = run_start;
+				Found = run_count;
+				if (Found == Count) {
+					break;
+				}
+			}
+		} else {
+			run_count = 0;
+		}
+
+		// Runs do not wrap around.
+		++cluster;
+		if (cluster >= end_cluster) {
+			cluster = CLUSTER_USED_MIN;
+			run_count = 0;
+		}
+	}
+
+	return best_start;
+}
+
+//*******************************************************************
+FAT16::FatFile&
+FAT16::OpenFile(
+	const unsigned int	fd
+)
+{
+	if (fd>=ARRAYSIZE(Files_) || !Files_[fd].IsOpen) {
+		throw Error("FAT16: file descriptor %d is not open.", fd);
+	}
+	return Files_[fd];
+}
+
+//*******************************************************************
+unsigned int
+FAT16::ClusterBlock(
+	const unsigned int	Cluster
+) const
+{
+	return PartitionStartBlock_ + DataStartBlock_ + (Cluster - CLUSTER_USED_MIN) * BlocksPerCluster_;
+}
+
+//*******************************************************************
+unsigned int
+FAT16::ClustersToEraseUnitEnd(
+	const unsigned int	Cluster
+) const
+{
+	// Clusters starting in the erase unit of the cluster. When the data area is not
+	// aligned to clusters, the last one of them extends into the next unit.
+	const unsigned int	unit = EraseUnitClusters_ * BlocksPerCluster_;
+	const unsigned int	offset = ClusterBlock(Cluster) % unit;
+	return (unit - offset + BlocksPerCluster_ - 1) / BlocksPerCluster_;
+}
+
+//*******************************************************************
+void
+FAT16::ReleaseReserved(
+	FatFile&	file
+)
+{
+	if (FreeBitmap_ != 0) {
+		for (unsigned int i=file.ReservedCluster; i<file.ReservedCluster+file.ReservedCount; ++i) {
+			FreeBitmap_[i >> 3] &= ~(1 << (i & 0x07));
+		}
+	}
+	if (file.ReservedCount>0 && file.ReservedCluster<FreeClusterSearchStart_) {
+		FreeClusterSearchStart_ = file.ReservedCluster;
+	}
+	file.ReservedCount = 0;
+}
+
+//*******************************************************************
+void
+FAT16::AppendCluster(
+	FatFile&	file
+)
+{
+	unsigned int	cluster = 0;
+
+	if (file.ReservedCount > 0) {
+		// Already marked in the free cluster bitmap.
+		cluster = file.ReservedCluster;
+		++file.ReservedCluster;
+		--file.ReservedCount;
+	} else {
+		cluster = FindFreeCluster();
+		filesystem_dprintf(("FAT16::AppendCluster found free cluster %d\n", cluster));
+		FreeClusterSearchStart_ = cluster + 1;
+		if (FreeBitmap_ != 0) {
+			FreeBitmap_[cluster >> 3] |= 1 << (cluster & 0x07);
+		}
+	}
+	if (FreeCount_ != FSINFO_UNKNOWN) {
+		--FreeCount_;
+	}
+	FsInfoDirty_ = true;
+
+	// 1. Set new cluster to be the last one.
+	SetFatEntry(cluster, EndOfChain_);
+
+	// 2. Link the new cluster to the chain.
+	if (file.SizeClusters == 0) {
+		// First cluster of an empty file goes to the directory entry.
+		file.FirstCluster = cluster;
+
+		Fat16DirectoryEntry	direntry = DirectoryEntries_.Fetch(file.DirectoryBlock)[file.DirectoryBlockIndex];
+		SetFirstCluster(direntry, cluster);
+		DirectoryEntries_[file.DirectoryBlockIndex] = direntry;
+	} else {
+		// Set the previous cluster to point to the new cluster.
+		SetFatEntry(file.CurrentCluster, cluster);
+	}
+
+	// 3. Update current cluster.
+	MapCluster(file, file.SizeClusters, cluster);
+	file.HintRelativeCluster = file.SizeClusters;
+	file.HintCluster = cluster;
+	file.SizeClusters	= file.SizeClusters + 1;
+	file.CurrentCluster = cluster;
+}
+
+//*******************************************************************
+void
+FAT16::WriteRun(
+	FatFile&			file,
+	const void*			blocks,
+	const unsigned int	count,
+	const bool			Cached
+)
+{
+	const bool	past_eof = file.RelativeBlock == file.SizeBlocks;
+
+	// Do we need to find a new cluster?
+	if (past_eof && (file.SizeBlocks % BlocksPerCluster_)==0) {
+		AppendCluster(file);
+	}
+
+	const unsigned int	data_block_nr = DataStartBlock_ +
+										(file.CurrentCluster - 2)*BlocksPerCluster_ +
+										(file.RelativeBlock % BlocksPerCluster_);
+
+	// Take the rest of the reserved clusters, if the run spans them.
+	for (unsigned int i=BlocksPerCluster_; i<(file.RelativeBlock % BlocksPerCluster_) + count; i+=BlocksPerCluster_) {
+		AppendCluster(file);
+	}
+
+	// Write :)
+	if (Cached && count == 1) {
+		WriteDevice(data_block_nr, blocks);
+	} else {
+		WriteDevice(data_block_nr, count, blocks);
+	}
+
+	// Is file size increased?
+	const unsigned int	end_block = file.RelativeBlock + count;
+	if (end_block > file.SizeBlocks) {
+		file.SizeBlocks = end_block;
+		file.Size	= file.SizeBlocks * BLOCK_SIZE;
+		if (GroupCommit_) {
+			// Directory entry is updated by Commit().
+			return;
+		}
+		Fat16DirectoryEntry	direntry = DirectoryEntries_.Fetch(file.DirectoryBlock)[file.DirectoryBlockIndex];
+		direntry.Size = file.Size;
+		DirectoryEntries_[file.DirectoryBlockIndex] = direntry;
+	} else {
+		// shall we set new size because last block of the file was written to?
+		const unsigned int	full_size = file.SizeBlocks * BLOCK_SIZE;
+		if (end_block==file.SizeBlocks && full_size!=file.Size && !GroupCommit_) {
+			Fat16DirectoryEntry	direntry = DirectoryEntries_.Fetch(file.DirectoryBlock)[file.DirectoryBlockIndex];
+			direntry.Size = full_size;
+			DirectoryEntries_[file.DirectoryBlockIndex] = direntry;
+		}
+	}
+}
+
+//*******************************************************************
+void
+FAT16::SetFatEntry(
+	const unsigned int	Cluster,
+	const unsigned int	Value
+)
+{
+	const unsigned int	fatentries_per_block = FatEntriesPerBlock();
+	const unsigned int	block_nr = Cluster / fatentries_per_block;
+	const unsigned int	index = Cluster % fatentries_per_block;
+
+	if (Fat32_) {
+		// Keep the reserved top bits.
+		Fat32Entries_.Fetch(block_nr);
+		Fat32Entries_[index] = (Fat32Entries_[index] & ~CLUSTER32_MASK) | (Value & CLUSTER32_MASK);
+	} else {
+		FatEntries_.Fetch(block_nr);
+		FatEntries_[index] = Value;
+	}
+
+	if (GroupCommit_) {
+		if (block_nr < MirrorFirst_) {
+			MirrorFirst_ = block_nr;
+		}
+		if (block_nr >= MirrorEnd_) {
+			MirrorEnd_ = block_nr + 1;
+		}
+	}
+}
+
+//*******************************************************************
+void
+FAT16::UpdateDirectoryEntry(
+	FatFile&	file
+)
+{
+	Fat16DirectoryEntry	direntry = DirectoryEntries_.Fetch(file.DirectoryBlock)[file.DirectoryBlockIndex];
+	if (direntry.Size != file.Size || FirstClusterOf(direntry) != file.FirstCluster) {
+		direntry.Size = file.Size;
+		SetFirstCluster(direntry, file.FirstCluster);
+		DirectoryEntries_[file.DirectoryBlockIndex] = direntry;
+	}
 }
 
 } // namespace Filesystem
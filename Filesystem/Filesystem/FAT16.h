@@ -5,13 +5,21 @@ vim: shiftwidth=4
 #ifndef Filesystem_FAT16_h_
 #define	Filesystem_FAT16_h_
 
-#include <Filesystem/BlockDevice.h>
+#include <Filesystem/Blockdevice.h>
 #include <Filesystem/Blockbuffer.h>
+#include <Filesystem/Blockcache.h>
 
 #include <functional>			// pointer_to_unary_function :)
 #include <stdbool.h>			// bool, true, false.
 #include <stdint.h>				// int32, etc.
 
+#include <Filesystem_Config.h>
+
+#if !defined(FILESYSTEM_MAX_OPEN_FILES)
+/** Number of files open at the same time, each costs one FatFile in the FAT16 object. */
+#	define	FILESYSTEM_MAX_OPEN_FILES	4
+#endif
+
 namespace Filesystem {
 
 typedef enum {
@@ -25,15 +33,99 @@ typedef enum {
 
 
 
-/** FAT16 filesystem running on top of some block device, probably SD/MMC memory card. */
+/** FAT16 or FAT32 filesystem running on top of some block device, probably SD/MMC memory card.
+
+Up to FILESYSTEM_MAX_OPEN_FILES files may be open at the same time. They share
+the FAT, directory and data caches, so clusters allocated or reserved for one
+file are never handed out to another. A file can be open only once.
+
+On FAT32 the root directory is a cluster chain, which grows when it is full.
+The FSInfo free cluster count and next free cluster hint are kept up to date,
+allocation starts from the hint instead of scanning the FAT from the beginning.
+*/
 class FAT16 {
 public:
 	enum {
-		BLOCK_SIZE = Blockdevice::BLOCK_SIZE
+		BLOCK_SIZE = Blockdevice::BLOCK_SIZE,
+		/** Maximum number of FAT entries on FAT16, and in the free cluster bitmap. */
+		MAX_CLUSTERS = 65536,
+		/** Size of the free cluster bitmap, bytes. */
+		FREE_BITMAP_SIZE = MAX_CLUSTERS / 8,
+		/** Number of blocks in the built-in cache, used when no cache is given. */
+		DEFAULT_CACHE_BLOCKS = 3
 	};
 public:
+	/** Mount the filesystem.
+
+	When \c free_bitmap is given (FREE_BITMAP_SIZE bytes), the whole FAT is
+	scanned once and new clusters are allocated from the bitmap without
+	reading the FAT. Otherwise the FAT is scanned on every allocation.
+	The bitmap is not used on FAT32 volumes of more than MAX_CLUSTERS clusters.
+
+	FAT, directory and file data blocks are kept in \c cache, which must be
+	built on the same device and outlive the filesystem. When not given,
+	a small built-in cache of DEFAULT_CACHE_BLOCKS blocks is used.
+	*/
 	FAT16(
-		Blockdevice&	device
+		Blockdevice&	device,
+		uint8_t*		free_bitmap = 0,
+		Blockcache*		cache = 0
+	);
+
+	/** Write all cached blocks to the device. */
+	~FAT16();
+
+	/** Number of blocks in a cluster. */
+	unsigned int
+	BlocksPerCluster() const;
+
+	/** Is the filesystem FAT32? */
+	bool
+	IsFat32() const;
+
+	/** Block cache in use. */
+	const Blockcache&
+	Cache() const;
+
+	/** Underlying block device, for raw access to contiguous files. */
+	Blockdevice&
+	Device();
+
+	/** First data block on the device, blocks before it hold the filesystem metadata. */
+	unsigned int
+	DataStartBlock() const;
+
+	/** Enable or disable group commit.
+
+	In group commit mode Flush() writes file data only. The directory entry
+	is updated by Commit(), the second FAT copy by SyncMirror(), Close()
+	does all of them. The first FAT copy is written by Commit() too, but FAT
+	blocks modified since may reach the device earlier, when the block cache
+	evicts them. After power loss the file size is that of the last commit,
+	and the FAT on the device holds the chain of the last commit plus any
+	part of the appended clusters that has been evicted; the chain ends at
+	the first cluster whose entry was not written.
+
+	Nothing is recovered at mount time. RecoverSize() is to be called for
+	each file that was open for writing; it extends the size over the chain
+	found on the device, to the last block written.
+	*/
+	void
+	SetGroupCommit(
+		const bool	Enable
+	);
+
+	/** Enable or disable erasing ahead.
+
+	When enabled, Reserve() continues the file up to the end of its erase
+	unit, or else starts at the beginning of an erase unit of the device,
+	and ends at the end of one. The reserved clusters are erased before
+	Reserve() returns, so that the following multiple block writes never
+	wait for the card to erase. Off by default.
+	*/
+	void
+	SetPreErase(
+		const bool	Enable
 	);
 
 	/* BLOCK INTERFACE. */
@@ -42,6 +134,7 @@ public:
 	Throws exception on error.
 
 	Block pointer will be set to the beginning of the file.
+	Opening a file that is already open is an error.
 
 	TODO: scan directories other than the root, too.
 	*/
@@ -51,12 +144,22 @@ public:
 		OPEN_FLAGS	flags
 	);
 
-	/** Close file opened previously and flush the buffers. */
+	/** Close file opened previously and flush the buffers, the device as well.
+	The descriptor is released even when flushing throws.
+	*/
 	void
 	Close(
 		const unsigned int	fd
 	);
 
+	/** Delete a file which is not open and free its clusters.
+	Throws exception when the file is not found or is open.
+	*/
+	void
+	Remove(
+		const char*	filename
+	);
+
 	/** Query file size. */
 	unsigned int
 	Size(
@@ -83,6 +186,80 @@ public:
 		const void*			block
 	);
 
+	/** Read \c count blocks starting at the current block pointer.
+	Blocks within one cluster are read with one device command.
+	Block pointer is left at the block following the last block read.
+	*/
+	void
+	ReadBlocks(
+		const unsigned int	fd,
+		void*				blocks,
+		const unsigned int	count
+	);
+
+	/** Write \c count blocks starting at the current block pointer.
+	Blocks within one cluster are written with one device command, file
+	size is changed like in Write(). The blocks go straight to the device,
+	also a single one, without passing the cache.
+	Block pointer is left at the block following the last block written.
+	*/
+	void
+	WriteBlocks(
+		const unsigned int	fd,
+		const void*			blocks,
+		const unsigned int	count
+	);
+
+	/** Reserve a contiguous run of clusters for \c bytes to be appended to the file.
+
+	Reserved clusters are taken by the following appends in order, so that
+	writes spanning several of them go to the device with one command.
+	File size is not changed and the FAT is not touched until the data
+	is written, unused clusters are released on Close().
+	A shorter run is reserved when no run of the requested length is free.
+	\return Number of bytes which can be appended without allocating clusters.
+	*/
+	unsigned int
+	Reserve(
+		const unsigned int	fd,
+		const unsigned int	bytes
+	);
+
+	/** Give an empty file a contiguous run of clusters for \c bytes, without writing them.
+	File size is set to the end of the last cluster, file contents are whatever
+	the clusters held before. FAT and directory entry are written.
+	Throws exception when no run of the requested length is free.
+	*/
+	void
+	Preallocate(
+		const unsigned int	fd,
+		const unsigned int	bytes
+	);
+
+	/** Device blocks of a file stored in one run of clusters, to be accessed bypassing
+	the filesystem. Cached blocks of the file are dropped.
+	Throws exception when the file is empty or fragmented.
+	\param[out]	blocks	Number of blocks in the run, whole clusters.
+	\return First device block of the file.
+	*/
+	unsigned int
+	ContiguousBlocks(
+		const unsigned int	fd,
+		unsigned int&		blocks
+	);
+
+	/** Device blocks from the block pointer on which are consecutive on the device,
+	up to the end of the file. The block pointer is left past them, so that repeated
+	calls walk the cluster chain once, e.g. to read a file straight from a disk image.
+	\param[out]	count	Number of blocks, 0 at the end of the file.
+	\return First device block.
+	*/
+	unsigned int
+	NextRun(
+		const unsigned int	fd,
+		unsigned int&		count
+	);
+
 	/** Seek to the given block. Permits seeking one block past
 	the file size -- writing to this position increments file size.
 	*/
@@ -103,11 +280,49 @@ public:
 		const unsigned int	Size
 	);
 
-	/** Flush file and filesystem buffers. */
+	/** Flush file and filesystem buffers. In group commit mode, flush file data only. */
 	void
 	Flush(
 		const unsigned int	fd
 	);
+
+	/** Write file data, the first FAT copy and the directory entry, then
+	Blockdevice::Flush() the device, so that all of them have reached the card.
+	*/
+	void
+	Commit(
+		const unsigned int	fd
+	);
+
+	/** Write FAT blocks modified since the last call to the second FAT copy. */
+	void
+	SyncMirror();
+
+	/** Extend the file size over the cluster chain, if the chain is longer.
+	To be called after power loss in group commit mode, for each file that
+	was being written; mounting the filesystem does not do it.
+
+	The size is extended to the last block of the chain which does not read all
+	zeros or all ones, as erased blocks do; clusters past it are freed. Blocks
+	are recovered whole, the end of the last one is whatever the device held
+	before. Blocks left by deleted files are recovered as well, unless the
+	clusters were erased ahead, see SetPreErase().
+	\return Number of bytes added to the file size.
+	*/
+	unsigned int
+	RecoverSize(
+		const unsigned int	fd
+	);
+
+	/** Check once whether the device is still writing a block, without waiting.
+	\return true while the device is busy.
+	*/
+	bool
+	Poll();
+
+	/** Number of files open, the filesystem must outlive them. */
+	unsigned int
+	OpenFiles() const;
 private:
 	void
 	ReadDevice(
@@ -115,13 +330,54 @@ private:
 		void*				Block
 	);
 
+	/** Blockdevice::Flush(), throws exception when the device fails. */
+	void
+	FlushDevice();
+
+	void
+	ReadDevice(
+		const unsigned int	Nr,
+		const unsigned int	Count,
+		void*				Blocks
+	);
+
 	void
 	WriteDevice(
 		const unsigned int	Nr,
 		const void*			Block
 	);
+
+	/** Write blocks bypassing the cache, cached copies are dropped. */
+	void
+	WriteDevice(
+		const unsigned int	Nr,
+		const unsigned int	Count,
+		const void*			Blocks
+	);
 private:
 	typedef uint16_t		FatEntry;
+	typedef uint32_t		Fat32Entry;
+
+	/** Run of physically consecutive clusters of a file. */
+	typedef struct
+	{
+		/** First cluster of the run, relative to the beginning of the file. */
+		unsigned int		RelativeCluster;
+		/** First cluster of the run on the disk. */
+		unsigned int		Cluster;
+		/** Number of clusters in the run. */
+		unsigned int		Count;
+	} Extent;
+
+	enum {
+		/** Number of extents remembered per open file. */
+		MAX_EXTENTS	= 32
+	};
+
+	enum {
+		/** Past the end of the root directory. */
+		NO_BLOCK	= 0xFFFFFFFF
+	};
 
 	/** Internal representation of an opened file. */
 	typedef struct
@@ -151,6 +407,20 @@ private:
 		unsigned int		RelativeBlock;
 		/** Cluster relative to the beginning of the file. */
 		unsigned int		RelativeCluster;
+		/** Extent map of the cluster chain, built lazily, sorted by RelativeCluster.
+		When it fills up every second extent is dropped, the clusters between the
+		remaining ones are found by walking the FAT from the extent before. */
+		Extent				Extents[MAX_EXTENTS];
+		/** Number of extents in use. */
+		unsigned int		NrOfExtents;
+		/** Last cluster found by ClusterOf() or appended, relative to the beginning of the file. */
+		unsigned int		HintRelativeCluster;
+		/** Disk cluster of HintRelativeCluster, 0 if none. */
+		unsigned int		HintCluster;
+		/** First reserved cluster. */
+		unsigned int		ReservedCluster;
+		/** Number of reserved clusters. */
+		unsigned int		ReservedCount;
 	} FatFile;
 
 	/** Number of characters in Fat16 filename length. */
@@ -176,8 +446,8 @@ private:
 		uint16_t	CreatedDate;					// 16,17
 		/** Last accessed date. */
 		uint16_t	LastAccessedDate;				// 18,19
-		/**   Extended Attribute (reserved for OS/2; always 0). */
-		uint16_t	ExtendedAttribute;				// 20,21
+		/** High word of the first cluster on FAT32 (Extended Attribute on FAT16; always 0). */
+		uint16_t	ClusterHigh;					// 20,21
 		uint16_t	Time;							// 22,23
 		uint16_t	Date;							// 24,25
 		uint16_t	Cluster;						// 26,27
@@ -196,10 +466,218 @@ private:
 		Fat16DirectoryEntry&	entry
 	);
 
+	/** Fix endianness of all directory entries in the block. */
+	static void
+	FixDirectoryBlockEndian(
+		void*	block
+	);
+
+	/** Fix endianness of all FAT entries in the block. */
+	static void
+	FixFatBlockEndian(
+		void*	block
+	);
+
+	/** Fix endianness of all FAT32 entries in the block. */
+	static void
+	FixFat32BlockEndian(
+		void*	block
+	);
+
+	/** First cluster of the file in the directory entry. */
+	unsigned int
+	FirstClusterOf(
+		const Fat16DirectoryEntry&	entry
+	) const;
+
+	/** Set first cluster of the file in the directory entry. */
+	static void
+	SetFirstCluster(
+		Fat16DirectoryEntry&	entry,
+		const unsigned int		Cluster
+	);
+
+	/** Is the cluster within the data area? */
+	bool
+	IsDataCluster(
+		const unsigned int	Cluster
+	) const;
+
+	/** Number of FAT entries in one block. */
+	unsigned int
+	FatEntriesPerBlock() const;
+
+	/** FAT entry of the cluster, i.e. the next cluster in the chain. */
+	unsigned int
+	NextCluster(
+		const unsigned int	Cluster
+	);
+
+	/** Set the FAT range and its second copy, if in use. */
+	void
+	SetFatOptions(
+		const bool	Mirror
+	);
+
+	/** Write FAT blocks in the cache to the first copy. */
+	void
+	FlushFat();
+
+	/** Write cached file data blocks. Directory blocks of open files, which are in
+	the data area on FAT32, are left for the directory flush.
+	*/
+	void
+	FlushData();
+
+	/** Directory block number of the given root directory block.
+	\return NO_BLOCK past the end of the root directory.
+	*/
+	unsigned int
+	RootDirectoryBlock(
+		const unsigned int	Index
+	);
+
+	/** Append an empty cluster to the root directory on FAT32.
+	\return Directory block number of its first block.
+	*/
+	unsigned int
+	ExtendRootDirectory();
+
+	/** Read the free cluster count and the next free cluster hint from FSInfo. */
+	void
+	LoadFsInfo();
+
+	/** Write the free cluster count and the next free cluster hint to FSInfo, if changed. */
+	void
+	WriteFsInfo();
+
+	/** Add cluster to the end of the extent map of the file, clusters before the
+	end of the map are ignored. Every second extent is dropped when the map is full.
+	*/
+	void
+	MapCluster(
+		FatFile&			file,
+		const unsigned int	RelativeCluster,
+		const unsigned int	Cluster
+	);
+
+	/** Find the disk cluster of the given file cluster. Uses the extent map,
+	otherwise walks the FAT from the nearest known cluster before it: the end
+	of the extent before it or the cluster found last, e.g. one step when
+	moving to the next cluster. Clusters past the end of the map are mapped.
+	*/
+	unsigned int
+	ClusterOf(
+		FatFile&			file,
+		const unsigned int	RelativeCluster
+	);
+
+	/** Free the clusters of the chain starting at \c Cluster. */
+	void
+	FreeChain(
+		const unsigned int	Cluster
+	);
+
+	/** Does the device block read all zeros or all ones? */
+	bool
+	IsBlockErased(
+		const unsigned int	Nr
+	);
+
+	/** Scan the FAT and fill in the free cluster bitmap. */
+	void
+	LoadFreeBitmap();
+
+	/** Find a free cluster, starting from FreeClusterSearchStart_.
+	Throws exception when disk is full.
+	*/
+	unsigned int
+	FindFreeCluster();
+
+	/** Is the cluster free and not reserved by an open file? */
+	bool
+	IsClusterFree(
+		const unsigned int	Cluster
+	);
+
+	/** Find the first run of \c Count free clusters, starting from \c Start.
+	When there is none, the longest run is returned.
+	With \c Aligned, runs start at the beginning of an erase unit only.
+	\param[out]	Found	Length of the run found.
+	\return First cluster of the run.
+	*/
+	unsigned int
+	FindFreeRun(
+		const unsigned int	Start,
+		const unsigned int	Count,
+		unsigned int&		Found,
+		const bool			Aligned = false
+	);
+
+	/** Device block of the cluster. */
+	unsigned int
+	ClusterBlock(
+		const unsigned int	Cluster
+	) const;
+
+	/** Number of clusters from \c Cluster to the end of its erase unit,
+	EraseUnitClusters_ for the first cluster of a unit.
+	*/
+	unsigned int
+	ClustersToEraseUnitEnd(
+		const unsigned int	Cluster
+	) const;
+
+	/** Open file of the descriptor, throws exception when \c fd is not open. */
+	FatFile&
+	OpenFile(
+		const unsigned int	fd
+	);
+
+	/** Release clusters reserved for the file. */
+	void
+	ReleaseReserved(
+		FatFile&	file
+	);
+
+	/** Append the next reserved or a free cluster to the cluster chain of the file.
+	Current cluster of the file is set to the new cluster.
+	*/
+	void
+	AppendCluster(
+		FatFile&	file
+	);
+
+	/** Set FAT entry of the cluster. */
+	void
+	SetFatEntry(
+		const unsigned int	Cluster,
+		const unsigned int	Value
+	);
+
+	/** Write file size and first cluster into the directory entry, if changed. */
+	void
+	UpdateDirectoryEntry(
+		FatFile&	file
+	);
+
+	/** Write blocks at the current block pointer, all within the current cluster.
+	New cluster is allocated when writing past the end of the file at the cluster boundary.
+	Appends at the cluster boundary may span several reserved clusters.
+	\param[in]	Cached	Write a single block into the cache, instead of to the device.
+	*/
+	void
+	WriteRun(
+		FatFile&			file,
+		const void*			blocks,
+		const unsigned int	count,
+		const bool			Cached
+	);
+
 	/** Underlying block device. */
 	Blockdevice&	Device_;
 	/** List of open files. */
-	FatFile			Files_[1];	// at the moment limited to one.
+	FatFile			Files_[FILESYSTEM_MAX_OPEN_FILES];
 
 	/** Partition start block. */
 	unsigned int	PartitionStartBlock_;
@@ -221,11 +699,51 @@ private:
 	unsigned int	LastEmptyBlock_;
 	/** Free cluster search start cluster. */
 	unsigned int	FreeClusterSearchStart_;
+	/** Number of data clusters. */
+	unsigned int	NrOfClusters_;
+	/** Is the filesystem FAT32? */
+	bool			Fat32_;
+	/** FAT entry of the last cluster of a file. */
+	unsigned int	EndOfChain_;
+	/** First cluster of the root directory, FAT32 only. */
+	unsigned int	RootCluster_;
+	/** Root directory cluster found last by RootDirectoryBlock(). */
+	unsigned int	RootDirCluster_;
+	/** Index of RootDirCluster_ in the root directory chain. */
+	unsigned int	RootDirClusterIndex_;
+	/** FSInfo block, 0 if not in use. */
+	unsigned int	FsInfoBlock_;
+	/** Number of free clusters, 0xFFFFFFFF if not known. */
+	unsigned int	FreeCount_;
+	/** Are the FSInfo fields changed since loaded or written? */
+	bool			FsInfoDirty_;
+	/** Free cluster bitmap, bit set when cluster is in use. NULL if not in use. */
+	uint8_t*		FreeBitmap_;
+	/** Is group commit enabled? */
+	bool			GroupCommit_;
+	/** Is erasing ahead enabled? */
+	bool			PreErase_;
+	/** Clusters in an erase unit of the device, 1 when not aligning to erase units. */
+	unsigned int	EraseUnitClusters_;
+	/** First FAT block not yet written to the second copy. */
+	unsigned int	MirrorFirst_;
+	/** End of FAT blocks not yet written to the second copy. */
+	unsigned int	MirrorEnd_;
+
+	/** Memory of the built-in cache. */
+	uint32_t		OwnCacheMemory_[(DEFAULT_CACHE_BLOCKS * Blockcache::SLOT_SIZE + 3) / 4];
+	/** Built-in cache, used when no cache is given. */
+	Blockcache		OwnCache_;
+	/** Cache of the FAT, directory and file data blocks. */
+	Blockcache&		Cache_;
 
-	/** Directory entries, one block cached. */
+	/** Directory entries, current block pinned in the cache.
+	The range is the root directory on FAT16, the whole data area on FAT32. */
 	Blockbuffer<Fat16DirectoryEntry>	DirectoryEntries_;
-	/** FAT entries, one block cached. */
+	/** FAT entries, current block pinned in the cache. */
 	Blockbuffer<FatEntry>				FatEntries_;
+	/** FAT32 entries, current block pinned in the cache. */
+	Blockbuffer<Fat32Entry>				Fat32Entries_;
 
 }; // class FAT16
 
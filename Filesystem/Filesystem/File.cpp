@@ -23,6 +23,17 @@ File::File(
 	,buffer_block_nr_(0)
 	,buffer_valid_(false)
 	,buffer_dirty_(false)
+	,queue_(0)
+	,queue_size_(0)
+	,queue_head_(0)
+	,queue_count_(0)
+	,queue_block_nr_(0)
+	,ahead_(0)
+	,ahead_size_(0)
+	,ahead_window_(0)
+	,ahead_block_nr_(0)
+	,ahead_count_(0)
+	,next_read_block_nr_(0)
 {
 	fd_ = filesys_.Open(filename, flags);
 	const unsigned int	size = filesys_.Size(fd_);
@@ -35,6 +46,11 @@ File::~File()
 {
 	try {
 		Flush();
+	} catch (const std::exception& e) {
+		filesystem_dprintf(("File::~File Exception: '%s'\n", e.what()));
+	}
+	// Close even when flushing failed, the filesystem may stay mounted.
+	try {
 		filesys_.Close(fd_);
 	} catch (const std::exception& e) {
 		filesystem_dprintf(("File::~File Exception: '%s'\n", e.what()));
@@ -56,23 +72,38 @@ File::Read(
 	unsigned int	todo = size;
 	char*			ptr = reinterpret_cast<char*>(buffer);
 
+	FlushQueue();
 	while (todo>0) {
+		// Whole blocks are read directly into the caller's buffer.
+		if (pos_mod_blocks_==0 && todo>=BLOCK_SIZE) {
+			const unsigned int	nblocks = todo / BLOCK_SIZE;
+			const unsigned int	nbytes = nblocks * BLOCK_SIZE;
+
+			FlushBuffer();
+			filesys_.SeekSetBlock(fd_, pos_blocks_);
+			filesys_.ReadBlocks(fd_, ptr, nblocks);
+			next_read_block_nr_ = pos_blocks_ + nblocks;
+
+			SeekSet(Pos() + nbytes);
+			todo -= nbytes;
+			ptr += nbytes;
+			continue;
+		}
+
 		// Fetch current block.
 		const unsigned int	this_round =
 			(pos_mod_blocks_ + todo) > BLOCK_SIZE
 				? BLOCK_SIZE - pos_mod_blocks_
 				: todo;
-		const char*			block = Fetch(pos_blocks_);
+		const char*			block = FetchAhead(pos_blocks_);
 
 		// Copy data.
-		for (unsigned int i=0; i<this_round; ++i) {
-			*ptr = block[pos_mod_blocks_ + i];
-			++ptr;
-		}
+		memcpy(ptr, block + pos_mod_blocks_, this_round);
 
 		// Adjust pointers.
 		SeekSet(Pos() + this_round);
 		todo -= this_round;
+		ptr += this_round;
 	}
 }
 
@@ -92,7 +123,37 @@ File::Write(
 	unsigned int	todo = size;
 	char*			block = 0;
 
+	// Blocks read ahead may be overwritten.
+	ahead_count_ = 0;
+	if (queue_size_>0 && Pos()==Size()) {
+		WriteQueued(ptr, size);
+		return;
+	}
+	DrainQueue();
+
 	while (todo>0) {
+		// Whole blocks are written directly from the caller's buffer.
+		if (pos_mod_blocks_==0 && todo>=BLOCK_SIZE) {
+			const unsigned int	nblocks = todo / BLOCK_SIZE;
+			const unsigned int	nbytes = nblocks * BLOCK_SIZE;
+
+			FlushBuffer();
+			if (buffer_block_nr_>=pos_blocks_ && buffer_block_nr_<pos_blocks_+nblocks) {
+				buffer_valid_ = false;
+			}
+			filesys_.SeekSetBlock(fd_, pos_blocks_);
+			filesys_.WriteBlocks(fd_, ptr, nblocks);
+
+			SeekSet(Pos() + nbytes);
+			if (Pos() > Size()) {
+				size_blocks_		= pos_blocks_;
+				size_mod_blocks_	= pos_mod_blocks_;
+			}
+			todo -= nbytes;
+			ptr += nbytes;
+			continue;
+		}
+
 		// Fetch current block.
 		const unsigned int	this_round =
 			(pos_mod_blocks_ + todo) > BLOCK_SIZE
@@ -156,10 +217,123 @@ void
 File::Flush()
 {
 	FlushBuffer();
+	FlushQueue();
 	filesys_.SetSize(fd_, size_blocks_*BLOCK_SIZE + size_mod_blocks_);
 	filesys_.Flush(fd_);
 }
 
+//*******************************************************************
+void
+File::SetQueue(
+	void*				memory,
+	const unsigned int	nblocks
+)
+{
+	DrainQueue();
+	queue_ = reinterpret_cast<char*>(memory);
+	queue_size_ = memory!=0 ? nblocks : 0;
+	queue_head_ = 0;
+	queue_count_ = 0;
+}
+
+//*******************************************************************
+unsigned int
+File::Pump(
+	const unsigned int	max_blocks
+)
+{
+	if (queue_count_ == 0 || filesys_.Poll()) {
+		return 0;
+	}
+	return WriteQueue(max_blocks);
+}
+
+//*******************************************************************
+unsigned int
+File::Queued() const
+{
+	return queue_count_;
+}
+
+//*******************************************************************
+unsigned int
+File::WriteQueue(
+	const unsigned int	max_blocks
+)
+{
+	if (queue_count_ == 0) {
+		return 0;
+	}
+
+	// Last block is not complete until the file size is at the block boundary.
+	const unsigned int	completed = size_mod_blocks_!=0 ? queue_count_ - 1 : queue_count_;
+	unsigned int		nblocks = completed < max_blocks ? completed : max_blocks;
+	if (nblocks > queue_size_ - queue_head_) {
+		nblocks = queue_size_ - queue_head_;
+	}
+
+	if (nblocks > 0) {
+		filesys_.SeekSetBlock(fd_, queue_block_nr_);
+		filesys_.WriteBlocks(fd_, queue_ + queue_head_*BLOCK_SIZE, nblocks);
+
+		queue_head_ = (queue_head_ + nblocks) % queue_size_;
+		queue_count_ -= nblocks;
+		queue_block_nr_ += nblocks;
+	}
+	return nblocks;
+}
+
+//*******************************************************************
+void
+File::SetReadAhead(
+	void*				memory,
+	const unsigned int	nblocks
+)
+{
+	ahead_ = reinterpret_cast<char*>(memory);
+	ahead_size_ = memory!=0 ? nblocks : 0;
+	ahead_window_ = ahead_size_ < 2 ? ahead_size_ : 2;
+	ahead_count_ = 0;
+}
+
+//*******************************************************************
+unsigned int
+File::Reserve(
+	const unsigned int	bytes
+)
+{
+	// Buffered bytes are not yet counted in the file size of the filesystem,
+	// written blocks are counted in full.
+	const int			buffered = static_cast<int>(Size()) - static_cast<int>(filesys_.Size(fd_));
+	const unsigned int	reserved = filesys_.Reserve(fd_, buffered>0 ? bytes + buffered : bytes);
+	const int			available = static_cast<int>(reserved) - buffered;
+	return available>0 ? available : 0;
+}
+
+//*******************************************************************
+void
+File::Commit()
+{
+	FlushBuffer();
+	FlushQueue();
+	filesys_.SetSize(fd_, size_blocks_*BLOCK_SIZE + size_mod_blocks_);
+	filesys_.Commit(fd_);
+}
+
+//*******************************************************************
+unsigned int
+File::RecoverSize()
+{
+	FlushBuffer();
+	DrainQueue();
+	ahead_count_ = 0;
+	const unsigned int	recovered = filesys_.RecoverSize(fd_);
+	const unsigned int	size = filesys_.Size(fd_);
+	size_blocks_ = size / BLOCK_SIZE;
+	size_mod_blocks_ = size % BLOCK_SIZE;
+	return recovered;
+}
+
 //*******************************************************************
 char*
 File::Fetch(
@@ -195,4 +369,128 @@ File::FlushBuffer()
 	}
 }
 
+//*******************************************************************
+const char*
+File::FetchAhead(
+	const unsigned int	block_nr
+)
+{
+	const bool	sequential = block_nr == next_read_block_nr_;
+
+	next_read_block_nr_ = block_nr + 1;
+
+	// 1. Read ahead before.
+	if (ahead_count_ > 0 && block_nr - ahead_block_nr_ < ahead_count_) {
+		return ahead_ + (block_nr - ahead_block_nr_) * BLOCK_SIZE;
+	}
+
+	// 2. Buffered block, it may hold changes.
+	if (ahead_size_ < 2 || (buffer_valid_ && block_nr == buffer_block_nr_)) {
+		return Fetch(block_nr);
+	}
+	if (!sequential) {
+		ahead_window_ = 2;
+		return Fetch(block_nr);
+	}
+
+	// 3. Sequential: the next blocks on the device, before the queued ones.
+	unsigned int	end = (filesys_.Size(fd_) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if (queue_count_ > 0 && queue_block_nr_ < end) {
+		end = queue_block_nr_;
+	}
+	if (block_nr + 2 > end) {
+		return Fetch(block_nr);
+	}
+	const unsigned int	count = end - block_nr < ahead_window_ ? end - block_nr : ahead_window_;
+	FlushBuffer();
+	ahead_count_ = 0;
+	filesys_.SeekSetBlock(fd_, block_nr);
+	filesys_.ReadBlocks(fd_, ahead_, count);
+	ahead_block_nr_ = block_nr;
+	ahead_count_ = count;
+	ahead_window_ = 2 * ahead_window_ < ahead_size_ ? 2 * ahead_window_ : ahead_size_;
+	return ahead_;
+}
+
+//*******************************************************************
+void
+File::WriteQueued(
+	const char*			buffer,
+	const unsigned int	size
+)
+{
+	const char*		ptr = buffer;
+	unsigned int	todo = size;
+
+	// 1. Partially filled last block of the file is the first one in the queue.
+	if (queue_count_ == 0) {
+		queue_head_ = 0;
+		queue_block_nr_ = pos_blocks_;
+		if (pos_mod_blocks_ != 0) {
+			memcpy(queue_, Fetch(pos_blocks_), BLOCK_SIZE);
+			queue_count_ = 1;
+		}
+	}
+
+	// 2. Buffer must not keep a copy of the queued block, the queue has the latest data.
+	if (buffer_valid_ && buffer_block_nr_ >= queue_block_nr_) {
+		buffer_valid_ = false;
+		buffer_dirty_ = false;
+	}
+
+	while (todo>0) {
+		// New block, wait for a free slot.
+		if (pos_mod_blocks_ == 0) {
+			while (queue_count_ == queue_size_) {
+				WriteQueue(queue_size_);
+			}
+			++queue_count_;
+			memset(QueueBlock(pos_blocks_), 0, BLOCK_SIZE);
+		}
+
+		const unsigned int	this_round =
+			(pos_mod_blocks_ + todo) > BLOCK_SIZE
+				? BLOCK_SIZE - pos_mod_blocks_
+				: todo;
+		memcpy(QueueBlock(pos_blocks_) + pos_mod_blocks_, ptr, this_round);
+
+		// Always appending.
+		SeekSet(Pos() + this_round);
+		size_blocks_		= pos_blocks_;
+		size_mod_blocks_	= pos_mod_blocks_;
+		todo -= this_round;
+		ptr += this_round;
+	}
+}
+
+//*******************************************************************
+void
+File::FlushQueue()
+{
+	while (WriteQueue(queue_size_) > 0) {
+	}
+	if (queue_count_ > 0) {
+		// Partially filled last block is written, but kept for the following appends.
+		filesys_.SeekSetBlock(fd_, queue_block_nr_);
+		filesys_.Write(fd_, QueueBlock(queue_block_nr_));
+	}
+}
+
+//*******************************************************************
+void
+File::DrainQueue()
+{
+	FlushQueue();
+	queue_count_ = 0;
+}
+
+//*******************************************************************
+char*
+File::QueueBlock(
+	const unsigned int	block_nr
+)
+{
+	return queue_ + ((queue_head_ + block_nr - queue_block_nr_) % queue_size_) * BLOCK_SIZE;
+}
+
 } // namespace Filesystem
@@ -50,9 +50,64 @@ public:
 	unsigned int
 	Size() const;
 
-	/** Flush any pending writes. */
+	/** Flush any pending writes, waits until the write-behind queue is written. */
 	void
 	Flush();
+
+	/** Set up the write-behind queue of \c nblocks blocks in the given memory,
+	which must hold nblocks*BLOCK_SIZE bytes and outlive the file. Appends to the end of the file
+	are then only copied into the queue and reach the device by Pump().
+	Queue is written out before other operations.
+	*/
+	void
+	SetQueue(
+		void*				memory,
+		const unsigned int	nblocks
+	);
+
+	/** Write at most \c max_blocks completed blocks from the write-behind queue.
+	Nothing is written while the device is still busy with a previous block.
+	\return Number of blocks written.
+	*/
+	unsigned int
+	Pump(
+		const unsigned int	max_blocks = 1
+	);
+
+	/** Number of blocks in the write-behind queue. */
+	unsigned int
+	Queued() const;
+
+	/** Set up read-ahead of at most \c nblocks blocks in the given memory,
+	which must hold nblocks*BLOCK_SIZE bytes and outlive the file. When Read()
+	goes through the file block after block, the next blocks are read with one
+	multiple block read and the following reads are served from memory. The
+	number of blocks read ahead starts at 2 and doubles while the reads stay
+	sequential. NULL turns read-ahead off.
+	*/
+	void
+	SetReadAhead(
+		void*				memory,
+		const unsigned int	nblocks
+	);
+
+	/** Reserve contiguous clusters for \c bytes to be appended, see FAT16::Reserve().
+	\return Number of bytes which can be appended without allocating clusters.
+	*/
+	unsigned int
+	Reserve(
+		const unsigned int	bytes
+	);
+
+	/** Flush any pending writes and commit the file size, see FAT16::Commit(). */
+	void
+	Commit();
+
+	/** Extend file size over clusters appended before power loss, see FAT16::RecoverSize().
+	\return Number of bytes added to the file size.
+	*/
+	unsigned int
+	RecoverSize();
 private:
 	char* Fetch(
 		const unsigned int	block_nr
@@ -60,6 +115,39 @@ private:
 
 	void
 	FlushBuffer();
+
+	/** Block for Read(), from the read-ahead blocks when possible. */
+	const char*
+	FetchAhead(
+		const unsigned int	block_nr
+	);
+
+	/** Append to the write-behind queue. */
+	void
+	WriteQueued(
+		const char*			buffer,
+		const unsigned int	size
+	);
+
+	/** Write at most \c max_blocks completed blocks from the queue, waiting for the device if busy. */
+	unsigned int
+	WriteQueue(
+		const unsigned int	max_blocks
+	);
+
+	/** Write all blocks in the queue, the partially filled last block stays in the queue. */
+	void
+	FlushQueue();
+
+	/** Write all blocks in the queue and empty it. */
+	void
+	DrainQueue();
+
+	/** Queued block of the file. */
+	char*
+	QueueBlock(
+		const unsigned int	block_nr
+	);
 private:
 	FAT16&				filesys_;
 	const OPEN_FLAGS	flags_;
@@ -73,6 +161,30 @@ private:
 	char				buffer_[FAT16::BLOCK_SIZE];
 	bool				buffer_valid_;
 	bool				buffer_dirty_;
+
+	/** Write-behind queue blocks, NULL if not in use. */
+	char*				queue_;
+	/** Queue size, blocks. */
+	unsigned int		queue_size_;
+	/** Queue slot of the first block. */
+	unsigned int		queue_head_;
+	/** Number of blocks in the queue, the last one may be partially filled. */
+	unsigned int		queue_count_;
+	/** File block number of the first block in the queue. */
+	unsigned int		queue_block_nr_;
+
+	/** Read-ahead blocks, NULL if not in use. */
+	char*				ahead_;
+	/** Read-ahead memory, blocks. */
+	unsigned int		ahead_size_;
+	/** Blocks to read ahead next time. */
+	unsigned int		ahead_window_;
+	/** File block number of the first block read ahead. */
+	unsigned int		ahead_block_nr_;
+	/** Number of blocks read ahead, 0 when they are not valid. */
+	unsigned int		ahead_count_;
+	/** Block following the last one read, reading it is sequential access. */
+	unsigned int		next_read_block_nr_;
 }; // class File
 
 } // namespace File
@@ -0,0 +1,372 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include <Filesystem/RawLog.h>
+#include <Filesystem/Endian.h>
+#include <Filesystem/Error.h>
+
+#include <Filesystem_Config.h>
+
+#include <string.h>		// memcpy, memmove, memset
+
+
+namespace Filesystem {
+
+//*******************************************************************
+RawLog::RawLog(
+	Blockdevice&		device,
+	void*				buffer,
+	const unsigned int	buffer_blocks
+)
+:	device_(device)
+	,buffer_(reinterpret_cast<uint8_t*>(buffer))
+	,buffer_blocks_(buffer_blocks - 1)
+	,scratch_(reinterpret_cast<uint8_t*>(buffer) + (buffer_blocks - 1) * BLOCK_SIZE)
+	,first_block_(0)
+	,segment_count_(0)
+	,generation_(0)
+	,volume_id_(0)
+	,tail_(0)
+	,head_(0)
+	,segment_bytes_(0)
+	,written_blocks_(0)
+{
+	if (buffer_blocks < 2) {
+		throw Error("RawLog: buffer of %d blocks is too small.", buffer_blocks);
+	}
+}
+
+//*******************************************************************
+void
+RawLog::Open(
+	FAT16&				filesys,
+	const char*			filename,
+	const unsigned int	bytes
+)
+{
+	const unsigned int	fd = filesys.Open(filename, OPEN_CREATE);
+	unsigned int		first = 0;
+	unsigned int		blocks = 0;
+
+	try {
+		if (filesys.Size(fd) == 0) {
+			filesys.Preallocate(fd, bytes);
+		}
+		first = filesys.ContiguousBlocks(fd, blocks);
+	} catch (...) {
+		filesys.Close(fd);
+		throw;
+	}
+	filesys.Close(fd);
+
+	if (!Mount(first, blocks)) {
+		Format(first, blocks);
+	}
+}
+
+//*******************************************************************
+bool
+RawLog::Mount(
+	const unsigned int	first,
+	const unsigned int	blocks
+)
+{
+	enum {
+		WORDS = sizeof(Superblock) / sizeof(uint32_t)
+	};
+
+	first_block_ = first;
+	segment_count_ = blocks > SUPERBLOCK_BLOCKS ? (blocks - SUPERBLOCK_BLOCKS) / SEGMENT_BLOCKS : 0;
+	if (segment_count_ < 2) {
+		throw Error("RawLog: %d blocks hold less than two segments.", blocks);
+	}
+
+	// 1. The valid superblock copy with the higher generation.
+	Superblock		current;
+	bool			found = false;
+	memset(&current, 0, sizeof(current));
+	for (unsigned int i=0; i<SUPERBLOCK_BLOCKS; ++i) {
+		Superblock	sb;
+		device_.Read(first_block_ + i, scratch_);
+		memcpy(&sb, scratch_, sizeof(sb));
+		FixEndian(&sb.Magic, WORDS);
+		if (sb.Magic == SUPERBLOCK_MAGIC
+			&& sb.Checksum == Checksum(&sb.Magic, WORDS)
+			&& sb.Version == VERSION
+			&& sb.SegmentBlocks == SEGMENT_BLOCKS
+			&& sb.SegmentCount == segment_count_
+			&& (!found || sb.Generation > current.Generation)) {
+			current = sb;
+			found = true;
+		}
+	}
+	if (!found) {
+		filesystem_dprintf(("RawLog::Mount: no superblock at block %d.\n", first_block_));
+		return false;
+	}
+	generation_ = current.Generation;
+	volume_id_ = current.VolumeId;
+
+	// 2. Follow the segments filled or committed since.
+	SegmentHeader	header;
+	unsigned int	end = current.Head;
+	while (end - current.Head < segment_count_ && ReadHeader(end, header)) {
+		++end;
+	}
+
+	// 3. Continue at the next segment, it may have been partly written over the oldest one.
+	tail_ = current.Tail;
+	StartSegment(end);
+	filesystem_dprintf(("RawLog::Mount: volume %d, segments %d .. %d of %d.\n", volume_id_, tail_, head_, segment_count_));
+	return true;
+}
+
+//*******************************************************************
+void
+RawLog::Format(
+	const unsigned int	first,
+	const unsigned int	blocks
+)
+{
+	// Another volume number than a previous one, so that its headers are not taken for ours.
+	const bool			mounted = Mount(first, blocks);
+	const unsigned int	volume_id = mounted ? volume_id_ + 1 : 1;
+
+	memset(scratch_, 0, BLOCK_SIZE);
+	for (unsigned int i=0; i<segment_count_; ++i) {
+		device_.Write(SegmentBlock(i), scratch_);
+	}
+
+	volume_id_ = volume_id;
+	generation_ = mounted ? generation_ : 0;
+	tail_ = 0;
+	head_ = 0;
+	segment_bytes_ = 0;
+	written_blocks_ = 0;
+	WriteHeader();
+	WriteSuperblock();
+	filesystem_dprintf(("RawLog::Format: volume %d, %d segments.\n", volume_id_, segment_count_));
+}
+
+//*******************************************************************
+void
+RawLog::Write(
+	const void*			data,
+	const unsigned int	size
+)
+{
+	const uint8_t*	ptr = reinterpret_cast<const uint8_t*>(data);
+	unsigned int	todo = size;
+
+	while (todo > 0) {
+		const unsigned int	buffered = segment_bytes_ - written_blocks_ * BLOCK_SIZE;
+		unsigned int		n = buffer_blocks_ * BLOCK_SIZE - buffered;
+		if (n > SEGMENT_BYTES - segment_bytes_) {
+			n = SEGMENT_BYTES - segment_bytes_;
+		}
+		if (n > todo) {
+			n = todo;
+		}
+		memcpy(buffer_ + buffered, ptr, n);
+		segment_bytes_ += n;
+		ptr += n;
+		todo -= n;
+
+		if (segment_bytes_ == SEGMENT_BYTES) {
+			WriteBuffer();
+			WriteHeader();
+			StartSegment(head_ + 1);
+		} else if (buffered + n == buffer_blocks_ * BLOCK_SIZE) {
+			WriteBuffer();
+		}
+	}
+}
+
+//*******************************************************************
+void
+RawLog::Commit()
+{
+	WriteBuffer();
+
+	// The partial block is written again when it fills up.
+	const unsigned int	rest = segment_bytes_ - written_blocks_ * BLOCK_SIZE;
+	if (rest > 0) {
+		memset(buffer_ + rest, 0, BLOCK_SIZE - rest);
+		device_.Write(SegmentBlock(head_) + 1 + written_blocks_, buffer_);
+	}
+	WriteHeader();
+	WriteSuperblock();
+}
+
+//*******************************************************************
+unsigned int
+RawLog::SegmentCount() const
+{
+	return segment_count_;
+}
+
+//*******************************************************************
+unsigned int
+RawLog::Tail() const
+{
+	return tail_;
+}
+
+//*******************************************************************
+unsigned int
+RawLog::Head() const
+{
+	return head_;
+}
+
+//*******************************************************************
+unsigned int
+RawLog::ReadSegment(
+	const unsigned int	seq,
+	void*				data
+)
+{
+	SegmentHeader	header;
+
+	if (seq < tail_ || seq - tail_ >= segment_count_ || !ReadHeader(seq, header)) {
+		throw Error("RawLog: segment %d is not in the ring.", seq);
+	}
+	const unsigned int	blocks = (header.Bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if (blocks > 0) {
+		device_.ReadBlocks(SegmentBlock(seq) + 1, blocks, data);
+	}
+	return header.Bytes;
+}
+
+//*******************************************************************
+uint32_t
+RawLog::Checksum(
+	const uint32_t*		words,
+	const unsigned int	count
+)
+{
+	uint32_t	sum = 0;
+	for (unsigned int i=0; i<count-1; ++i) {
+		sum = ((sum << 1) | (sum >> 31)) + words[i];
+	}
+	return ~sum;
+}
+
+//*******************************************************************
+void
+RawLog::FixEndian(
+	uint32_t*			words,
+	const unsigned int	count
+)
+{
+	HostEndian::Fix32(words, count);
+}
+
+//*******************************************************************
+unsigned int
+RawLog::SegmentBlock(
+	const unsigned int	seq
+) const
+{
+	return first_block_ + SUPERBLOCK_BLOCKS + (seq % segment_count_) * SEGMENT_BLOCKS;
+}
+
+//*******************************************************************
+bool
+RawLog::ReadHeader(
+	const unsigned int	seq,
+	SegmentHeader&		header
+)
+{
+	enum {
+		WORDS = sizeof(SegmentHeader) / sizeof(uint32_t)
+	};
+
+	device_.Read(SegmentBlock(seq), scratch_);
+	memcpy(&header, scratch_, sizeof(header));
+	FixEndian(&header.Magic, WORDS);
+	return header.Magic == SEGMENT_MAGIC
+		&& header.Checksum == Checksum(&header.Magic, WORDS)
+		&& header.VolumeId == volume_id_
+		&& header.Sequence == seq
+		&& header.Bytes <= SEGMENT_BYTES;
+}
+
+//*******************************************************************
+void
+RawLog::WriteHeader()
+{
+	enum {
+		WORDS = sizeof(SegmentHeader) / sizeof(uint32_t)
+	};
+	SegmentHeader	header;
+
+	header.Magic = SEGMENT_MAGIC;
+	header.VolumeId = volume_id_;
+	header.Sequence = head_;
+	header.Bytes = segment_bytes_;
+	header.Checksum = Checksum(&header.Magic, WORDS);
+	FixEndian(&header.Magic, WORDS);
+
+	memset(scratch_, 0, BLOCK_SIZE);
+	memcpy(scratch_, &header, sizeof(header));
+	device_.Write(SegmentBlock(head_), scratch_);
+}
+
+//*******************************************************************
+void
+RawLog::WriteSuperblock()
+{
+	enum {
+		WORDS = sizeof(Superblock) / sizeof(uint32_t)
+	};
+	Superblock	sb;
+
+	++generation_;
+	sb.Magic = SUPERBLOCK_MAGIC;
+	sb.Version = VERSION;
+	sb.Generation = generation_;
+	sb.VolumeId = volume_id_;
+	sb.SegmentBlocks = SEGMENT_BLOCKS;
+	sb.SegmentCount = segment_count_;
+	sb.Tail = tail_;
+	sb.Head = head_;
+	sb.Checksum = Checksum(&sb.Magic, WORDS);
+	FixEndian(&sb.Magic, WORDS);
+
+	memset(scratch_, 0, BLOCK_SIZE);
+	memcpy(scratch_, &sb, sizeof(sb));
+	device_.Write(first_block_ + generation_ % SUPERBLOCK_BLOCKS, scratch_);
+}
+
+//*******************************************************************
+void
+RawLog::WriteBuffer()
+{
+	const unsigned int	buffered = segment_bytes_ - written_blocks_ * BLOCK_SIZE;
+	const unsigned int	blocks = buffered / BLOCK_SIZE;
+
+	if (blocks == 0) {
+		return;
+	}
+	device_.WriteBlocks(SegmentBlock(head_) + 1 + written_blocks_, blocks, buffer_);
+	written_blocks_ += blocks;
+	memmove(buffer_, buffer_ + blocks * BLOCK_SIZE, buffered - blocks * BLOCK_SIZE);
+}
+
+//*******************************************************************
+void
+RawLog::StartSegment(
+	const unsigned int	seq
+)
+{
+	head_ = seq;
+	segment_bytes_ = 0;
+	written_blocks_ = 0;
+	if (head_ + 1 > segment_count_ && head_ + 1 - segment_count_ > tail_) {
+		tail_ = head_ + 1 - segment_count_;
+	}
+}
+
+} // namespace Filesystem
@@ -0,0 +1,228 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef Filesystem_RawLog_h_
+#define Filesystem_RawLog_h_
+
+
+/** \file Log-structured ring of blocks, bypassing the filesystem. */
+
+#include <Filesystem/Blockdevice.h>
+#include <Filesystem/FAT16.h>
+
+#include <stdint.h>
+
+namespace Filesystem {
+
+/** Byte stream stored in a ring of segments on a contiguous run of device blocks,
+usually a file preallocated through FAT16. Writes go to the device in whole
+blocks with multiple block writes, the FAT and directory are never touched.
+
+Layout of the run:
+- blocks 0 and 1: two copies of the superblock, written in turn.
+- then segments of SEGMENT_BLOCKS blocks: a header block followed by the data blocks.
+
+Segments are numbered with ever increasing sequence numbers, segment \c seq is
+stored at index seq % SegmentCount. The superblock holds the segment being
+written at the last Commit() and the oldest segment still in the ring, the
+segment header holds its sequence number and the number of bytes in it.
+The header is written when the segment is full and at Commit().
+
+After power loss Mount() starts at the segment of the superblock and follows
+the segments whose headers carry the next sequence numbers. Data written after
+the last Commit() to a segment which did not fill up is lost. Writing
+continues at a new segment.
+
+All fields are stored in the little-endian byte order. Memory is supplied by
+the caller: \c buffer_blocks blocks, the last of which is used for the
+superblock and the headers, the others collect data for one multiple block write.
+*/
+class RawLog {
+public:
+	enum {
+		BLOCK_SIZE = Blockdevice::BLOCK_SIZE,
+		/** Blocks in a segment, with the header block. */
+		SEGMENT_BLOCKS = 64,
+		/** Data bytes in a segment. */
+		SEGMENT_BYTES = (SEGMENT_BLOCKS - 1) * BLOCK_SIZE,
+		/** Blocks of the superblock copies at the start of the run. */
+		SUPERBLOCK_BLOCKS = 2,
+		SUPERBLOCK_MAGIC = 0x52415731,	// "RAW1"
+		SEGMENT_MAGIC = 0x53454731,		// "SEG1"
+		VERSION = 1
+	};
+public:
+	/** Nothing is read or written until Mount() or Format().
+	\param[in]	buffer			Memory of \c buffer_blocks * BLOCK_SIZE bytes.
+	\param[in]	buffer_blocks	At least 2.
+	*/
+	RawLog(
+		Blockdevice&		device,
+		void*				buffer,
+		const unsigned int	buffer_blocks
+	);
+
+	/** Use the ring in the device blocks [first, first+blocks) of a contiguous file,
+	creating the file when missing or empty. The ring is formatted when no valid
+	superblock is found, or else recovered by Mount().
+	The file is not left open.
+	*/
+	void
+	Open(
+		FAT16&				filesys,
+		const char*			filename,
+		const unsigned int	bytes
+	);
+
+	/** Find the ring in the device blocks [first, first+blocks) after power loss.
+	\return false when there is no valid superblock.
+	*/
+	bool
+	Mount(
+		const unsigned int	first,
+		const unsigned int	blocks
+	);
+
+	/** Start an empty ring in the device blocks [first, first+blocks).
+	The old segment headers are invalidated.
+	*/
+	void
+	Format(
+		const unsigned int	first,
+		const unsigned int	blocks
+	);
+
+	/** Append bytes. Whole blocks are written when the buffer or the segment is full. */
+	void
+	Write(
+		const void*			data,
+		const unsigned int	size
+	);
+
+	/** Write the buffered data, the segment header and the superblock.
+	Data written so far survives power loss.
+	*/
+	void
+	Commit();
+
+	/** Number of segments in the ring. */
+	unsigned int
+	SegmentCount() const;
+
+	/** Sequence number of the oldest segment in the ring. */
+	unsigned int
+	Tail() const;
+
+	/** Sequence number of the segment being written. Segments [Tail(), Head()) hold
+	the data written before, the last of them may be shorter than SEGMENT_BYTES.
+	*/
+	unsigned int
+	Head() const;
+
+	/** Read the data of segment \c seq into \c data, SEGMENT_BYTES bytes.
+	Throws exception when the segment has been overwritten or is not valid.
+	\return Number of bytes in the segment.
+	*/
+	unsigned int
+	ReadSegment(
+		const unsigned int	seq,
+		void*				data
+	);
+private:
+	/** Superblock, in the first bytes of its block. */
+	typedef struct {
+		uint32_t	Magic;
+		uint32_t	Version;
+		/** Incremented at every write, the copy with the higher one is current. */
+		uint32_t	Generation;
+		/** Changed by every Format(), headers of other volumes are stale. */
+		uint32_t	VolumeId;
+		uint32_t	SegmentBlocks;
+		uint32_t	SegmentCount;
+		/** Oldest segment in the ring. */
+		uint32_t	Tail;
+		/** Segment being written at the last commit. */
+		uint32_t	Head;
+		uint32_t	Checksum;
+	} Superblock;
+
+	/** Segment header, in the first bytes of the first block of the segment. */
+	typedef struct {
+		uint32_t	Magic;
+		uint32_t	VolumeId;
+		uint32_t	Sequence;
+		/** Data bytes in the segment. */
+		uint32_t	Bytes;
+		uint32_t	Checksum;
+	} SegmentHeader;
+
+	/** Checksum of the words before the last one, in host byte order. */
+	static uint32_t
+	Checksum(
+		const uint32_t*		words,
+		const unsigned int	count
+	);
+
+	/** Convert the words between host and little-endian byte order. */
+	static void
+	FixEndian(
+		uint32_t*			words,
+		const unsigned int	count
+	);
+
+	/** Device block of the header of segment \c seq. */
+	unsigned int
+	SegmentBlock(
+		const unsigned int	seq
+	) const;
+
+	/** Read the header of segment \c seq into \c header.
+	\return false when the header belongs to another segment or is not valid.
+	*/
+	bool
+	ReadHeader(
+		const unsigned int	seq,
+		SegmentHeader&		header
+	);
+
+	/** Write the header of the segment being written. */
+	void
+	WriteHeader();
+
+	/** Write the next copy of the superblock. */
+	void
+	WriteSuperblock();
+
+	/** Write the whole blocks collected in the buffer, keep the rest. */
+	void
+	WriteBuffer();
+
+	/** Start writing segment \c seq, dropping the segment it overwrites from the ring. */
+	void
+	StartSegment(
+		const unsigned int	seq
+	);
+
+	Blockdevice&	device_;
+	uint8_t*		buffer_;
+	/** Data blocks in the buffer, one less than given. */
+	unsigned int	buffer_blocks_;
+	/** Block for the superblock and the headers. */
+	uint8_t*		scratch_;
+	/** First device block of the run. */
+	unsigned int	first_block_;
+	unsigned int	segment_count_;
+	unsigned int	generation_;
+	unsigned int	volume_id_;
+	unsigned int	tail_;
+	unsigned int	head_;
+	/** Data bytes in the segment being written. */
+	unsigned int	segment_bytes_;
+	/** Data blocks of the segment written to the device. */
+	unsigned int	written_blocks_;
+}; // class RawLog
+
+} // namespace Filesystem
+
+#endif /* Filesystem_RawLog_h_ */
@@ -0,0 +1,132 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include <Filesystem/Storage.h>
+#include <Filesystem/Error.h>
+
+#include <Filesystem_Config.h>
+
+#include <new>		// placement new
+
+
+namespace Filesystem {
+
+//*******************************************************************
+Storage::Storage(
+	uint8_t*			free_bitmap,
+	void*				cache_memory,
+	const unsigned int	cache_size,
+	void*				window_memory,
+	const unsigned int	window_blocks
+)
+:	card_(false)
+	,free_bitmap_(free_bitmap)
+	,cache_memory_(cache_memory)
+	,cache_size_(cache_size)
+	,window_memory_(window_memory)
+	,window_blocks_(window_blocks)
+	,window_(0)
+	,cache_(0)
+	,filesys_(0)
+	,mount_count_(0)
+{
+}
+
+//*******************************************************************
+Storage::~Storage()
+{
+	Release();
+}
+
+//*******************************************************************
+FAT16&
+Storage::Mount()
+{
+	if (filesys_ != 0 && card_.IsPresent()) {
+		return *filesys_;
+	}
+	Unmount();
+
+	card_.Initialize();
+	Blockdevice*	device = &card_;
+	if (window_memory_ != 0) {
+		window_ = new (window_place_.Bytes) Blockdevice_Coalescing(card_, window_memory_, window_blocks_);
+		device = window_;
+	}
+	if (cache_memory_ != 0) {
+		cache_ = new (cache_place_.Bytes) Blockcache(*device, cache_memory_, cache_size_);
+	}
+	try {
+		filesys_ = new (filesys_place_.Bytes) FAT16(*device, free_bitmap_, cache_);
+	} catch (...) {
+		Release();
+		throw;
+	}
+	++mount_count_;
+	filesystem_dprintf(("Storage: mounted, %d times so far.\n", mount_count_));
+	return *filesys_;
+}
+
+//*******************************************************************
+void
+Storage::Unmount()
+{
+	if (filesys_ != 0 && filesys_->OpenFiles() != 0) {
+		throw Error("Storage: %d files open, close them before unmounting.", filesys_->OpenFiles());
+	}
+	Release();
+}
+
+//*******************************************************************
+void
+Storage::Release()
+{
+	// Blocks of a lost card are dropped: the card refuses them until initialized again.
+	if (filesys_ != 0) {
+		filesys_->~FAT16();
+		filesys_ = 0;
+	}
+	if (cache_ != 0) {
+		cache_->~Blockcache();
+		cache_ = 0;
+	}
+	if (window_ != 0) {
+		window_->~Blockdevice_Coalescing();
+		window_ = 0;
+	}
+}
+
+//*******************************************************************
+bool
+Storage::IsMounted() const
+{
+	return filesys_ != 0;
+}
+
+//*******************************************************************
+bool
+Storage::IsCardPresent()
+{
+	if (card_.IsPresent()) {
+		return true;
+	}
+	Unmount();
+	return false;
+}
+
+//*******************************************************************
+void
+Storage::WaitCard()
+{
+	card_.WaitReady();
+}
+
+//*******************************************************************
+unsigned int
+Storage::MountCount() const
+{
+	return mount_count_;
+}
+
+} // namespace Filesystem
@@ -0,0 +1,120 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef Filesystem_Storage_h_
+#define Filesystem_Storage_h_
+
+
+/** \file Memory card mounted once and kept mounted. */
+
+#include <Filesystem/Blockdevice_SDMMC.h>
+#include <Filesystem/Blockdevice_Coalescing.h>
+#include <Filesystem/Blockcache.h>
+#include <Filesystem/FAT16.h>
+
+#include <stdint.h>
+
+namespace Filesystem {
+
+/** Memory card session: the SD/MMC card, the block cache and the FAT16 filesystem,
+mounted once and kept for as long as the card stays in the slot.
+
+Mount() initializes the card, reads the boot sector and scans the FAT only the
+first time and after the card has been lost. Otherwise it costs one CMD13
+(SEND_STATUS) exchange and returns the filesystem mounted before, with its
+geometry, free cluster bitmap and cached FAT and directory blocks.
+
+With window memory given, writes go to the card through Blockdevice_Coalescing,
+and Device() of the filesystem is the window: its Flush() writes the blocks
+held back.
+
+Memory is supplied by the caller, like for FAT16 and Blockcache.
+*/
+class Storage {
+public:
+	/** Nothing is done with the card until Mount().
+	\param[in]	free_bitmap		FAT16::FREE_BITMAP_SIZE bytes, or NULL.
+	\param[in]	cache_memory	Memory of the block cache, or NULL for the small FAT16 built-in cache.
+	\param[in]	cache_size		Size of \c cache_memory, bytes.
+	\param[in]	window_memory	Memory of the write window, or NULL to write to the card directly.
+	\param[in]	window_blocks	Size of \c window_memory, blocks.
+	*/
+	Storage(
+		uint8_t*			free_bitmap = 0,
+		void*				cache_memory = 0,
+		const unsigned int	cache_size = 0,
+		void*				window_memory = 0,
+		const unsigned int	window_blocks = 0
+	);
+
+	/** Unmount, writing cached blocks if the card is still there. */
+	~Storage();
+
+	/** Mounted filesystem, mounted again if the card does not answer.
+	Throws exception when there is no usable card, and when the card was lost
+	while files are open: the files refer to the filesystem and must be closed
+	before it is mounted again.
+	*/
+	FAT16&
+	Mount();
+
+	/** Forget the filesystem. Cached blocks are written only if the card still answers.
+	Throws exception when files are open.
+	*/
+	void
+	Unmount();
+
+	/** Is the filesystem mounted? The card is not asked. */
+	bool
+	IsMounted() const;
+
+	/** Is the card still in the slot? Unmounts when it is not, throws
+	exception like Unmount() when files are open then.
+	*/
+	bool
+	IsCardPresent();
+
+	/** Wait until the card has programmed the last block written, before other
+	devices on the SPI bus of the card are used. See Blockdevice_SDMMC.
+	*/
+	void
+	WaitCard();
+
+	/** Number of times the card has been mounted. */
+	unsigned int
+	MountCount() const;
+private:
+	/** Destroy the filesystem, the cache and the window, whether files are open or not. */
+	void
+	Release();
+
+	/** Memory for constructing the objects in place, aligned for any member. */
+	template <unsigned int SIZE>
+	union Place {
+		double	Align;
+		void*	AlignPointer;
+		char	Bytes[SIZE];
+	};
+
+	Blockdevice_SDMMC			card_;
+	uint8_t*					free_bitmap_;
+	void*						cache_memory_;
+	unsigned int				cache_size_;
+	void*						window_memory_;
+	unsigned int				window_blocks_;
+	/** Write window constructed in \c window_place_, NULL if none. */
+	Blockdevice_Coalescing*		window_;
+	/** Block cache constructed in \c cache_place_, NULL if none. */
+	Blockcache*					cache_;
+	/** Filesystem constructed in \c filesys_place_, NULL when not mounted. */
+	FAT16*						filesys_;
+	unsigned int				mount_count_;
+	Place<sizeof(Blockdevice_Coalescing)>	window_place_;
+	Place<sizeof(Blockcache)>	cache_place_;
+	Place<sizeof(FAT16)>		filesys_place_;
+}; // class Storage
+
+} // namespace Filesystem
+
+#endif /* Filesystem_Storage_h_ */
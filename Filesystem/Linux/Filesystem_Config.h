@@ -0,0 +1,26 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef Filesystem_Config_h_
+#define	Filesystem_Config_h_
+
+#include <stdio.h>
+
+#if defined(FILESYSTEM_DEBUG)
+#define	filesystem_dprintf(args)	do { printf args; } while (0)
+#else
+#define	filesystem_dprintf(args)	do { } while (0)
+#endif
+
+#include <MSVC/SDMMC_Mock.h>	// shared with the MSVC build
+
+#define	FILESYSTEM_SDMMC_MOCK
+
+#define	FILESYSTEM_SDMMC_SPI_SELECT()		sdmmc_mock_select(true)
+#define	FILESYSTEM_SDMMC_SPI_UNSELECT()		sdmmc_mock_select(false)
+#define	FILESYSTEM_SDMMC_SPI_READ(dataptr)	sdmmc_mock_read(dataptr)
+#define	FILESYSTEM_SDMMC_SPI_WRITE(data)	sdmmc_mock_write(data)
+
+
+#endif /* Filesystem_Config_h_ */
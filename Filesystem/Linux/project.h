@@ -0,0 +1,11 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef project_h_
+#define	project_h_
+
+#define	dprintf(args)	do { printf args; } while (0)
+
+
+#endif /* project_h_ */
@@ -13,5 +13,14 @@ vim: shiftwidth=4
 #define	filesystem_dprintf(args)	do { } while (0)
 #endif
 
+#include "SDMMC_Mock.h"
+
+#define	FILESYSTEM_SDMMC_MOCK
+
+#define	FILESYSTEM_SDMMC_SPI_SELECT()		sdmmc_mock_select(true)
+#define	FILESYSTEM_SDMMC_SPI_UNSELECT()		sdmmc_mock_select(false)
+#define	FILESYSTEM_SDMMC_SPI_READ(dataptr)	sdmmc_mock_read(dataptr)
+#define	FILESYSTEM_SDMMC_SPI_WRITE(data)	sdmmc_mock_write(data)
+
 
 #endif /* Filesystem_Config_h_ */
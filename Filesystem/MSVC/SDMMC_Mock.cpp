@@ -0,0 +1,458 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include "SDMMC_Mock.h"
+
+#include <Filesystem/Blockdevice.h>
+
+#include <string.h>	// memset
+
+namespace Filesystem {
+
+SDMMC_Mock*	SDMMC_Mock::current_ = 0;
+
+//*******************************************************************
+SDMMC_Mock::SDMMC_Mock(
+	Blockdevice&		storage,
+	const unsigned int	busy_bytes,
+	const bool			sdhc
+)
+:	storage_(storage)
+	,busy_bytes_(busy_bytes)
+	,sdhc_(sdhc)
+	,inserted_(true)
+	,spi_mode_(true)
+	,selected_(false)
+	,state_(STATE_IDLE)
+	,idle_(true)
+	,app_command_(false)
+	,multiple_(false)
+	,command_size_(0)
+	,block_nr_(0)
+	,block_size_(0)
+	,output_head_(0)
+	,output_count_(0)
+	,busy_left_(0)
+	,last_read_(0xFF)
+	,blocks_written_(0)
+	,busy_exchanges_(0)
+	,resets_(0)
+	,au_blocks_(0)
+	,erase_first_(0)
+	,erase_last_(0)
+	,blocks_erased_(0)
+{
+	current_ = this;
+}
+
+//*******************************************************************
+SDMMC_Mock::~SDMMC_Mock()
+{
+	if (current_ == this) {
+		current_ = 0;
+	}
+}
+
+//*******************************************************************
+void
+SDMMC_Mock::Select(
+	const bool	selected
+)
+{
+	selected_ = selected;
+	command_size_ = 0;
+}
+
+//*******************************************************************
+uint8_t
+SDMMC_Mock::Exchange(
+	const uint8_t	data
+)
+{
+	if (!selected_ || !inserted_) {
+		last_read_ = 0xFF;
+		return last_read_;
+	}
+
+	// 1. Clock out.
+	if (output_count_ == 0 && state_ == STATE_READ_MULTIPLE) {
+		OutputBlock(block_nr_);
+		++block_nr_;
+	}
+	if (output_count_ > 0) {
+		last_read_ = output_[output_head_];
+		output_head_ = (output_head_ + 1) % OUTPUT_SIZE;
+		--output_count_;
+	} else if (busy_left_ > 0) {
+		last_read_ = 0x00;
+		--busy_left_;
+		++busy_exchanges_;
+	} else {
+		last_read_ = 0xFF;
+	}
+
+	// 2. Clock in.
+	switch (state_) {
+	case STATE_WRITE_TOKEN:
+		if (data == 0xFE) {
+			block_size_ = 0;
+			state_ = STATE_WRITE_DATA;
+		}
+		break;
+	case STATE_WRITE_MULTIPLE_TOKEN:
+		if (data == 0xFC) {
+			block_size_ = 0;
+			state_ = STATE_WRITE_DATA;
+		} else if (data == 0xFD) {
+			// One byte before busy.
+			Output(0xFF);
+			busy_left_ = busy_bytes_;
+			state_ = STATE_IDLE;
+		}
+		break;
+	case STATE_WRITE_DATA:
+		block_[block_size_++] = data;
+		if (block_size_ == sizeof(block_)) {
+			storage_.Write(block_nr_, block_);
+			++block_nr_;
+			++blocks_written_;
+			// Data accepted, then busy while programming.
+			Output(0x05);
+			busy_left_ = busy_bytes_;
+			state_ = multiple_ ? STATE_WRITE_MULTIPLE_TOKEN : STATE_IDLE;
+		}
+		break;
+	default:
+		if (command_size_ == 0) {
+			if ((data & 0xC0) == 0x40) {
+				command_[command_size_++] = data;
+			}
+		} else {
+			command_[command_size_++] = data;
+			if (command_size_ == COMMAND_SIZE) {
+				command_size_ = 0;
+				Command();
+			}
+		}
+		break;
+	}
+	return last_read_;
+}
+
+//*******************************************************************
+uint8_t
+SDMMC_Mock::LastRead() const
+{
+	return last_read_;
+}
+
+//*******************************************************************
+void
+SDMMC_Mock::Elapse(
+	const unsigned int	bytes
+)
+{
+	busy_left_ = bytes < busy_left_ ? busy_left_ - bytes : 0;
+}
+
+//*******************************************************************
+void
+SDMMC_Mock::SetBusyBytes(
+	const unsigned int	busy_bytes
+)
+{
+	busy_bytes_ = busy_bytes;
+}
+
+//*******************************************************************
+bool
+SDMMC_Mock::IsBusy() const
+{
+	return busy_left_ > 0;
+}
+
+//*******************************************************************
+void
+SDMMC_Mock::SetInserted(
+	const bool	inserted
+)
+{
+	if (inserted && !inserted_) {
+		// Power up: forget everything, wait for CMD0.
+		state_ = STATE_IDLE;
+		idle_ = true;
+		spi_mode_ = false;
+		app_command_ = false;
+		command_size_ = 0;
+		output_count_ = 0;
+		busy_left_ = 0;
+	}
+	inserted_ = inserted;
+}
+
+//*******************************************************************
+void
+SDMMC_Mock::SetAllocationUnit(
+	const unsigned int	blocks
+)
+{
+	au_blocks_ = blocks;
+}
+
+//*******************************************************************
+unsigned int
+SDMMC_Mock::BlocksErased() const
+{
+	return blocks_erased_;
+}
+
+//*******************************************************************
+unsigned int
+SDMMC_Mock::Resets() const
+{
+	return resets_;
+}
+
+//*******************************************************************
+unsigned int
+SDMMC_Mock::BlocksWritten() const
+{
+	return blocks_written_;
+}
+
+//*******************************************************************
+unsigned int
+SDMMC_Mock::BusyExchanges() const
+{
+	return busy_exchanges_;
+}
+
+//*******************************************************************
+SDMMC_Mock*
+SDMMC_Mock::Current()
+{
+	return current_;
+}
+
+//*******************************************************************
+void
+SDMMC_Mock::Command()
+{
+	const uint8_t		command = command_[0] & 0x3F;
+	const unsigned int	arg = (command_[1]<<24) | (command_[2]<<16) | (command_[3]<<8) | command_[4];
+	const uint8_t		r1 = idle_ ? 0x01 : 0x00;
+	const bool			app_command = app_command_;
+
+	app_command_ = false;
+	if (!spi_mode_ && command != 0) {
+		return;
+	}
+	if (state_ == STATE_READ_MULTIPLE) {
+		// Only STOP_TRANSMISSION is expected; stuff byte, response, then short busy.
+		if (command == 12) {
+			output_count_ = 0;
+			Output(0xFF);
+			Output(r1);
+			busy_left_ = 2;
+			state_ = STATE_IDLE;
+		}
+		return;
+	}
+
+	// Response comes after one byte.
+	Output(0xFF);
+	switch (command) {
+	case 0:		// GO_IDLE_STATE
+		idle_ = true;
+		spi_mode_ = true;
+		++resets_;
+		Output(0x01);
+		break;
+	case 1:		// SEND_OP_COND
+		idle_ = false;
+		Output(0x00);
+		break;
+	case 41:	// SD_SEND_OP_COND
+		if (app_command) {
+			idle_ = false;
+			Output(0x00);
+		} else {
+			Output(r1 | 0x04);
+		}
+		break;
+	case 8:		// SEND_IF_COND, echoes voltage and check pattern
+		if (sdhc_) {
+			Output(r1);
+			Output(0x00);
+			Output(0x00);
+			Output((arg >> 8) & 0x0F);
+			Output(arg & 0xFF);
+		} else {
+			Output(r1 | 0x04);
+		}
+		break;
+	case 58:	// READ_OCR, power up done and card capacity status
+		Output(r1);
+		Output(sdhc_ ? 0xC0 : 0x80);
+		Output(0xFF);
+		Output(0x80);
+		Output(0x00);
+		break;
+	case 13:	// SEND_STATUS, R2; SD_STATUS after APP_CMD
+		Output(r1);
+		Output(0x00);
+		if (app_command) {
+			// AU_SIZE is the high nibble of byte 10.
+			unsigned int	au_size = 0;
+			for (unsigned int blocks=32; au_blocks_!=0 && blocks<=au_blocks_; blocks <<= 1) {
+				++au_size;
+			}
+			Output(0xFF);
+			Output(0xFE);
+			for (unsigned int i=0; i<64; ++i) {
+				Output(i==10 ? au_size << 4 : 0x00);
+			}
+			Output(0xFF);		// CRC
+			Output(0xFF);
+		}
+		break;
+	case 23:	// SET_WR_BLK_ERASE_COUNT, a hint only
+		Output(app_command ? r1 : r1 | 0x04);
+		break;
+	case 32:	// ERASE_WR_BLK_START
+		erase_first_ = BlockOf(arg);
+		Output(r1);
+		break;
+	case 33:	// ERASE_WR_BLK_END
+		erase_last_ = BlockOf(arg);
+		Output(r1);
+		break;
+	case 38:	// ERASE, then busy
+		{
+			uint8_t	zeros[BLOCK_SIZE];
+			memset(zeros, 0, sizeof(zeros));
+			for (unsigned int nr=erase_first_; nr<=erase_last_; ++nr) {
+				storage_.Write(nr, zeros);
+				++blocks_erased_;
+			}
+		}
+		Output(r1);
+		busy_left_ = busy_bytes_;
+		break;
+	case 55:	// APP_CMD
+		app_command_ = true;
+		Output(r1);
+		break;
+	case 9:		// SEND_CSD
+		Output(r1);
+		Output(0xFF);
+		Output(0xFE);
+		for (unsigned int i=0; i<16+2; ++i) {
+			Output(0x00);
+		}
+		break;
+	case 17:	// READ_SINGLE_BLOCK
+		Output(r1);
+		OutputBlock(BlockOf(arg));
+		break;
+	case 18:	// READ_MULTIPLE_BLOCK
+		Output(r1);
+		block_nr_ = BlockOf(arg);
+		state_ = STATE_READ_MULTIPLE;
+		break;
+	case 24:	// WRITE_BLOCK
+		Output(r1);
+		block_nr_ = BlockOf(arg);
+		multiple_ = false;
+		state_ = STATE_WRITE_TOKEN;
+		break;
+	case 25:	// WRITE_MULTIPLE_BLOCK
+		Output(r1);
+		block_nr_ = BlockOf(arg);
+		multiple_ = true;
+		state_ = STATE_WRITE_MULTIPLE_TOKEN;
+		break;
+	case 12:	// STOP_TRANSMISSION
+	case 16:	// SET_BLOCKLEN
+	case 59:	// CRC_ON_OFF
+		Output(r1);
+		break;
+	default:
+		Output(r1 | 0x04);	// illegal command
+		break;
+	}
+}
+
+//*******************************************************************
+unsigned int
+SDMMC_Mock::BlockOf(
+	const unsigned int	arg
+) const
+{
+	return sdhc_ ? arg : arg / BLOCK_SIZE;
+}
+
+//*******************************************************************
+void
+SDMMC_Mock::Output(
+	const uint8_t	data
+)
+{
+	if (output_count_ < OUTPUT_SIZE) {
+		output_[(output_head_ + output_count_) % OUTPUT_SIZE] = data;
+		++output_count_;
+	}
+}
+
+//*******************************************************************
+void
+SDMMC_Mock::OutputBlock(
+	const unsigned int	nr
+)
+{
+	storage_.Read(nr, block_);
+	Output(0xFF);
+	Output(0xFE);
+	for (unsigned int i=0; i<BLOCK_SIZE; ++i) {
+		Output(block_[i]);
+	}
+	Output(0xFF);		// CRC
+	Output(0xFF);
+}
+
+} // namespace Filesystem
+
+//*******************************************************************
+void
+sdmmc_mock_select(
+	const bool	selected
+)
+{
+	Filesystem::SDMMC_Mock*	card = Filesystem::SDMMC_Mock::Current();
+	if (card != 0) {
+		card->Select(selected);
+	}
+}
+
+//*******************************************************************
+void
+sdmmc_mock_read(
+	uint16_t*	data
+)
+{
+	Filesystem::SDMMC_Mock*	card = Filesystem::SDMMC_Mock::Current();
+	*data = card != 0 ? card->LastRead() : 0xFF;
+}
+
+//*******************************************************************
+void
+sdmmc_mock_write(
+	const uint16_t	data
+)
+{
+	Filesystem::SDMMC_Mock*	card = Filesystem::SDMMC_Mock::Current();
+	if (card != 0) {
+		card->Exchange(static_cast<uint8_t>(data));
+	}
+}
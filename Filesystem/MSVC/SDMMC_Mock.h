@@ -0,0 +1,196 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef SDMMC_Mock_h_
+#define	SDMMC_Mock_h_
+
+#include <stdint.h>
+
+namespace Filesystem {
+
+class Blockdevice;
+
+/** SD card emulated at the SPI byte level, for testing Blockdevice_SDMMC on the host.
+
+Card contents are kept in another block device. Every byte clocked in by the host
+clocks one byte out, like the SPI bus does. After a block is written the card holds
+the data line low for the given number of byte times, during which it is busy.
+Time passes with each byte exchanged while selected, and with Elapse().
+An SDHC card answers CMD8 and CMD58 and takes block numbers as addresses,
+otherwise the card behaves like an SD 1.x card with byte addresses.
+
+The SD status tells the allocation unit set with SetAllocationUnit(); erased
+blocks read as zeros. A removed card leaves the bus at 0xFF. A card inserted again has been power
+cycled and ignores everything until it is reset with CMD0.
+
+Only one card can be attached at a time; it is used by the FILESYSTEM_SDMMC_SPI_*
+macros of the host Filesystem_Config.h.
+*/
+class SDMMC_Mock {
+public:
+	/** Attach the card to the SPI macros. */
+	SDMMC_Mock(
+		Blockdevice&		storage,
+		const unsigned int	busy_bytes,
+		const bool			sdhc = false
+	);
+
+	/** Detach the card. */
+	~SDMMC_Mock();
+
+	/** Set the chip select line. */
+	void
+	Select(
+		const bool	selected
+	);
+
+	/** Clock one byte in and one byte out. */
+	uint8_t
+	Exchange(
+		const uint8_t	data
+	);
+
+	/** Byte clocked out by the last Exchange(). */
+	uint8_t
+	LastRead() const;
+
+	/** Let the time of \c bytes byte transfers pass without using the bus. */
+	void
+	Elapse(
+		const unsigned int	bytes
+	);
+
+	/** Number of byte times the card is busy after each block write. */
+	void
+	SetBusyBytes(
+		const unsigned int	busy_bytes
+	);
+
+	/** Is the card programming a block? */
+	bool
+	IsBusy() const;
+
+	/** Remove the card from the slot or insert it again. */
+	void
+	SetInserted(
+		const bool	inserted
+	);
+
+	/** Allocation unit reported in the SD status, blocks: 32 << n, or 0 for none. */
+	void
+	SetAllocationUnit(
+		const unsigned int	blocks
+	);
+
+	/** Number of blocks erased with CMD38 so far. */
+	unsigned int
+	BlocksErased() const;
+
+	/** Number of CMD0 (GO_IDLE_STATE) commands so far, i.e. card initializations. */
+	unsigned int
+	Resets() const;
+
+	/** Number of blocks programmed so far. */
+	unsigned int
+	BlocksWritten() const;
+
+	/** Number of bytes exchanged while the card was busy, i.e. time the host spent waiting. */
+	unsigned int
+	BusyExchanges() const;
+
+	/** Card attached to the SPI macros, NULL if none. */
+	static SDMMC_Mock*
+	Current();
+private:
+	enum STATE {
+		/** Waiting for a command. */
+		STATE_IDLE,
+		/** Sending blocks after CMD18, until CMD12. */
+		STATE_READ_MULTIPLE,
+		/** Waiting for the data token after CMD24. */
+		STATE_WRITE_TOKEN,
+		/** Waiting for the data or stop token after CMD25. */
+		STATE_WRITE_MULTIPLE_TOKEN,
+		/** Receiving block data and CRC. */
+		STATE_WRITE_DATA
+	};
+	enum {
+		BLOCK_SIZE		= 512,
+		COMMAND_SIZE	= 6,
+		/** Block, its start token, CRC and some command response bytes. */
+		OUTPUT_SIZE		= BLOCK_SIZE + 16
+	};
+
+	/** Execute the command in command_. */
+	void
+	Command();
+
+	/** Queue a byte to be clocked out. */
+	void
+	Output(
+		const uint8_t	data
+	);
+
+	/** Block number of the command argument. */
+	unsigned int
+	BlockOf(
+		const unsigned int	arg
+	) const;
+
+	/** Queue a block read from the storage, with start token and CRC. */
+	void
+	OutputBlock(
+		const unsigned int	nr
+	);
+
+	Blockdevice&	storage_;
+	unsigned int	busy_bytes_;
+	bool			sdhc_;
+	bool			inserted_;
+	bool			spi_mode_;
+	bool			selected_;
+	STATE			state_;
+	bool			idle_;
+	bool			app_command_;
+	bool			multiple_;
+	uint8_t			command_[COMMAND_SIZE];
+	unsigned int	command_size_;
+	unsigned int	block_nr_;
+	uint8_t			block_[BLOCK_SIZE + 2];
+	unsigned int	block_size_;
+	uint8_t			output_[OUTPUT_SIZE];
+	unsigned int	output_head_;
+	unsigned int	output_count_;
+	unsigned int	busy_left_;
+	uint8_t			last_read_;
+	unsigned int	blocks_written_;
+	unsigned int	busy_exchanges_;
+	unsigned int	resets_;
+	unsigned int	au_blocks_;
+	unsigned int	erase_first_;
+	unsigned int	erase_last_;
+	unsigned int	blocks_erased_;
+
+	static SDMMC_Mock*	current_;
+}; // class SDMMC_Mock
+
+} // namespace Filesystem
+
+/** SPI functions behind the FILESYSTEM_SDMMC_SPI_* macros. Without a card attached the bus reads 0xFF. */
+void
+sdmmc_mock_select(
+	const bool	selected
+);
+
+void
+sdmmc_mock_read(
+	uint16_t*	data
+);
+
+void
+sdmmc_mock_write(
+	const uint16_t	data
+);
+
+#endif /* SDMMC_Mock_h_ */
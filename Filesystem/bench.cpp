@@ -0,0 +1,378 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include <exception>
+#include <vector>		// std::vector
+#include <stdio.h>
+#include <string.h>		// memset
+#include <time.h>		// clock
+
+#include <Filesystem_Config.h>
+#include <Filesystem/Blockcache.h>
+#include <Filesystem/Blockdevice_Coalescing.h>
+#include <Filesystem/Blockdevice_RAM.h>
+#include <Filesystem/Endian.h>
+#include <Filesystem/FAT16.h>
+#include <Filesystem/File.h>
+
+#include "LoggerIO.h"
+
+using namespace Filesystem;
+
+/** \file Filesystem benchmark.
+
+Usage: fsbench image.fat [image.fat ...]
+
+Every case runs on a fresh in-memory copy of the disk image, so that the
+numbers measure the filesystem code and not the disk of the host.
+Give a fragmented image to see the cost of cluster allocation.
+The FAT fetch case measures the byte order conversion of FAT blocks
+on a cache miss, for the big-endian target as well.
+*/
+
+//*******************************************************************
+/** RAM disk counting writes to the filesystem metadata area. */
+class MetadataCountingRAM : public Blockdevice_RAM {
+public:
+	MetadataCountingRAM(
+		void*				memory,
+		const unsigned int	nblocks
+	)
+	:	Blockdevice_RAM(memory, nblocks)
+		,MetadataEnd(0)
+		,MetadataWrites(0)
+	{
+		Start();
+	}
+
+	virtual bool
+	WriteBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		const void*			buffer
+	)
+	{
+		if (first < MetadataEnd) {
+			MetadataWrites += count;
+		}
+		return Blockdevice_RAM::WriteBlocks(first, count, buffer);
+	}
+
+	/** Start measuring, counts so far are not reported. */
+	void
+	Start()
+	{
+		StartReads = ReadCount();
+		StartWrites = WriteCount();
+		StartReadCommands = ReadCommandCount();
+		StartWriteCommands = WriteCommandCount();
+		StartMetadataWrites = MetadataWrites;
+		StartTime = clock();
+	}
+
+	/** Blocks below this are counted as metadata. */
+	unsigned int	MetadataEnd;
+	/** Number of metadata blocks written. */
+	unsigned int	MetadataWrites;
+
+	unsigned int	StartReads;
+	unsigned int	StartWrites;
+	unsigned int	StartReadCommands;
+	unsigned int	StartWriteCommands;
+	unsigned int	StartMetadataWrites;
+	clock_t			StartTime;
+};
+
+//*******************************************************************
+static void
+report(
+	const char*					name,
+	const unsigned int			bytes,
+	const MetadataCountingRAM&	disk
+)
+{
+	const clock_t	ticks = clock() - disk.StartTime;
+	const double	mb = bytes / (1024.0 * 1024.0);
+	const double	seconds = (ticks > 0 ? ticks : 1) / static_cast<double>(CLOCKS_PER_SEC);
+
+	const unsigned int	writes = disk.WriteCount() - disk.StartWrites;
+	const unsigned int	write_commands = disk.WriteCommandCount() - disk.StartWriteCommands;
+
+	printf("%-16s %8.1f MB/s %8.1f reads/MB %8.1f writes/MB %7.1f read cmds/MB %7.1f write cmds/MB %6.1f blocks/write cmd %7.1f metadata writes/MB\n",
+		name,
+		mb / seconds,
+		(disk.ReadCount() - disk.StartReads) / mb,
+		writes / mb,
+		(disk.ReadCommandCount() - disk.StartReadCommands) / mb,
+		write_commands / mb,
+		write_commands > 0 ? static_cast<double>(writes) / write_commands : 0.0,
+		(disk.MetadataWrites - disk.StartMetadataWrites) / mb);
+}
+
+//*******************************************************************
+/** Append \c total_size bytes in \c packet_size packets, flushing every 64 kB like the logger does. */
+static void
+append(
+	File&				f,
+	const unsigned int	packet_size,
+	const unsigned int	total_size
+)
+{
+	const unsigned int	flush_interval = 64 * 1024;
+	std::vector<char>	packet(packet_size, 'b');
+
+	for (unsigned int written=0; written<total_size; written += packet_size) {
+		f.Write(&packet[0], packet_size);
+		if ((written + packet_size) / flush_interval != written / flush_interval) {
+			f.Flush();
+		}
+	}
+}
+
+//*******************************************************************
+/** Sequential append at the logger packet sizes, writing to the disk
+directly and through a 64 block Blockdevice_Coalescing window.
+*/
+static void
+bench_append(
+	const std::vector<char>&	image
+)
+{
+	const unsigned int	total_size = 4 * 1024 * 1024;
+	const unsigned int	window_blocks = 64;
+	const unsigned int	sizes[4] = { sizeof(LoggerIO::SENSORS), sizeof(LoggerIO::GPS), sizeof(LoggerIO::SENSORS), sizeof(LoggerIO::GPS) };
+	const char*			names[4] = { "append SENSORS", "append GPS", "window SENSORS", "window GPS" };
+
+	for (unsigned int i=0; i<4; ++i) {
+		std::vector<char>		memory(image);
+		MetadataCountingRAM		disk(&memory[0], memory.size() / FAT16::BLOCK_SIZE);
+		std::vector<char>		window_memory(window_blocks * FAT16::BLOCK_SIZE);
+		Blockdevice_Coalescing	window(disk, &window_memory[0], window_blocks);
+		Blockdevice&			device = i < 2 ? static_cast<Blockdevice&>(disk) : window;
+		FAT16					filesys(device);
+		disk.MetadataEnd = filesys.DataStartBlock();
+		disk.Start();
+		{
+			File	f(filesys, "BENCH.BIN", OPEN_CREATE);
+			append(f, sizes[i], total_size);
+		}
+		device.Flush();
+		report(names[i], total_size, disk);
+	}
+}
+
+//*******************************************************************
+/** Open, append 64 kB of GPS packets and close, 64 times. */
+static void
+bench_reopen(
+	const std::vector<char>&	image
+)
+{
+	const unsigned int	round_size = 64 * 1024;
+	const unsigned int	rounds = 64;
+	std::vector<char>	memory(image);
+	MetadataCountingRAM	disk(&memory[0], memory.size() / FAT16::BLOCK_SIZE);
+	FAT16				filesys(disk);
+
+	disk.MetadataEnd = filesys.DataStartBlock();
+	{
+		File	f(filesys, "BENCH.BIN", OPEN_CREATE);
+	}
+	disk.Start();
+	for (unsigned int i=0; i<rounds; ++i) {
+		File	f(filesys, "BENCH.BIN", OPEN_EXISTING);
+		f.SeekSet(f.Size());
+		append(f, sizeof(LoggerIO::GPS), round_size);
+	}
+	report("reopen+append", rounds * round_size, disk);
+}
+
+//*******************************************************************
+/** Read a 4 MB file in 4 kB chunks, in GPS packets and in GPS packets with
+8 and 32 blocks of read-ahead.
+*/
+static void
+bench_read(
+	const std::vector<char>&	image
+)
+{
+	const unsigned int	total_size = 4 * 1024 * 1024;
+	const unsigned int	sizes[4] = { 4096, sizeof(LoggerIO::GPS), sizeof(LoggerIO::GPS), sizeof(LoggerIO::GPS) };
+	const unsigned int	ahead_blocks[4] = { 0, 0, 8, 32 };
+	const char*			names[4] = { "read 4 kB", "read GPS", "ahead 8 GPS", "ahead 32 GPS" };
+	std::vector<char>	ahead_memory(32 * FAT16::BLOCK_SIZE);
+	std::vector<char>	memory(image);
+	MetadataCountingRAM	disk(&memory[0], memory.size() / FAT16::BLOCK_SIZE);
+	FAT16				filesys(disk);
+
+	disk.MetadataEnd = filesys.DataStartBlock();
+	{
+		File	f(filesys, "BENCH.BIN", OPEN_CREATE);
+		append(f, 4096, total_size);
+	}
+	for (unsigned int i=0; i<4; ++i) {
+		std::vector<char>	buffer(sizes[i]);
+		File				f(filesys, "BENCH.BIN", OPEN_READONLY);
+		unsigned int		size = 0;
+
+		if (ahead_blocks[i] > 0) {
+			f.SetReadAhead(&ahead_memory[0], ahead_blocks[i]);
+		}
+		disk.Start();
+		while (size + sizes[i] <= f.Size()) {
+			f.Read(&buffer[0], sizes[i]);
+			size += sizes[i];
+		}
+		report(names[i], size, disk);
+	}
+}
+
+//*******************************************************************
+/** Append 4 MB in 64 kB multi-block writes, allocating clusters one by one
+and with the clusters reserved beforehand.
+*/
+static void
+bench_allocation(
+	const std::vector<char>&	image
+)
+{
+	const unsigned int	total_blocks = 4*1024*1024 / FAT16::BLOCK_SIZE;
+	const unsigned int	run_blocks = 128;
+	std::vector<char>	data(run_blocks * FAT16::BLOCK_SIZE, 'a');
+	const char*			names[2] = { "allocate", "allocate+Reserve" };
+
+	for (unsigned int pass=0; pass<2; ++pass) {
+		std::vector<char>	memory(image);
+		MetadataCountingRAM	disk(&memory[0], memory.size() / FAT16::BLOCK_SIZE);
+		FAT16				filesys(disk);
+		disk.MetadataEnd = filesys.DataStartBlock();
+		disk.Start();
+
+		const unsigned int	fd = filesys.Open("BENCH.BIN", OPEN_CREATE);
+		if (pass == 1) {
+			filesys.Reserve(fd, total_blocks * FAT16::BLOCK_SIZE);
+		}
+		for (unsigned int i=0; i<total_blocks; i+=run_blocks) {
+			filesys.WriteBlocks(fd, &data[0], run_blocks);
+		}
+		filesys.Close(fd);
+		report(names[pass], total_blocks * FAT16::BLOCK_SIZE, disk);
+	}
+}
+
+//*******************************************************************
+/** Swap of one entry, byte by byte. */
+static void
+fix_entry(
+	uint16_t&	x
+)
+{
+	uint8_t*		ptr = reinterpret_cast<uint8_t*>(&x);
+	const uint8_t	tmp = ptr[0];
+	ptr[0] = ptr[1];
+	ptr[1] = tmp;
+}
+
+/** Called through a pointer, like the former FixEndian16() of Endian.cpp
+which the compiler could not inline into FAT16.cpp.
+*/
+static void (* volatile fix_entry_call)(uint16_t&) = fix_entry;
+
+//*******************************************************************
+/** Conversion of a FAT block one entry at a time, as it was done before the bulk kernel. */
+static void
+fix_fat_block_per_entry(
+	void*	block
+)
+{
+	uint16_t*	entries = reinterpret_cast<uint16_t*>(block);
+	for (unsigned int i=0; i<FAT16::BLOCK_SIZE/sizeof(uint16_t); ++i) {
+		fix_entry_call(entries[i]);
+	}
+}
+
+//*******************************************************************
+static void
+fix_fat_block_bulk(
+	void*	block
+)
+{
+	EndianTraits<false>::Fix16(reinterpret_cast<uint16_t*>(block), FAT16::BLOCK_SIZE / sizeof(uint16_t));
+}
+
+//*******************************************************************
+/** Fetch the metadata blocks through a two block cache, so that every fetch
+misses, converting them as FAT blocks: without conversion (little-endian hosts), with the bulk swap of the
+big-endian target and with the former per-entry swap.
+*/
+static void
+bench_fat_fetch(
+	const std::vector<char>&	image
+)
+{
+	const unsigned int			fetches = 1024 * 1024;
+	const Blockcache::FixBlockEndian	fixes[3] = { 0, fix_fat_block_bulk, fix_fat_block_per_entry };
+	const char*					names[3] = { "FAT fetch", "FAT fetch+bulk", "FAT fetch+entry" };
+	std::vector<char>			memory(image);
+	MetadataCountingRAM			disk(&memory[0], memory.size() / FAT16::BLOCK_SIZE);
+	unsigned int				metadata_blocks = 0;
+	{
+		FAT16	filesys(disk);
+		metadata_blocks = filesys.DataStartBlock();
+	}
+
+	for (unsigned int i=0; i<3; ++i) {
+		std::vector<char>	cache_memory(2 * Blockcache::SLOT_SIZE);
+		Blockcache			cache(disk, &cache_memory[0], cache_memory.size());
+		const clock_t		start = clock();
+		for (unsigned int n=0; n<fetches; ++n) {
+			cache.Unpin(cache.Fetch(n % metadata_blocks, fixes[i], -1));
+		}
+		const clock_t		ticks = clock() - start;
+		const double		seconds = (ticks > 0 ? ticks : 1) / static_cast<double>(CLOCKS_PER_SEC);
+		printf("%-16s %8.1f ns/fetch\n", names[i], seconds * 1e9 / fetches);
+	}
+}
+
+//*******************************************************************
+int
+main(
+	int	argc,
+	char**	argv)
+{
+	if (argc < 2) {
+		printf("Usage: %s image.fat [image.fat ...]\n", argv[0]);
+		return 1;
+	}
+
+	for (int i=1; i<argc; ++i) {
+		FILE*	f = fopen(argv[i], "rb");
+		if (f == 0) {
+			printf("Cannot open '%s'.\n", argv[i]);
+			return 1;
+		}
+		fseek(f, 0, SEEK_END);
+		std::vector<char>	image(ftell(f));
+		fseek(f, 0, SEEK_SET);
+		const size_t		r = fread(&image[0], 1, image.size(), f);
+		fclose(f);
+		if (r != image.size()) {
+			printf("Cannot read '%s'.\n", argv[i]);
+			return 1;
+		}
+
+		printf("%s:\n", argv[i]);
+		try {
+			bench_append(image);
+			bench_reopen(image);
+			bench_read(image);
+			bench_allocation(image);
+			bench_fat_fetch(image);
+		} catch (const std::exception& e) {
+			printf("Exception: %s\n", e.what());
+			return 1;
+		}
+	}
+	return 0;
+}
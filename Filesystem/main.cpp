@@ -4,17 +4,27 @@ vim: shiftwidth=4
 */
 #include <stdexcept>
 #include <exception>
+#include <algorithm>	// std::min, std::sort
 #include <vector>		// std::vector
 #include <stdio.h>
-#include <string.h>		// memcpy
+#include <string.h>		// memcpy, strcmp
+#include <stdint.h>		// uint8_t
+#include <time.h>		// clock
 
 #include <Filesystem_Config.h>
+#include <Filesystem/Blockdevice_Coalescing.h>
 #include <Filesystem/Blockdevice_File.h>
+#include <Filesystem/Blockdevice_SDMMC.h>
+#include <Filesystem/Blockdevice_SimSD.h>
+#include <Filesystem/Blockcache.h>
 #include <Filesystem/FAT16.h>
 #include <Filesystem/File.h>
+#include <Filesystem/Storage.h>
+#include <Filesystem/RawLog.h>
 
 #include "LoggerIO.h"
 #include "LoggerConfig.h"
+#include <MSVC/SDMMC_Mock.h>
 
 using namespace Filesystem;
 
@@ -115,7 +125,7 @@ GetTSC()
 }
 
 //*******************************************************************
-static void
+static unsigned int
 test_logging(
 	const char*	disk_filename
 )
@@ -174,6 +184,7 @@ test_logging(
 			}
 		}
 		printf("Total %d mismatches.\n", mismatch_count);
+		return mismatch_count;
 	}
 }
 
@@ -191,18 +202,1873 @@ test_config(
 }
 
 //*******************************************************************
-int
-main(
-	int	argc,
-	char**	argv)
+/** Write the same amount of data block-by-block and with multi-block writes,
+count device commands per megabyte written. */
+static void
+bench_multiblock(
+	const char*	disk_filename
+)
 {
-	const char*	disk_filename = argc>1 ? argv[1] : "test1_empty.fat";
+	const unsigned int	total_blocks = 2*1024*1024 / FAT16::BLOCK_SIZE;
+	const unsigned int	run_blocks = 16;
+	std::vector<char>	data(run_blocks * FAT16::BLOCK_SIZE, 'x');
+	const char*			filenames[2] = { "BENCH1.BIN", "BENCH2.BIN" };
 
-	try {
-		// test_logging(disk_filename);
-		test_config(disk_filename);
+	for (unsigned int pass=0; pass<2; ++pass) {
+		const bool			multiblock = pass==1;
+		Blockdevice_File	disk(disk_filename);
+		{
+			FAT16				filesys(disk);
+			const unsigned int	fd = filesys.Open(filenames[pass], OPEN_CREATE);
+			unsigned int		block_nr = (filesys.Size(fd) + FAT16::BLOCK_SIZE - 1) / FAT16::BLOCK_SIZE;
+
+			filesys.SeekSetBlock(fd, block_nr);
+			for (unsigned int i=0; i<total_blocks; i+=run_blocks) {
+				if (multiblock) {
+					filesys.WriteBlocks(fd, &data[0], run_blocks);
+				} else {
+					for (unsigned int j=0; j<run_blocks; ++j) {
+						filesys.Write(fd, &data[j*FAT16::BLOCK_SIZE]);
+						filesys.SeekSetBlock(fd, ++block_nr);
+					}
+				}
+			}
+			filesys.Close(fd);
+		}
+
+		const double	mb = total_blocks * FAT16::BLOCK_SIZE / (1024.0 * 1024.0);
+		printf("%-12s: %7.1f write commands/MB, %5.2f blocks/command, %7.1f read commands/MB\n",
+			multiblock ? "WriteBlocks" : "Write",
+			disk.WriteCommandCount() / mb,
+			static_cast<double>(disk.WriteCount()) / disk.WriteCommandCount(),
+			disk.ReadCommandCount() / mb);
+	}
+}
+
+//*******************************************************************
+/** Leave \c holes free clusters \c stride clusters apart: append stride-1
+clusters to FRAGA.BIN and one to FRAGB.BIN in turn, then delete FRAGB.BIN.
+*/
+static void
+fragment_free_space(
+	const char*			disk_filename,
+	const unsigned int	holes,
+	const unsigned int	stride
+)
+{
+	Blockdevice_File	disk(disk_filename);
+	FAT16				filesys(disk);
+	const unsigned int	blocks_per_cluster = filesys.BlocksPerCluster();
+	const unsigned int	used = filesys.Open("FRAGA.BIN", OPEN_CREATE);
+	const unsigned int	freed = filesys.Open("FRAGB.BIN", OPEN_CREATE);
+	std::vector<char>	data((stride - 1) * blocks_per_cluster * FAT16::BLOCK_SIZE, 'f');
+
+	for (unsigned int i=0; i<holes; ++i) {
+		filesys.WriteBlocks(used, &data[0], (stride - 1) * blocks_per_cluster);
+		filesys.WriteBlocks(freed, &data[0], blocks_per_cluster);
+	}
+	filesys.Close(used);
+	filesys.Close(freed);
+	filesys.Remove("FRAGB.BIN");
+}
+
+//*******************************************************************
+/** Append clusters with and without the free cluster bitmap, count device
+reads per allocated cluster. The free space is fragmented first, with the
+free clusters two FAT blocks apart, and the files are deleted afterwards.
+*/
+static void
+bench_allocation(
+	const char*	disk_filename
+)
+{
+	const unsigned int	nclusters = 32;
+	const char*			filenames[2] = { "BENCHA.BIN", "BENCHB.BIN" };
+	std::vector<uint8_t>	free_bitmap(FAT16::FREE_BITMAP_SIZE);
+	unsigned int		stride = 0;
+
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		stride = 2 * FAT16::BLOCK_SIZE / (filesys.IsFat32() ? 4 : 2);
+	}
+	for (unsigned int pass=0; pass<2; ++pass) {
+		const bool			use_bitmap = pass==1;
+		unsigned int		mount_reads = 0;
+		unsigned int		append_reads = 0;
+
+		fragment_free_space(disk_filename, nclusters, stride);
+		{
+			Blockdevice_File	disk(disk_filename);
+			FAT16				filesys(disk, use_bitmap ? &free_bitmap[0] : 0);
+			const unsigned int	blocks_per_cluster = filesys.BlocksPerCluster();
+			const unsigned int	fd = filesys.Open(filenames[pass], OPEN_CREATE);
+			std::vector<char>	data(blocks_per_cluster * FAT16::BLOCK_SIZE, 'a');
+
+			mount_reads = disk.ReadCommandCount();
+			for (unsigned int i=0; i<nclusters; ++i) {
+				filesys.WriteBlocks(fd, &data[0], blocks_per_cluster);
+			}
+			filesys.Close(fd);
+			append_reads = disk.ReadCommandCount() - mount_reads;
+
+			filesys.Remove(filenames[pass]);
+			filesys.Remove("FRAGA.BIN");
+		}
+
+		printf("%-10s: %5d reads at mount, %6.2f device reads per allocated cluster, %d free clusters %d apart\n",
+			use_bitmap ? "bitmap" : "FAT scan",
+			mount_reads,
+			static_cast<double>(append_reads) / nclusters,
+			nclusters,
+			stride);
+	}
+}
+
+//*******************************************************************
+/** Grow a big file, then reopen it and count FAT reads of seeking around in it. */
+static void
+bench_reopen(
+	const char*	disk_filename
+)
+{
+	const unsigned int	target_blocks = 256*1024*1024 / FAT16::BLOCK_SIZE;
+	const unsigned int	run_blocks = 128;
+	const char*			filename = "BIGLOG.BIN";
+
+	// 1. Grow the file.
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		const unsigned int	fd = filesys.Open(filename, OPEN_CREATE);
+		unsigned int		size_blocks = (filesys.Size(fd) + FAT16::BLOCK_SIZE - 1) / FAT16::BLOCK_SIZE;
+		std::vector<char>	data(run_blocks * FAT16::BLOCK_SIZE, 'b');
+
+		filesys.SeekSetBlock(fd, size_blocks);
+		while (size_blocks < target_blocks) {
+			const unsigned int	n = target_blocks - size_blocks < run_blocks ? target_blocks - size_blocks : run_blocks;
+			filesys.WriteBlocks(fd, &data[0], n);
+			size_blocks += n;
+		}
+		filesys.Close(fd);
+	}
+
+	// 2. Reopen and seek around.
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		const unsigned int	fd = filesys.Open(filename, OPEN_EXISTING);
+		const unsigned int	size_blocks = (filesys.Size(fd) + FAT16::BLOCK_SIZE - 1) / FAT16::BLOCK_SIZE;
+		const unsigned int	targets[] = { size_blocks, 0, size_blocks / 2, size_blocks - 1, 0, size_blocks };
+
+		printf("File '%s' size is %d blocks.\n", filename, size_blocks);
+		for (unsigned int i=0; i<sizeof(targets)/sizeof(targets[0]); ++i) {
+			const unsigned int	reads_before = disk.ReadCommandCount();
+			filesys.SeekSetBlock(fd, targets[i]);
+			printf("Seek to block %8d: %5d FAT reads\n", targets[i], disk.ReadCommandCount() - reads_before);
+		}
+		filesys.Close(fd);
+	}
+}
+
+//*******************************************************************
+/** Fill one cluster of the fragments test file \c k. */
+static void
+fragments_fill(
+	std::vector<char>&	data,
+	const unsigned int	k,
+	const unsigned int	cluster
+)
+{
+	for (unsigned int i=0; i<data.size(); ++i) {
+		data[i] = static_cast<char>(cluster * 3 + k * 101 + i / FAT16::BLOCK_SIZE);
+	}
+}
+
+//*******************************************************************
+/** Grow two files one cluster at a time in turn, so that the first one has
+more fragments than the extent map holds. Reopen it, append and count the
+device reads, seek around in it and read it back.
+*/
+static unsigned int
+test_fragments(
+	const char*	disk_filename
+)
+{
+	const unsigned int	nfragments = 100;
+	const unsigned int	append_clusters = 1000;
+	const char*			filenames[2] = { "FRAG0.BIN", "FRAG1.BIN" };
+	unsigned int		mismatches = 0;
+
+	// 1. Interleave, every cluster of FRAG0.BIN is a fragment of its own.
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		const unsigned int	blocks_per_cluster = filesys.BlocksPerCluster();
+		std::vector<char>	data(blocks_per_cluster * FAT16::BLOCK_SIZE);
+		unsigned int		fds[2];
+
+		for (unsigned int k=0; k<2; ++k) {
+			fds[k] = filesys.Open(filenames[k], OPEN_CREATE);
+			if (filesys.Size(fds[k]) != 0) {
+				printf("'%s' exists already.\n", filenames[k]);
+				return 1;
+			}
+		}
+		for (unsigned int i=0; i<nfragments; ++i) {
+			for (unsigned int k=0; k<2; ++k) {
+				fragments_fill(data, k, i);
+				filesys.WriteBlocks(fds[k], &data[0], blocks_per_cluster);
+			}
+		}
+		filesys.Close(fds[0]);
+		filesys.Close(fds[1]);
+	}
+
+	// 2. Append to the fragmented file.
+	unsigned int	seek_reads = 0;
+	unsigned int	append_reads = 0;
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		const unsigned int	blocks_per_cluster = filesys.BlocksPerCluster();
+		const unsigned int	fd = filesys.Open(filenames[0], OPEN_EXISTING);
+		std::vector<char>	data(blocks_per_cluster * FAT16::BLOCK_SIZE);
+
+		const unsigned int	reads = disk.ReadCommandCount();
+		filesys.SeekSetBlock(fd, filesys.Size(fd) / FAT16::BLOCK_SIZE);
+		seek_reads = disk.ReadCommandCount() - reads;
+		for (unsigned int i=nfragments; i<nfragments+append_clusters; ++i) {
+			fragments_fill(data, 0, i);
+			filesys.WriteBlocks(fd, &data[0], blocks_per_cluster);
+		}
+		append_reads = disk.ReadCommandCount() - reads - seek_reads;
+		filesys.Close(fd);
+	}
+	if (append_reads > append_clusters / 16) {
+		printf("%d device reads appending %d clusters.\n", append_reads, append_clusters);
+		++mismatches;
+	}
+
+	// 3. Seek to clusters all over the file and read them.
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		const unsigned int	blocks_per_cluster = filesys.BlocksPerCluster();
+		const unsigned int	fd = filesys.Open(filenames[0], OPEN_READONLY);
+		const unsigned int	nclusters = nfragments + append_clusters;
+		std::vector<char>	data(blocks_per_cluster * FAT16::BLOCK_SIZE);
+		std::vector<char>	expected(data.size());
+
+		if (filesys.Size(fd) != nclusters * data.size()) {
+			printf("Size %d, expected %d.\n", filesys.Size(fd), static_cast<unsigned int>(nclusters * data.size()));
+			++mismatches;
+		}
+		for (unsigned int n=0; n<2*nclusters; ++n) {
+			const unsigned int	i = n < nclusters ? (n * 37) % nclusters : n - nclusters;
+			filesys.SeekSetBlock(fd, i * blocks_per_cluster);
+			filesys.ReadBlocks(fd, &data[0], blocks_per_cluster);
+			fragments_fill(expected, 0, i);
+			if (data != expected) {
+				++mismatches;
+			}
+		}
+		filesys.Close(fd);
+	}
+	printf("%d fragments, %d reads to seek to the end, %d reads appending %d clusters, %d mismatches.\n",
+		nfragments, seek_reads, append_reads, append_clusters, mismatches);
+	return mismatches;
+}
+
+//*******************************************************************
+/** Append \c nclusters clusters in GPS+sensor sized packets, flushing the FAT
+and the directory entry after each cluster, and print cache and device statistics.
+The free space is fragmented first so that consecutive clusters of the file are
+in different FAT blocks, the files are deleted afterwards.
+*/
+static void
+append_through_cache(
+	const char*			disk_filename,
+	const unsigned int	cache_blocks,
+	const unsigned int	nclusters
+)
+{
+	const char*			filename = "CACHE.BIN";
+	char				packet[108 + 36];	// GPS record + sensors record.
+	unsigned int		stride = 0;
+
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		stride = FAT16::BLOCK_SIZE / (filesys.IsFat32() ? 4 : 2);
+	}
+	fragment_free_space(disk_filename, nclusters, stride);
+
+	Blockdevice_File	disk(disk_filename);
+	std::vector<char>	memory(std::max<unsigned int>(cache_blocks, FAT16::DEFAULT_CACHE_BLOCKS) * Blockcache::SLOT_SIZE);
+	Blockcache			cache(disk, &memory[0], memory.size());
+	FAT16				filesys(disk, 0, cache_blocks > 0 ? &cache : 0);
+	const unsigned int	cluster_size = filesys.BlocksPerCluster() * FAT16::BLOCK_SIZE;
+	const unsigned int	reads = disk.ReadCommandCount();
+
+	memset(packet, 'c', sizeof(packet));
+	{
+		File		f(filesys, filename, OPEN_CREATE);
+		for (unsigned int written=0; written<nclusters*cluster_size; written += sizeof(packet)) {
+			f.Write(packet, sizeof(packet));
+			if ((written + sizeof(packet)) / cluster_size != written / cluster_size) {
+				f.Flush();
+			}
+		}
+	}
+
+	printf("%3d blocks%-9s: %6d hits, %6d misses, %6.2f device reads per cluster\n",
+		filesys.Cache().Size(),
+		cache_blocks > 0 ? "" : " built-in",
+		filesys.Cache().Hits(),
+		filesys.Cache().Misses(),
+		static_cast<double>(disk.ReadCommandCount() - reads) / nclusters);
+
+	filesys.Remove(filename);
+	filesys.Remove("FRAGA.BIN");
+}
+
+//*******************************************************************
+/** Compare the built-in block cache with larger caller supplied caches. The built-in
+one has a single block besides the pinned FAT and directory blocks, like the
+separate one-block buffers had before the cache was shared.
+*/
+static void
+bench_cache(
+	const char*	disk_filename
+)
+{
+	const unsigned int	nclusters = 64;
+	const unsigned int	cache_blocks[3] = { 0, 16, 64 };
+
+	for (unsigned int i=0; i<3; ++i) {
+		append_through_cache(disk_filename, cache_blocks[i], nclusters);
+	}
+}
+
+//*******************************************************************
+/** Disk image counting writes to the filesystem metadata area. */
+class MetadataCountingFile : public Blockdevice_File {
+public:
+	MetadataCountingFile(
+		const std::string&	filename
+	)
+	:	Blockdevice_File(filename)
+		,MetadataEnd(0)
+		,MetadataWrites(0)
+	{
+	}
+
+	virtual bool
+	WriteBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		const void*			buffer
+	)
+	{
+		if (first < MetadataEnd) {
+			MetadataWrites += count;
+		}
+		return Blockdevice_File::WriteBlocks(first, count, buffer);
+	}
+
+	/** Blocks below this are counted as metadata. */
+	unsigned int	MetadataEnd;
+	/** Number of metadata blocks written. */
+	unsigned int	MetadataWrites;
+};
+
+//*******************************************************************
+/** Disk image which loses writes from a given block on, like a card losing
+power, and erases to zeros.
+*/
+class PowerLossFile : public Blockdevice_File {
+public:
+	PowerLossFile(
+		const std::string&	filename
+	)
+	:	Blockdevice_File(filename)
+		,DropFrom(0xFFFFFFFF)
+	{
+	}
+
+	virtual bool
+	WriteBlocks(
+		const unsigned int	first,
+		const unsigned int	count,
+		const void*			buffer
+	)
+	{
+		if (first + count > DropFrom) {
+			return true;
+		}
+		return Blockdevice_File::WriteBlocks(first, count, buffer);
+	}
+
+	virtual bool
+	Erase(
+		const unsigned int	first,
+		const unsigned int	count
+	)
+	{
+		const std::vector<char>	zeros(FAT16::BLOCK_SIZE, 0);
+		for (unsigned int i=0; i<count; ++i) {
+			WriteBlocks(first + i, 1, &zeros[0]);
+		}
+		return true;
+	}
+
+	/** Writes reaching this block are dropped. */
+	unsigned int	DropFrom;
+};
+
+//*******************************************************************
+/** Log 4 MB with flushes every 16 kB, once committing the metadata at
+every flush and once in group commit mode, committing every 256 kB.
+*/
+static void
+bench_groupcommit(
+	const char*	disk_filename
+)
+{
+	const unsigned int	total_size = 4 * 1024 * 1024;
+	const unsigned int	flush_interval = 16 * 1024;
+	const unsigned int	commit_interval = 256 * 1024;
+	const char*			filenames[2] = { "GROUP0.BIN", "GROUP1.BIN" };
+	char				packet[108 + 36];	// GPS record + sensors record.
+
+	memset(packet, 'g', sizeof(packet));
+	for (unsigned int pass=0; pass<2; ++pass) {
+		const bool				group_commit = pass==1;
+		MetadataCountingFile	disk(disk_filename);
+		std::vector<char>		memory(64 * Blockcache::SLOT_SIZE);
+		Blockcache				cache(disk, &memory[0], memory.size());
+		{
+			FAT16		filesys(disk, 0, &cache);
+			filesys.SetGroupCommit(group_commit);
+			disk.MetadataEnd = filesys.DataStartBlock();
+			File		f(filesys, filenames[pass], OPEN_CREATE);
+			for (unsigned int written=0; written<total_size; written += sizeof(packet)) {
+				f.Write(packet, sizeof(packet));
+				const unsigned int	pos = written + sizeof(packet);
+				if (pos / commit_interval != written / commit_interval) {
+					f.Commit();
+				} else if (pos / flush_interval != written / flush_interval) {
+					f.Flush();
+				}
+			}
+		}
+		printf("%-13s: %6.1f metadata writes/MB, %7.1f write commands/MB\n",
+			group_commit ? "group commit" : "flush",
+			disk.MetadataWrites * (1024.0 * 1024.0 / total_size),
+			disk.WriteCommandCount() * (1024.0 * 1024.0 / total_size));
+	}
+}
+
+//*******************************************************************
+/** Append 4 MB in 64 kB multi-block writes, without and with reserving
+the clusters beforehand.
+*/
+static void
+bench_reserve(
+	const char*	disk_filename
+)
+{
+	const unsigned int	total_blocks = 4*1024*1024 / FAT16::BLOCK_SIZE;
+	const unsigned int	run_blocks = 128;
+	std::vector<char>	data(run_blocks * FAT16::BLOCK_SIZE, 'r');
+	const char*			filenames[2] = { "BENCHR0.BIN", "BENCHR1.BIN" };
+
+	for (unsigned int pass=0; pass<2; ++pass) {
+		const bool			reserve = pass==1;
+		Blockdevice_File	disk(disk_filename);
+		unsigned int		reserved = 0;
+		{
+			FAT16				filesys(disk);
+			const unsigned int	fd = filesys.Open(filenames[pass], OPEN_CREATE);
+
+			filesys.SeekSetBlock(fd, (filesys.Size(fd) + FAT16::BLOCK_SIZE - 1) / FAT16::BLOCK_SIZE);
+			if (reserve) {
+				reserved = filesys.Reserve(fd, total_blocks * FAT16::BLOCK_SIZE);
+			}
+			for (unsigned int i=0; i<total_blocks; i+=run_blocks) {
+				filesys.WriteBlocks(fd, &data[0], run_blocks);
+			}
+			filesys.Close(fd);
+		}
+
+		const double	mb = total_blocks * FAT16::BLOCK_SIZE / (1024.0 * 1024.0);
+		printf("%-10s: %7.1f write commands/MB, %6.2f blocks/command, %8d bytes reserved\n",
+			reserve ? "Reserve" : "no Reserve",
+			disk.WriteCommandCount() / mb,
+			static_cast<double>(disk.WriteCount()) / disk.WriteCommandCount(),
+			reserved);
+	}
+}
+
+//*******************************************************************
+/** File::Write and File::Read throughput for different packet sizes. */
+static unsigned int
+bench_file(
+	const char*	disk_filename
+)
+{
+	const unsigned int	total_size = 4 * 1024 * 1024;
+	const unsigned int	packet_sizes[3] = { 12, 108, 4096 };
+	const char*			filenames[3] = { "PKT12.BIN", "PKT108.BIN", "PKT4096.BIN" };
+	unsigned int		total_mismatches = 0;
+
+	for (unsigned int pass=0; pass<3; ++pass) {
+		const unsigned int	packet_size = packet_sizes[pass];
+		const unsigned int	npackets = total_size / packet_size;
+		const double		mb = static_cast<double>(npackets * packet_size) / (1024.0 * 1024.0);
+		std::vector<char>	packet(packet_size);
+		double				write_seconds = 0;
+		double				read_seconds = 0;
+		unsigned int		mismatches = 0;
+
+		for (unsigned int i=0; i<packet_size; ++i) {
+			packet[i] = static_cast<char>(i * 13 + pass);
+		}
+		{
+			Blockdevice_File	disk(disk_filename);
+			FAT16				filesys(disk);
+			File				f(filesys, filenames[pass], OPEN_CREATE);
+			const clock_t		start = clock();
+			for (unsigned int i=0; i<npackets; ++i) {
+				f.Write(&packet[0], packet_size);
+			}
+			f.Flush();
+			write_seconds = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+		}
+		{
+			Blockdevice_File	disk(disk_filename);
+			FAT16				filesys(disk);
+			File				f(filesys, filenames[pass], OPEN_READONLY);
+			std::vector<char>	readback(packet_size);
+			const clock_t		start = clock();
+			for (unsigned int i=0; i<npackets; ++i) {
+				f.Read(&readback[0], packet_size);
+				if (memcmp(&readback[0], &packet[0], packet_size) != 0) {
+					++mismatches;
+				}
+			}
+			read_seconds = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+		}
+
+		printf("%4d byte packets: write %7.1f MB/s, read %7.1f MB/s, %d mismatches\n",
+			packet_size,
+			write_seconds>0 ? mb / write_seconds : 0.0,
+			read_seconds>0 ? mb / read_seconds : 0.0,
+			mismatches);
+		total_mismatches += mismatches;
+	}
+	return total_mismatches;
+}
+
+//*******************************************************************
+/** Log 4 MB in GPS+sensor sized packets, once writing directly and once
+through the write-behind queue pumped one block after each packet.
+Reports the longest File::Write call and checks both files are identical.
+*/
+static void
+bench_writebehind(
+	const char*	disk_filename
+)
+{
+	const unsigned int	total_size = 4 * 1024 * 1024;
+	const unsigned int	flush_interval = 64 * 1024;
+	const unsigned int	queue_blocks = 64;
+	const char*			filenames[2] = { "DIRECT.BIN", "QUEUED.BIN" };
+	char				packet[108 + 36];	// GPS record + sensors record.
+	std::vector<char>	contents[2];
+
+	for (unsigned int pass=0; pass<2; ++pass) {
+		const bool			queued = pass==1;
+		std::vector<char>	queue_memory(queue_blocks * FAT16::BLOCK_SIZE);
+		clock_t				max_stall = 0;
+		unsigned int		max_commands = 0;
+		{
+			Blockdevice_File	disk(disk_filename);
+			FAT16				filesys(disk);
+			File				f(filesys, filenames[pass], OPEN_CREATE);
+			if (queued) {
+				f.SetQueue(&queue_memory[0], queue_blocks);
+			}
+			for (unsigned int written=0, i=0; written<total_size; written += sizeof(packet), ++i) {
+				for (unsigned int j=0; j<sizeof(packet); ++j) {
+					packet[j] = static_cast<char>(i + j);
+				}
+
+				const unsigned int	commands = disk.WriteCommandCount();
+				const clock_t		start = clock();
+				f.Write(packet, sizeof(packet));
+				const clock_t		stall = clock() - start;
+				if (stall > max_stall) {
+					max_stall = stall;
+				}
+				if (disk.WriteCommandCount() - commands > max_commands) {
+					max_commands = disk.WriteCommandCount() - commands;
+				}
+
+				if (queued) {
+					f.Pump();
+				}
+				if ((written + sizeof(packet)) / flush_interval != written / flush_interval) {
+					f.Flush();
+				}
+			}
+		}
+		{
+			Blockdevice_File	disk(disk_filename);
+			FAT16				filesys(disk);
+			File				f(filesys, filenames[pass], OPEN_READONLY);
+			contents[pass].resize(f.Size());
+			f.Read(&contents[pass][0], f.Size());
+		}
+
+		printf("%-7s: longest File::Write %6.1f us, at most %d device writes in one File::Write\n",
+			queued ? "queued" : "direct",
+			max_stall * 1e6 / CLOCKS_PER_SEC,
+			max_commands);
+	}
+	printf("Files are %s.\n", contents[0]==contents[1] ? "identical" : "DIFFERENT");
+}
+
+//*******************************************************************
+/** Run the SD/MMC driver against the SPI card mock.
+1. Rewrite blocks with Write() and with BeginWrite() followed by other work
+while polling, and report the byte times spent waiting for the busy card.
+2. Log a file through the filesystem on the mock card, with the write-behind
+queue pumped between packets, and verify it on the disk image directly.
+*/
+static unsigned int
+test_sdmmc(
+	const char*	disk_filename
+)
+{
+	const unsigned int	busy_bytes = 2000;
+	const unsigned int	work_bytes = 1000;
+	const unsigned int	nblocks = 64;
+	const unsigned int	total_size = 256 * 1024;
+	const unsigned int	queue_blocks = 16;
+	const char*			filename = "SDMMC.BIN";
+	char				packet[108 + 36];	// GPS record + sensors record.
+	std::vector<char>	queue_memory(queue_blocks * FAT16::BLOCK_SIZE);
+
+	{
+		Blockdevice_File	storage(disk_filename);
+		SDMMC_Mock			card(storage, busy_bytes);
+		card.SetAllocationUnit(64);
+		Blockdevice_SDMMC	sd;
+		char				block[Blockdevice::BLOCK_SIZE];
+
+		// Blocks are written back unchanged.
+		for (unsigned int pass=0; pass<2; ++pass) {
+			const bool			split = pass==1;
+			const unsigned int	waited = card.BusyExchanges();
+			unsigned int		polls = 0;
+
+			for (unsigned int nr=0; nr<nblocks; ++nr) {
+				sd.Read(nr, block);
+				if (split) {
+					sd.BeginWrite(nr, block);
+					while (sd.Poll()) {
+						card.Elapse(work_bytes);
+						++polls;
+					}
+				} else {
+					sd.Write(nr, block);
+				}
+			}
+			printf("%-10s: %d blocks, %6.1f byte times waited per block, %5.1f polls per block\n",
+				split ? "BeginWrite" : "Write",
+				nblocks,
+				(card.BusyExchanges() - waited) / static_cast<double>(nblocks),
+				polls / static_cast<double>(nblocks));
+		}
+
+		// Packets are converted while the card is busy, into erased allocation units.
+		FAT16	filesys(sd);
+		filesys.SetPreErase(true);
+		File	f(filesys, filename, OPEN_CREATE);
+		const unsigned int	waited = card.BusyExchanges();
+		const unsigned int	written = card.BlocksWritten();
+		f.Reserve(total_size);
+		f.SetQueue(&queue_memory[0], queue_blocks);
+		for (unsigned int size=0, i=0; size<total_size; size += sizeof(packet), ++i) {
+			for (unsigned int j=0; j<sizeof(packet); ++j) {
+				packet[j] = static_cast<char>(i + j);
+			}
+			f.Write(packet, sizeof(packet));
+			f.Pump();
+			card.Elapse(work_bytes);
+		}
+		f.Flush();
+		printf("File      : %d blocks, %6.1f byte times waited per block, %d blocks erased in units of %d\n",
+			card.BlocksWritten() - written,
+			(card.BusyExchanges() - waited) / static_cast<double>(card.BlocksWritten() - written),
+			card.BlocksErased(),
+			sd.EraseUnitSize());
+	}
+
+	Blockdevice_File	disk(disk_filename);
+	FAT16				filesys(disk);
+	File				f(filesys, filename, OPEN_READONLY);
+	unsigned int		mismatches = 0;
+	for (unsigned int size=0, i=0; size<total_size; size += sizeof(packet), ++i) {
+		f.Read(packet, sizeof(packet));
+		for (unsigned int j=0; j<sizeof(packet); ++j) {
+			if (packet[j] != static_cast<char>(i + j)) {
+				++mismatches;
+			}
+		}
+	}
+	printf("Verified %d bytes, %d mismatches.\n", f.Pos(), mismatches);
+	return mismatches;
+}
+
+//*******************************************************************
+/** Log 4 MB of packets in simulated SD card time with the logger's options
+added one by one: flushing every 64 kB, group commit with commits every
+256 kB, cluster reservation, the write-behind queue and erase unit aligned,
+erased reservations. Each packet takes 50 us to convert.
+Latency is the card time spent per packet in File::Write, Pump, Flush and Commit.
+*/
+static void
+bench_simsd(
+	const char*	disk_filename
+)
+{
+	const unsigned int	total_size = 4 * 1024 * 1024;
+	const unsigned int	flush_interval = 64 * 1024;
+	const unsigned int	commit_interval = 256 * 1024;
+	const unsigned int	queue_blocks = 128;
+	const double		packet_time = 50;
+	const unsigned int	reserve_size = 1024 * 1024;
+	const char*			names[5] = { "flush", "group commit", "+ Reserve", "+ queue", "+ pre-erase" };
+	const char*			filenames[5] = { "SIMSD0.BIN", "SIMSD1.BIN", "SIMSD2.BIN", "SIMSD3.BIN", "SIMSD4.BIN" };
+	char				packet[108 + 36];	// GPS record + sensors record.
+
+	memset(packet, 's', sizeof(packet));
+	for (unsigned int pass=0; pass<5; ++pass) {
+		std::vector<double>	latencies;
+		Blockdevice_File	disk(disk_filename);
+		Blockdevice_SimSD	card(disk);
+		std::vector<char>	memory(64 * Blockcache::SLOT_SIZE);
+		std::vector<char>	queue_memory(queue_blocks * FAT16::BLOCK_SIZE);
+		Blockcache			cache(card, &memory[0], memory.size());
+		{
+			FAT16	filesys(card, 0, &cache);
+			filesys.SetGroupCommit(pass>=1);
+			filesys.SetPreErase(pass>=4);
+			File	f(filesys, filenames[pass], OPEN_CREATE);
+			if (pass>=2) {
+				f.Reserve(reserve_size);
+			}
+			if (pass>=3) {
+				f.SetQueue(&queue_memory[0], queue_blocks);
+			}
+			card.ResetStatistics();
+
+			for (unsigned int written=0; written<total_size; written += sizeof(packet)) {
+				card.Elapse(packet_time);
+				const double	start = card.Now();
+				f.Write(packet, sizeof(packet));
+				if (pass>=3) {
+					f.Pump();
+				}
+				const unsigned int	pos = written + sizeof(packet);
+				if (pass>=1 && pos / commit_interval != written / commit_interval) {
+					f.Commit();
+				} else if (pos / flush_interval != written / flush_interval) {
+					f.Flush();
+				}
+				// Like the logger, keep a run reserved ahead.
+				if (pass>=2 && f.Reserve(0) < reserve_size/2) {
+					f.Reserve(reserve_size);
+				}
+				latencies.push_back(card.Now() - start);
+			}
+			f.Commit();
+		}
+
+		const double	mb = total_size / (1024.0 * 1024.0);
+		double			sum = 0;
+		for (unsigned int i=0; i<latencies.size(); ++i) {
+			sum += latencies[i];
+		}
+		std::sort(latencies.begin(), latencies.end());
+		printf("%-12s: %6.1f ms, %5.2f MB/s, %6.1f ms waiting, longest %5.1f ms, %6.1f commands/MB, %d stalls, "
+			"latency %5.1f us average, %6.1f us 99%%, %6.1f us 99.9%%\n",
+			names[pass],
+			card.Now() / 1000,
+			mb / (card.Now() / 1e6),
+			card.WaitTime() / 1000,
+			card.MaxWaitTime() / 1000,
+			card.CommandCount() / mb,
+			card.GcCount(),
+			sum / latencies.size(),
+			latencies[latencies.size() * 99 / 100],
+			latencies[latencies.size() * 999 / 1000]);
+	}
+}
+
+//*******************************************************************
+/** Check the FAT32 code path on a FAT32 disk image.
+0. On images larger than 4 GB, e.g. 'truncate -s 6G big32.fat; mkfs.fat -F 32 big32.fat',
+fill the clusters below 4 GB with preallocated files, so that the following
+files are stored past 4 GB.
+1. Create enough small files to grow the root directory past its first cluster,
+then log 4 MB in GPS+sensor sized packets into reserved clusters.
+2. Remount and verify all files.
+3. Remount through the SD/MMC driver on an SDHC card mock, verify and append
+to the log, then verify the appended data on the image.
+*/
+static unsigned int
+test_fat32(
+	const char*	disk_filename
+)
+{
+	const unsigned int	nfiles = 40;
+	const unsigned int	total_size = 4 * 1024 * 1024;
+	const unsigned int	append_size = 256 * 1024;
+	const unsigned int	boundary = 0x100000000ULL / FAT16::BLOCK_SIZE;
+	const unsigned int	filler_size = 1024 * 1024 * 1024;
+	const char*			filename = "FAT32.BIN";
+	char				packet[108 + 36];	// GPS record + sensors record.
+	char				name[16];
+	unsigned int		mismatches = 0;
+	unsigned int		nfillers = 0;
+
+	// 0. Fill the first 4 GB.
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		if (!filesys.IsFat32()) {
+			printf("'%s' is not a FAT32 image.\n", disk_filename);
+			return 1;
+		}
+		unsigned int	end = 0;
+		while (disk.BlockCount() > boundary + 2 * total_size / FAT16::BLOCK_SIZE && end < boundary) {
+			sprintf(name, "FILL%03d.BIN", nfillers++);
+			const unsigned int	fd = filesys.Open(name, OPEN_CREATE);
+			filesys.Preallocate(fd, static_cast<unsigned int>(std::min<uint64_t>(
+				static_cast<uint64_t>(boundary - end) * FAT16::BLOCK_SIZE, filler_size)));
+			unsigned int	blocks = 0;
+			end = filesys.ContiguousBlocks(fd, blocks) + blocks;
+			filesys.Close(fd);
+		}
+	}
+
+	// 1. Write.
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		for (unsigned int i=0; i<nfiles; ++i) {
+			sprintf(name, "FILE%03d.TXT", i);
+			File	f(filesys, name, OPEN_CREATE);
+			for (unsigned int j=0; j<i*100+1; ++j) {
+				const char	c = static_cast<char>(i + j);
+				f.Write(&c, 1);
+			}
+		}
+
+		File	f(filesys, filename, OPEN_CREATE);
+		f.Reserve(total_size);
+		for (unsigned int size=0, i=0; size<total_size; size += sizeof(packet), ++i) {
+			for (unsigned int j=0; j<sizeof(packet); ++j) {
+				packet[j] = static_cast<char>(i + j);
+			}
+			f.Write(packet, sizeof(packet));
+		}
+	}
+
+	// 2. Verify.
+	unsigned int	log_size = 0;
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		for (unsigned int i=0; i<nfiles; ++i) {
+			sprintf(name, "FILE%03d.TXT", i);
+			File				f(filesys, name, OPEN_READONLY);
+			std::vector<char>	contents(f.Size() + 1);
+			f.Read(&contents[0], f.Size());
+			for (unsigned int j=0; j<i*100+1; ++j) {
+				if (f.Size() != i*100+1 || contents[j] != static_cast<char>(i + j)) {
+					++mismatches;
+				}
+			}
+		}
+
+		const unsigned int	fd = filesys.Open(filename, OPEN_READONLY);
+		unsigned int		blocks = 0;
+		const unsigned int	first = filesys.ContiguousBlocks(fd, blocks);
+		filesys.Close(fd);
+		if (nfillers > 0 && first < boundary) {
+			printf("Log at block %d, below 4 GB.\n", first);
+			++mismatches;
+		}
+
+		File	f(filesys, filename, OPEN_READONLY);
+		log_size = f.Size();
+		for (unsigned int size=0, i=0; size+sizeof(packet)<=f.Size(); size += sizeof(packet), ++i) {
+			f.Read(packet, sizeof(packet));
+			for (unsigned int j=0; j<sizeof(packet); ++j) {
+				if (packet[j] != static_cast<char>(i + j)) {
+					++mismatches;
+				}
+			}
+		}
+	}
+
+	// 3. Append on the SDHC card.
+	{
+		Blockdevice_File	storage(disk_filename);
+		SDMMC_Mock			card(storage, 0, true);
+		Blockdevice_SDMMC	sd;
+		FAT16				filesys(sd);
+		File				f(filesys, filename, OPEN_EXISTING);
+
+		f.Read(packet, sizeof(packet));
+		for (unsigned int j=0; j<sizeof(packet); ++j) {
+			if (packet[j] != static_cast<char>(j)) {
+				++mismatches;
+			}
+		}
+		f.SeekSet(f.Size());
+		memset(packet, 'h', sizeof(packet));
+		for (unsigned int size=0; size<append_size; size += sizeof(packet)) {
+			f.Write(packet, sizeof(packet));
+		}
+	}
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		File				f(filesys, filename, OPEN_READONLY);
+		f.SeekSet(log_size);
+		for (unsigned int size=0; size<append_size; size += sizeof(packet)) {
+			f.Read(packet, sizeof(packet));
+			for (unsigned int j=0; j<sizeof(packet); ++j) {
+				if (packet[j] != 'h') {
+					++mismatches;
+				}
+			}
+		}
+		printf("%d files, log %d bytes, %d filler files, %d mismatches.\n", nfiles + 1, f.Size(), nfillers, mismatches);
+		return mismatches;
+	}
+}
+
+//*******************************************************************
+/** Byte \c offset of multifile test file \c k. */
+static char
+multifile_byte(
+	const unsigned int	k,
+	const unsigned int	offset
+)
+{
+	return static_cast<char>(offset * 7 + offset / 512 + k * 85);
+}
+
+//*******************************************************************
+/** Interleave appends to three open files, with the built-in cache, with the
+free cluster bitmap and one file reserved, and with group commit. Read all
+three back at the same time after remounting.
+*/
+static unsigned int
+test_multifile(
+	const char*	disk_filename
+)
+{
+	const unsigned int	nfiles = 3;
+	const unsigned int	total_size = 1024 * 1024;
+	const unsigned int	packet_sizes[nfiles] = { sizeof(LoggerIO::SENSORS), sizeof(LoggerIO::GPS), 1000 };
+	char				packet[1000];
+	char				name[16];
+	unsigned int		mismatches = 0;
+
+	for (unsigned int pass=0; pass<3; ++pass) {
+		// 1. Write.
+		{
+			Blockdevice_File		disk(disk_filename);
+			std::vector<uint8_t>	bitmap(FAT16::FREE_BITMAP_SIZE);
+			std::vector<char>		memory(16 * Blockcache::SLOT_SIZE);
+			Blockcache				cache(disk, &memory[0], memory.size());
+			FAT16					filesys(disk, pass==1 ? &bitmap[0] : 0, pass==2 ? &cache : 0);
+			std::vector<File*>		files;
+
+			filesys.SetGroupCommit(pass==2);
+			for (unsigned int k=0; k<nfiles; ++k) {
+				sprintf(name, "MULTI%d%d.BIN", pass, k);
+				files.push_back(new File(filesys, name, OPEN_CREATE));
+			}
+			if (pass == 1) {
+				files[1]->Reserve(total_size);
+				try {
+					File	again(filesys, "MULTI10.BIN", OPEN_EXISTING);
+					printf("Opening an open file twice succeeded.\n");
+					++mismatches;
+				} catch (const std::exception&) {
+				}
+			}
+
+			unsigned int	sizes[nfiles] = { 0, 0, 0 };
+			for (bool more=true; more; ) {
+				more = false;
+				for (unsigned int k=0; k<nfiles; ++k) {
+					if (sizes[k] < total_size) {
+						const unsigned int	n = std::min(packet_sizes[k], total_size - sizes[k]);
+						for (unsigned int j=0; j<n; ++j) {
+							packet[j] = multifile_byte(k, sizes[k] + j);
+						}
+						files[k]->Write(packet, n);
+						sizes[k] += n;
+						more = true;
+					}
+				}
+			}
+			for (unsigned int k=0; k<nfiles; ++k) {
+				delete files[k];
+			}
+		}
+
+		// 2. Verify, reading all files at the same time.
+		{
+			Blockdevice_File	disk(disk_filename);
+			FAT16				filesys(disk);
+			std::vector<File*>	files;
+
+			for (unsigned int k=0; k<nfiles; ++k) {
+				sprintf(name, "MULTI%d%d.BIN", pass, k);
+				files.push_back(new File(filesys, name, OPEN_READONLY));
+				if (files[k]->Size() != total_size) {
+					printf("%s: size %d, expected %d.\n", name, files[k]->Size(), total_size);
+					++mismatches;
+				}
+			}
+			for (unsigned int offset=0; offset<total_size; offset += sizeof(packet)) {
+				const unsigned int	n = std::min<unsigned int>(sizeof(packet), total_size - offset);
+				for (unsigned int k=0; k<nfiles; ++k) {
+					files[k]->Read(packet, n);
+					for (unsigned int j=0; j<n; ++j) {
+						if (packet[j] != multifile_byte(k, offset + j)) {
+							++mismatches;
+						}
+					}
+				}
+			}
+			for (unsigned int k=0; k<nfiles; ++k) {
+				delete files[k];
+			}
+		}
+	}
+	printf("%d files of %d bytes, %d mismatches.\n", 3 * nfiles, total_size, mismatches);
+	return mismatches;
+}
+
+//*******************************************************************
+/** Storage session on the mocked SD card: mounting again while the card is in
+costs no initialization, removing the card in the middle of writing unmounts,
+blocks written after removal never reach the card inserted again, and a lost
+card is not mounted again while a file is open on it.
+*/
+static unsigned int
+test_storage(
+	const char*	disk_filename
+)
+{
+	const unsigned int		round_size = 64 * 1024;
+	const char*				filename = "STORAGE.BIN";
+	const char				fill[3] = { 'a', 'b', 'c' };
+	char					packet[108 + 36];	// GPS record + sensors record.
+	unsigned int			mismatches = 0;
+	Blockdevice_File		disk(disk_filename);
+	SDMMC_Mock				card(disk, 0);
+	std::vector<uint8_t>	bitmap(FAT16::FREE_BITMAP_SIZE);
+	std::vector<char>		memory(16 * Blockcache::SLOT_SIZE);
+	Storage					storage(&bitmap[0], &memory[0], memory.size());
+
+	// 1. Mount, append, mount again and append again.
+	FAT16*	mounted = 0;
+	for (unsigned int round=0; round<2; ++round) {
+		const unsigned int	resets = card.Resets();
+		FAT16&				filesys = storage.Mount();
+		if (round > 0 && (&filesys != mounted || card.Resets() != resets)) {
+			printf("Card initialized again while in the slot.\n");
+			++mismatches;
+		}
+		mounted = &filesys;
+
+		File	f(filesys, filename, round==0 ? OPEN_CREATE : OPEN_EXISTING);
+		f.SeekSet(f.Size());
+		memset(packet, fill[round], sizeof(packet));
+		for (unsigned int size=0; size<round_size; size += sizeof(packet)) {
+			f.Write(packet, std::min<unsigned int>(sizeof(packet), round_size - size));
+		}
+	}
+
+	// 2. Remove the card while writing.
+	unsigned int	errors = 0;
+	try {
+		File	f(storage.Mount(), filename, OPEN_EXISTING);
+		f.SeekSet(f.Size());
+		memset(packet, fill[2], sizeof(packet));
+		for (unsigned int size=0; size<round_size; size += sizeof(packet)) {
+			if (size >= round_size / 2) {
+				card.SetInserted(false);
+			}
+			f.Write(packet, sizeof(packet));
+		}
+		f.Flush();
+	} catch (const std::exception& e) {
+		++errors;
+	}
+	if (errors == 0 || storage.IsCardPresent() || storage.IsMounted()) {
+		printf("Card removal not noticed.\n");
+		++mismatches;
+	}
+
+	// 3. Insert it again and check the first two rounds.
+	card.SetInserted(true);
+	const unsigned int	written = card.BlocksWritten();
+	{
+		FAT16&	filesys = storage.Mount();
+		File	f(filesys, filename, OPEN_READONLY);
+		if (f.Size() < 2 * round_size) {
+			printf("File size %d, expected at least %d.\n", f.Size(), 2 * round_size);
+			++mismatches;
+		}
+		for (unsigned int size=0; size<2*round_size; ++size) {
+			char	c = 0;
+			f.Read(&c, 1);
+			if (c != fill[size / round_size]) {
+				++mismatches;
+			}
+		}
+	}
+	if (card.BlocksWritten() != written) {
+		printf("%d blocks of the removed card written to the new one.\n", card.BlocksWritten() - written);
+		++mismatches;
+	}
+
+	// 4. Lose the card with a file open: mounting again is refused until it is closed.
+	{
+		File	f(storage.Mount(), filename, OPEN_READONLY);
+		card.SetInserted(false);
+		bool	refused = false;
+		try {
+			storage.Mount();
+		} catch (const std::exception& e) {
+			refused = true;
+		}
+		if (!refused || !storage.IsMounted()) {
+			printf("Mounted again with a file open.\n");
+			++mismatches;
+		}
+	}
+	if (storage.IsCardPresent() || storage.IsMounted()) {
+		printf("Lost card not unmounted after closing the file.\n");
+		++mismatches;
+	}
+	card.SetInserted(true);
+	storage.Mount();
+	printf("%d mounts, %d card resets, %d mismatches.\n", storage.MountCount(), card.Resets(), mismatches);
+	return mismatches;
+}
+
+//*******************************************************************
+/** Byte \c offset of the recovery test file. */
+static char
+recover_byte(
+	const unsigned int	offset
+)
+{
+	return static_cast<char>(offset * 11 + offset / 509 + 1);
+}
+
+//*******************************************************************
+/** Lose power in group commit mode, as the logger does: with clusters reserved
+and erased ahead, commit, append and write the FAT without the directory entry,
+then append more of which only the FAT reaches the card. Recovery extends the
+file to the last block written and frees the clusters past it.
+Meant for an empty image: the file is expected to stay contiguous.
+*/
+static unsigned int
+test_recover(
+	const char*	disk_filename
+)
+{
+	const char*			filename = "RECOVER.BIN";
+	const unsigned int	committed_size = 100000;
+	unsigned int		cluster_size = 0;
+	unsigned int		written_size = 0;
+	unsigned int		mismatches = 0;
+
+	// 1. Commit, append, sync the FAT; append with the data lost; lose power.
+	{
+		PowerLossFile	disk(disk_filename);
+		FAT16			filesys(disk);
+		filesys.SetGroupCommit(true);
+		filesys.SetPreErase(true);
+		cluster_size = filesys.BlocksPerCluster() * FAT16::BLOCK_SIZE;
+		written_size = committed_size + 3 * cluster_size + cluster_size / 2 + 100;
+
+		File	f(filesys, filename, OPEN_CREATE);
+		if (f.Size() != 0) {
+			printf("'%s' exists already.\n", filename);
+			return 1;
+		}
+		f.Reserve(written_size + 4 * cluster_size);
+		for (unsigned int i=0; i<written_size; ++i) {
+			const char	c = recover_byte(i);
+			f.Write(&c, 1);
+			if (i + 1 == committed_size) {
+				f.Commit();
+			}
+		}
+		f.Flush();
+		filesys.SyncMirror();
+
+		disk.DropFrom = filesys.DataStartBlock();
+		for (unsigned int i=written_size; i<written_size + 2 * cluster_size; ++i) {
+			const char	c = recover_byte(i);
+			f.Write(&c, 1);
+		}
+		f.Flush();
+		filesys.SyncMirror();
+		disk.DropFrom = 0;
+	}
+
+	// 2. Recover and check.
+	const unsigned int	expected_size = (written_size + FAT16::BLOCK_SIZE - 1) / FAT16::BLOCK_SIZE * FAT16::BLOCK_SIZE;
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		filesys.SetGroupCommit(true);
+		File				f(filesys, filename, OPEN_EXISTING);
+		if (f.Size() != committed_size) {
+			printf("Committed size %d, expected %d.\n", f.Size(), committed_size);
+			++mismatches;
+		}
+		const unsigned int	recovered = f.RecoverSize();
+		if (f.Size() != expected_size || recovered != expected_size - committed_size) {
+			printf("Recovered %d bytes to %d, expected %d.\n", recovered, f.Size(), expected_size);
+			++mismatches;
+		}
+		std::vector<char>	contents(f.Size());
+		f.Read(&contents[0], contents.size());
+		for (unsigned int i=0; i<contents.size(); ++i) {
+			if (contents[i] != (i < written_size ? recover_byte(i) : 0)) {
+				++mismatches;
+			}
+		}
+
+		// The clusters past the end are free again, appending continues the run.
+		std::vector<char>	more(cluster_size, 'm');
+		f.SeekSet(f.Size());
+		f.Write(&more[0], more.size());
+	}
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		const unsigned int	fd = filesys.Open(filename, OPEN_READONLY);
+		unsigned int		blocks = 0;
+		if (filesys.Size(fd) != expected_size + cluster_size) {
+			printf("Size %d after appending, expected %d.\n", filesys.Size(fd), expected_size + cluster_size);
+			++mismatches;
+		}
+		try {
+			filesys.ContiguousBlocks(fd, blocks);
+		} catch (const std::exception& e) {
+			printf("%s\n", e.what());
+			++mismatches;
+		}
+		filesys.Close(fd);
+	}
+	printf("Committed %d bytes, wrote %d, recovered to %d, %d mismatches.\n",
+		committed_size, written_size, expected_size, mismatches);
+	return mismatches;
+}
+
+//*******************************************************************
+/** Check that the words read back from the raw log count up by one,
+except after \c gaps jumps forward.
+\param[out]	last	Last word in the log.
+\return Number of mismatches.
+*/
+static unsigned int
+rawlog_check(
+	RawLog&				log,
+	const unsigned int	gaps,
+	uint32_t&			last
+)
+{
+	std::vector<uint32_t>	data(RawLog::SEGMENT_BYTES / sizeof(uint32_t));
+	unsigned int			mismatches = 0;
+	unsigned int			jumps = 0;
+	uint32_t				expected = 0;
+	bool					first = true;
+
+	for (unsigned int seq=log.Tail(); seq<log.Head(); ++seq) {
+		const unsigned int	bytes = log.ReadSegment(seq, &data[0]);
+		for (unsigned int i=0; i<bytes/sizeof(uint32_t); ++i) {
+			if (!first && data[i] != expected) {
+				if (data[i] > expected) {
+					++jumps;
+				} else {
+					++mismatches;
+				}
+			}
+			expected = data[i] + 1;
+			first = false;
+		}
+	}
+	if (jumps != gaps) {
+		printf("%d gaps in the raw log, expected %d.\n", jumps, gaps);
+		++mismatches;
+	}
+	last = expected - 1;
+	return mismatches;
+}
+
+//*******************************************************************
+/** Write a counter through the raw log ring, lose power and write again. */
+static unsigned int
+test_rawlog(
+	const char*	disk_filename
+)
+{
+	const unsigned int		ring_size = 2 * 1024 * 1024;
+	const unsigned int		packet_words = 9;	// SENSORS packet size.
+	const unsigned int		buffer_blocks = 17;
+	std::vector<char>		buffer(buffer_blocks * RawLog::BLOCK_SIZE);
+	uint32_t				packet[packet_words];
+	uint32_t				counter = 0;
+	uint32_t				committed = 0;
+	unsigned int			mismatches = 0;
+	Blockdevice_File		disk(disk_filename);
+	FAT16					filesys(disk);
+
+	// 1. Write three times around the ring, commit every 64 kB and lose power after 100 more packets.
+	{
+		RawLog	log(filesys.Device(), &buffer[0], buffer_blocks);
+		log.Open(filesys, "LOGGER.RAW", ring_size);
+		for (unsigned int size=0; size<3*ring_size; size += sizeof(packet)) {
+			for (unsigned int i=0; i<packet_words; ++i) {
+				packet[i] = counter++;
+			}
+			log.Write(packet, sizeof(packet));
+			if ((size + sizeof(packet)) / (64*1024) != size / (64*1024)) {
+				log.Commit();
+				committed = counter - 1;
+			}
+		}
+		for (unsigned int i=0; i<packet_words*100; ++i) {
+			log.Write(&counter, sizeof(counter));
+			++counter;
+		}
+	}
+
+	// 2. Recover, the data after the last commit is lost when its segment did not fill up.
+	unsigned int	segments = 0;
+	{
+		RawLog	log(filesys.Device(), &buffer[0], buffer_blocks);
+		log.Open(filesys, "LOGGER.RAW", ring_size);
+		segments = log.SegmentCount();
+		if (log.Head() - log.Tail() + 1 != segments) {
+			printf("Ring holds %d segments of %d.\n", log.Head() - log.Tail(), segments);
+			++mismatches;
+		}
+		uint32_t	last = 0;
+		mismatches += rawlog_check(log, 0, last);
+		if (last < committed || last >= counter) {
+			printf("Raw log ends at %d, last commit at %d.\n", last, committed);
+			++mismatches;
+		}
+
+		// 3. Write another session and commit.
+		for (unsigned int size=0; size<ring_size/4; size += sizeof(packet)) {
+			for (unsigned int i=0; i<packet_words; ++i) {
+				packet[i] = counter++;
+			}
+			log.Write(packet, sizeof(packet));
+		}
+		log.Commit();
+	}
+	{
+		RawLog	log(filesys.Device(), &buffer[0], buffer_blocks);
+		log.Open(filesys, "LOGGER.RAW", ring_size);
+		uint32_t	last = 0;
+		mismatches += rawlog_check(log, 1, last);
+		if (last != counter - 1) {
+			printf("Raw log ends at %d, expected %d.\n", last, counter - 1);
+			++mismatches;
+		}
+		printf("%d segments, tail %d, head %d, %d mismatches.\n", segments, log.Tail(), log.Head(), mismatches);
+		return mismatches;
+	}
+}
+
+//*******************************************************************
+/** Log 4 MB in GPS+sensor sized packets through the write-behind queue,
+once to the disk directly and once through a Blockdevice_Coalescing window.
+Close() must leave no blocks pending in the window. The file is read back
+through the window, and again from the disk.
+*/
+static unsigned int
+test_coalescing(
+	const char*	disk_filename
+)
+{
+	const unsigned int	total_size = 4 * 1024 * 1024;
+	const unsigned int	flush_interval = 64 * 1024;
+	const unsigned int	queue_blocks = 64;
+	const unsigned int	window_blocks = 64;
+	const char*			filenames[2] = { "DIRECTW.BIN", "WINDOW.BIN" };
+	char				packet[108 + 36];	// GPS record + sensors record.
+	unsigned int		mismatches = 0;
+
+	for (unsigned int pass=0; pass<2; ++pass) {
+		const bool			windowed = pass==1;
+		std::vector<char>	queue_memory(queue_blocks * FAT16::BLOCK_SIZE);
+		std::vector<char>	window_memory(window_blocks * FAT16::BLOCK_SIZE);
+		std::vector<char>	contents;
+		unsigned int		pending = 0;
+		unsigned int		writes = 0;
+		unsigned int		commands = 0;
+		{
+			Blockdevice_File		disk(disk_filename);
+			Blockdevice_Coalescing	window(disk, &window_memory[0], window_blocks);
+			FAT16					filesys(windowed ? static_cast<Blockdevice&>(window) : disk);
+			{
+				File	f(filesys, filenames[pass], OPEN_CREATE);
+				f.SetQueue(&queue_memory[0], queue_blocks);
+				for (unsigned int written=0, i=0; written<total_size; written += sizeof(packet), ++i) {
+					for (unsigned int j=0; j<sizeof(packet); ++j) {
+						packet[j] = static_cast<char>(i + j);
+					}
+					f.Write(packet, sizeof(packet));
+					f.Pump();
+					if ((written + sizeof(packet)) / flush_interval != written / flush_interval) {
+						f.Flush();
+					}
+				}
+			}
+
+			// Read back through the window.
+			pending = window.PendingCount();
+			if (pending != 0) {
+				printf("%s: %d blocks pending after Close().\n", filenames[pass], pending);
+				++mismatches;
+			}
+			File	f(filesys, filenames[pass], OPEN_READONLY);
+			contents.resize(f.Size());
+			f.Read(&contents[0], f.Size());
+			filesys.Device().Flush();
+			writes = disk.WriteCount();
+			commands = disk.WriteCommandCount();
+		}
+		{
+			Blockdevice_File	disk(disk_filename);
+			FAT16				filesys(disk);
+			File				f(filesys, filenames[pass], OPEN_READONLY);
+			std::vector<char>	readback(f.Size());
+			f.Read(&readback[0], f.Size());
+			if (readback != contents || contents.size() < total_size) {
+				printf("%s: contents differ.\n", filenames[pass]);
+				++mismatches;
+			}
+		}
+		for (unsigned int i=0; i<contents.size(); ++i) {
+			if (contents[i] != static_cast<char>(i / sizeof(packet) + i % sizeof(packet))) {
+				++mismatches;
+			}
+		}
+
+		printf("%-6s: %7.1f write commands/MB, %6.2f blocks/command, %d blocks pending at close\n",
+			windowed ? "window" : "direct",
+			commands * (1024.0 * 1024.0 / total_size),
+			static_cast<double>(writes) / commands,
+			pending);
+	}
+	printf("%d mismatches.\n", mismatches);
+	return mismatches;
+}
+
+//*******************************************************************
+/** Byte \c offset of the read-ahead test file. */
+static char
+readahead_byte(
+	const unsigned int	offset
+)
+{
+	return static_cast<char>(offset * 13 + offset / 512);
+}
+
+//*******************************************************************
+/** Write two files interleaved, so that their clusters alternate, and read
+one back in GPS sized packets without and with read-ahead. Then mix seeks,
+whole block reads and overwrites with the reads, checking every byte.
+*/
+static unsigned int
+test_readahead(
+	const char*	disk_filename
+)
+{
+	const unsigned int	total_size = 2 * 1024 * 1024;
+	const unsigned int	chunk_size = 48 * 1024;
+	const unsigned int	ahead_blocks = 32;
+	const unsigned int	packet_size = 108;
+	std::vector<char>	chunk(chunk_size);
+	std::vector<char>	ahead_memory(ahead_blocks * FAT16::BLOCK_SIZE);
+	std::vector<char>	packet(4 * FAT16::BLOCK_SIZE);
+	unsigned int		mismatches = 0;
+
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		File				f(filesys, "AHEAD.BIN", OPEN_CREATE);
+		File				other(filesys, "AHEAD2.BIN", OPEN_CREATE);
+		for (unsigned int pos=0; pos<total_size; pos+=chunk_size) {
+			for (unsigned int i=0; i<chunk_size; ++i) {
+				chunk[i] = readahead_byte(pos + i);
+			}
+			f.Write(&chunk[0], chunk_size);
+			other.Write(&chunk[0], chunk_size);
+			f.Flush();
+			other.Flush();
+		}
+	}
+
+	// 1. Sequential packets.
+	for (unsigned int pass=0; pass<2; ++pass) {
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		File				f(filesys, "AHEAD.BIN", OPEN_READONLY);
+		if (pass == 1) {
+			f.SetReadAhead(&ahead_memory[0], ahead_blocks);
+		}
+		const unsigned int	reads = disk.ReadCount();
+		const unsigned int	commands = disk.ReadCommandCount();
+		for (unsigned int pos=0; pos+packet_size<=f.Size(); pos+=packet_size) {
+			f.Read(&packet[0], packet_size);
+			for (unsigned int i=0; i<packet_size; ++i) {
+				if (packet[i] != readahead_byte(pos + i)) {
+					++mismatches;
+				}
+			}
+		}
+		const double	mb = f.Size() / (1024.0 * 1024.0);
+		printf("%-10s: %7.1f read commands/MB, %6.2f blocks/command\n",
+			pass==1 ? "read-ahead" : "direct",
+			(disk.ReadCommandCount() - commands) / mb,
+			static_cast<double>(disk.ReadCount() - reads) / (disk.ReadCommandCount() - commands));
+	}
+
+	// 2. Seeks, whole block reads and overwrites between the reads.
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		File				f(filesys, "AHEAD.BIN", OPEN_EXISTING);
+		std::vector<char>	expected(f.Size());
+		unsigned int		seed = 1;
+
+		for (unsigned int i=0; i<expected.size(); ++i) {
+			expected[i] = readahead_byte(i);
+		}
+		f.SetReadAhead(&ahead_memory[0], ahead_blocks);
+		for (unsigned int round=0; round<2000; ++round) {
+			seed = seed * 1103515245 + 12345;
+			const unsigned int	what = (seed >> 16) % 8;
+			seed = seed * 1103515245 + 12345;
+			const unsigned int	size = what == 6 ? 2 * FAT16::BLOCK_SIZE : 1 + (seed >> 16) % packet_size;
+			if (what == 0) {
+				// Seek somewhere else.
+				seed = seed * 1103515245 + 12345;
+				f.SeekSet((seed >> 8) % (expected.size() - packet.size()));
+			} else if (what == 6 && f.Pos() % FAT16::BLOCK_SIZE != 0) {
+				f.SeekSet(f.Pos() - f.Pos() % FAT16::BLOCK_SIZE);
+			} else if (what == 7) {
+				// Overwrite what is read next.
+				const unsigned int	pos = f.Pos();
+				for (unsigned int i=0; i<size; ++i) {
+					packet[i] = expected[pos + i] = static_cast<char>(round + i);
+				}
+				f.Write(&packet[0], size);
+				f.SeekSet(pos);
+			}
+			if (f.Pos() + size > expected.size()) {
+				f.SeekSet(0);
+			}
+			const unsigned int	pos = f.Pos();
+			f.Read(&packet[0], size);
+			if (memcmp(&packet[0], &expected[pos], size) != 0) {
+				++mismatches;
+			}
+		}
+	}
+	printf("%d mismatches.\n", mismatches);
+	return mismatches;
+}
+
+//*******************************************************************
+/** FAT16::Remove(): an open file and a missing file are refused, the clusters
+of a removed file are taken by the next file, and both FAT copies are equal
+afterwards in group commit mode (images without a partition table).
+*/
+static unsigned int
+test_remove(
+	const char*	disk_filename
+)
+{
+	const unsigned int	nclusters = 16;
+	const char*			filename = "REMOVE.BIN";
+	const char*			reuse_filename = "REUSE.BIN";
+	unsigned int		mismatches = 0;
+	unsigned int		first_removed = 0;
+	unsigned int		first_reused = 0;
+
+	{
+		Blockdevice_File	disk(disk_filename);
+		FAT16				filesys(disk);
+		std::vector<char>	cluster(filesys.BlocksPerCluster() * FAT16::BLOCK_SIZE, 'r');
+		unsigned int		blocks = 0;
+
+		// The second FAT copy is written by SyncMirror() only.
+		filesys.SetGroupCommit(true);
+
+		// 1. Open file.
+		{
+			File	f(filesys, filename, OPEN_CREATE);
+			for (unsigned int i=0; i<nclusters; ++i) {
+				f.Write(&cluster[0], cluster.size());
+			}
+			f.Flush();
+			bool	refused = false;
+			try {
+				filesys.Remove(filename);
+			} catch (const std::exception& e) {
+				refused = true;
+			}
+			if (!refused) {
+				printf("Removed an open file.\n");
+				++mismatches;
+			}
+		}
+		unsigned int	fd = filesys.Open(filename, OPEN_READONLY);
+		first_removed = filesys.ContiguousBlocks(fd, blocks);
+		filesys.Close(fd);
+
+		// 2. Missing file, after removing it.
+		filesys.Remove(filename);
+		bool	refused = false;
+		try {
+			filesys.Remove(filename);
+		} catch (const std::exception& e) {
+			refused = true;
+		}
+		if (!refused) {
+			printf("Removed a missing file.\n");
+			++mismatches;
+		}
+
+		// 3. The freed clusters are taken again.
+		{
+			File	f(filesys, reuse_filename, OPEN_CREATE);
+			for (unsigned int i=0; i<nclusters; ++i) {
+				f.Write(&cluster[0], cluster.size());
+			}
+		}
+		fd = filesys.Open(reuse_filename, OPEN_READONLY);
+		first_reused = filesys.ContiguousBlocks(fd, blocks);
+		filesys.Close(fd);
+		if (first_reused != first_removed) {
+			printf("%s at block %d, the removed file was at %d.\n", reuse_filename, first_reused, first_removed);
+			++mismatches;
+		}
+		filesys.Remove(reuse_filename);
+
+		// 4. FAT copies on the device, before the filesystem is unmounted.
+		uint8_t				boot[FAT16::BLOCK_SIZE];
+		disk.Read(0, boot);
+		const unsigned int	reserved = boot[14] | (boot[15] << 8);
+		const unsigned int	nfats = boot[16];
+		unsigned int		fat_blocks = boot[22] | (boot[23] << 8);
+		if (fat_blocks == 0) {
+			fat_blocks = boot[36] | (boot[37] << 8) | (boot[38] << 16) | (boot[39] << 24);
+		}
+		unsigned int	differing = 0;
+		for (unsigned int i=0; nfats == 2 && i<fat_blocks; ++i) {
+			uint8_t	fat1[FAT16::BLOCK_SIZE];
+			uint8_t	fat2[FAT16::BLOCK_SIZE];
+			disk.Read(reserved + i, fat1);
+			disk.Read(reserved + fat_blocks + i, fat2);
+			if (memcmp(fat1, fat2, sizeof(fat1)) != 0) {
+				++differing;
+			}
+		}
+		if (differing > 0) {
+			printf("%d FAT blocks differ between the copies.\n", differing);
+			++mismatches;
+		}
+	}
+	printf("Removed file at block %d, reused at %d, %d mismatches.\n", first_removed, first_reused, mismatches);
+	return mismatches;
+}
+
+//*******************************************************************
+/** Contents of block \c nr in the large image test, numbered by block. */
+static void
+large_image_block(
+	const unsigned int	nr,
+	const unsigned int	pass,
+	uint8_t*			block
+)
+{
+	for (unsigned int i=0; i<FAT16::BLOCK_SIZE; ++i) {
+		block[i] = static_cast<uint8_t>((nr >> (8 * (i % 4))) + i / 4 + pass);
+	}
+}
+
+//*******************************************************************
+/** Write and read back blocks on both sides of the 4 GB boundary of a sparse
+image, e.g. from 'truncate -s 6G large.img'. Blocks past 4 GB must not land
+on the blocks 4 GB below them. The image is overwritten.
+*/
+static unsigned int
+test_large_image(
+	const char*	disk_filename
+)
+{
+	const unsigned int	boundary = 0x100000000ULL / FAT16::BLOCK_SIZE;
+	const unsigned int	offsets[] = { 0, 1, 2, 100, 1000000 };
+	std::vector<uint8_t>	block(FAT16::BLOCK_SIZE);
+	std::vector<uint8_t>	expected(FAT16::BLOCK_SIZE);
+	unsigned int		mismatches = 0;
+
+	std::vector<unsigned int>	blocks;
+	{
+		Blockdevice_File	disk(disk_filename);
+		if (disk.BlockCount() < boundary + 2 * offsets[sizeof(offsets) / sizeof(offsets[0]) - 1]) {
+			printf("'%s' is too small, need more than %d blocks.\n", disk_filename, boundary + 2 * offsets[sizeof(offsets) / sizeof(offsets[0]) - 1]);
+			return 1;
+		}
+		for (unsigned int i=0; i<sizeof(offsets) / sizeof(offsets[0]); ++i) {
+			blocks.push_back(offsets[i]);
+			blocks.push_back(boundary - 1 - offsets[i]);
+			blocks.push_back(boundary + offsets[i]);
+		}
+		blocks.push_back(disk.BlockCount() - 1);
+
+		// Below the boundary first, so that a wrapped write overwrites them.
+		for (unsigned int pass=0; pass<2; ++pass) {
+			for (unsigned int i=0; i<blocks.size(); ++i) {
+				if ((blocks[i] < boundary) == (pass == 0)) {
+					large_image_block(blocks[i], 0, &block[0]);
+					disk.Write(blocks[i], &block[0]);
+				}
+			}
+		}
+		// Two blocks in one command across the boundary.
+		large_image_block(boundary - 1, 1, &block[0]);
+		large_image_block(boundary, 1, &expected[0]);
+		std::vector<uint8_t>	both(block);
+		both.insert(both.end(), expected.begin(), expected.end());
+		disk.WriteBlocks(boundary - 1, 2, &both[0]);
+	}
+
+	Blockdevice_File	disk(disk_filename);
+	for (unsigned int i=0; i<blocks.size(); ++i) {
+		const unsigned int	pass = blocks[i] == boundary - 1 || blocks[i] == boundary ? 1 : 0;
+		large_image_block(blocks[i], pass, &expected[0]);
+		disk.Read(blocks[i], &block[0]);
+		if (block != expected) {
+			printf("Block %u differs.\n", blocks[i]);
+			++mismatches;
+		}
+	}
+	std::vector<uint8_t>	both(2 * FAT16::BLOCK_SIZE);
+	disk.ReadBlocks(boundary - 1, 2, &both[0]);
+	large_image_block(boundary, 1, &expected[0]);
+	if (!std::equal(expected.begin(), expected.end(), both.begin() + FAT16::BLOCK_SIZE)) {
+		printf("Block %u read across the boundary differs.\n", boundary);
+		++mismatches;
+	}
+	printf("%d blocks around 4 GB of %d blocks, %d mismatches.\n", static_cast<int>(blocks.size()), disk.BlockCount(), mismatches);
+	return mismatches;
+}
+
+//*******************************************************************
+int
+main(
+	int	argc,
+	char**	argv)
+{
+	const char*	disk_filename = argc>1 ? argv[1] : "test1_empty.fat";
+	const char*	test_name = argc>2 ? argv[2] : "config";
+	unsigned int	mismatches = 0;
+
+	try {
+		if (strcmp(test_name, "simple")==0) {
+			test_simple(disk_filename);
+		} else if (strcmp(test_name, "logging")==0) {
+			mismatches = test_logging(disk_filename);
+		} else if (strcmp(test_name, "config")==0) {
+			test_config(disk_filename);
+		} else if (strcmp(test_name, "multiblock")==0) {
+			bench_multiblock(disk_filename);
+		} else if (strcmp(test_name, "allocation")==0) {
+			bench_allocation(disk_filename);
+		} else if (strcmp(test_name, "fragments")==0) {
+			mismatches = test_fragments(disk_filename);
+		} else if (strcmp(test_name, "reopen")==0) {
+			bench_reopen(disk_filename);
+		} else if (strcmp(test_name, "cache")==0) {
+			bench_cache(disk_filename);
+		} else if (strcmp(test_name, "groupcommit")==0) {
+			bench_groupcommit(disk_filename);
+		} else if (strcmp(test_name, "reserve")==0) {
+			bench_reserve(disk_filename);
+		} else if (strcmp(test_name, "file")==0) {
+			mismatches = bench_file(disk_filename);
+		} else if (strcmp(test_name, "writebehind")==0) {
+			bench_writebehind(disk_filename);
+		} else if (strcmp(test_name, "sdmmc")==0) {
+			mismatches = test_sdmmc(disk_filename);
+		} else if (strcmp(test_name, "simsd")==0) {
+			bench_simsd(disk_filename);
+		} else if (strcmp(test_name, "fat32")==0) {
+			mismatches = test_fat32(disk_filename);
+		} else if (strcmp(test_name, "multifile")==0) {
+			mismatches = test_multifile(disk_filename);
+		} else if (strcmp(test_name, "storage")==0) {
+			mismatches = test_storage(disk_filename);
+		} else if (strcmp(test_name, "recover")==0) {
+			mismatches = test_recover(disk_filename);
+		} else if (strcmp(test_name, "rawlog")==0) {
+			mismatches = test_rawlog(disk_filename);
+		} else if (strcmp(test_name, "coalescing")==0) {
+			mismatches = test_coalescing(disk_filename);
+		} else if (strcmp(test_name, "readahead")==0) {
+			mismatches = test_readahead(disk_filename);
+		} else if (strcmp(test_name, "remove")==0) {
+			mismatches = test_remove(disk_filename);
+		} else if (strcmp(test_name, "largeimage")==0) {
+			mismatches = test_large_image(disk_filename);
+		} else {
+			printf("Unknown test '%s'.\n", test_name);
+			return 1;
+		}
 	} catch (const std::exception& e) {
 		printf("Exception: %s\n", e.what());
+		return 1;
 	}
-	return 0;
+	// Nonzero exit status when the test found mismatches, for scripts.
+	return mismatches > 0 ? 1 : 0;
 }
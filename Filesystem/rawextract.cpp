@@ -0,0 +1,95 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include <exception>
+#include <vector>		// std::vector
+#include <stdio.h>
+
+#include <Filesystem_Config.h>
+#include <Filesystem/Blockdevice_File.h>
+#include <Filesystem/FAT16.h>
+#include <Filesystem/RawLog.h>
+
+using namespace Filesystem;
+
+/** \file Raw log extraction tool.
+
+Usage: rawextract card.img [LOGGER.BIN] [LOGGER.RAW]
+
+Reads the raw log ring from the memory card image and writes its segments,
+oldest first, to a file in the LOGGER.BIN format for LogConvert. The image
+is opened read-only and never changed.
+*/
+
+//*******************************************************************
+static void
+extract(
+	const char*	image_filename,
+	const char*	output_filename,
+	const char*	raw_filename
+)
+{
+	// The image is only read, the filesystem must not write anything back.
+	Blockdevice_File	disk(image_filename, true);
+	FAT16				filesys(disk);
+	unsigned int		first = 0;
+	unsigned int		blocks = 0;
+	{
+		const unsigned int	fd = filesys.Open(raw_filename, OPEN_READONLY);
+		try {
+			first = filesys.ContiguousBlocks(fd, blocks);
+		} catch (...) {
+			filesys.Close(fd);
+			throw;
+		}
+		filesys.Close(fd);
+	}
+
+	std::vector<char>	buffer(2 * RawLog::BLOCK_SIZE);
+	RawLog				log(disk, &buffer[0], 2);
+	if (!log.Mount(first, blocks)) {
+		printf("No raw log in '%s'.\n", raw_filename);
+		return;
+	}
+
+	FILE*	f = fopen(output_filename, "wb");
+	if (f == 0) {
+		printf("Cannot open '%s' for writing.\n", output_filename);
+		return;
+	}
+	std::vector<char>	data(RawLog::SEGMENT_BYTES);
+	unsigned int		total = 0;
+	for (unsigned int seq=log.Tail(); seq<log.Head(); ++seq) {
+		const unsigned int	bytes = log.ReadSegment(seq, &data[0]);
+		if (bytes > 0 && fwrite(&data[0], bytes, 1, f) != 1) {
+			fclose(f);
+			printf("Cannot write '%s'.\n", output_filename);
+			return;
+		}
+		total += bytes;
+	}
+	fclose(f);
+	printf("Segments %d .. %d of %d, %d bytes written to '%s'.\n",
+		log.Tail(), log.Head(), log.SegmentCount(), total, output_filename);
+}
+
+//*******************************************************************
+int
+main(
+	int	argc,
+	char**	argv)
+{
+	if (argc < 2) {
+		printf("Usage: %s card.img [LOGGER.BIN] [LOGGER.RAW]\n", argv[0]);
+		return 1;
+	}
+
+	try {
+		extract(argv[1], argc>2 ? argv[2] : "LOGGER.BIN", argc>3 ? argv[3] : "LOGGER.RAW");
+	} catch (const std::exception& e) {
+		printf("Exception: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
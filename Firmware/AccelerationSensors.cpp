@@ -21,7 +21,12 @@ vim: shiftwidth=4
 
 #define	BUMP_TIMEOUT_ROUNDS		(LoggerConfig::SamplingFrequency)
 
-CircularBuffer<SENSORS_RXBUFFER>	AccelerationSensors_RxQueue(0, 10);
+RingBuffer<SENSORS_SAMPLE>		AccelerationSensors_RxQueue(0, 8);
+
+/** Characters of the current and of the previous round. */
+static SENSORS_RXBUFFER				rx_buffers[2];
+/** Buffer of the current round, filled by the receiver. */
+static SENSORS_RXBUFFER* volatile	rx_current = &rx_buffers[0];
 
 /** Round number. */
 static volatile unsigned int		current_round = 0;
@@ -36,7 +41,7 @@ AccelerationSensors_RxChar(
 	const char	c
 )
 {
-	SENSORS_RXBUFFER&	el = AccelerationSensors_RxQueue.Poke();
+	SENSORS_RXBUFFER&	el = *rx_current;
 	uint16_t&			el_count = el.count;
 	if (el_count < sizeof(el.buffer)) {
 		el.buffer[el_count] = c;
@@ -117,13 +122,38 @@ DecodeData(
 }
 
 //*******************************************************************
+/** Decode the characters of a round into a sample. */
 static void
-timer_sampling( void )
+convert_round(
+	SENSORS_SAMPLE&			dst,
+	const SENSORS_RXBUFFER&	src
+)
 {
-	// 1. Push, if any.
-	if (current_round > 0) {
-		AccelerationSensors_RxQueue.Push();
+	const unsigned int	rx_count = src.count;
+	unsigned int		byte_index = 0;
+	unsigned int		packet_index = 0;
+
+	dst.tick = src.tick;
+	memset(dst.readings, 0, sizeof(dst.readings));
+
+	// Parse incoming data.
+	for (unsigned int i=0; i+LoggerIO::SENSORS_PACKET_SIZE<=rx_count; ++i) {
+		if (decode_rxtick(packet_index, byte_index, src.rxtick[i]) && byte_index==0 && bytes_in_line(src.rxtick+i)) {
+			// Copy packet data.
+			const unsigned int	dst_offset = packet_index*LoggerIO::SENSORS_PACKET_SIZE + byte_index;
+			memcpy(dst.readings+dst_offset, src.buffer+i, LoggerIO::SENSORS_PACKET_SIZE);
+		}
 	}
+}
+
+//*******************************************************************
+static void
+timer_sampling( void )
+{
+	// 1. The round just ended is complete, receive into the other buffer.
+	SENSORS_RXBUFFER&	ended = *rx_current;
+	const bool			any = current_round > 0;
+	rx_current = rx_current == &rx_buffers[0] ? &rx_buffers[1] : &rx_buffers[0];
 
 	// 2. Increment current round counter.
 	{
@@ -136,38 +166,30 @@ timer_sampling( void )
 	}
 
 	// 3. Start it again.
-	SENSORS_RXBUFFER&	el = AccelerationSensors_RxQueue.Poke();
+	SENSORS_RXBUFFER&	el = *rx_current;
 	el.tick = current_round;
 	el.count = 0;
 	round_start_ticks = GetTSC();
 	IUsart_Write(IUsart1, SENSORS_QUERY);
+
+	// 4. Decode the round just ended while the sensors answer, and push it, if any.
+	if (any) {
+		convert_round(AccelerationSensors_RxQueue.Poke(), ended);
+		AccelerationSensors_RxQueue.Push();
+	}
 }
 
 //*******************************************************************
 void
 AccelerationSensors_Convert(
 	LoggerIO::SENSORS&		dst,
-	const SENSORS_RXBUFFER&	src
+	const SENSORS_SAMPLE&	src
 )
 {
-	const unsigned int	rx_count = src.count;
-	unsigned int		byte_index = 0;
-	unsigned int		packet_index = 0;
-
-	// Update header.
 	dst.Header.Type			= LoggerIO::TYPE_SENSORS;
 	dst.Header.TotalSize	= sizeof(LoggerIO::SENSORS);
 	dst.Header.Tick			= src.tick;
-	memset(dst.Readings, 0, sizeof(dst.Readings));
-
-	// Parse incoming data.
-	for (unsigned int i=0; i+LoggerIO::SENSORS_PACKET_SIZE<=rx_count; ++i) {
-		if (decode_rxtick(packet_index, byte_index, src.rxtick[i]) && byte_index==0 && bytes_in_line(src.rxtick+i)) {
-			// Copy packet data.
-			const unsigned int	dst_offset = packet_index*LoggerIO::SENSORS_PACKET_SIZE + byte_index;
-			memcpy(dst.Readings+dst_offset, src.buffer+i, LoggerIO::SENSORS_PACKET_SIZE);
-		}
-	}
+	memcpy(dst.Readings, src.readings, sizeof(dst.Readings));
 }
 
 //*******************************************************************
@@ -188,6 +210,7 @@ AccelerationSensors_Init(
 {
 	tprintf("Acceleration sensors...");
 	memset(sensor_state, 0, sizeof(sensor_state));
+	memset(rx_buffers, 0, sizeof(rx_buffers));
 
 	cputicks_per_round = F_CPU / sampling_rate;
 	round_start_ticks = GetTSC();
@@ -207,7 +230,21 @@ AccelerationSensors_GetTick()
 //*******************************************************************
 bool
 AccelerationSensors_PacketWithinLimits(
-	const LoggerIO::SENSORS&	packet
+	const SENSORS_SAMPLE&	sample
+)
+{
+	unsigned int	sensor;
+	unsigned int	axis;
+
+	return !AccelerationSensors_FindOverLimit(sample, sensor, axis);
+}
+
+//*******************************************************************
+bool
+AccelerationSensors_FindOverLimit(
+	const SENSORS_SAMPLE&	sample,
+	unsigned int&			sensor,
+	unsigned int&			axis
 )
 {
 	unsigned int	x;
@@ -216,18 +253,24 @@ AccelerationSensors_PacketWithinLimits(
 
 	for (unsigned int i=0; i<LoggerIO::SENSORS_MAX_PACKETS; ++i) {
 		const LoggerConfig::AccelerationMinMax&	limits = LoggerConfig::LimitsAcceleration[i];
-		DecodeData(packet.Readings + i*LoggerIO::SENSORS_PACKET_SIZE, x, y, z);
+		DecodeData(sample.readings + i*LoggerIO::SENSORS_PACKET_SIZE, x, y, z);
 		if (x!=0 && y!=0 && z!=0) {
-			const bool	ok =
-				x>=limits.MinX && x<=limits.MaxX &&
-				y>=limits.MinY && y<=limits.MaxY &&
-				z>=limits.MinZ && z<=limits.MaxZ;
-			if (!ok) {
-				return false;
+			sensor = i;
+			if (x<limits.MinX || x>limits.MaxX) {
+				axis = 0;
+				return true;
+			}
+			if (y<limits.MinY || y>limits.MaxY) {
+				axis = 1;
+				return true;
+			}
+			if (z<limits.MinZ || z>limits.MaxZ) {
+				axis = 2;
+				return true;
 			}
 		}
 	}
-	return true;
+	return false;
 }
 
 //*******************************************************************
@@ -240,27 +283,28 @@ AccelerationSensors_Display_Process(void)
 {
 	const unsigned int	rxqueue_size = AccelerationSensors_RxQueue.Size();
 	if (rxqueue_size>=1) {
-		const SENSORS_RXBUFFER&	rxpacket = AccelerationSensors_RxQueue.Peek(rxqueue_size - 1);
-		const unsigned int		rx_count = rxpacket.count;
-		const unsigned int		rx_tick = rxpacket.tick;
-		unsigned int			byte_index = 0;
-		unsigned int			packet_index = 0;
+		const SENSORS_SAMPLE&	sample = AccelerationSensors_RxQueue.Peek(rxqueue_size - 1);
+		const unsigned int		rx_tick = sample.tick;
 		char					xbuf[34];
 		unsigned int			x,y,z;
 		char*					xptr = xbuf;
 
 #if defined(TRACE_SENSORS_TIMING)
-		tprintf("i: ");
+		{
+			// Characters of the round decoded last.
+			const SENSORS_RXBUFFER&	rxpacket = rx_current == &rx_buffers[0] ? rx_buffers[1] : rx_buffers[0];
+			tprintf("i: ");
+			for (unsigned int i=0; i<rxpacket.count; ++i) {
+				tprintf("%d ", (int)rxpacket.rxtick[i]);
+			}
+			tprintf("\n");
+		}
 #endif
-		for (unsigned int i=0; i<rx_count; ++i) {
-			if (decode_rxtick(packet_index, byte_index, rxpacket.rxtick[i])
-			 && byte_index==0
-			 && i+LoggerIO::SENSORS_PACKET_SIZE<=rx_count
-			 && bytes_in_line(rxpacket.rxtick+i)) {
-				const LoggerConfig::AccelerationMinMax&	limits = LoggerConfig::LimitsAcceleration[packet_index];
-				SENSOR_STATE&							st = sensor_state[packet_index];
-
-				DecodeData(rxpacket.buffer + i, x, y, z);
+		for (unsigned int i=0; i<LoggerIO::SENSORS_MAX_PACKETS; ++i) {
+			DecodeData(sample.readings + i*LoggerIO::SENSORS_PACKET_SIZE, x, y, z);
+			if (x!=0 && y!=0 && z!=0) {
+				const LoggerConfig::AccelerationMinMax&	limits = LoggerConfig::LimitsAcceleration[i];
+				SENSOR_STATE&							st = sensor_state[i];
 
 				// Update sensor state.
 				st.last_read_round = rx_tick;
@@ -271,13 +315,7 @@ AccelerationSensors_Display_Process(void)
 					st.last_min_round = rx_tick;
 				}
 			}
-#if defined(TRACE_SENSORS_TIMING)
-			tprintf("%d ", (int)rxpacket.rxtick[i]);
-#endif
 		}
-#if defined(TRACE_SENSORS_TIMING)
-		tprintf("\n");
-#endif
 
 		// Update display.
 		*xptr = timer_scroll[(rx_tick >> 10) & 0x01];
@@ -6,8 +6,9 @@ vim: shiftwidth=4
 #define AccelerationSensors_h_
 
 #include "LoggerIO.h"
-#include "CircularBuffer.h"
+#include "RingBuffer.h"
 
+/** Characters received in one round, with their receive times. */
 typedef struct {
 	unsigned char	buffer[LoggerIO::SENSORS_BUFFER_SIZE + 8];
 	uint16_t		rxtick[LoggerIO::SENSORS_BUFFER_SIZE + 8];
@@ -15,14 +16,22 @@ typedef struct {
 	uint16_t		count;
 } SENSORS_RXBUFFER;
 
-/** Receive queue. */
-extern CircularBuffer<SENSORS_RXBUFFER>	AccelerationSensors_RxQueue;
+/** One round of readings, decoded from the received characters by the sampling
+ * timer. A sensor that did not answer has all bytes zero.
+ */
+typedef struct {
+	uint32_t		tick;
+	uint8_t			readings[LoggerIO::SENSORS_BUFFER_SIZE];
+} SENSORS_SAMPLE;
+
+/** Receive queue, one sample per round. */
+extern RingBuffer<SENSORS_SAMPLE>	AccelerationSensors_RxQueue;
 
 /** Packet converter. */
 extern void
 AccelerationSensors_Convert(
 	LoggerIO::SENSORS&		dst,
-	const SENSORS_RXBUFFER&	src
+	const SENSORS_SAMPLE&	src
 );
 
 /** Initialize acceleration sensors module. */
@@ -38,7 +47,19 @@ AccelerationSensors_GetTick();
 /** Is packet within current limits? */
 extern bool
 AccelerationSensors_PacketWithinLimits(
-	const LoggerIO::SENSORS&	packet
+	const SENSORS_SAMPLE&	sample
+);
+
+/** Find the first reading outside the current limits.
+ * \param[out]	sensor	Sensor index, 0...6
+ * \param[out]	axis	0 = x, 1 = y, 2 = z.
+ * \return		false iff all readings are within the limits.
+ */
+extern bool
+AccelerationSensors_FindOverLimit(
+	const SENSORS_SAMPLE&	sample,
+	unsigned int&			sensor,
+	unsigned int&			axis
 );
 
 /** Process display data :) */
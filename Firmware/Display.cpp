@@ -14,6 +14,7 @@ static char MemoryCard_Line[ROW_LENGTH+1]	= { 0 };
 static char Gps_Line[ROW_LENGTH+1]	= { 0 };
 static char AccelerationSensors_Line[ROW_LENGTH+1]	= { 0 };
 static char Error[ROW_LENGTH+1]			= { 0 };
+static Display_BusWait	BusWait = 0;
 
 void Display_Init(void)
 {
@@ -22,9 +23,21 @@ void Display_Init(void)
 	tprintf(" done.\n");
 }
 
+//*******************************************************************
+void Display_SetBusWait(
+	Display_BusWait	wait
+)
+{
+	BusWait = wait;
+}
+
 //*******************************************************************
 void Display_Draw(void)
 {
+  if (BusWait != 0) {
+    BusWait();
+  }
+
   // Display default message.
   dip204_set_cursor_position(1,1);
   dip204_write_string(MemoryCard_Line[0]==0 ? "Memory Card N/A     " : MemoryCard_Line);
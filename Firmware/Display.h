@@ -12,6 +12,18 @@ extern void Display_Init(void);
 /** Main thread: Draw display. */
 extern void Display_Draw(void);
 
+/** Function waiting until the SPI bus of the display is free. */
+typedef void (*Display_BusWait)(void);
+
+/** Main thread: Set the function called before the display is drawn, NULL for none.
+The memory card shares the SPI bus and must have finished programming a block
+before the display is written to, see Blockdevice_SDMMC.
+\param[in]	wait	Function waiting for the memory card.
+ */
+extern void Display_SetBusWait(
+	Display_BusWait	wait
+);
+
 /** Display memory card info line.
 \param[in]	Memory card status.
  */
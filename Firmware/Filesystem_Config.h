@@ -17,6 +17,9 @@ vim: shiftwidth=4
 #	define	filesystem_dprintf(args)	do { } while (0)
 #endif
 
+/** Log file and one more, FatFile structures are kept in the FAT16 object. */
+#define	FILESYSTEM_MAX_OPEN_FILES			2
+
 #define	FILESYSTEM_SDMMC_SPI_SELECT()		spi_selectChip(SD_MMC_SPI, 1)
 #define	FILESYSTEM_SDMMC_SPI_UNSELECT()		spi_unselectChip(SD_MMC_SPI, 1)
 #define	FILESYSTEM_SDMMC_SPI_READ(dataptr)	spi_read(SD_MMC_SPI, dataptr)
@@ -22,7 +22,7 @@ vim: shiftwidth=4
 #define	FIELD_MAX_COUNT				20
 #define	FIELD_MAX_LENGTH			20
 
-CircularBuffer<LoggerIO::GPS>	Gps_RxQueue(0, 10);
+RingBuffer<LoggerIO::GPS>		Gps_RxQueue(0, 8);
 
 typedef enum {
 	PHASE_LOOK_FOR_FIRST,
@@ -5,11 +5,11 @@ vim: shiftwidth=4
 #ifndef Gps_h_
 #define Gps_h_
 
-#include <CircularBuffer.h>
+#include <RingBuffer.h>
 #include <LoggerIO.h>
 
 /** GPS receive queue. */
-extern CircularBuffer<LoggerIO::GPS>	Gps_RxQueue;
+extern RingBuffer<LoggerIO::GPS>	Gps_RxQueue;
 
 /** Initialize GPS USART_0 with given baud rate. */
 extern void Gps_Init(
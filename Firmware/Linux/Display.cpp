@@ -0,0 +1,86 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include "../Display.h"
+#include "../AccelerationSensors.h"
+#include "../Gps.h"
+#include "Simulator.h"
+
+/** \file Display of the host simulator. Nothing is shown, drawing takes the
+time of the DIP204 and the end of the simulation is checked when processing.
+*/
+
+static Display_BusWait	BusWait = 0;
+
+//*******************************************************************
+void Display_Init(void)
+{
+}
+
+//*******************************************************************
+void Display_SetBusWait(
+	Display_BusWait	wait
+)
+{
+	BusWait = wait;
+}
+
+//*******************************************************************
+void Display_Draw(void)
+{
+	if (BusWait != 0) {
+		BusWait();
+	}
+	Simulator::Current()->DrawDisplay();
+}
+
+//*******************************************************************
+void Display_MemoryCard(
+	const char*	line
+)
+{
+}
+
+//*******************************************************************
+void Display_Gps_Line(
+	const char*	line
+)
+{
+}
+
+//*******************************************************************
+void Display_AccelerationSensors(
+	const char*	line
+)
+{
+}
+
+//*******************************************************************
+void Display_Error(
+	const char*	line
+)
+{
+}
+
+//*******************************************************************
+void
+Display_Process(void)
+{
+	Gps_Display_Process();
+	AccelerationSensors_Display_Process();
+	Display_Draw();
+	Simulator::Current()->CheckEnd();
+}
+
+//*******************************************************************
+void
+Display_Sleep(
+	const unsigned int	time_ms
+)
+{
+	const uint64_t	end = Simulator::Current()->Now() + Simulator::Ticks(time_ms * 1000.0);
+	while (Simulator::Current()->Now() < end) {
+		Display_Process();
+	}
+}
@@ -0,0 +1,30 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef Filesystem_Config_h_
+#define	Filesystem_Config_h_
+
+#include <stdio.h>
+
+#if defined(FILESYSTEM_DEBUG)
+#define	filesystem_dprintf(args)	do { printf args; } while (0)
+#else
+#define	filesystem_dprintf(args)	do { } while (0)
+#endif
+
+/** Log file and one more, like the firmware. */
+#define	FILESYSTEM_MAX_OPEN_FILES			2
+
+#include <MSVC/SDMMC_Mock.h>	// card of the simulator
+#include "Simulator.h"			// SPI timing
+
+#define	FILESYSTEM_SDMMC_MOCK
+
+#define	FILESYSTEM_SDMMC_SPI_SELECT()		sdmmc_mock_select(true)
+#define	FILESYSTEM_SDMMC_SPI_UNSELECT()		sdmmc_mock_select(false)
+#define	FILESYSTEM_SDMMC_SPI_READ(dataptr)	sdmmc_mock_read(dataptr)
+#define	FILESYSTEM_SDMMC_SPI_WRITE(data)	Simulator_SpiWrite(data)
+
+
+#endif /* Filesystem_Config_h_ */
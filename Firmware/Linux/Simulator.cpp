@@ -0,0 +1,420 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include "Simulator.h"
+
+#include <MSVC/SDMMC_Mock.h>
+
+#include "../LoggerConfig.h"
+#include "../LoggerIO.h"
+#include "../AccelerationSensors.h"
+#include "../Gps.h"
+#include "../IClock.h"
+#include "../project.h"
+
+Simulator*	Simulator::current_ = 0;
+
+//*******************************************************************
+Simulator::Timing
+Simulator::DefaultTiming()
+{
+	Timing	t;
+	t.SpiClock = 6000000;
+	t.DisplayTime = 2000;
+	t.IsrTicks = 100;
+	t.CardBusyTime = 500;
+	t.CardStallTime = 100000;
+	t.CardStallBlocks = 4096;
+	t.SensorsJitter = 200;
+	return t;
+}
+
+//*******************************************************************
+Simulator::Simulator(
+	Filesystem::SDMMC_Mock&	card,
+	Source&					source,
+	const double			duration,
+	const Timing&			timing
+)
+:	card_(card)
+	,source_(source)
+	,timing_(timing)
+	,now_(0)
+	,end_(Ticks(duration * 1e6))
+	,spi_ticks_((8ULL * F_CPU + timing.SpiClock / 2) / timing.SpiClock)
+	,card_busy_bytes_(static_cast<unsigned int>(timing.CardBusyTime * (timing.SpiClock / 8e6)))
+	,card_stall_bytes_(static_cast<unsigned int>(timing.CardStallTime * (timing.SpiClock / 8e6)))
+	,threshold_(0)
+	,timer_callback_(0)
+	,timer_period_(0)
+	,timer_next_(0)
+	,round_(0)
+	,nmea_pos_(0)
+	,nmea_next_(0)
+	,seed_(1)
+{
+	for (unsigned int i=0; i<2; ++i) {
+		usart_callback_[i] = 0;
+		usart_ticks_[i] = 0;
+	}
+	stats_.Rounds = 0;
+	stats_.SensorsLate = 0;
+	stats_.Sentences = 0;
+	stats_.LagHighWater = 0;
+	stats_.IsrTicks = 0;
+	stats_.SpiBytes = 0;
+	card_.SetBusyBytes(card_busy_bytes_);
+	current_ = this;
+}
+
+//*******************************************************************
+Simulator::~Simulator()
+{
+	if (current_ == this) {
+		current_ = 0;
+	}
+}
+
+//*******************************************************************
+void
+Simulator::SetThreshold(
+	const unsigned int	packets
+)
+{
+	threshold_ = packets;
+}
+
+//*******************************************************************
+void
+Simulator::Elapse(
+	const uint64_t	ticks
+)
+{
+	card_.Elapse(static_cast<unsigned int>(Run(ticks) / spi_ticks_));
+}
+
+//*******************************************************************
+void
+Simulator::CheckEnd()
+{
+	if (now_ >= end_) {
+		throw End();
+	}
+}
+
+//*******************************************************************
+uint64_t
+Simulator::Now() const
+{
+	return now_;
+}
+
+//*******************************************************************
+uint64_t
+Simulator::Ticks(
+	const double	us
+)
+{
+	return static_cast<uint64_t>(us * (F_CPU / 1e6));
+}
+
+//*******************************************************************
+const Simulator::Statistics&
+Simulator::Stats() const
+{
+	return stats_;
+}
+
+//*******************************************************************
+void
+Simulator::UsartInit(
+	const IUsart			nr,
+	const unsigned int		baud_rate,
+	const IUsart_RxCallback	callback
+)
+{
+	usart_callback_[nr] = callback;
+	// 8N1: start bit, 8 data bits, stop bit.
+	usart_ticks_[nr] = baud_rate > 0 ? 10ULL * F_CPU / baud_rate : 0;
+	nmea_next_ = now_;
+}
+
+//*******************************************************************
+void
+Simulator::UsartWrite(
+	const IUsart	nr,
+	const char		c
+)
+{
+	if (nr != IUsart1) {
+		return;
+	}
+
+	// The sensors answer the query one after another.
+	uint8_t		readings[LoggerIO::SENSORS_BUFFER_SIZE] = { 0 };
+	const bool	gps_idle = nmea_pos_ == nmea_.size();
+	source_.Round(round_, readings, nmea_);
+	if (gps_idle && nmea_next_ < now_) {
+		nmea_next_ = now_;
+	}
+
+	for (unsigned int p=0; p<LoggerIO::SENSORS_MAX_PACKETS; ++p) {
+		const uint8_t*	packet = readings + p * LoggerIO::SENSORS_PACKET_SIZE;
+		bool			answers = false;
+		for (unsigned int b=0; b<LoggerIO::SENSORS_PACKET_SIZE; ++b) {
+			answers = answers || packet[b] != 0;
+		}
+		if (!answers) {
+			continue;
+		}
+		for (unsigned int b=0; b<LoggerIO::SENSORS_PACKET_SIZE; ++b) {
+			const double	jitter = (2 * Random() - 1) * timing_.SensorsJitter;
+			Arrival			a;
+			a.Time = now_ + static_cast<uint64_t>(LoggerConfig::SensorsTicksOffset
+				+ p * LoggerConfig::SensorsTicksPacket
+				+ b * LoggerConfig::SensorsTicksByte
+				+ jitter);
+			a.Round = round_;
+			a.C = static_cast<char>(packet[b]);
+
+			// Late answers to the previous query may still be on their way.
+			std::deque<Arrival>::iterator	it = sensors_.end();
+			while (it != sensors_.begin() && (it - 1)->Time > a.Time) {
+				--it;
+			}
+			sensors_.insert(it, a);
+		}
+	}
+}
+
+//*******************************************************************
+void
+Simulator::TimerInit(
+	const unsigned int	period_us,
+	ITimer_Callback		callback
+)
+{
+	// Timer/counter clocked at F_PBA/16, as set up by ITimer_Init().
+	const uint64_t	rc = ((F_PBA / 16000) * period_us) / 1000;
+	timer_callback_ = callback;
+	timer_period_ = rc * 16 * (F_CPU / F_PBA);
+	timer_next_ = now_ + timer_period_;
+}
+
+//*******************************************************************
+void
+Simulator::DrawDisplay()
+{
+	Elapse(Ticks(timing_.DisplayTime));
+}
+
+//*******************************************************************
+void
+Simulator::SpiWrite(
+	const uint16_t	data
+)
+{
+	if (timing_.CardStallBlocks > 0) {
+		const bool	stall = (card_.BlocksWritten() + 1) % timing_.CardStallBlocks == 0;
+		card_.SetBusyBytes(stall ? card_stall_bytes_ : card_busy_bytes_);
+	}
+	card_.Exchange(static_cast<uint8_t>(data));
+	++stats_.SpiBytes;
+
+	// The card counted the byte itself, only the interrupts are left.
+	const uint64_t	passed = Run(spi_ticks_);
+	card_.Elapse(static_cast<unsigned int>((passed - spi_ticks_) / spi_ticks_));
+}
+
+//*******************************************************************
+Simulator*
+Simulator::Current()
+{
+	return current_;
+}
+
+//*******************************************************************
+uint64_t
+Simulator::Run(
+	const uint64_t	ticks
+)
+{
+	const uint64_t	start = now_;
+	uint64_t		end = now_ + ticks;
+
+	while (RunInterrupt(end)) {
+		end += timing_.IsrTicks;
+	}
+	now_ = end;
+	return now_ - start;
+}
+
+//*******************************************************************
+bool
+Simulator::RunInterrupt(
+	const uint64_t	t
+)
+{
+	enum {
+		NONE,
+		TIMER,
+		SENSORS,
+		GPS
+	}			what = NONE;
+	uint64_t	when = t + 1;
+
+	if (timer_callback_ != 0 && timer_next_ < when) {
+		what = TIMER;
+		when = timer_next_;
+	}
+	if (!sensors_.empty() && usart_callback_[IUsart1] != 0 && sensors_.front().Time < when) {
+		what = SENSORS;
+		when = sensors_.front().Time;
+	}
+	if (nmea_pos_ < nmea_.size() && usart_callback_[IUsart0] != 0 && nmea_next_ < when) {
+		what = GPS;
+		when = nmea_next_;
+	}
+	if (what == NONE) {
+		return false;
+	}
+
+	if (when > now_) {
+		now_ = when;
+	}
+	switch (what) {
+	case TIMER:
+		Timer();
+		break;
+	case SENSORS:
+		{
+			const char	c = sensors_.front().C;
+			if (sensors_.front().Round + 1 != round_) {
+				++stats_.SensorsLate;
+			}
+			sensors_.pop_front();
+			usart_callback_[IUsart1](c);
+		}
+		break;
+	case GPS:
+		{
+			if (nmea_[nmea_pos_] == '$') {
+				++stats_.Sentences;
+			}
+			usart_callback_[IUsart0](nmea_[nmea_pos_]);
+			++nmea_pos_;
+			nmea_next_ += usart_ticks_[IUsart0];
+			if (nmea_pos_ == nmea_.size()) {
+				nmea_.clear();
+				nmea_pos_ = 0;
+			}
+		}
+		break;
+	default:
+		break;
+	}
+	now_ += timing_.IsrTicks;
+	stats_.IsrTicks += timing_.IsrTicks;
+	return true;
+}
+
+//*******************************************************************
+void
+Simulator::Timer()
+{
+	timer_next_ += timer_period_;
+	timer_callback_();
+	++round_;
+	++stats_.Rounds;
+
+	const unsigned int	size = AccelerationSensors_RxQueue.Size();
+	if (size > threshold_ && size - threshold_ > stats_.LagHighWater) {
+		stats_.LagHighWater = size - threshold_;
+	}
+}
+
+//*******************************************************************
+double
+Simulator::Random()
+{
+	seed_ = seed_ * 1103515245 + 12345;
+	return ((seed_ >> 8) & 0xFFFFFF) / double(0x1000000);
+}
+
+//*******************************************************************
+void
+Simulator_SpiWrite(
+	const uint16_t	data
+)
+{
+	Simulator::Current()->SpiWrite(data);
+}
+
+//*******************************************************************
+// Firmware interfaces.
+//*******************************************************************
+
+//*******************************************************************
+unsigned int
+Get_sys_count(void)
+{
+	return static_cast<unsigned int>(Simulator::Current()->Now());
+}
+
+//*******************************************************************
+void
+delay_ms(
+	const unsigned short	time_ms
+)
+{
+	Simulator::Current()->Elapse(Simulator::Ticks(time_ms * 1000.0));
+}
+
+//*******************************************************************
+void
+PLL0_Start(void)
+{
+}
+
+//*******************************************************************
+unsigned long
+GetTickCount(void)
+{
+	return static_cast<unsigned long>(Simulator::Current()->Now() / (F_CPU / 1000));
+}
+
+//*******************************************************************
+void
+IUsart_Init(
+	const IUsart			UsartNr,
+	const IUsart_Mode		Mode,
+	const unsigned int		InterruptPriority,
+	const unsigned int		BaudRate,
+	const IUsart_RxCallback	RxCallback
+)
+{
+	Simulator::Current()->UsartInit(UsartNr, BaudRate, RxCallback);
+}
+
+//*******************************************************************
+void
+IUsart_Write(
+	IUsart					UsartNr,
+	const char				C
+)
+{
+	Simulator::Current()->UsartWrite(UsartNr, C);
+}
+
+//*******************************************************************
+void
+ITimer_Init(
+	const ITimer		timer,
+	const unsigned int	priority,
+	const unsigned int	period_us,
+	ITimer_Callback		timer_func
+)
+{
+	Simulator::Current()->TimerInit(period_us, timer_func);
+}
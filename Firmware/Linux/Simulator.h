@@ -0,0 +1,258 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef Simulator_h_
+#define	Simulator_h_
+
+/** \file Simulated clock and interrupts of the logger board, for running the firmware on the host. */
+
+#include <stdint.h>
+#include <deque>		// std::deque
+#include <string>		// std::string
+
+#include "../IUsart.h"
+#include "../ITimer.h"
+
+namespace Filesystem {
+class SDMMC_Mock;
+} // namespace Filesystem
+
+/** Board of the logger, as seen by the firmware modules built for the host.
+
+The clock counts CPU cycles and moves on only when the firmware spends time:
+a byte exchanged with the memory card, drawing the display, delay_ms().
+Interrupts falling due meanwhile are run in time order at that point, each one
+taking IsrTicks cycles from the main program. Between those points the main
+program runs in no time.
+
+The sampling timer of ITimer_Init() fires at the period the timer/counter
+would have. When the sensors are queried through IUsart1, their answers arrive
+on IUsart1 at the times the receiver expects (LoggerConfig::SensorsTicks*),
+with a random jitter. GPS sentences arrive on IUsart0 at the GPS baud rate.
+The bytes come from a Source.
+
+Card programming time is set through the SDMMC_Mock busy time; the card holds
+the bus busy for CardBusyTime after every block, and for CardStallTime after
+every CardStallBlocks blocks.
+
+The queues of AccelerationSensors and Gps count their drops and high-water
+marks themselves; the simulator measures how far the writer lags behind.
+
+Only one simulator can exist at a time; the shims of the firmware interfaces
+use Current().
+*/
+class Simulator {
+public:
+	/** Board and card timing, microseconds unless noted otherwise. */
+	typedef struct {
+		/** SPI clock of the memory card, Hz. */
+		unsigned int	SpiClock;
+		/** Display_Draw(). */
+		unsigned int	DisplayTime;
+		/** Entering and leaving an interrupt handler, CPU cycles. */
+		unsigned int	IsrTicks;
+		/** Card busy after each block written. */
+		unsigned int	CardBusyTime;
+		/** Card busy after every CardStallBlocks blocks. */
+		unsigned int	CardStallTime;
+		/** Blocks written between stalls, 0 for none. */
+		unsigned int	CardStallBlocks;
+		/** Largest deviation of a sensor byte from its expected time, CPU cycles. */
+		unsigned int	SensorsJitter;
+	} Timing;
+
+	/** Bytes sent by the sensors and the GPS. */
+	class Source {
+	public:
+		virtual ~Source() {}
+
+		/** Fill in the answers of the sensors to query \c round and append the
+		GPS sentences starting during that round to \c nmea, with '$' and "\r\n".
+		\param[out]	readings	LoggerIO::SENSORS_BUFFER_SIZE bytes. A sensor with all
+								bytes zero does not answer.
+		*/
+		virtual void
+		Round(
+			const unsigned int	round,
+			uint8_t*			readings,
+			std::string&		nmea
+		) = 0;
+	};
+
+	/** Statistics of a run. */
+	typedef struct {
+		/** Rounds of the sampling timer. */
+		unsigned int	Rounds;
+		/** Sensor bytes arriving after the next query. */
+		unsigned int	SensorsLate;
+		/** GPS sentences sent. */
+		unsigned int	Sentences;
+		/** Largest number of packets in the sensor queue beyond the writer threshold. */
+		unsigned int	LagHighWater;
+		/** Cycles spent in interrupt handlers. */
+		uint64_t		IsrTicks;
+		/** Bytes exchanged with the card. */
+		uint64_t		SpiBytes;
+	} Statistics;
+
+	/** Thrown by Display_Process() when the simulated time is up. Not a
+	std::exception, so that the firmware does not take it for an error.
+	*/
+	class End {
+	};
+
+	/** Timing close to the EVK1100 with a class 4 card. */
+	static Timing
+	DefaultTiming();
+
+	/** \param[in]	card	The memory card on the SPI bus.
+	\param[in]	duration	Simulated time until End is thrown, seconds.
+	*/
+	Simulator(
+		Filesystem::SDMMC_Mock&	card,
+		Source&					source,
+		const double			duration,
+		const Timing&			timing = DefaultTiming()
+	);
+	~Simulator();
+
+	/** Writer threshold of the sensor queue, packets; the writer keeps this many queued. */
+	void
+	SetThreshold(
+		const unsigned int	packets
+	);
+
+	/** Let \c ticks CPU cycles of the main program pass, running the interrupts due meanwhile. */
+	void
+	Elapse(
+		const uint64_t	ticks
+	);
+
+	/** Throw End when the time is up. */
+	void
+	CheckEnd();
+
+	/** CPU cycles since start. */
+	uint64_t
+	Now() const;
+
+	/** CPU cycles of \c us microseconds. */
+	static uint64_t
+	Ticks(
+		const double	us
+	);
+
+	const Statistics&
+	Stats() const;
+
+	/** Shims of the firmware interfaces. */
+	void
+	UsartInit(
+		const IUsart			nr,
+		const unsigned int		baud_rate,
+		const IUsart_RxCallback	callback
+	);
+
+	void
+	UsartWrite(
+		const IUsart	nr,
+		const char		c
+	);
+
+	void
+	TimerInit(
+		const unsigned int	period_us,
+		ITimer_Callback		callback
+	);
+
+	/** Time of Display_Draw(). */
+	void
+	DrawDisplay();
+
+	/** One byte on the SPI bus of the card. */
+	void
+	SpiWrite(
+		const uint16_t	data
+	);
+
+	/** Simulator in use, NULL if none. */
+	static Simulator*
+	Current();
+private:
+	Simulator(const Simulator&);
+	Simulator& operator=(const Simulator&);
+
+	/** Sensor byte on its way. */
+	typedef struct {
+		uint64_t		Time;
+		/** Round of the query it answers. */
+		unsigned int	Round;
+		char			C;
+	} Arrival;
+
+	/** Let \c ticks CPU cycles pass, running the interrupts due meanwhile.
+	\return Cycles passed, with the interrupts.
+	*/
+	uint64_t
+	Run(
+		const uint64_t	ticks
+	);
+
+	/** Run the interrupt due first if it is due at or before \c t.
+	\return false when none is due.
+	*/
+	bool
+	RunInterrupt(
+		const uint64_t	t
+	);
+
+	/** Timer interrupt. */
+	void
+	Timer();
+
+	/** Pseudo random number in [0, 1). */
+	double
+	Random();
+
+	Filesystem::SDMMC_Mock&	card_;
+	Source&					source_;
+	Timing					timing_;
+	uint64_t				now_;
+	uint64_t				end_;
+	/** CPU cycles of a byte on the card SPI bus. */
+	uint64_t				spi_ticks_;
+	unsigned int			card_busy_bytes_;
+	unsigned int			card_stall_bytes_;
+	unsigned int			threshold_;
+
+	ITimer_Callback			timer_callback_;
+	uint64_t				timer_period_;
+	uint64_t				timer_next_;
+	unsigned int			round_;
+
+	IUsart_RxCallback		usart_callback_[2];
+	/** CPU cycles of a character on each USART. */
+	uint64_t				usart_ticks_[2];
+	/** Sensor bytes on their way, in time order. */
+	std::deque<Arrival>		sensors_;
+	/** GPS characters not sent yet. */
+	std::string				nmea_;
+	/** Position of the next one in \c nmea_. */
+	unsigned int			nmea_pos_;
+	/** Arrival time of the next one. */
+	uint64_t				nmea_next_;
+
+	unsigned int			seed_;
+	Statistics				stats_;
+
+	static Simulator*		current_;
+}; // class Simulator
+
+/** SPI write of the card, behind FILESYSTEM_SDMMC_SPI_WRITE. */
+void
+Simulator_SpiWrite(
+	const uint16_t	data
+);
+
+#endif /* Simulator_h_ */
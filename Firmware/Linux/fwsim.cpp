@@ -0,0 +1,422 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include <exception>
+#include <string>		// std::string
+#include <vector>		// std::vector
+#include <stdio.h>
+#include <stdlib.h>		// atoi, atof
+#include <string.h>		// strcmp, memset
+
+#include <Filesystem_Config.h>
+#include <Filesystem/Blockdevice_File.h>
+#include <Filesystem/Blockcache.h>
+#include <Filesystem/Endian.h>		// HostEndian
+#include <Filesystem/Error.h>
+#include <Filesystem/FAT16.h>
+#include <Filesystem/Storage.h>
+
+#include "Simulator.h"
+#include "../LoggerConfig.h"
+#include "../LoggerIO.h"
+#include "../AccelerationSensors.h"
+#include "../Gps.h"
+#include "../Display.h"
+#include "../MemoryCard.h"
+#include "../project.h"
+
+using namespace Filesystem;
+
+/** \file Firmware simulator.
+
+Usage: fwsim card.img [options]
+
+Runs the acquisition modules and the memory card writer of the firmware on the
+host, with the board and the card simulated by Simulator. The card image is
+written to like a card in the logger; LOGGER.INI on it is loaded as usual.
+Prints the output of the firmware and then the drops, queue high-water marks
+and writer lag of the run.
+*/
+
+/** SDRAM of the logger board, bytes. */
+#define	SDRAM_SIZE		(32*1024*1024)
+
+//*******************************************************************
+/** Sensors reading around 1 g with some noise; sensor 1 goes over the limits
+for a fifth of a second at regular intervals. GPS sentences once per second with a fix.
+*/
+class SyntheticSource : public Simulator::Source {
+public:
+	/** \param[in]	bump_interval	Seconds between bumps, 0 for none. */
+	SyntheticSource(
+		const double	bump_interval
+	)
+	:	bump_interval_(bump_interval)
+		,seed_(1)
+	{
+	}
+
+	virtual void
+	Round(
+		const unsigned int	round,
+		uint8_t*			readings,
+		std::string&		nmea
+	)
+	{
+		const unsigned int	frequency = LoggerConfig::SamplingFrequency;
+		const unsigned int	bump_rounds = static_cast<unsigned int>(bump_interval_ * frequency);
+		const bool			bump = bump_rounds > 0 && round % bump_rounds >= bump_rounds - frequency / 5;
+		for (unsigned int i=0; i<LoggerIO::SENSORS_MAX_PACKETS; ++i) {
+			const unsigned int	x = (i == 0 && bump) ? 512 + 200 : 512 + Noise();
+			const unsigned int	y = 512 + Noise();
+			const unsigned int	z = 512 + Noise();
+			Encode(readings + i * LoggerIO::SENSORS_PACKET_SIZE, x, y, z);
+		}
+
+		if (round % frequency == 0) {
+			const unsigned int	s = round / frequency;
+			char				body[100];
+			sprintf(body, "GPRMC,%02d%02d%02d,A,5925.1234,N,02445.6789,E,054.7,084.4,171026,003.1,W",
+				s / 3600 % 24, s / 60 % 60, s % 60);
+			Sentence(nmea, body);
+			sprintf(body, "GPGGA,%02d%02d%02d,5925.1234,N,02445.6789,E,1,08,0.9,045.4,M,018.0,M,,",
+				s / 3600 % 24, s / 60 % 60, s % 60);
+			Sentence(nmea, body);
+			sprintf(body, "PGRMF,1918,%06d,171026,%02d%02d%02d,14,5925.1234,N,02445.6789,E,A,2,101,084,2,1",
+				s % 604800, s / 3600 % 24, s / 60 % 60, s % 60);
+			Sentence(nmea, body);
+		}
+	}
+private:
+	/** The inverse of DecodeData() in AccelerationSensors.cpp, which takes the
+	low bits of z from the same nibble as the high bits of y.
+	*/
+	static void
+	Encode(
+		uint8_t*			buf,
+		const unsigned int	x,
+		const unsigned int	y,
+		const unsigned int	z
+	)
+	{
+		buf[0] = static_cast<uint8_t>(x);
+		buf[1] = static_cast<uint8_t>(((x >> 8) & 0x03) | ((y & 0x3F) << 2));
+		buf[2] = static_cast<uint8_t>((y >> 6) & 0x0F);
+		buf[3] = static_cast<uint8_t>((z >> 4) & 0x3F);
+	}
+
+	/** '$', the body, the checksum and the line end. */
+	static void
+	Sentence(
+		std::string&	nmea,
+		const char*		body
+	)
+	{
+		unsigned int	checksum = 0;
+		char			tail[8];
+		for (const char* p=body; *p!=0; ++p) {
+			checksum ^= static_cast<unsigned char>(*p);
+		}
+		sprintf(tail, "*%02X\r\n", checksum);
+		nmea += '$';
+		nmea += body;
+		nmea += tail;
+	}
+
+	/** Pseudo random deviation in [-16, 16). */
+	int
+	Noise()
+	{
+		seed_ = seed_ * 1103515245 + 12345;
+		return static_cast<int>((seed_ >> 16) & 0x1F) - 16;
+	}
+
+	double			bump_interval_;
+	unsigned int	seed_;
+}; // class SyntheticSource
+
+//*******************************************************************
+/** Readings and sentences of a LOGGER.BIN, one SENSORS packet per round and the
+GPS packets before it, over and over again.
+*/
+class RecordedSource : public Simulator::Source {
+public:
+	/** Throws exception when the file cannot be opened or has no sensor packets. */
+	RecordedSource(
+		const char*	filename
+	)
+	:	file_(fopen(filename, "rb"))
+	{
+		if (file_ == 0) {
+			throw Error("Cannot open '%s'.", filename);
+		}
+		uint8_t		readings[LoggerIO::SENSORS_BUFFER_SIZE];
+		std::string	nmea;
+		Rewind();
+		if (!Next(readings, nmea)) {
+			fclose(file_);
+			throw Error("No sensor packets in '%s'.", filename);
+		}
+		Rewind();
+	}
+
+	virtual ~RecordedSource()
+	{
+		fclose(file_);
+	}
+
+	virtual void
+	Round(
+		const unsigned int	round,
+		uint8_t*			readings,
+		std::string&		nmea
+	)
+	{
+		if (!Next(readings, nmea)) {
+			Rewind();
+			Next(readings, nmea);
+		}
+	}
+private:
+	RecordedSource(const RecordedSource&);
+	RecordedSource& operator=(const RecordedSource&);
+
+	/** Start over after the HELLO packet. */
+	void
+	Rewind()
+	{
+		fseek(file_, sizeof(LoggerIO::HELLO), SEEK_SET);
+	}
+
+	/** Read up to the next SENSORS packet, GPS packets on the way go to \c nmea.
+	\return false at the end of the file.
+	*/
+	bool
+	Next(
+		uint8_t*		readings,
+		std::string&	nmea
+	)
+	{
+		LoggerIO::HEADER	header;
+		uint8_t				payload[256];
+
+		while (fread(&header, sizeof(header), 1, file_) == 1) {
+			HostEndian::Fix16(header.Type);
+			HostEndian::Fix16(header.TotalSize);
+			const unsigned int	size = header.TotalSize > sizeof(header) ? header.TotalSize - sizeof(header) : 0;
+			if (size > sizeof(payload) || (size > 0 && fread(payload, size, 1, file_) != 1)) {
+				return false;
+			}
+			if (header.Type == LoggerIO::TYPE_SENSORS && size >= LoggerIO::SENSORS_BUFFER_SIZE) {
+				memcpy(readings, payload, LoggerIO::SENSORS_BUFFER_SIZE);
+				return true;
+			}
+			if (header.Type == LoggerIO::TYPE_GPS) {
+				nmea += '$';
+				for (unsigned int i=0; i<size && payload[i]!=0; ++i) {
+					nmea += static_cast<char>(payload[i]);
+				}
+				nmea += "\r\n";
+			}
+		}
+		return false;
+	}
+
+	FILE*	file_;
+}; // class RecordedSource
+
+//*******************************************************************
+/** Memory card, which shares the SPI bus with the display. */
+static Storage*	card_storage = 0;
+
+/** Display_BusWait: the display is written to once the card has programmed its last block. */
+static void
+wait_card(void)
+{
+	card_storage->WaitCard();
+}
+
+//*******************************************************************
+static void
+load_config(
+	Storage&	storage
+)
+{
+	try {
+		LoggerConfig::Load(storage.Mount(), "LOGGER.INI");
+	} catch (const std::exception& e) {
+		printf("Exception: %s\n", e.what());
+		printf("Using defaults.\n");
+	}
+}
+
+//*******************************************************************
+static void
+usage(
+	const char*	program
+)
+{
+	printf("Usage: %s card.img [options]\n", program);
+	printf("  -f Hz         SamplingFrequency, instead of LOGGER.INI\n");
+	printf("  -w seconds    WritingInterval, instead of LOGGER.INI\n");
+	printf("  -t seconds    simulated time, default 300\n");
+	printf("  -r LOGGER.BIN replay the sensors and GPS of a log, else synthetic data\n");
+	printf("  -b seconds    synthetic data: time between bumps over the limits, default 30, 0 for none\n");
+	printf("  -p us         card busy time per block, default %d\n", Simulator::DefaultTiming().CardBusyTime);
+	printf("  -g us         card stall every %d blocks, default %d, 0 for none\n",
+		Simulator::DefaultTiming().CardStallBlocks, Simulator::DefaultTiming().CardStallTime);
+	printf("  -s Hz         card SPI clock, default %d\n", Simulator::DefaultTiming().SpiClock);
+	printf("The card image is written to.\n");
+}
+
+//*******************************************************************
+static void
+simulate(
+	const char*					image_filename,
+	Simulator::Source*			replay,
+	const unsigned int			frequency,
+	const unsigned int			writing_interval,
+	const double				duration,
+	const double				bump_interval,
+	const Simulator::Timing&	timing
+)
+{
+	Blockdevice_File	disk(image_filename);
+	SDMMC_Mock			card(disk, 0);
+	SyntheticSource		synthetic(bump_interval);
+	Simulator			sim(card, replay != 0 ? *replay : synthetic, duration, timing);
+
+	// SDRAM distribution, memory card buffers first, as in main.cpp.
+	std::vector<uint8_t>	fat_free_bitmap(FAT16::FREE_BITMAP_SIZE);
+	std::vector<uint8_t>	fat_cache_memory(FAT_CACHE_BLOCKS * Blockcache::SLOT_SIZE);
+	std::vector<uint8_t>	file_queue_memory(FILE_QUEUE_BLOCKS * FAT16::BLOCK_SIZE);
+	std::vector<uint8_t>	write_window_memory(WRITE_WINDOW_BLOCKS * FAT16::BLOCK_SIZE);
+	// Sized by the configuration, kept until the card has been unmounted.
+	std::vector<LoggerIO::GPS>		gps_queue;
+	std::vector<SENSORS_SAMPLE>	sensors_queue;
+	size_t					used_bytes = fat_free_bitmap.size() + fat_cache_memory.size()
+										+ file_queue_memory.size() + write_window_memory.size();
+
+	Storage		storage(&fat_free_bitmap[0], &fat_cache_memory[0], fat_cache_memory.size(),
+					&write_window_memory[0], WRITE_WINDOW_BLOCKS);
+	card_storage = &storage;
+	Display_SetBusWait(wait_card);
+	load_config(storage);
+	if (frequency > 0) {
+		LoggerConfig::SamplingFrequency = frequency;
+	}
+	if (writing_interval > 0) {
+		LoggerConfig::WritingInterval = writing_interval;
+	}
+	LoggerConfig::PrintToDebug();
+
+	const unsigned int	max_time = LoggerConfig::LimitsTimeBefore + QUEUE_MARGIN_SECONDS;	// seconds
+	gps_queue.resize(RingBuffer<LoggerIO::GPS>::SizeFor(max_time * 20));
+	sensors_queue.resize(RingBuffer<SENSORS_SAMPLE>::SizeFor(max_time * LoggerConfig::SamplingFrequency));
+	Gps_RxQueue.SetBuffer(&gps_queue[0], gps_queue.size());
+	AccelerationSensors_RxQueue.SetBuffer(&sensors_queue[0], sensors_queue.size());
+	used_bytes += gps_queue.size() * sizeof(LoggerIO::GPS) + sensors_queue.size() * sizeof(SENSORS_SAMPLE);
+	printf("SDRAM: %d bytes used of %d%s.\n", static_cast<unsigned int>(used_bytes), SDRAM_SIZE, used_bytes > SDRAM_SIZE ? ", DOES NOT FIT" : "");
+
+	AccelerationSensors_Init(LoggerConfig::SamplingFrequency);
+	Gps_Init(LoggerConfig::GpsBaudRate);
+
+	// Sensor packets the writer keeps queued for the trigger.
+	const unsigned int	threshold = LoggerConfig::LimitsTimeBefore * LoggerConfig::SamplingFrequency;
+	sim.SetThreshold(threshold);
+
+	// Main loop of the firmware.
+	try {
+		for (;;) {
+			try {
+				MemoryCard_Loop(storage, &file_queue_memory[0]);
+			} catch (const std::exception& e) {
+				printf("Exception: %s\n", e.what());
+				Display_Error(e.what());
+			}
+			Display_MemoryCard("Memory Card Error.");
+			Display_Sleep(1000);
+		}
+	} catch (const Simulator::End&) {
+	}
+	Display_SetBusWait(0);
+	card_storage = 0;
+
+	const Simulator::Statistics&	st = sim.Stats();
+	const double					seconds = sim.Now() / double(F_CPU);
+	const double					spi_us = 8e6 / timing.SpiClock;
+	printf("\nSimulated %.1f s at %d Hz, writing interval %d s.\n",
+		seconds, LoggerConfig::SamplingFrequency, LoggerConfig::WritingInterval);
+	printf("sensors: %d rounds, %d dropped, %d bytes late, queue high-water %d of %d packets (%.0f%%)\n",
+		st.Rounds, AccelerationSensors_RxQueue.Dropped(), st.SensorsLate,
+		AccelerationSensors_RxQueue.HighWater(), AccelerationSensors_RxQueue.Capacity(),
+		100.0 * AccelerationSensors_RxQueue.HighWater() / AccelerationSensors_RxQueue.Capacity());
+	printf("gps:     %d sentences, %d dropped, queue high-water %d of %d packets\n",
+		st.Sentences, Gps_RxQueue.Dropped(), Gps_RxQueue.HighWater(), Gps_RxQueue.Capacity());
+	printf("writer:  lag %.3f s beyond the %d s lookback of the trigger\n",
+		double(st.LagHighWater) / LoggerConfig::SamplingFrequency, threshold / LoggerConfig::SamplingFrequency);
+	printf("card:    %d blocks written, SPI %.1f%% of the time, waiting for the card %.1f%%\n",
+		card.BlocksWritten(), 100.0 * st.SpiBytes * spi_us / (seconds * 1e6),
+		100.0 * card.BusyExchanges() * spi_us / (seconds * 1e6));
+	printf("cpu:     interrupts %.1f%% of the time\n", 100.0 * st.IsrTicks / sim.Now());
+}
+
+//*******************************************************************
+int
+main(
+	int		argc,
+	char**	argv)
+{
+	if (argc < 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	const char*			replay_filename = 0;
+	unsigned int		frequency = 0;
+	unsigned int		writing_interval = 0;
+	double				duration = 300;
+	double				bump_interval = 30;
+	Simulator::Timing	timing = Simulator::DefaultTiming();
+	for (int i=2; i<argc; i+=2) {
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+			return 1;
+		}
+		const char*	value = argv[i + 1];
+		if (strcmp(argv[i], "-f") == 0) {
+			frequency = atoi(value);
+		} else if (strcmp(argv[i], "-w") == 0) {
+			writing_interval = atoi(value);
+		} else if (strcmp(argv[i], "-t") == 0) {
+			duration = atof(value);
+		} else if (strcmp(argv[i], "-r") == 0) {
+			replay_filename = value;
+		} else if (strcmp(argv[i], "-b") == 0) {
+			bump_interval = atof(value);
+		} else if (strcmp(argv[i], "-p") == 0) {
+			timing.CardBusyTime = atoi(value);
+		} else if (strcmp(argv[i], "-g") == 0) {
+			timing.CardStallTime = atoi(value);
+		} else if (strcmp(argv[i], "-s") == 0) {
+			timing.SpiClock = atoi(value);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	try {
+		if (replay_filename != 0) {
+			RecordedSource	replay(replay_filename);
+			simulate(argv[1], &replay, frequency, writing_interval, duration, bump_interval, timing);
+		} else {
+			simulate(argv[1], 0, frequency, writing_interval, duration, bump_interval, timing);
+		}
+	} catch (const std::exception& e) {
+		printf("Exception: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
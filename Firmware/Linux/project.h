@@ -0,0 +1,23 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef Linux_project_h_
+#define	Linux_project_h_
+
+/** \file Board definitions of the host simulator, in place of the AVR32 headers. */
+
+/** Oscillator 0 of the EVK1100, Hz. */
+#define	FOSC0		12000000
+
+/** Interrupt priorities. */
+#define	INT0		0
+#define	INT1		1
+#define	INT2		2
+#define	INT3		3
+
+/** Simulated CPU cycle counter, wraps around like the COUNT register. */
+extern unsigned int
+Get_sys_count(void);
+
+#endif /* Linux_project_h_ */
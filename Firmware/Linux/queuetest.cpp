@@ -0,0 +1,440 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include <vector>		// std::vector
+#include <stdio.h>
+#include <stdlib.h>		// atof
+#include <string.h>		// memcpy, memset, strcmp
+#include <stdint.h>		// uint32_t
+#include <time.h>		// clock
+#include <pthread.h>
+
+#include "../CircularBuffer.h"
+#include "../RingBuffer.h"
+
+/** \file Receive queue test and benchmark.
+
+Usage: queuetest [compare|stress [seconds]|bench]
+
+compare	runs the same random operations on CircularBuffer and RingBuffer of equal
+		size and compares every result, the spans and the drop and high-water
+		counters.
+stress	runs a producer thread, standing in for the interrupt handler, against
+		a consumer thread draining by Pop() and by ReadableSpans()/Consume(),
+		and checks that every element arrives once, in order and intact.
+bench	times push and pop, and draining, of both classes.
+
+Without arguments all three run. Exits with 1 when a check fails.
+*/
+
+/** Element of the size of a sensor sample. */
+typedef struct {
+	uint32_t	seq;
+	uint32_t	check;
+	uint8_t		payload[24];
+} Element;
+
+//*******************************************************************
+static uint32_t
+check_of(
+	const uint32_t	seq
+)
+{
+	return ~seq * 2654435761u;
+}
+
+//*******************************************************************
+static void
+fill(
+	Element&		e,
+	const uint32_t	seq
+)
+{
+	e.seq = seq;
+	e.check = check_of(seq);
+	memset(e.payload, static_cast<uint8_t>(seq), sizeof(e.payload));
+}
+
+//*******************************************************************
+static bool
+intact(
+	const Element&	e
+)
+{
+	for (unsigned int i=0; i<sizeof(e.payload); ++i) {
+		if (e.payload[i] != static_cast<uint8_t>(e.seq)) {
+			return false;
+		}
+	}
+	return e.check == check_of(e.seq);
+}
+
+//*******************************************************************
+static unsigned int	random_seed = 1;
+
+static unsigned int
+random_below(
+	const unsigned int	n
+)
+{
+	random_seed = random_seed * 1103515245 + 12345;
+	return ((random_seed >> 8) & 0xFFFFFF) % n;
+}
+
+//*******************************************************************
+#define	CHECK(cond, ...) do {		\
+	if (!(cond)) {					\
+		printf(__VA_ARGS__);		\
+		printf("\n");				\
+		return false;				\
+	}								\
+} while (0)
+
+//*******************************************************************
+/** Same operations on both classes. */
+static bool
+test_compare()
+{
+	enum {
+		SIZE = 16,
+		OPERATIONS = 1000000
+	};
+	std::vector<uint32_t>		old_memory(SIZE);
+	std::vector<uint32_t>		new_memory(SIZE);
+	CircularBuffer<uint32_t>	old_queue(&old_memory[0], SIZE);
+	RingBuffer<uint32_t>		new_queue(&new_memory[0], SIZE);
+	uint32_t					next = 1;
+	unsigned int				refused = 0;
+	unsigned int				high_water = 0;
+
+	printf("compare: %d operations, size %d...\n", OPERATIONS, SIZE);
+	for (unsigned int op=0; op<OPERATIONS; ++op) {
+		const unsigned int	what = random_below(100);
+		if (what < 30) {
+			const bool	a = old_queue.Push(next);
+			const bool	b = new_queue.Push(next);
+			CHECK(a == b, "%d: Push %d vs %d", op, a, b);
+			refused += a ? 0 : 1;
+			++next;
+		} else if (what < 50) {
+			old_queue.Poke() = next;
+			new_queue.Poke() = next;
+			const bool	a = old_queue.Push();
+			const bool	b = new_queue.Push();
+			CHECK(a == b, "%d: Poke/Push %d vs %d", op, a, b);
+			refused += a ? 0 : 1;
+			++next;
+		} else if (what < 80) {
+			uint32_t	a = 0;
+			uint32_t	b = 0;
+			const bool	ra = old_queue.Pop(a);
+			const bool	rb = new_queue.Pop(b);
+			CHECK(ra == rb && a == b, "%d: Pop %d/%d vs %d/%d", op, ra, a, rb, b);
+		} else if (what < 98) {
+			// Drain some through the spans, the old queue by Pop().
+			const uint32_t*	first = 0;
+			const uint32_t*	second = 0;
+			unsigned int	first_count = 0;
+			unsigned int	second_count = 0;
+			const unsigned int	count = new_queue.ReadableSpans(first, first_count, second, second_count);
+			CHECK(count == old_queue.Size(), "%d: spans hold %d, not %d", op, count, old_queue.Size());
+			CHECK(first_count + second_count == count, "%d: spans %d + %d", op, first_count, second_count);
+			const unsigned int	n = count > 0 ? random_below(count + 1) : 0;
+			for (unsigned int i=0; i<n; ++i) {
+				const uint32_t	b = i < first_count ? first[i] : second[i - first_count];
+				const uint32_t	a = old_queue.Pop();
+				CHECK(a == b, "%d: span element %d is %d, not %d", op, i, b, a);
+			}
+			new_queue.Consume(n);
+		} else {
+			old_queue.Clear();
+			new_queue.Clear();
+		}
+
+		CHECK(old_queue.Size() == new_queue.Size(), "%d: Size %d vs %d", op, old_queue.Size(), new_queue.Size());
+		CHECK(old_queue.IsFull() == new_queue.IsFull(), "%d: IsFull", op);
+		CHECK(old_queue.IsEmpty() == new_queue.IsEmpty(), "%d: IsEmpty", op);
+		for (unsigned int i=0; i<new_queue.Size(); ++i) {
+			CHECK(old_queue.Peek(i) == new_queue.Peek(i), "%d: Peek(%d)", op, i);
+		}
+		if (new_queue.Size() > high_water) {
+			high_water = new_queue.Size();
+		}
+	}
+	CHECK(new_queue.Dropped() == refused, "Dropped %d, refused %d", new_queue.Dropped(), refused);
+	CHECK(new_queue.HighWater() == high_water, "HighWater %d, seen %d", new_queue.HighWater(), high_water);
+	CHECK(new_queue.Capacity() == SIZE - 1, "Capacity %d", new_queue.Capacity());
+	CHECK(RingBuffer<uint32_t>::SizeFor(SIZE - 1) == SIZE && RingBuffer<uint32_t>::SizeFor(SIZE) == 2 * SIZE, "SizeFor");
+	printf("compare: ok, %d pushes refused, high-water %d.\n", refused, high_water);
+	return true;
+}
+
+//*******************************************************************
+/** Shared by the producer and the consumer thread of the stress test. */
+typedef struct {
+	RingBuffer<Element>*	queue;
+	volatile bool			stop;
+	uint32_t				produced;
+	uint32_t				refused;
+} Stress;
+
+//*******************************************************************
+/** Producer: pushes as fast as it can, as the interrupts would with a stalled writer. */
+static void*
+stress_producer(
+	void*	arg
+)
+{
+	Stress&		st = *reinterpret_cast<Stress*>(arg);
+	uint32_t	seq = 0;
+
+	while (!st.stop) {
+		fill(st.queue->Poke(), seq);
+		if (st.queue->Push()) {
+			++seq;
+		} else {
+			++st.refused;
+		}
+	}
+	st.produced = seq;
+	return 0;
+}
+
+//*******************************************************************
+static bool
+test_stress(
+	const double	seconds
+)
+{
+	enum {
+		SIZE = 1024
+	};
+	std::vector<Element>	memory(SIZE);
+	RingBuffer<Element>		queue(&memory[0], SIZE);
+	Stress					st;
+	pthread_t				producer;
+	uint32_t				expected = 0;
+	unsigned int			by_pop = 0;
+	unsigned int			by_span = 0;
+	bool					ok = true;
+
+	st.queue = &queue;
+	st.stop = false;
+	st.produced = 0;
+	st.refused = 0;
+
+	printf("stress: %.1f s, size %d...\n", seconds, SIZE);
+	pthread_create(&producer, 0, stress_producer, &st);
+	const clock_t	end = clock() + static_cast<clock_t>(seconds * CLOCKS_PER_SEC);
+	for (unsigned int loop=0; ok; ++loop) {
+		const bool	done = st.stop;
+		if ((loop & 0x3FF) == 0 && clock() >= end) {
+			st.stop = true;
+			pthread_join(producer, 0);
+		}
+
+		if (random_below(2) == 0) {
+			Element	e;
+			for (unsigned int n=random_below(SIZE); ok && n>0 && queue.Pop(e); --n) {
+				ok = intact(e) && e.seq == expected;
+				++expected;
+				++by_pop;
+			}
+		} else {
+			const Element*	first = 0;
+			const Element*	second = 0;
+			unsigned int	first_count = 0;
+			unsigned int	second_count = 0;
+			const unsigned int	count = queue.ReadableSpans(first, first_count, second, second_count);
+			for (unsigned int i=0; ok && i<count; ++i) {
+				const Element&	e = i < first_count ? first[i] : second[i - first_count];
+				ok = intact(e) && e.seq == expected;
+				++expected;
+				++by_span;
+			}
+			queue.Consume(count);
+		}
+		if (done && queue.IsEmpty()) {
+			break;
+		}
+	}
+	if (!ok) {
+		st.stop = true;
+		pthread_join(producer, 0);
+		printf("stress: element %d broken or out of order.\n", expected - 1);
+		return false;
+	}
+
+	CHECK(expected == st.produced, "stress: received %d of %d", expected, st.produced);
+	CHECK(queue.Dropped() == st.refused, "stress: Dropped %d, refused %d", queue.Dropped(), st.refused);
+	CHECK(queue.HighWater() <= queue.Capacity(), "stress: HighWater %d", queue.HighWater());
+	printf("stress: ok, %d elements, %d by Pop, %d by spans, %d pushes refused, high-water %d.\n",
+		expected, by_pop, by_span, st.refused, queue.HighWater());
+	return true;
+}
+
+//*******************************************************************
+static double
+elapsed(
+	const clock_t	start
+)
+{
+	return double(clock() - start) / CLOCKS_PER_SEC;
+}
+
+//*******************************************************************
+/** Push and pop one at a time, as the interrupt handler and the writer do. */
+template <class QUEUE>
+static double
+bench_push_pop(
+	QUEUE&				queue,
+	const unsigned int	count
+)
+{
+	const clock_t	start = clock();
+	Element			e;
+	uint32_t		sum = 0;
+
+	for (unsigned int i=0; i<count; ++i) {
+		fill(queue.Poke(), i);
+		queue.Push();
+		if ((i & 7) == 7) {
+			while (queue.Pop(e)) {
+				sum += e.seq;
+			}
+		}
+	}
+	while (queue.Pop(e)) {
+		sum += e.seq;
+	}
+	const double	t = elapsed(start);
+	if (sum == 1) {
+		printf("%d", sum);
+	}
+	return t;
+}
+
+//*******************************************************************
+/** Fill up, then copy all out, by Pop() or through the spans. */
+template <class QUEUE>
+static double
+bench_drain_pop(
+	QUEUE&				queue,
+	const unsigned int	rounds,
+	const unsigned int	fill_count,
+	Element*			out
+)
+{
+	double	t = 0;
+	for (unsigned int r=0; r<rounds; ++r) {
+		for (unsigned int i=0; i<fill_count; ++i) {
+			fill(queue.Poke(), i);
+			queue.Push();
+		}
+		const clock_t	start = clock();
+		unsigned int	n = 0;
+		while (queue.Pop(out[n])) {
+			++n;
+		}
+		t += elapsed(start);
+	}
+	return t;
+}
+
+//*******************************************************************
+static double
+bench_drain_spans(
+	RingBuffer<Element>&	queue,
+	const unsigned int		rounds,
+	const unsigned int		fill_count,
+	Element*				out
+)
+{
+	double	t = 0;
+	for (unsigned int r=0; r<rounds; ++r) {
+		for (unsigned int i=0; i<fill_count; ++i) {
+			fill(queue.Poke(), i);
+			queue.Push();
+		}
+		const clock_t	start = clock();
+		const Element*	first = 0;
+		const Element*	second = 0;
+		unsigned int	first_count = 0;
+		unsigned int	second_count = 0;
+		queue.ReadableSpans(first, first_count, second, second_count);
+		memcpy(out, first, first_count * sizeof(Element));
+		memcpy(out + first_count, second, second_count * sizeof(Element));
+		queue.Consume(first_count + second_count);
+		t += elapsed(start);
+	}
+	return t;
+}
+
+//*******************************************************************
+static void
+bench()
+{
+	enum {
+		PUSHES = 20000000,
+		ROUNDS = 200,
+		// The sensor queue at 1 kHz, as main.cpp sized it for CircularBuffer and for RingBuffer.
+		OLD_SIZE = 182000,
+		NEW_SIZE = 262144,
+		FILL = 100000
+	};
+	std::vector<Element>		old_memory(OLD_SIZE);
+	std::vector<Element>		new_memory(NEW_SIZE);
+	std::vector<Element>		out(NEW_SIZE);
+	CircularBuffer<Element>		old_queue(&old_memory[0], OLD_SIZE);
+	RingBuffer<Element>			new_queue(&new_memory[0], NEW_SIZE);
+
+	// Start next to the end, so that the drains wrap around.
+	for (unsigned int i=0; i<OLD_SIZE-FILL/2; ++i) {
+		old_queue.Push(old_memory[0]);
+		old_queue.Pop();
+	}
+	for (unsigned int i=0; i<NEW_SIZE-FILL/2; ++i) {
+		new_queue.Push(new_memory[0]);
+		new_queue.Pop();
+	}
+
+	const double	old_pp = bench_push_pop(old_queue, PUSHES);
+	const double	new_pp = bench_push_pop(new_queue, PUSHES);
+	printf("push+pop:  CircularBuffer %6.1f ns, RingBuffer %6.1f ns per element.\n",
+		old_pp * 1e9 / PUSHES, new_pp * 1e9 / PUSHES);
+
+	const double	old_drain = bench_drain_pop(old_queue, ROUNDS, FILL, &out[0]);
+	const double	new_drain = bench_drain_pop(new_queue, ROUNDS, FILL, &out[0]);
+	const double	span_drain = bench_drain_spans(new_queue, ROUNDS, FILL, &out[0]);
+	printf("drain:     CircularBuffer Pop %6.1f ns, RingBuffer Pop %6.1f ns, RingBuffer spans %6.1f ns per element.\n",
+		old_drain * 1e9 / (ROUNDS * FILL), new_drain * 1e9 / (ROUNDS * FILL), span_drain * 1e9 / (ROUNDS * FILL));
+	printf("The divisions are in hardware on the host, on the AVR32 the difference is larger.\n");
+}
+
+//*******************************************************************
+int
+main(
+	int		argc,
+	char**	argv
+)
+{
+	const char*	what = argc > 1 ? argv[1] : "all";
+	const bool	all = strcmp(what, "all") == 0;
+	bool		ok = true;
+
+	if (!all && strcmp(what, "compare") != 0 && strcmp(what, "stress") != 0 && strcmp(what, "bench") != 0) {
+		printf("Usage: %s [compare|stress [seconds]|bench]\n", argv[0]);
+		return 1;
+	}
+	if (all || strcmp(what, "compare") == 0) {
+		ok = test_compare() && ok;
+	}
+	if (all || strcmp(what, "stress") == 0) {
+		ok = test_stress(argc > 2 ? atof(argv[2]) : 2.0) && ok;
+	}
+	if (all || strcmp(what, "bench") == 0) {
+		bench();
+	}
+	return ok ? 0 : 1;
+}
@@ -36,6 +36,7 @@ namespace LoggerConfig {
 	};
 
 	unsigned int			WritingInterval = DEFAULT_WRITING_INTERVAL;
+	unsigned int			RawLogSize		= DEFAULT_RAW_LOG_SIZE;
 
 	//*******************************************************************
 	static bool
@@ -92,6 +93,7 @@ namespace LoggerConfig {
 		GpsBaudRate			= cfg.ValueAsInt(section, "GPS",				DEFAULT_GPS_SPEED);
 		SamplingFrequency	= cfg.ValueAsInt(section, "SamplingFrequency",	DEFAULT_SAMPLING_FREQUENCY);
 		WritingInterval		= cfg.ValueAsInt(section, "WritingInterval",	DEFAULT_WRITING_INTERVAL);
+		RawLogSize			= cfg.ValueAsInt(section, "RawLog",				DEFAULT_RAW_LOG_SIZE);
 
 		if (!atoi_array(cfg, section, "Limits_Default", &LimitsDefault.MinX, 6)) {
 			LimitsDefault.MinX = AMIN;
@@ -137,6 +139,7 @@ namespace LoggerConfig {
 		}
 		tprintf("Limits_Time=%d %d\n", LimitsTimeBefore, LimitsTimeAfter);
 		tprintf("WritingInterval=%d\n", WritingInterval);
+		tprintf("RawLog=%d\n", RawLogSize);
 	}
 
 }; // namespace LoggerConfig
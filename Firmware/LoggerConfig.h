@@ -23,7 +23,8 @@ namespace LoggerConfig {
 		DEFAULT_LIMITS_TIME_AFTER		= 10,
 		DEFAULT_LIMITS_MIN_ACCELERATION	= 512-96,
 		DEFAULT_LIMITS_MAX_ACCELERATION	= 512+96,
-		DEFAULT_WRITING_INTERVAL		= 60
+		DEFAULT_WRITING_INTERVAL		= 60,
+		DEFAULT_RAW_LOG_SIZE			= 0
 	};
 
 	/** Acceleration limits to one sensor. */
@@ -57,9 +58,12 @@ namespace LoggerConfig {
 	/** Acceleration limits to the sensors. */
 	extern AccelerationMinMax	LimitsAcceleration[LoggerIO::SENSORS_MAX_PACKETS];
 
-	/** Number of seconds between writing sessions. */
+	/** Number of seconds of samples between commits of the log. */
 	extern unsigned int			WritingInterval;
 
+	/** Size of the raw log ring LOGGER.RAW, MB. 0 = write LOGGER.BIN. */
+	extern unsigned int			RawLogSize;
+
 	/** Load configuration file. */
 	void
 	Load(
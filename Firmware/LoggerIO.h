@@ -21,6 +21,7 @@ namespace LoggerIO {
 
 enum {
 	MAGIC				= 0xF4D0BD07,
+	EVENT_NO_OFFSET		= 0xFFFFFFFF,
 	SENSORS_PACKET_SIZE	= 4,
 	SENSORS_MAX_PACKETS	= 7,
 	SENSORS_BUFFER_SIZE = SENSORS_MAX_PACKETS * SENSORS_PACKET_SIZE
@@ -64,6 +65,27 @@ typedef struct {
 	uint8_t		Readings[SENSORS_BUFFER_SIZE];
 } STRUCT_ALIGN_1 SENSORS;
 
+/** Record of the event index EVENTS.BIN. An event is the run of sensor
+ * packets written around samples over the limits, overlapping windows merged.
+ */
+typedef struct {
+	/** Tick of the first sensor packet. */
+	uint32_t	StartTick;
+	/** Tick of the first sample over the limits. */
+	uint32_t	TriggerTick;
+	/** Tick of the last sensor packet. */
+	uint32_t	EndTick;
+	/** Position of the first sensor packet in LOGGER.BIN, EVENT_NO_OFFSET in the raw log. */
+	uint32_t	Offset;
+	/** Number of samples over the limits. */
+	uint32_t	Triggers;
+	/** Sensor of the first sample over the limits, 0...SENSORS_MAX_PACKETS-1. */
+	uint8_t		Sensor;
+	/** Axis of it, 0 = x, 1 = y, 2 = z. */
+	uint8_t		Axis;
+	uint16_t	Reserved;
+} STRUCT_ALIGN_1 EVENT;
+
 }; // namespace LoggerIO
 
 #if defined(_MSC_VER)
@@ -0,0 +1,355 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include <stdio.h>			// sprintf
+
+#include "MemoryCard.h"
+#include "LoggerConfig.h"
+#include "LoggerIO.h"
+#include "Gps.h"
+#include "AccelerationSensors.h"
+#include "Display.h"
+#include "Trigger.h"
+#include "tprintf.h"
+#include <Filesystem/FAT16.h>
+#include <Filesystem/File.h>
+#include <Filesystem/RawLog.h>
+#include <Filesystem/Endian.h>		// HostEndian
+#include "project.h"
+
+/** Writing intervals between commits of the file size and FAT. */
+#define	FAT_COMMIT_INTERVALS	4
+/** Commits between writes of the second FAT copy. */
+#define	FAT_MIRROR_COMMITS		4
+/** Clusters reserved ahead of the end of LOGGER.BIN, bytes. */
+#define	FAT_RESERVE_BYTES		(4*1024*1024)
+
+/** Samples handled between two looks at the queue. */
+#define	WRITE_BATCH_PACKETS		64
+
+/** Raw log ring, used instead of LOGGER.BIN when RawLog is set in LOGGER.INI. */
+#define	RAW_LOG_FILENAME		"LOGGER.RAW"
+/** Index of the events in the log, LoggerIO::EVENT records. */
+#define	EVENTS_FILENAME			"EVENTS.BIN"
+/** Clusters reserved ahead of the end of EVENTS.BIN, bytes, so that it does not split the runs of the log. */
+#define	EVENTS_RESERVE_BYTES	(64*1024)
+
+//*******************************************************************
+static inline void
+FixEndianHELLO(
+	LoggerIO::HELLO&	packet
+)
+{
+	Filesystem::HostEndian::Fix32(packet.Magic);
+	Filesystem::HostEndian::Fix32(packet.Frequency);
+	Filesystem::HostEndian::Fix32(packet.Tick);
+}
+
+//*******************************************************************
+static inline void
+FixEndianGPS(
+	LoggerIO::GPS&	packet
+)
+{
+	Filesystem::HostEndian::Fix16(packet.Header.Type);
+	Filesystem::HostEndian::Fix16(packet.Header.TotalSize);
+	Filesystem::HostEndian::Fix32(packet.Header.Tick);
+}
+
+//*******************************************************************
+static inline void
+FixEndianSENSORS(
+	LoggerIO::SENSORS&	packet
+)
+{
+	Filesystem::HostEndian::Fix16(packet.Header.Type);
+	Filesystem::HostEndian::Fix16(packet.Header.TotalSize);
+	Filesystem::HostEndian::Fix32(packet.Header.Tick);
+}
+
+//*******************************************************************
+static inline void
+FixEndianEVENT(
+	LoggerIO::EVENT&	record
+)
+{
+	Filesystem::HostEndian::Fix32(record.StartTick);
+	Filesystem::HostEndian::Fix32(record.TriggerTick);
+	Filesystem::HostEndian::Fix32(record.EndTick);
+	Filesystem::HostEndian::Fix32(record.Offset);
+	Filesystem::HostEndian::Fix32(record.Triggers);
+	Filesystem::HostEndian::Fix16(record.Reserved);
+}
+
+
+//*******************************************************************
+/** Move one block from the write-behind queue of LOGGER.BIN to the card. */
+static void
+log_pump(
+	Filesystem::File&	f
+)
+{
+	f.Pump();
+}
+
+//*******************************************************************
+/** The raw log writes whole buffers at once, nothing to do between packets. */
+static void
+log_pump(
+	Filesystem::RawLog&	log
+)
+{
+}
+
+//*******************************************************************
+/** Position of the next packet in LOGGER.BIN. */
+static uint32_t
+log_offset(
+	Filesystem::File&	f
+)
+{
+	return f.Pos();
+}
+
+//*******************************************************************
+/** The raw log has no file positions, the events are found by their ticks. */
+static uint32_t
+log_offset(
+	Filesystem::RawLog&	log
+)
+{
+	return LoggerIO::EVENT_NO_OFFSET;
+}
+
+//*******************************************************************
+/** End of a writing interval of LOGGER.BIN: group commit, reserve ahead and write the window. */
+static void
+log_interval_end(
+	Filesystem::File&	f,
+	Filesystem::FAT16&	filesys,
+	const unsigned int	interval_count
+)
+{
+	if (interval_count % FAT_COMMIT_INTERVALS == 0) {
+		f.Commit();
+		if (interval_count % (FAT_COMMIT_INTERVALS * FAT_MIRROR_COMMITS) == 0) {
+			filesys.SyncMirror();
+		}
+	} else {
+		f.Flush();
+	}
+	if (f.Reserve(0) < FAT_RESERVE_BYTES/2) {
+		f.Reserve(FAT_RESERVE_BYTES);
+	}
+	filesys.Device().Flush();
+}
+
+//*******************************************************************
+/** End of a writing interval of the raw log: the superblock is cheap, commit every time. */
+static void
+log_interval_end(
+	Filesystem::RawLog&	log,
+	Filesystem::FAT16&	filesys,
+	const unsigned int	interval_count
+)
+{
+	log.Commit();
+	filesys.Device().Flush();
+}
+
+//*******************************************************************
+/** Sample \c index of the spans of the sensor queue. */
+static inline const SENSORS_SAMPLE&
+sample_at(
+	const SENSORS_SAMPLE*	first,
+	const unsigned int		first_count,
+	const SENSORS_SAMPLE*	second,
+	const unsigned int		index
+)
+{
+	return index < first_count ? first[index] : second[index - first_count];
+}
+
+//*******************************************************************
+/** Write packets to \c log, LOGGER.BIN or the raw log, returns only by exception.
+The samples stream to the log as they arrive, LimitsTimeBefore seconds behind
+the sampling timer, so that the trigger sees what follows each one.
+*/
+template <class LOG>
+static void
+write_loop(
+	LOG&				f,
+	Filesystem::File&	events,
+	Filesystem::FAT16&	filesys,
+	const char*			message
+)
+{
+	Display_MemoryCard(message);
+	Display_Error("");
+	Display_Draw();
+
+	// Hello packet.
+	{
+		LoggerIO::HELLO			PacketHELLO;
+		PacketHELLO.Magic 		= LoggerIO::MAGIC;
+		PacketHELLO.Frequency	= F_CPU;
+		PacketHELLO.Tick		= AccelerationSensors_GetTick();
+		FixEndianHELLO(PacketHELLO);
+
+		f.Write(&PacketHELLO, sizeof(PacketHELLO));
+
+		Display_Sleep(2 * 1000 / LoggerConfig::SamplingFrequency);
+	}
+
+
+	const unsigned int	interval_packets = LoggerConfig::WritingInterval * LoggerConfig::SamplingFrequency;
+	const unsigned int	before_packets = LoggerConfig::LimitsTimeBefore * LoggerConfig::SamplingFrequency;
+	const unsigned int	after_packets = LoggerConfig::LimitsTimeAfter * LoggerConfig::SamplingFrequency;
+
+	Trigger				trigger(before_packets, after_packets);
+	/** Packets handled in the current writing interval. */
+	unsigned int		interval_done = 0;
+	/** Number of writing intervals, for the group commit. */
+	unsigned int		interval_count = 0;
+	unsigned int		sensors_packets_written = 0;
+	unsigned int		gps_packets_written = 0;
+
+	tprintf("Entering write loop.\n");
+	AccelerationSensors_RxQueue.Clear();
+	Gps_RxQueue.Clear();
+	for (;;) {
+		LoggerIO::GPS		PacketGPS;
+		LoggerIO::SENSORS	PacketSENSORS;
+		const SENSORS_SAMPLE*	first = 0;
+		const SENSORS_SAMPLE*	second = 0;
+		unsigned int		first_count = 0;
+		unsigned int		second_count = 0;
+		char				xbuf[100];
+
+		// 1. The last before_packets samples stay queued, the trigger looks that far ahead.
+		const unsigned int	queued = AccelerationSensors_RxQueue.ReadableSpans(first, first_count, second, second_count);
+		if (queued <= before_packets) {
+			if (trigger.Countdown() > 0) {
+				sprintf(xbuf, "Writing: %3d sec.", trigger.Countdown() / LoggerConfig::SamplingFrequency);
+			} else if (queued < before_packets) {
+				sprintf(xbuf, "Collecting: %3d sec.", (before_packets - queued) / LoggerConfig::SamplingFrequency);
+			} else {
+				sprintf(xbuf, "Monitoring.");
+			}
+			Display_MemoryCard(xbuf);
+			Display_Process();
+			log_pump(f);
+			continue;
+		}
+
+		// 2. Handle a batch of the samples beyond the lookback, in place.
+		unsigned int	batch = queued - before_packets;
+		if (batch > WRITE_BATCH_PACKETS) {
+			batch = WRITE_BATCH_PACKETS;
+		}
+		for (unsigned int i=0; i<batch; ++i) {
+			const SENSORS_SAMPLE&	sample = sample_at(first, first_count, second, i);
+			const SENSORS_SAMPLE&	testsample = sample_at(first, first_count, second, i + before_packets);
+			AccelerationSensors_Convert(PacketSENSORS, sample);
+
+			// 2.1. Write all preceding GPS packets.
+			while (!Gps_RxQueue.IsEmpty()) {
+				const LoggerIO::GPS		gps_testpacket = Gps_RxQueue.Peek(0);
+				if (gps_testpacket.Header.Tick < PacketSENSORS.Header.Tick) {
+					Gps_RxQueue.Pop(PacketGPS);
+					FixEndianGPS(PacketGPS);
+					f.Write(&PacketGPS, sizeof(PacketGPS));
+					++gps_packets_written;
+				} else {
+					break;
+				}
+			}
+
+			// 2.2. Check the test sample against limits, write if needed :)
+			if (trigger.Process(sample, testsample, log_offset(f))) {
+				FixEndianSENSORS(PacketSENSORS);
+				f.Write(&PacketSENSORS, sizeof(PacketSENSORS));
+				++sensors_packets_written;
+			}
+
+			// 2.3. Index the event just finished, committed to the card at once: events are rare.
+			if (trigger.Finished() != 0) {
+				LoggerIO::EVENT	record = *trigger.Finished();
+				tprintf("write_loop: event at tick %d, sensor %d axis %d, %d samples over the limits.\n",
+					record.TriggerTick, record.Sensor + 1, record.Axis, record.Triggers);
+				FixEndianEVENT(record);
+				events.Write(&record, sizeof(record));
+				events.Commit();
+				if (events.Reserve(0) < EVENTS_RESERVE_BYTES/2) {
+					events.Reserve(EVENTS_RESERVE_BYTES);
+				}
+			}
+
+			// 2.4. Move one block from the write-behind queue to the card.
+			log_pump(f);
+
+			// 2.5. Display nice message :)
+			++interval_done;
+			if ((interval_done % LoggerConfig::SamplingFrequency) == 0) {
+				sprintf(xbuf, "Writing: %3d sec.", trigger.Countdown() / LoggerConfig::SamplingFrequency);
+				Display_MemoryCard(trigger.Countdown() > 0 ? xbuf : "Monitoring.");
+				Display_Process();
+			}
+		}
+		AccelerationSensors_RxQueue.Consume(batch);
+
+		// 3. Commit after every writing interval of samples.
+		if (interval_done >= interval_packets) {
+			tprintf("write_loop: wrote %d sensor packets, %d gps packets.\n",
+				sensors_packets_written, gps_packets_written);
+			interval_done = 0;
+			sensors_packets_written = 0;
+			gps_packets_written = 0;
+			++interval_count;
+			log_interval_end(f, filesys, interval_count);
+		}
+	}
+}
+
+//*******************************************************************
+void
+MemoryCard_Loop(
+	Filesystem::Storage&	storage,
+	uint8_t*				queue_memory
+)
+{
+	Filesystem::FAT16&				filesys = storage.Mount();
+	filesys.SetGroupCommit(true);
+	filesys.SetPreErase(true);
+
+	// Event index, whole records only: a record torn by power loss is written again.
+	Filesystem::File				events(filesys, EVENTS_FILENAME, Filesystem::OPEN_CREATE);
+	events.SeekSet(events.Size() - events.Size() % sizeof(LoggerIO::EVENT));
+	events.Reserve(EVENTS_RESERVE_BYTES);
+
+	if (LoggerConfig::RawLogSize > 0) {
+		// Raw log ring in a preallocated file, the write-behind queue is its buffer.
+		Filesystem::RawLog			log(filesys.Device(), queue_memory, FILE_QUEUE_BLOCKS);
+		log.Open(filesys, RAW_LOG_FILENAME, LoggerConfig::RawLogSize * 1024 * 1024);
+		tprintf("MemoryCard_Loop: %s segments %d .. %d of %d.\n",
+			RAW_LOG_FILENAME, log.Tail(), log.Head(), log.SegmentCount());
+		write_loop(log, events, filesys, "Writing LOGGER.RAW.");
+	} else {
+		const char*					filename = "LOGGER.BIN";
+		Filesystem::File			f(filesys, filename, Filesystem::OPEN_CREATE);
+		const unsigned int			recovered = f.RecoverSize();
+		const unsigned int			filesize = f.Size();
+
+		if (recovered > 0) {
+			tprintf("MemoryCard_Loop: recovered %d bytes of %s.\n", recovered, filename);
+		}
+		f.Reserve(FAT_RESERVE_BYTES);
+		f.SetQueue(queue_memory, FILE_QUEUE_BLOCKS);
+
+		f.SeekSet(filesize);	// prepare for append.
+
+		write_loop(f, events, filesys, "Writing LOGGER.BIN.");
+	}
+}
+
@@ -0,0 +1,36 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef MemoryCard_h_
+#define MemoryCard_h_
+
+/** \file Writing the sensor and GPS queues to the memory card. */
+
+#include <stdint.h>
+
+#include <Filesystem/Storage.h>
+
+/** Number of memory card blocks cached in SDRAM. */
+#define	FAT_CACHE_BLOCKS		64
+/** Number of blocks in the write-behind queue of LOGGER.BIN. */
+#define	FILE_QUEUE_BLOCKS		128
+/** Number of blocks in the write window of the memory card. */
+#define	WRITE_WINDOW_BLOCKS		64
+/** Seconds the receive queues hold beyond the lookback of the trigger, for
+card stalls, commits and mounting the card again. */
+#define	QUEUE_MARGIN_SECONDS	10
+
+/** Write loop, returns only by exception. It keeps LimitsTimeBefore seconds of
+samples queued for the trigger and writes the older ones as they arrive. The memory card stays mounted
+in \c storage, so that it is not initialized again unless it has been lost.
+\param[in]	queue_memory	FILE_QUEUE_BLOCKS blocks, the write-behind queue of LOGGER.BIN
+							or the buffer of the raw log.
+*/
+extern void
+MemoryCard_Loop(
+	Filesystem::Storage&	storage,
+	uint8_t*				queue_memory
+);
+
+#endif /* MemoryCard_h_ */
@@ -0,0 +1,290 @@
+// vim: ts=4 shiftwidth=4
+#ifndef RingBuffer_h_
+#define	RingBuffer_h_
+
+#include <stdbool.h>	// bool
+
+/** Orders the element accesses before the index update that publishes them.
+ * One core on the AVR32, and the x86 keeps stores and loads in order, so only
+ * the compiler must not move the accesses.
+ */
+#if defined(__AVR32__) || defined(__i386__) || defined(__x86_64__)
+#	define	RINGBUFFER_BARRIER()	__asm__ __volatile__("" ::: "memory")
+#elif defined(__GNUC__)
+#	define	RINGBUFFER_BARRIER()	__sync_synchronize()
+#else
+#	define	RINGBUFFER_BARRIER()
+#endif
+
+/**
+ * Lock-free circular buffer of a power of two size, for one producer (an
+ * interrupt handler) and one consumer (the main loop).
+ *
+ * Same interface as CircularBuffer, without the divisions: the indices run
+ * freely and are masked on access. One element is kept free for Poke(),
+ * a buffer of \c size elements holds size-1.
+ *
+ * The producer counts the pushes refused and the largest size seen.
+ */
+template <class E>
+class RingBuffer {
+public:
+	/** Initialize buffer to empty state.
+	 * \param[in]	size	Power of two, see SetBuffer().
+	 */
+	RingBuffer(
+		E*					buffer,
+		const unsigned int	size
+	)
+	:	 buffer_(buffer)
+		,mask_(Floor(size) - 1)
+		,push_index_(0)
+		,pop_index_(0)
+		,dropped_(0)
+		,high_water_(0)
+	{
+	}
+
+	/** Smallest power of two size holding \c count elements, for SetBuffer(). */
+	static unsigned int
+	SizeFor(
+		const unsigned int	count
+	)
+	{
+		unsigned int	size = 2;
+		while (size - 1 < count) {
+			size <<= 1;
+		}
+		return size;
+	}
+
+	/** Set buffer memory.
+	 * \param[in]	size	Number of elements, a power of two. Otherwise only the
+	 *						largest power of two below it is used.
+	 */
+	void
+	SetBuffer(
+		E*					buffer,
+		const unsigned int	size
+	)
+	{
+		buffer_ = buffer;
+		mask_ = Floor(size) - 1;
+
+		Clear();
+	}
+
+	/** Is buffer empty? */
+	bool
+	IsEmpty() const
+	{
+		return push_index_ == pop_index_;
+	}
+
+	/** Is buffer full? */
+	bool
+	IsFull() const
+	{
+		return push_index_ - pop_index_ == mask_;
+	}
+
+	/** Push element \c e into the buffer.
+	 * \return true on success, false when buffer is full.
+	 */
+	bool
+	Push(
+		const E&	e
+	)
+	{
+		const unsigned int	ipush = push_index_;
+		if (ipush - pop_index_ == mask_) {
+			++dropped_;
+			return false;
+		}
+		buffer_[ipush & mask_] = e;
+		Publish(ipush + 1);
+		return true;
+	}
+
+	/** Push an alread-present element, prepared by Poke(), into the buffer.
+	 * \return true on success, false when buffer is full.
+	 */
+	bool
+	Push()
+	{
+		const unsigned int	ipush = push_index_;
+		if (ipush - pop_index_ == mask_) {
+			++dropped_;
+			return false;
+		}
+		Publish(ipush + 1);
+		return true;
+	}
+
+	/** Pop an element, note that it doesn't check for failure!
+	 * \return Popped element.
+	 */
+	E
+	Pop()
+	{
+		const unsigned int	ipop = pop_index_;
+		const E				r = buffer_[ipop & mask_];
+		RINGBUFFER_BARRIER();
+		pop_index_ = ipop + 1;
+		return r;
+	}
+
+	/** Pop an element, check for failure.
+	 * \return Popped element.
+	 */
+	bool
+	Pop(
+		E&	e
+	)
+	{
+		const unsigned int	ipop = pop_index_;
+		if (ipop == push_index_) {
+			return false;
+		}
+		RINGBUFFER_BARRIER();
+		e = buffer_[ipop & mask_];
+		RINGBUFFER_BARRIER();
+		pop_index_ = ipop + 1;
+		return true;
+	}
+
+	/** Clear the buffer. This is meant to be called by the consumer side. */
+	void
+	Clear()
+	{
+		pop_index_ = push_index_;
+	}
+
+	/** Approximate size of the buffer */
+	unsigned int
+	Size() const
+	{
+		return push_index_ - pop_index_;
+	}
+
+	/** Number of elements the buffer holds. */
+	unsigned int
+	Capacity() const
+	{
+		return mask_;
+	}
+
+	/** Peek into the data buffer. No bounds checking.
+	 * \param[in]	index	Index starting at current pop index.
+	 */
+	const E&
+	Peek(
+		const unsigned int	index
+	) const
+	{
+		const unsigned int	ipop = pop_index_ + index;
+		RINGBUFFER_BARRIER();
+		return buffer_[ipop & mask_];
+	}
+
+	/** Get a pointer for poking the next to be pushed element in the buffer.
+	 * Push() without arguments will push this element.
+	 */
+	E&
+	Poke()
+	{
+		return buffer_[push_index_ & mask_];
+	}
+
+	/** Elements ready for the consumer, as at most two contiguous runs,
+	 * the second one from the start of the memory when the first wraps.
+	 * They stay in the buffer until Consume().
+	 * \return Total number of elements, \c first_count + \c second_count.
+	 */
+	unsigned int
+	ReadableSpans(
+		const E*&		first,
+		unsigned int&	first_count,
+		const E*&		second,
+		unsigned int&	second_count
+	) const
+	{
+		const unsigned int	ipop = pop_index_;
+		const unsigned int	count = push_index_ - ipop;
+		const unsigned int	start = ipop & mask_;
+		const unsigned int	to_end = mask_ + 1 - start;
+
+		RINGBUFFER_BARRIER();
+		first = buffer_ + start;
+		second = buffer_;
+		first_count = count < to_end ? count : to_end;
+		second_count = count - first_count;
+		return count;
+	}
+
+	/** Drop \c n elements from the consumer side, after ReadableSpans(). No bounds checking. */
+	void
+	Consume(
+		const unsigned int	n
+	)
+	{
+		RINGBUFFER_BARRIER();
+		pop_index_ = pop_index_ + n;
+	}
+
+	/** Number of pushes refused because the buffer was full. */
+	unsigned int
+	Dropped() const
+	{
+		return dropped_;
+	}
+
+	/** Largest size after a push. */
+	unsigned int
+	HighWater() const
+	{
+		return high_water_;
+	}
+private:
+	/** Largest power of two not above \c size, at least 2. */
+	static unsigned int
+	Floor(
+		const unsigned int	size
+	)
+	{
+		unsigned int	r = 2;
+		while (r <= size / 2) {
+			r <<= 1;
+		}
+		return r;
+	}
+
+	/** Producer side: make the elements before \c ipush visible to the consumer. */
+	void
+	Publish(
+		const unsigned int	ipush
+	)
+	{
+		RINGBUFFER_BARRIER();
+		push_index_ = ipush;
+		const unsigned int	size = ipush - pop_index_;
+		if (size > high_water_) {
+			high_water_ = size;
+		}
+	}
+
+	/** Circular buffer. */
+	E*						buffer_;
+	/** Size of the buffer minus one. */
+	unsigned int			mask_;
+	/** Push count, masked on access (heading). */
+	volatile unsigned int	push_index_;
+	/** Pop count, masked on access (trailing). */
+	volatile unsigned int	pop_index_;
+	/** Pushes refused, written by the producer only. */
+	volatile unsigned int	dropped_;
+	/** Largest size after a push, written by the producer only. */
+	volatile unsigned int	high_water_;
+}; // class RingBuffer
+
+#endif /* RingBuffer_h_ */
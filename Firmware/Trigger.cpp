@@ -0,0 +1,68 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include "Trigger.h"
+
+#include <string.h>		// memset
+
+//*******************************************************************
+Trigger::Trigger(
+	const unsigned int	before_packets,
+	const unsigned int	after_packets
+)
+:	window_(before_packets + after_packets)
+	,countdown_(0)
+	,finished_(false)
+{
+	memset(&event_, 0, sizeof(event_));
+}
+
+//*******************************************************************
+bool
+Trigger::Process(
+	const SENSORS_SAMPLE&	sample,
+	const SENSORS_SAMPLE&	test,
+	const uint32_t			offset
+)
+{
+	unsigned int	sensor = 0;
+	unsigned int	axis = 0;
+
+	finished_ = false;
+	if (AccelerationSensors_FindOverLimit(test, sensor, axis)) {
+		if (countdown_ == 0) {
+			event_.StartTick = sample.tick;
+			event_.TriggerTick = test.tick;
+			event_.Offset = offset;
+			event_.Triggers = 0;
+			event_.Sensor = sensor;
+			event_.Axis = axis;
+			event_.Reserved = 0;
+		}
+		++event_.Triggers;
+		countdown_ = window_;
+	}
+	if (countdown_ == 0) {
+		return false;
+	}
+
+	event_.EndTick = sample.tick;
+	--countdown_;
+	finished_ = countdown_ == 0;
+	return true;
+}
+
+//*******************************************************************
+const LoggerIO::EVENT*
+Trigger::Finished() const
+{
+	return finished_ ? &event_ : 0;
+}
+
+//*******************************************************************
+unsigned int
+Trigger::Countdown() const
+{
+	return countdown_;
+}
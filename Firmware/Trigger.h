@@ -0,0 +1,56 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef Trigger_h_
+#define Trigger_h_
+
+/** \file Events of the writer: which samples go to the log. */
+
+#include <stdint.h>
+
+#include "LoggerIO.h"
+#include "AccelerationSensors.h"
+
+/** Trigger of the writer.
+
+Each sample is tested against the limits once, as the newest one the writer
+looks at, and decides on the sample \c before_packets older. A sample over the
+limits opens an event starting \c before_packets back, or extends the open one;
+the event ends \c after_packets past the last sample over the limits. The
+finished event is the record of the event index.
+*/
+class Trigger {
+public:
+	Trigger(
+		const unsigned int	before_packets,
+		const unsigned int	after_packets
+	);
+
+	/** Test \c test, the newest sample, and decide on \c sample.
+	\param[in]	offset	Position of \c sample in the log when written.
+	\return true when \c sample is to be written.
+	*/
+	bool
+	Process(
+		const SENSORS_SAMPLE&	sample,
+		const SENSORS_SAMPLE&	test,
+		const uint32_t			offset
+	);
+
+	/** Event finished by the last Process(), in host byte order. NULL if none. */
+	const LoggerIO::EVENT*
+	Finished() const;
+
+	/** Samples left to write in the open event, 0 if none is open. */
+	unsigned int
+	Countdown() const;
+private:
+	/** Samples written for a sample over the limits. */
+	const unsigned int	window_;
+	unsigned int		countdown_;
+	bool				finished_;
+	LoggerIO::EVENT		event_;
+}; // class Trigger
+
+#endif /* Trigger_h_ */
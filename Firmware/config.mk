@@ -106,15 +106,19 @@ CSRCS = \
 CXXSRCS := \
   Gps.cpp AccelerationSensors.cpp			\
   Display.cpp						\
-  main.cpp						\
+  main.cpp MemoryCard.cpp Trigger.cpp			\
   LoggerConfig.cpp 					\
+  ../Filesystem/Filesystem/Blockcache.cpp		\
   ../Filesystem/Filesystem/Blockdevice.cpp		\
+  ../Filesystem/Filesystem/Blockdevice_Coalescing.cpp	\
   ../Filesystem/Filesystem/Blockdevice_File.cpp		\
   ../Filesystem/Filesystem/Blockdevice_SDMMC.cpp	\
   ../Filesystem/Filesystem/Endian.cpp			\
   ../Filesystem/Filesystem/Error.cpp			\
   ../Filesystem/Filesystem/FAT16.cpp			\
   ../Filesystem/Filesystem/File.cpp			\
+  ../Filesystem/Filesystem/RawLog.cpp			\
+  ../Filesystem/Filesystem/Storage.cpp			\
   ../Filesystem/Filesystem/Config.cpp
 
 
@@ -14,9 +14,10 @@ vim: shiftwidth=4
 #include "IUsart.h"
 #include "tprintf.h"
 #include <Filesystem/Blockdevice_SDMMC.h>
+#include <Filesystem/Blockcache.h>
 #include <Filesystem/FAT16.h>
-#include <Filesystem/File.h>
-#include <Filesystem/Endian.h>		// FixEndian32
+#include <Filesystem/Storage.h>
+#include "MemoryCard.h"
 #include "project.h"
 
 #include <led.h>
@@ -90,149 +91,24 @@ SDRAM_Init(void)
 }
 
 //*******************************************************************
-static void
-FixEndianHELLO(
-	LoggerIO::HELLO&	packet
-)
-{
-	Filesystem::FixEndian32(packet.Magic);
-	Filesystem::FixEndian32(packet.Frequency);
-	Filesystem::FixEndian32(packet.Tick);
-}
+/** Free cluster bitmap of the memory card, in SDRAM. */
+static uint8_t*		fat_free_bitmap = 0;
+/** Memory of the memory card block cache, in SDRAM. */
+static uint8_t*		fat_cache_memory = 0;
+/** Memory of the write-behind queue, in SDRAM. Buffer of the raw log in raw mode. */
+static uint8_t*		file_queue_memory = 0;
+/** Memory of the write window, in SDRAM. */
+static uint8_t*		write_window_memory = 0;
 
 //*******************************************************************
-static void
-FixEndianGPS(
-	LoggerIO::GPS&	packet
-)
-{
-	Filesystem::FixEndian16(packet.Header.Type);
-	Filesystem::FixEndian16(packet.Header.TotalSize);
-	Filesystem::FixEndian32(packet.Header.Tick);
-}
+/** Memory card, which shares the SPI bus with the display. */
+static Filesystem::Storage*	card_storage = 0;
 
-//*******************************************************************
+/** Display_BusWait: the display is written to once the card has programmed its last block. */
 static void
-FixEndianSENSORS(
-	LoggerIO::SENSORS&	packet
-)
+wait_card(void)
 {
-	Filesystem::FixEndian16(packet.Header.Type);
-	Filesystem::FixEndian16(packet.Header.TotalSize);
-	Filesystem::FixEndian32(packet.Header.Tick);
-}
-
-//*******************************************************************
-static void
-memorycard_loop()
-{
-	const char*						filename = "LOGGER.BIN";
-
-	Filesystem::Blockdevice_SDMMC	sdmmc_card;
-	Filesystem::FAT16				filesys(sdmmc_card);
-	Filesystem::File				f(filesys, filename, Filesystem::OPEN_CREATE);
-	const unsigned int				filesize = f.Size();
-
-	f.SeekSet(filesize);	// prepare for append.
-
-	Display_MemoryCard("Writing LOGGER.BIN.");
-	Display_Error("");
-	Display_Draw();
-
-	// Hello packet.
-	{
-		LoggerIO::HELLO			PacketHELLO;
-		PacketHELLO.Magic 		= LoggerIO::MAGIC;
-		PacketHELLO.Frequency	= F_CPU;
-		PacketHELLO.Tick		= AccelerationSensors_GetTick();
-		FixEndianHELLO(PacketHELLO);
-
-		f.Write(&PacketHELLO, sizeof(PacketHELLO));
-
-		Display_Sleep(2 * 1000 / LoggerConfig::SamplingFrequency);
-	}
-
-
-	const unsigned int	interval_packets = LoggerConfig::WritingInterval * LoggerConfig::SamplingFrequency;
-	const unsigned int	threshold = interval_packets + 
-										(LoggerConfig::LimitsTimeBefore + LoggerConfig::LimitsTimeAfter) * LoggerConfig::SamplingFrequency;
-	const unsigned int	before_packets = LoggerConfig::LimitsTimeBefore * LoggerConfig::SamplingFrequency;
-	const unsigned int	after_packets = LoggerConfig::LimitsTimeBefore * LoggerConfig::SamplingFrequency;
-
-	/** Over limit countdown. Decremented at each packet.
-	 * 0 = no reading over limit.
-	 * x = should write.
-	 */
-	unsigned int		overlimit_countdown = 0;
-
-	tprintf("Entering write loop.\n");
-	AccelerationSensors_RxQueue.Clear();
-	Gps_RxQueue.Clear();
-	for (;;) {
-		unsigned int		packetcount_sensors = AccelerationSensors_RxQueue.Size();
-		unsigned int		packetcount_gps = Gps_RxQueue.Size();
-		LoggerIO::GPS		PacketGPS;
-		LoggerIO::SENSORS	PacketSENSORS;
-		LoggerIO::SENSORS	testpacket;
-		SENSORS_RXBUFFER	PacketSENSORS_RXBUFFER;
-		char				xbuf[100];
-
-		// Print "Collecting..."
-		while (packetcount_sensors < threshold) {
-			sprintf(xbuf, "Collecting: %3d sec.", (threshold - packetcount_sensors) / LoggerConfig::SamplingFrequency);
-			Display_MemoryCard(xbuf);
-			Display_Process();
-			packetcount_sensors = AccelerationSensors_RxQueue.Size();
-			packetcount_gps = Gps_RxQueue.Size();
-		}
-
-		// Writing :)
-		unsigned int	sensors_packets_written = 0;
-		unsigned int	gps_packets_written = 0;
-		for (unsigned int i=0; i<interval_packets; ++i) {
-			const SENSORS_RXBUFFER&	testpacket_buffer = AccelerationSensors_RxQueue.Peek(before_packets);
-			AccelerationSensors_RxQueue.Pop(PacketSENSORS_RXBUFFER);
-			AccelerationSensors_Convert(testpacket, testpacket_buffer);
-			AccelerationSensors_Convert(PacketSENSORS, PacketSENSORS_RXBUFFER);
-
-			// 1. Display nice message :)
-			if ((i % LoggerConfig::SamplingFrequency) == 0) {
-				sprintf(xbuf, "Writing: %3d sec.", (interval_packets - i) / LoggerConfig::SamplingFrequency);
-				Display_MemoryCard(xbuf);
-				Display_Process();
-			}
-
-			// 2. Write all preceding GPS packets.
-			while (!Gps_RxQueue.IsEmpty()) {
-				const LoggerIO::GPS		gps_testpacket = Gps_RxQueue.Peek(0);
-				if (gps_testpacket.Header.Tick < PacketSENSORS.Header.Tick) {
-					Gps_RxQueue.Pop(PacketGPS);
-					FixEndianGPS(PacketGPS);
-					f.Write(&PacketGPS, sizeof(PacketGPS));
-					++gps_packets_written;
-				} else {
-					break;
-				}
-			}
-
-			// 3. Check the testpacket against limits.
-			if (!AccelerationSensors_PacketWithinLimits(testpacket)) {
-				overlimit_countdown = before_packets + after_packets;
-			}
-
-			// 4. Write, if needed :)
-			if (overlimit_countdown > 0) {
-				FixEndianSENSORS(PacketSENSORS);
-				f.Write(&PacketSENSORS, sizeof(PacketSENSORS));
-				--overlimit_countdown;
-				++sensors_packets_written;
-			}
-
-		}
-		tprintf("memorycard_loop: flush, wrote %d sensor packets, %d gps packets.\n",
-			sensors_packets_written, gps_packets_written);
-		f.Flush();
-	}
+	card_storage->WaitCard();
 }
 
 //*******************************************************************
@@ -290,7 +166,9 @@ spi_init()
 
 //*******************************************************************
 static void
-load_config()
+load_config(
+	Filesystem::Storage&	storage
+)
 {
 	static bool	config_loaded = false;
 
@@ -298,10 +176,7 @@ load_config()
 		return;
 	}
 	try {
-		Filesystem::Blockdevice_SDMMC	sdmmc_card;
-		Filesystem::FAT16				filesys(sdmmc_card);
-
-		LoggerConfig::Load(filesys, "LOGGER.INI");
+		LoggerConfig::Load(storage.Mount(), "LOGGER.INI");
 		config_loaded = true;
 	} catch (const std::exception& e) {
 		tprintf("Exception: %s\n", e.what());
@@ -334,28 +209,49 @@ main( void )
 	LED_Display_Mask(LED2, LED2);	// LED2 - interrupts.
 
 	spi_init();
-	load_config();
 
 	// Initialize modules.
 	Display_Init();
 
 	SDRAM_Init();
 
+	/** SDRAM distribution, memory card buffers first. */
+	unsigned char*		sdram_ptr = reinterpret_cast<unsigned char*>(SDRAM);
+	{
+		// Free cluster bitmap of the memory card.
+		fat_free_bitmap = sdram_ptr;
+		sdram_ptr += Filesystem::FAT16::FREE_BITMAP_SIZE;
+	}
+	{
+		// Memory card block cache.
+		fat_cache_memory = sdram_ptr;
+		sdram_ptr += FAT_CACHE_BLOCKS * Filesystem::Blockcache::SLOT_SIZE;
+	}
+	{
+		// Write-behind queue of the log file.
+		file_queue_memory = sdram_ptr;
+		sdram_ptr += FILE_QUEUE_BLOCKS * Filesystem::FAT16::BLOCK_SIZE;
+	}
+	{
+		// Write window of the memory card.
+		write_window_memory = sdram_ptr;
+		sdram_ptr += WRITE_WINDOW_BLOCKS * Filesystem::FAT16::BLOCK_SIZE;
+	}
 
-	AccelerationSensors_Init(LoggerConfig::SamplingFrequency);
-	Gps_Init(LoggerConfig::GpsBaudRate);
+	// The memory card is mounted once, for the configuration and the log.
+	Filesystem::Storage	storage(fat_free_bitmap, fat_cache_memory, FAT_CACHE_BLOCKS * Filesystem::Blockcache::SLOT_SIZE,
+							write_window_memory, WRITE_WINDOW_BLOCKS);
+	card_storage = &storage;
+	Display_SetBusWait(wait_card);
+	load_config(storage);
 
-	/** SDRAM distribution. */
-	unsigned char*		sdram_ptr = reinterpret_cast<unsigned char*>(SDRAM);
-	const unsigned int	max_time = 2 * (1 +
-			LoggerConfig::WritingInterval +
-			LoggerConfig::LimitsTimeBefore +
-			LoggerConfig::LimitsTimeAfter);	// seconds
+	// The writer streams, the queues hold the lookback of the trigger and a margin.
+	const unsigned int	max_time = LoggerConfig::LimitsTimeBefore + QUEUE_MARGIN_SECONDS;	// seconds
 	tprintf("SDRAM: max time is %d seconds.\n", max_time);
 	{
 		// GPS rx queue buffer.
 		const unsigned int	freq = 20;	// times per second.
-		const unsigned int	nrof_items = max_time * freq;
+		const unsigned int	nrof_items = RingBuffer<LoggerIO::GPS>::SizeFor(max_time * freq);
 		const unsigned int	nrof_bytes = nrof_items * sizeof(LoggerIO::GPS);
 		Gps_RxQueue.SetBuffer(reinterpret_cast<LoggerIO::GPS*>(sdram_ptr), nrof_items);
 		sdram_ptr += nrof_bytes;
@@ -363,9 +259,9 @@ main( void )
 	{
 		// Acceleration sensors rx queue buffer.
 		const unsigned int	freq = LoggerConfig::SamplingFrequency;	// times per second.
-		const unsigned int	nrof_items = max_time * freq;
-		const unsigned int	nrof_bytes = nrof_items * sizeof(SENSORS_RXBUFFER);
-		AccelerationSensors_RxQueue.SetBuffer(reinterpret_cast<SENSORS_RXBUFFER*>(sdram_ptr), nrof_items);
+		const unsigned int	nrof_items = RingBuffer<SENSORS_SAMPLE>::SizeFor(max_time * freq);
+		const unsigned int	nrof_bytes = nrof_items * sizeof(SENSORS_SAMPLE);
+		AccelerationSensors_RxQueue.SetBuffer(reinterpret_cast<SENSORS_SAMPLE*>(sdram_ptr), nrof_items);
 		sdram_ptr += nrof_bytes;
 	}
 	{
@@ -375,19 +271,29 @@ main( void )
 				used_bytes, free_bytes, max_time * ((free_bytes + used_bytes)/512) / ((used_bytes/512)));
 	}
 
+	// The interrupts fill the queues from the first round on.
+	AccelerationSensors_Init(LoggerConfig::SamplingFrequency);
+	Gps_Init(LoggerConfig::GpsBaudRate);
+
 	/* Main loop. */
 	tprintf("Entering main loop.\n");
 
 	for (;;) {
 		Display_Draw();
 		try {
-			memorycard_loop();
+			MemoryCard_Loop(storage, file_queue_memory);
 		} catch (const std::exception& e) {
 			tprintf("Exception: %s\n", e.what());
 			Display_Error(e.what());
 		}
-		Display_MemoryCard("Memory Card Lost.");
-		Display_Sleep(5*1000);
+		if (storage.IsCardPresent()) {
+			// Start over on the mounted card.
+			Display_MemoryCard("Memory Card Error.");
+			Display_Sleep(1000);
+		} else {
+			Display_MemoryCard("Memory Card Lost.");
+			Display_Sleep(5*1000);
+		}
 	}
 }
 
@@ -1,6 +1,10 @@
 #ifndef _PROJECT_H
 #define _PROJECT_H
 
+#if defined(__linux__)
+// Host simulator: stand-ins for the board and the cycle counter.
+#	include "Linux/project.h"
+#else
 #include "board.h"
 #include "compiler.h"
 #include "dip204.h"
@@ -14,6 +18,7 @@
 #include "flashc.h"
 #include "sdramc.h"
 #include <avr32/io.h>
+#endif
 
 // OSC0 runs at 12 MHz.
 // CPU clock runs at 64 MHz.
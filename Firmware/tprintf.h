@@ -6,13 +6,13 @@ vim: shiftwidth=4
 #define	tprintf_h_
 
 
-#include "project.h"
-
-#if defined(_MSC_VER)
+#if defined(_MSC_VER) || defined(__linux__)
 #	include <stdio.h>
 #	define tprintf	printf
 #else
 
+#include "project.h"
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -0,0 +1,234 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#include "LogStream.h"
+
+#include <stdexcept>	// std::runtime_error
+#include <string.h>		// memcpy
+
+#if defined(_MSC_VER)
+#	include <windows.h>
+#else
+#	include <fcntl.h>		// open
+#	include <sys/mman.h>	// mmap
+#	include <sys/stat.h>	// fstat
+#	include <unistd.h>		// close, lseek
+#endif
+
+//*******************************************************************
+MappedFile::MappedFile(
+	const std::string&	filename
+)
+:	data_(0)
+	,size_(0)
+{
+#if defined(_MSC_VER)
+	file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (file_ == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("Cannot open '" + filename + "'.");
+	}
+	LARGE_INTEGER	size;
+	GetFileSizeEx(file_, &size);
+	size_ = static_cast<size_t>(size.QuadPart);
+	mapping_ = size_ > 0 ? CreateFileMappingA(file_, 0, PAGE_WRITECOPY, 0, 0, 0) : 0;
+	if (mapping_ != 0) {
+		data_ = reinterpret_cast<uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_COPY, 0, 0, 0));
+	}
+	if (size_ > 0 && data_ == 0) {
+		if (mapping_ != 0) {
+			CloseHandle(mapping_);
+		}
+		CloseHandle(file_);
+		throw std::runtime_error("Cannot map '" + filename + "'.");
+	}
+#else
+	const int	fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("Cannot open '" + filename + "'.");
+	}
+	struct stat	st;
+	if (fstat(fd, &st) == 0) {
+		size_ = st.st_size;
+	}
+	if (size_ == 0) {
+		// Block devices, e.g. the card in a card reader, have no size in st_size.
+		const off_t	end = lseek(fd, 0, SEEK_END);
+		if (end > 0) {
+			size_ = static_cast<size_t>(end);
+		}
+	}
+	if (size_ > 0) {
+		void*	p = mmap(0, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Cannot map '" + filename + "'.");
+		}
+		data_ = reinterpret_cast<uint8_t*>(p);
+		madvise(p, size_, MADV_SEQUENTIAL);
+	}
+	close(fd);
+#endif
+}
+
+//*******************************************************************
+MappedFile::~MappedFile()
+{
+#if defined(_MSC_VER)
+	if (data_ != 0) {
+		UnmapViewOfFile(data_);
+	}
+	if (mapping_ != 0) {
+		CloseHandle(mapping_);
+	}
+	CloseHandle(file_);
+#else
+	if (data_ != 0) {
+		munmap(data_, size_);
+	}
+#endif
+}
+
+//*******************************************************************
+uint8_t*
+MappedFile::Data() const
+{
+	return data_;
+}
+
+//*******************************************************************
+size_t
+MappedFile::Size() const
+{
+	return size_;
+}
+
+//*******************************************************************
+LogStream::LogStream()
+:	size_(0)
+	,pos_(0)
+	,range_(0)
+{
+}
+
+//*******************************************************************
+void
+LogStream::Append(
+	const uint8_t*	data,
+	const size_t	size
+)
+{
+	if (size == 0) {
+		return;
+	}
+	if (!ranges_.empty() && ranges_.back().Data + ranges_.back().Size == data) {
+		ranges_.back().Size += size;
+	} else {
+		Range	r;
+		r.Data = data;
+		r.Size = size;
+		r.Pos = size_;
+		ranges_.push_back(r);
+	}
+	size_ += size;
+	Seek(pos_);
+}
+
+//*******************************************************************
+size_t
+LogStream::Ranges() const
+{
+	return ranges_.size();
+}
+
+//*******************************************************************
+size_t
+LogStream::Size() const
+{
+	return size_;
+}
+
+//*******************************************************************
+size_t
+LogStream::Tell() const
+{
+	return pos_;
+}
+
+//*******************************************************************
+void
+LogStream::Seek(
+	const size_t	pos
+)
+{
+	pos_ = pos < size_ ? pos : size_;
+
+	// Binary search for the last range starting at or before pos_.
+	size_t	lo = 0;
+	size_t	hi = ranges_.size();
+	while (lo < hi) {
+		const size_t	mid = (lo + hi) / 2;
+		if (ranges_[mid].Pos <= pos_) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	range_ = pos_ < size_ ? lo - 1 : ranges_.size();
+}
+
+//*******************************************************************
+int
+LogStream::Getc()
+{
+	if (range_ >= ranges_.size()) {
+		return -1;
+	}
+	const Range&	r = ranges_[range_];
+	const int		c = r.Data[pos_ - r.Pos];
+	++pos_;
+	if (pos_ == r.Pos + r.Size) {
+		++range_;
+	}
+	return c;
+}
+
+//*******************************************************************
+const uint8_t*
+LogStream::Read(
+	const size_t	size
+)
+{
+	if (size == 0 || size > size_ - pos_) {
+		return 0;
+	}
+
+	// 1. Within the current range, no copying.
+	const Range&	r = ranges_[range_];
+	const size_t	offset = pos_ - r.Pos;
+	if (offset + size <= r.Size) {
+		pos_ += size;
+		if (offset + size == r.Size) {
+			++range_;
+		}
+		return r.Data + offset;
+	}
+
+	// 2. Across ranges.
+	copy_.resize(size);
+	for (size_t done=0; done<size; ) {
+		const Range&	cur = ranges_[range_];
+		const size_t	cur_offset = pos_ - cur.Pos;
+		size_t			n = cur.Size - cur_offset;
+		if (n > size - done) {
+			n = size - done;
+		}
+		memcpy(&copy_[done], cur.Data + cur_offset, n);
+		pos_ += n;
+		done += n;
+		if (pos_ == cur.Pos + cur.Size) {
+			++range_;
+		}
+	}
+	return &copy_[0];
+}
@@ -0,0 +1,113 @@
+/**
+vim: ts=4
+vim: shiftwidth=4
+*/
+#ifndef LogStream_h_
+#define LogStream_h_
+
+/** \file Logger data read from memory mapped files. */
+
+#include <stddef.h>		// size_t
+#include <stdint.h>
+#include <string>		// std::string
+#include <vector>		// std::vector
+
+//*******************************************************************
+/** Whole file mapped into memory, copy-on-write: changes never reach the file.
+On Linux the file may also be a block device, e.g. /dev/sdb of a card reader.
+Devices are not supported on Windows, copy the card to an image file first.
+*/
+class MappedFile {
+public:
+	/** Map the file, throws exception when it cannot be opened or mapped. */
+	MappedFile(
+		const std::string&	filename
+	);
+
+	~MappedFile();
+
+	/** Contents of the file. */
+	uint8_t*
+	Data() const;
+
+	/** Size of the file, bytes. */
+	size_t
+	Size() const;
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	uint8_t*	data_;
+	size_t		size_;
+#if defined(_MSC_VER)
+	void*		file_;
+	void*		mapping_;
+#endif
+}; // class MappedFile
+
+//*******************************************************************
+/** Byte stream over ranges of memory, e.g. the cluster runs of a file in a
+memory mapped card image. Reads within one range return pointers into it,
+only reads across ranges are copied.
+*/
+class LogStream {
+public:
+	LogStream();
+
+	/** Append \c size bytes at \c data to the end of the stream.
+	Ranges following each other in memory are joined.
+	*/
+	void
+	Append(
+		const uint8_t*	data,
+		const size_t	size
+	);
+
+	/** Number of memory ranges. */
+	size_t
+	Ranges() const;
+
+	/** Total size, bytes. */
+	size_t
+	Size() const;
+
+	/** Current position. */
+	size_t
+	Tell() const;
+
+	/** Move to the given position, at most Size(). */
+	void
+	Seek(
+		const size_t	pos
+	);
+
+	/** Next byte, or -1 at the end of the stream. */
+	int
+	Getc();
+
+	/** The next \c size bytes, and move past them.
+	\return Pointer valid until the next Read(), NULL when \c size is 0 or more than the bytes left.
+	*/
+	const uint8_t*
+	Read(
+		const size_t	size
+	);
+private:
+	/** Memory range and its position in the stream. */
+	typedef struct {
+		const uint8_t*	Data;
+		size_t			Size;
+		size_t			Pos;
+	} Range;
+
+	std::vector<Range>		ranges_;
+	size_t					size_;
+	/** Current position. */
+	size_t					pos_;
+	/** Range of the current position, ranges_.size() at the end. */
+	size_t					range_;
+	/** Bytes of reads across ranges. */
+	std::vector<uint8_t>	copy_;
+}; // class LogStream
+
+#endif /* LogStream_h_ */
@@ -2,9 +2,15 @@
 #include <stdexcept>
 #include <exception>	// std::exception
 #include <string>		// std::string
+#include <algorithm>	// std::find, std::min
 
 #include <stdio.h>		// fopen, etc.
+#include <string.h>		// memcpy, memset, strcmp
 #include "LoggerIO.h"
+#include "LogStream.h"
+
+#include <Filesystem/Blockdevice_RAM.h>
+#include <Filesystem/FAT16.h>
 
 //*******************************************************************
 enum {
@@ -52,61 +58,52 @@ DecodeData(
 }
 
 //*******************************************************************
+/** Convert the packets of \c in into text files named prefix-N.txt, one per hello packet.
+Only checks the packets when \c write_output is false.
+*/
 static void
-convert_file(
-	const std::string&	filename
+convert_stream(
+	LogStream&			in,
+	const std::string&	filename_prefix,
+	const bool			write_output
 )
 {
-	const std::string::size_type	dotpos = filename.rfind('.');
-	const std::string				filename_prefix = dotpos==std::string::npos
-										? filename
-										: filename.substr(0, dotpos);
-
-	FILE*	f = fopen(filename.c_str(), "rb");
-	// FILE*	f = fopen("ahahahaha", "rb");
-	if (f==0) {
-		printf("File '%s' not found for reading.\n",
-			filename.c_str());
-		return;
-	}
-	fseek(f, 0, SEEK_END);
-	const unsigned int		filesize = ftell(f);
-	fseek(f, 0, SEEK_SET);
-
-	printf("Opened file '%s', file size %d bytes\n",
-		filename.c_str(), filesize);
-
 	unsigned int					filecount = 0;
+	unsigned int					gps_count = 0;
+	unsigned int					sensors_count = 0;
 
 	for (;;) {
 		// 1. Scan for the magic byte.
 		LoggerIO::HELLO	hello = { 0, 0, 0 };
 		{
 			bool				found = false;
-			volatile char*		magicbuffer = reinterpret_cast<char*>(&hello.Magic);
-			volatile int*		magicptr = reinterpret_cast<int*>(&hello.Magic);
-			const unsigned int	start_pos = ftell(f);
-			do {
-				const int	c = fgetc(f);
-				if (c==EOF) {
+			uint32_t			magic = 0;
+			const size_t		start_pos = in.Tell();
+			for (;;) {
+				const int	c = in.Getc();
+				if (c<0) {
 					printf("File end reached.");
 					break;
 				}
 
-				magicbuffer[0] = magicbuffer[1];
-				magicbuffer[1] = magicbuffer[2];
-				magicbuffer[2] = magicbuffer[3];
-				magicbuffer[3] = c;
+				magic = (magic >> 8) | (static_cast<uint32_t>(c) << 24);
 
-				found = *magicptr == LoggerIO::MAGIC;
-			} while (!found);
+				found = magic == LoggerIO::MAGIC;
+				if (found) {
+					break;
+				}
+			}
 
 			if (found) {
 				// Yeah found :) Read rest of the hello packet.
-				const unsigned int	headerpos = ftell(f) - sizeof(hello.Magic);
-				printf("Hello at pos 0x%04x, skipping %d bytes.\n", headerpos, headerpos - start_pos);
-				fseek(f, headerpos, SEEK_SET);
-				fread(&hello, sizeof(hello), 1, f);
+				const size_t	headerpos = in.Tell() - sizeof(hello.Magic);
+				printf("Hello at pos 0x%04x, skipping %d bytes.\n",
+					static_cast<unsigned int>(headerpos), static_cast<unsigned int>(headerpos - start_pos));
+				in.Seek(headerpos);
+				const uint8_t*	p = in.Read(sizeof(hello));
+				if (p != 0) {
+					memcpy(&hello, p, sizeof(hello));
+				}
 				printf("Frequency: %d\n", hello.Frequency);
 				printf("Tick     : %d\n", hello.Tick);
 			} else {
@@ -116,23 +113,29 @@ convert_file(
 		}
 
 		// Open output file.
-		std::string	filename_out;
-		{
-			filename_out.resize(filename_prefix.size() + 100);
-			const int	n = sprintf(const_cast<char*>(filename_out.c_str()),
-								"%s-%d.txt", filename_prefix.c_str(), ++filecount);
-		}
-		FILE*	fout = fopen(filename_out.c_str(), "w");
-		if (fout == 0) {
-			printf("File '%s' cannot be opened for writing.\n", filename_out.c_str());
-			continue;
+		FILE*	fout = 0;
+		if (write_output) {
+			std::string	filename_out;
+			{
+				filename_out.resize(filename_prefix.size() + 100);
+				const int	n = sprintf(const_cast<char*>(filename_out.c_str()),
+									"%s-%d.txt", filename_prefix.c_str(), ++filecount);
+				filename_out.resize(n);
+			}
+			fout = fopen(filename_out.c_str(), "w");
+			if (fout == 0) {
+				printf("File '%s' cannot be opened for writing.\n", filename_out.c_str());
+				continue;
+			}
+			printf("Writing '%s'.", filename_out.c_str());
+		} else {
+			printf("Checking.");
 		}
-		printf("Writing '%s'.", filename_out.c_str());
 		fflush(stdout);
 
 		// 2. Read rest of the packets until mismatch :)
 		std::string		gps_line;
-		unsigned int	last_ok_pos = ftell(f);
+		size_t			last_ok_pos = in.Tell();
 		unsigned int	sparse_output = 0;
 		unsigned int	skipcount = 2;
 		AccelerationMinMax	minmax[MAX_SENSORS];
@@ -141,22 +144,23 @@ convert_file(
 			// 1. Read header.
 			LoggerIO::HEADER	header;
 			{
-				const int r1 = fread(&header, sizeof(header), 1, f);
-				if (r1 != 1) {
+				const uint8_t*	p = in.Read(sizeof(header));
+				if (p == 0) {
 					break;
 				}
+				memcpy(&header, p, sizeof(header));
 			}
 
-			// 2. Read the rest.
+			// 2. Read the rest, straight from the input.
 			bool	packet_ok = false;
 			switch (header.Type) {
 			case LoggerIO::TYPE_GPS:
 				if (header.TotalSize == sizeof(LoggerIO::GPS)) {
-					LoggerIO::GPS	gps;
-					gps.Header = header;
-					const int	r = fread(gps.NmeaLine, sizeof(gps.NmeaLine), 1, f);
-					if (r == 1) {
-						gps_line = reinterpret_cast<const char*>(gps.NmeaLine);
+					const unsigned int	line_size = sizeof(reinterpret_cast<LoggerIO::GPS*>(0)->NmeaLine);
+					const char*			line = reinterpret_cast<const char*>(in.Read(line_size));
+					if (line != 0) {
+						gps_line.assign(line, std::find(line, line + line_size, '\0'));
+						++gps_count;
 						packet_ok = true;
 					}
 				} else {
@@ -165,21 +169,24 @@ convert_file(
 				break;
 			case LoggerIO::TYPE_SENSORS:
 				if (header.TotalSize == sizeof(LoggerIO::SENSORS)) {
-					LoggerIO::SENSORS	sensors;
-					sensors.Header = header;
-					const int	r = fread(sensors.Readings, sizeof(sensors.Readings), 1, f);
-					if (r == 1) {
+					const uint8_t*	readings = in.Read(sizeof(reinterpret_cast<LoggerIO::SENSORS*>(0)->Readings));
+					if (readings != 0) {
 						if (skipcount>0) {
 							--skipcount;
 							continue;
 						}
-						fprintf(fout, "%d,", header.Tick);
+						++sensors_count;
+						if (fout != 0) {
+							fprintf(fout, "%d,", header.Tick);
+						}
 						for (unsigned int i=0; i<MAX_SENSORS; ++i) {
 							unsigned int	x;
 							unsigned int	y;
 							unsigned int	z;
-							DecodeData(&sensors.Readings[i*PACKET_SIZE], &x, &y, &z);
-							fprintf(fout, "%d,%d,%d,", x,y,z);
+							DecodeData(&readings[i*PACKET_SIZE], &x, &y, &z);
+							if (fout != 0) {
+								fprintf(fout, "%d,%d,%d,", x,y,z);
+							}
 							
 							// Update min, max.
 							if (x!=0 && y!=0 && z!=0) {
@@ -210,7 +217,9 @@ convert_file(
 								}
 							}
 						}
-						fprintf(fout, "%s\n", gps_line.c_str());
+						if (fout != 0) {
+							fprintf(fout, "%s\n", gps_line.c_str());
+						}
 						if (++sparse_output > 60*1000) {
 							sparse_output = 0;
 							putchar('.');
@@ -228,7 +237,7 @@ convert_file(
 			}
 
 			if (packet_ok) {
-				last_ok_pos = ftell(f);
+				last_ok_pos = in.Tell();
 			} else {
 				break;
 			}
@@ -243,12 +252,149 @@ convert_file(
 		printf("\n");
 
 		printf("End of file reached.\n");
-		fclose(fout);
+		if (fout != 0) {
+			fclose(fout);
+		}
+
+		in.Seek(last_ok_pos);
+	}
+
+	printf("%d sensors packets, %d gps packets.\n", sensors_count, gps_count);
+}
+
+//*******************************************************************
+/** File name without the extension. */
+static std::string
+filename_prefix_of(
+	const std::string&	filename
+)
+{
+	const std::string::size_type	dotpos = filename.rfind('.');
+	return dotpos==std::string::npos
+			? filename
+			: filename.substr(0, dotpos);
+}
+
+//*******************************************************************
+static void
+convert_file(
+	const std::string&	filename,
+	const bool			write_output
+)
+{
+	MappedFile	f(filename);
+	LogStream	in;
 
-		fseek(f, last_ok_pos, SEEK_SET);
+	in.Append(f.Data(), f.Size());
+	printf("Opened file '%s', file size %d bytes\n",
+		filename.c_str(), static_cast<unsigned int>(in.Size()));
+
+	convert_stream(in, filename_prefix_of(filename), write_output);
+}
+
+//*******************************************************************
+/** Append the cluster runs of \c filename in the mapped \c image to \c in,
+the last one up to the file size.
+*/
+static void
+append_file(
+	const MappedFile&	image,
+	Filesystem::FAT16&	filesys,
+	const char*			filename,
+	LogStream&			in
+)
+{
+	const unsigned int	fd = filesys.Open(filename, Filesystem::OPEN_READONLY);
+
+	size_t	todo = filesys.Size(fd);
+	while (todo > 0) {
+		unsigned int	count = 0;
+		const size_t	first = filesys.NextRun(fd, count);
+		if (count == 0) {
+			break;
+		}
+		const size_t	size = std::min<size_t>(todo, count * static_cast<size_t>(Filesystem::FAT16::BLOCK_SIZE));
+		in.Append(image.Data() + first * Filesystem::FAT16::BLOCK_SIZE, size);
+		todo -= size;
 	}
+	filesys.Close(fd);
+}
+
+//*******************************************************************
+/** Convert a file of the memory card image, without copying it off the image.
+The cluster runs of the file are read in place from the mapped image.
+*/
+static void
+convert_image(
+	const std::string&	image_filename,
+	const char*			filename,
+	const bool			write_output
+)
+{
+	MappedFile						image(image_filename);
+	Filesystem::Blockdevice_RAM		disk(image.Data(), image.Size() / Filesystem::FAT16::BLOCK_SIZE);
+	Filesystem::FAT16				filesys(disk);
+	LogStream						in;
+
+	append_file(image, filesys, filename, in);
+	printf("Opened '%s' in image '%s', file size %d bytes in %d runs\n",
+		filename, image_filename.c_str(), static_cast<unsigned int>(in.Size()), static_cast<unsigned int>(in.Ranges()));
+
+	convert_stream(in, filename_prefix_of(image_filename), write_output);
+}
 
-	fclose(f);
+//*******************************************************************
+/** List the events of EVENTS.BIN in the memory card image, checking that
+each one points at its first sensor packet in LOGGER.BIN.
+*/
+static void
+list_events(
+	const std::string&	image_filename
+)
+{
+	static const char	axes[] = "xyz";
+
+	MappedFile						image(image_filename);
+	Filesystem::Blockdevice_RAM		disk(image.Data(), image.Size() / Filesystem::FAT16::BLOCK_SIZE);
+	Filesystem::FAT16				filesys(disk);
+	LogStream						events;
+	LogStream						log;
+
+	append_file(image, filesys, "EVENTS.BIN", events);
+	append_file(image, filesys, "LOGGER.BIN", log);
+
+	const unsigned int	count = events.Size() / sizeof(LoggerIO::EVENT);
+	unsigned int		bad = 0;
+	printf("%d events in '%s'.\n", count, image_filename.c_str());
+	printf("   start  trigger      end  sensor  samples     offset\n");
+	for (unsigned int i=0; i<count; ++i) {
+		LoggerIO::EVENT	ev;
+		memcpy(&ev, events.Read(sizeof(ev)), sizeof(ev));
+
+		// The offset is that of a sensors packet of the start tick.
+		const char*	check = "";
+		if (ev.Offset != LoggerIO::EVENT_NO_OFFSET) {
+			LoggerIO::HEADER	header = { 0, 0, 0 };
+			const uint8_t*		p = 0;
+			if (ev.Offset < log.Size()) {
+				log.Seek(ev.Offset);
+				p = log.Read(sizeof(header));
+			}
+			if (p != 0) {
+				memcpy(&header, p, sizeof(header));
+			}
+			if (header.Type != LoggerIO::TYPE_SENSORS || header.Tick != ev.StartTick) {
+				check = " BAD OFFSET";
+				++bad;
+			}
+		}
+		printf("%8d %8d %8d  %d%c    %8d %10u%s\n",
+			ev.StartTick, ev.TriggerTick, ev.EndTick, ev.Sensor + 1, ev.Axis < 3 ? axes[ev.Axis] : '?',
+			ev.Triggers, ev.Offset, check);
+	}
+	if (bad > 0) {
+		printf("%d events do not point at their first packet in LOGGER.BIN.\n", bad);
+	}
 }
 
 //*******************************************************************
@@ -258,17 +404,43 @@ main(
 	char**	argv
 )
 {
-	if (argc > 1) {
-		for (int i=1; i<argc; ++i) {
+	bool	write_output = true;
+	int		first_arg = 1;
+
+	if (first_arg < argc && strcmp(argv[first_arg], "-c") == 0) {
+		write_output = false;
+		++first_arg;
+	}
+
+	if (first_arg + 1 < argc && strcmp(argv[first_arg], "-e") == 0) {
+		try {
+			list_events(argv[first_arg + 1]);
+		} catch (const std::exception& e) {
+			printf("Exception: %s\n", e.what());
+		}
+	} else if (first_arg + 1 < argc && strcmp(argv[first_arg], "-i") == 0) {
+		try {
+			convert_image(argv[first_arg + 1], first_arg + 2 < argc ? argv[first_arg + 2] : "LOGGER.BIN", write_output);
+		} catch (const std::exception& e) {
+			printf("Exception: %s\n", e.what());
+		}
+	} else if (first_arg < argc) {
+		for (int i=first_arg; i<argc; ++i) {
 			try {
-				convert_file(argv[i]);
+				convert_file(argv[i], write_output);
 			} catch (const std::exception& e) {
 				printf("Exception: %s\n", e.what());
 			}
 		}
 	} else {
 		printf("Usage:\n");
-		printf("\tLogConvert input_file.bin [input_file2.bin] ... \n");
+		printf("\tLogConvert [-c] input_file.bin [input_file2.bin] ... \n");
+		printf("\tLogConvert [-c] -i card.img [LOGGER.BIN]\n");
+		printf("\tLogConvert -e card.img\n");
+		printf("\t-c: check the packets only, do not write the text files.\n");
+		printf("\t-i: read the file straight from a memory card image.\n");
+		printf("\t-e: list the events of EVENTS.BIN in a memory card image.\n");
+		printf("\tcard.img may be the card reader device on Linux, e.g. /dev/sdb.\n");
 	}
 	return 0;
 }